@@ -0,0 +1,1193 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#define __MSVCRT_VERSION__ 0x0700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include "utils.c"
+
+/**
+ * Name........: extsort
+ * Autor.......: Jens Steube <jens.steube@gmail.com>
+ * License.....: MIT
+ *
+ * External-memory sort for wordlists that do not fit into RAM.
+ *
+ * The input is read in chunks bounded by --memory. Each chunk is cut into
+ * one slice per thread, every slice is MSD radix sorted and collapsed into
+ * (word, count) records and written as a sorted run to --tmpdir. Runs are
+ * combined with a k-way merge driven by a loser tree. Whenever the number of
+ * runs would exceed --fan-in, the newest and smallest runs are merged into one
+ * run of the next level, so every word is rewritten about once per level
+ * rather than on every merge.
+ *
+ * With --tmp-limit, every chunk and every merge is checked against the limit
+ * before anything is written. A merge counts twice, since its input and
+ * output runs exist side by side until it is done. Merging drops duplicates,
+ * so when a chunk does not fit that is tried first, but if the distinct words
+ * alone do not fit the tool aborts rather than exceed the limit.
+ *
+ * Words from removefiles are sorted the same way and dropped during the final
+ * merge, which is what rli does, but the output is sorted instead of being in
+ * original order.
+ */
+
+#define DEF_MEMORY    256   // MB per chunk
+#define DEF_THREADS   4
+#define DEF_FAN_IN    64
+#define MAX_THREADS   256
+
+#define RADIX_INSERT  16    // below this slice size use insertion sort
+#define RADIX_DEPTH   64    // beyond this recursion depth use qsort
+
+#define RUN_BUFSIZ    (1024 * 1024)
+
+typedef struct
+{
+  char *buf;
+  uint  len;
+
+} rec_t;
+
+typedef struct
+{
+  char     path[BUFSIZ];
+  uint64_t bytes;
+  uint     level;
+
+} run_t;
+
+typedef struct
+{
+  run_t   *runs;
+  uint     runs_cnt;
+  uint     runs_avail;
+  uint     runs_seq;
+
+} runlist_t;
+
+typedef struct
+{
+  FILE     *fp;
+  char     *iobuf;
+
+  char      buf[BUFSIZ];
+  uint      len;
+  uint64_t  cnt;
+
+  int       eof;
+  int       err;
+
+} reader_t;
+
+typedef struct
+{
+  rec_t    *recs;
+  rec_t    *tmp;
+  uint64_t  cnt;
+
+  run_t    *run;
+  int       rc;
+
+} slice_t;
+
+typedef struct
+{
+  const char *tmpdir;
+
+  uint64_t    memory;
+  uint        threads;
+  uint        fan_in;
+  uint64_t    tmp_limit;
+
+  int         unique;
+  int         count;
+
+} opts_t;
+
+static opts_t opts;
+
+// bytes in run files of both the input and the removefiles, for --tmp-limit
+
+static uint64_t tmp_bytes = 0;
+
+/**
+ * compare, lexical by unsigned bytes, shorter prefix first (same as strcmp)
+ */
+
+static int cmp_key (const char *buf1, const uint len1, const char *buf2, const uint len2)
+{
+  const uint len = (len1 < len2) ? len1 : len2;
+
+  const int r = memcmp (buf1, buf2, len);
+
+  if (r) return r;
+
+  if (len1 < len2) return -1;
+  if (len1 > len2) return  1;
+
+  return 0;
+}
+
+static int cmp_rec (const rec_t *r1, const rec_t *r2)
+{
+  return cmp_key (r1->buf, r1->len, r2->buf, r2->len);
+}
+
+static int cmp_rec_qsort (const void *p1, const void *p2)
+{
+  return cmp_rec ((const rec_t *) p1, (const rec_t *) p2);
+}
+
+/**
+ * MSD radix sort on rec_t slices
+ */
+
+static void insertion_sort (rec_t *recs, const uint64_t cnt)
+{
+  uint64_t i;
+
+  for (i = 1; i < cnt; i++)
+  {
+    rec_t cur = recs[i];
+
+    uint64_t j = i;
+
+    while ((j > 0) && (cmp_rec (&cur, &recs[j - 1]) < 0))
+    {
+      recs[j] = recs[j - 1];
+
+      j--;
+    }
+
+    recs[j] = cur;
+  }
+}
+
+static inline uint radix_key (const rec_t *rec, const uint depth)
+{
+  // bucket 0 is reserved for words that end before depth
+
+  if (depth >= rec->len) return 0;
+
+  return 1 + (uint8_t) rec->buf[depth];
+}
+
+static void radix_sort (rec_t *recs, rec_t *tmp, uint64_t cnt, uint depth, const uint level)
+{
+  while (cnt >= RADIX_INSERT)
+  {
+    if (level >= RADIX_DEPTH)
+    {
+      qsort (recs, cnt, sizeof (rec_t), cmp_rec_qsort);
+
+      return;
+    }
+
+    uint64_t counts[257];
+
+    memset (counts, 0, sizeof (counts));
+
+    uint64_t i;
+
+    for (i = 0; i < cnt; i++) counts[radix_key (&recs[i], depth)]++;
+
+    // all in the same bucket, walk to the next byte without recursion
+
+    uint key0 = radix_key (&recs[0], depth);
+
+    if (counts[key0] == cnt)
+    {
+      if (key0 == 0) return;
+
+      depth++;
+
+      continue;
+    }
+
+    uint64_t offsets[257];
+
+    uint64_t sum = 0;
+
+    uint k;
+
+    for (k = 0; k < 257; k++)
+    {
+      offsets[k] = sum;
+
+      sum += counts[k];
+    }
+
+    for (i = 0; i < cnt; i++) tmp[offsets[radix_key (&recs[i], depth)]++] = recs[i];
+
+    memcpy (recs, tmp, cnt * sizeof (rec_t));
+
+    uint64_t pos = counts[0];
+
+    for (k = 1; k < 257; k++)
+    {
+      if (counts[k] > 1) radix_sort (recs + pos, tmp + pos, counts[k], depth + 1, level + 1);
+
+      pos += counts[k];
+    }
+
+    return;
+  }
+
+  insertion_sort (recs, cnt);
+}
+
+/**
+ * run files: sequence of (uint len, uint64_t cnt, char buf[len]) records
+ */
+
+static int run_write_rec (FILE *fp, const char *buf, const uint len, const uint64_t cnt)
+{
+  if (fwrite (&len, sizeof (uint),     1, fp) != 1) return -1;
+  if (fwrite (&cnt, sizeof (uint64_t), 1, fp) != 1) return -1;
+
+  if (len == 0) return 0;
+
+  if (fwrite (buf, len, 1, fp) != 1) return -1;
+
+  return 0;
+}
+
+static int reader_open (reader_t *reader, const char *path)
+{
+  memset (reader, 0, sizeof (reader_t));
+
+  reader->fp = fopen (path, "rb");
+
+  if (reader->fp == NULL)
+  {
+    fprintf (stderr, "%s: %s\n", path, strerror (errno));
+
+    return -1;
+  }
+
+  reader->iobuf = (char *) malloc (RUN_BUFSIZ);
+
+  if (reader->iobuf != NULL) setvbuf (reader->fp, reader->iobuf, _IOFBF, RUN_BUFSIZ);
+
+  return 0;
+}
+
+static void reader_close (reader_t *reader)
+{
+  if (reader->fp != NULL) fclose (reader->fp);
+
+  free (reader->iobuf);
+
+  reader->fp    = NULL;
+  reader->iobuf = NULL;
+}
+
+static void reader_next (reader_t *reader)
+{
+  if (reader->eof) return;
+
+  // only running out of data right at a record boundary is a clean end,
+  // anything else is a read error or a truncated run and must not be
+  // mistaken for the end of the run
+
+  const size_t got = fread (&reader->len, 1, sizeof (uint), reader->fp);
+
+  if ((got == 0) && (ferror (reader->fp) == 0))
+  {
+    reader->eof = 1;
+
+    return;
+  }
+
+  if ((got != sizeof (uint))
+   || (fread (&reader->cnt, sizeof (uint64_t), 1, reader->fp) != 1)
+   || (reader->len >= BUFSIZ)
+   || ((reader->len > 0) && (fread (reader->buf, reader->len, 1, reader->fp) != 1)))
+  {
+    reader->eof = 1;
+    reader->err = 1;
+
+    return;
+  }
+
+  reader->buf[reader->len] = 0;
+}
+
+/**
+ * loser tree over k readers, index k is a -inf sentinel used while building
+ */
+
+typedef struct
+{
+  reader_t *readers;
+  uint     *tree;
+  uint      k;
+
+} losertree_t;
+
+static int lt_beats (const losertree_t *lt, const uint a, const uint b)
+{
+  if (a == lt->k) return (b != lt->k);
+  if (b == lt->k) return 0;
+
+  const reader_t *ra = &lt->readers[a];
+  const reader_t *rb = &lt->readers[b];
+
+  if (ra->eof) return 0;
+  if (rb->eof) return 1;
+
+  const int r = cmp_key (ra->buf, ra->len, rb->buf, rb->len);
+
+  if (r) return (r < 0);
+
+  return (a < b);
+}
+
+static void lt_adjust (losertree_t *lt, uint s)
+{
+  uint t = (s + lt->k) / 2;
+
+  while (t > 0)
+  {
+    if (lt_beats (lt, lt->tree[t], s))
+    {
+      const uint x = lt->tree[t];
+
+      lt->tree[t] = s;
+
+      s = x;
+    }
+
+    t /= 2;
+  }
+
+  lt->tree[0] = s;
+}
+
+static int lt_init (losertree_t *lt, reader_t *readers, const uint k)
+{
+  lt->readers = readers;
+  lt->k       = k;
+  lt->tree    = (uint *) malloc ((k + 1) * sizeof (uint));
+
+  if (lt->tree == NULL) return -1;
+
+  uint i;
+
+  for (i = 0; i < k; i++) lt->tree[i] = k;
+
+  for (i = k; i > 0; i--) lt_adjust (lt, i - 1);
+
+  return 0;
+}
+
+static reader_t *lt_top (const losertree_t *lt)
+{
+  reader_t *reader = &lt->readers[lt->tree[0]];
+
+  if (reader->eof) return NULL;
+
+  return reader;
+}
+
+static void lt_pop (losertree_t *lt)
+{
+  const uint s = lt->tree[0];
+
+  reader_next (&lt->readers[s]);
+
+  lt_adjust (lt, s);
+}
+
+/**
+ * run list bookkeeping
+ */
+
+static run_t *runlist_add (runlist_t *runlist)
+{
+  if (runlist->runs_cnt == runlist->runs_avail)
+  {
+    runlist->runs_avail += DEF_FAN_IN;
+
+    runlist->runs = (run_t *) realloc (runlist->runs, runlist->runs_avail * sizeof (run_t));
+
+    if (runlist->runs == NULL)
+    {
+      fprintf (stderr, "Not enough memory\n");
+
+      exit (-1);
+    }
+  }
+
+  run_t *run = &runlist->runs[runlist->runs_cnt];
+
+  snprintf (run->path, BUFSIZ, "%s/extsort.%u.%u.run", opts.tmpdir, (uint) getpid (), runlist->runs_seq);
+
+  run->bytes = 0;
+  run->level = 0;
+
+  runlist->runs_cnt++;
+  runlist->runs_seq++;
+
+  return run;
+}
+
+static void runlist_drop (runlist_t *runlist)
+{
+  uint i;
+
+  for (i = 0; i < runlist->runs_cnt; i++)
+  {
+    unlink (runlist->runs[i].path);
+
+    tmp_bytes -= runlist->runs[i].bytes;
+  }
+
+  runlist->runs_cnt = 0;
+}
+
+static uint64_t file_size (const char *path)
+{
+  struct stat s;
+
+  if (stat (path, &s) == -1) return 0;
+
+  return (uint64_t) s.st_size;
+}
+
+/**
+ * merge, either into a new run or as text into the final output
+ */
+
+typedef int (*emit_t) (void *ctx, const char *buf, const uint len, const uint64_t cnt);
+
+typedef struct
+{
+  FILE     *fp;
+  uint64_t  lines;
+
+  reader_t *remove;
+  uint64_t  removed;
+
+} out_ctx_t;
+
+static int emit_run (void *ctx, const char *buf, const uint len, const uint64_t cnt)
+{
+  out_ctx_t *out = (out_ctx_t *) ctx;
+
+  out->lines++;
+
+  return run_write_rec (out->fp, buf, len, cnt);
+}
+
+static int emit_text (void *ctx, const char *buf, const uint len, const uint64_t cnt)
+{
+  out_ctx_t *out = (out_ctx_t *) ctx;
+
+  // rli-style removal, the remove stream is sorted and unique
+
+  if (out->remove != NULL)
+  {
+    reader_t *remove = out->remove;
+
+    while ((remove->eof == 0) && (cmp_key (remove->buf, remove->len, buf, len) < 0)) reader_next (remove);
+
+    if ((remove->eof == 0) && (cmp_key (remove->buf, remove->len, buf, len) == 0))
+    {
+      out->removed += cnt;
+
+      return 0;
+    }
+  }
+
+  if (opts.count)
+  {
+    fprintf (out->fp, "%" PRIu64 " ", cnt);
+
+    fwrite (buf, len, 1, out->fp);
+
+    fputc ('\n', out->fp);
+
+    out->lines++;
+
+    return 0;
+  }
+
+  const uint64_t repeat = (opts.unique) ? 1 : cnt;
+
+  uint64_t i;
+
+  for (i = 0; i < repeat; i++)
+  {
+    fwrite (buf, len, 1, out->fp);
+
+    fputc ('\n', out->fp);
+  }
+
+  out->lines += repeat;
+
+  return 0;
+}
+
+static int merge_runs (run_t *runs, const uint runs_cnt, emit_t emit, void *ctx)
+{
+  if (runs_cnt == 0) return 0;
+
+  reader_t *readers = (reader_t *) calloc (runs_cnt, sizeof (reader_t));
+
+  if (readers == NULL)
+  {
+    fprintf (stderr, "Not enough memory\n");
+
+    return -1;
+  }
+
+  uint i;
+
+  for (i = 0; i < runs_cnt; i++)
+  {
+    if (reader_open (&readers[i], runs[i].path) == -1)
+    {
+      while (i--) reader_close (&readers[i]);
+
+      free (readers);
+
+      return -1;
+    }
+
+    reader_next (&readers[i]);
+  }
+
+  losertree_t lt;
+
+  if (lt_init (&lt, readers, runs_cnt) == -1)
+  {
+    fprintf (stderr, "Not enough memory\n");
+
+    for (i = 0; i < runs_cnt; i++) reader_close (&readers[i]);
+
+    free (readers);
+
+    return -1;
+  }
+
+  // equal words from different runs are folded into one record
+
+  char     *cur_buf = (char *) malloc (BUFSIZ);
+  uint      cur_len = 0;
+  uint64_t  cur_cnt = 0;
+
+  int rc = (cur_buf == NULL) ? -1 : 0;
+
+  reader_t *top;
+
+  while ((rc == 0) && ((top = lt_top (&lt)) != NULL))
+  {
+    if ((cur_cnt > 0) && (cmp_key (cur_buf, cur_len, top->buf, top->len) == 0))
+    {
+      cur_cnt += top->cnt;
+    }
+    else
+    {
+      if (cur_cnt > 0) rc = emit (ctx, cur_buf, cur_len, cur_cnt);
+
+      memcpy (cur_buf, top->buf, top->len);
+
+      cur_len = top->len;
+      cur_cnt = top->cnt;
+    }
+
+    lt_pop (&lt);
+  }
+
+  if ((rc == 0) && (cur_cnt > 0)) rc = emit (ctx, cur_buf, cur_len, cur_cnt);
+
+  free (cur_buf);
+
+  free (lt.tree);
+
+  for (i = 0; i < runs_cnt; i++)
+  {
+    if (readers[i].err)
+    {
+      fprintf (stderr, "%s: read failed\n", runs[i].path);
+
+      rc = -1;
+    }
+
+    reader_close (&readers[i]);
+  }
+
+  free (readers);
+
+  return rc;
+}
+
+static int merge_tail (runlist_t *runlist, const uint first, const uint level)
+{
+  const uint runs_cnt = runlist->runs_cnt - first;
+
+  run_t *old = &runlist->runs[first];
+
+  // the merged run is never bigger than its inputs, which are only removed
+  // once it is complete
+
+  if (opts.tmp_limit > 0)
+  {
+    uint64_t projected = tmp_bytes;
+
+    uint i;
+
+    for (i = 0; i < runs_cnt; i++) projected += old[i].bytes;
+
+    if (projected > opts.tmp_limit)
+    {
+      fprintf (stderr, "Merging %u runs could need %" PRIu64 " bytes of temp space, which exceeds --tmp-limit\n", runs_cnt, projected);
+
+      return -1;
+    }
+  }
+
+  run_t merged;
+
+  snprintf (merged.path, BUFSIZ, "%s/extsort.%u.%u.run", opts.tmpdir, (uint) getpid (), runlist->runs_seq++);
+
+  merged.level = level;
+
+  out_ctx_t out;
+
+  memset (&out, 0, sizeof (out));
+
+  out.fp = fopen (merged.path, "wb");
+
+  if (out.fp == NULL)
+  {
+    fprintf (stderr, "%s: %s\n", merged.path, strerror (errno));
+
+    return -1;
+  }
+
+  setvbuf (out.fp, NULL, _IOFBF, RUN_BUFSIZ);
+
+  printf ("Merging %u runs...\n", runs_cnt);
+
+  int rc = merge_runs (old, runs_cnt, emit_run, &out);
+
+  if (fclose (out.fp) != 0) rc = -1;
+
+  if (rc == -1)
+  {
+    fprintf (stderr, "%s: merge failed\n", merged.path);
+
+    unlink (merged.path);
+
+    return -1;
+  }
+
+  merged.bytes = file_size (merged.path);
+
+  uint i;
+
+  for (i = 0; i < runs_cnt; i++)
+  {
+    unlink (old[i].path);
+
+    tmp_bytes -= old[i].bytes;
+  }
+
+  runlist->runs[first] = merged;
+
+  runlist->runs_cnt = first + 1;
+
+  tmp_bytes += merged.bytes;
+
+  return 0;
+}
+
+static int compact_runs (runlist_t *runlist)
+{
+  // runs are kept oldest first in non-increasing level, so the runs at or
+  // below any level form the tail of the list; merge the shortest such tail
+  // that has at least two runs into one run of the next level, which leaves
+  // the big runs from earlier merges alone until the final merge
+
+  if (runlist->runs_cnt < 2) return 0;
+
+  uint first = runlist->runs_cnt - 1;
+
+  uint level = runlist->runs[first].level;
+
+  while (1)
+  {
+    while ((first > 0) && (runlist->runs[first - 1].level <= level)) first--;
+
+    if ((runlist->runs_cnt - first) >= 2) break;
+
+    level = runlist->runs[first - 1].level;
+  }
+
+  return merge_tail (runlist, first, level + 1);
+}
+
+/**
+ * run generation, one thread per slice
+ */
+
+static void *sort_slice (void *p)
+{
+  slice_t *slice = (slice_t *) p;
+
+  slice->rc = 0;
+
+  radix_sort (slice->recs, slice->tmp, slice->cnt, 0, 0);
+
+  FILE *fp = fopen (slice->run->path, "wb");
+
+  if (fp == NULL)
+  {
+    slice->rc = -1;
+
+    return NULL;
+  }
+
+  setvbuf (fp, NULL, _IOFBF, RUN_BUFSIZ);
+
+  uint64_t i = 0;
+
+  while ((i < slice->cnt) && (slice->rc == 0))
+  {
+    uint64_t j = i + 1;
+
+    while ((j < slice->cnt) && (cmp_rec (&slice->recs[i], &slice->recs[j]) == 0)) j++;
+
+    slice->rc = run_write_rec (fp, slice->recs[i].buf, slice->recs[i].len, j - i);
+
+    i = j;
+  }
+
+  if (fclose (fp) != 0) slice->rc = -1;
+
+  return NULL;
+}
+
+static int flush_chunk (runlist_t *runlist, rec_t *recs, rec_t *tmp, const uint64_t cnt, const uint64_t bytes)
+{
+  if (cnt == 0) return 0;
+
+  while (runlist->runs_cnt + opts.threads > opts.fan_in)
+  {
+    if (compact_runs (runlist) == -1) return -1;
+  }
+
+  // the chunk's runs are at most its words plus a record header each, if
+  // they might not fit, see whether merging away duplicates makes room
+
+  if (opts.tmp_limit > 0)
+  {
+    const uint64_t chunk_bytes = bytes + cnt * (sizeof (uint) + sizeof (uint64_t));
+
+    while ((tmp_bytes + chunk_bytes > opts.tmp_limit) && (runlist->runs_cnt > 1))
+    {
+      const uint64_t before = tmp_bytes;
+
+      if (compact_runs (runlist) == -1) return -1;
+
+      if (tmp_bytes == before) break;
+    }
+
+    if (tmp_bytes + chunk_bytes > opts.tmp_limit)
+    {
+      fprintf (stderr, "Writing the next chunk could need %" PRIu64 " bytes of temp space, which exceeds --tmp-limit\n", tmp_bytes + chunk_bytes);
+
+      return -1;
+    }
+  }
+
+  uint threads = opts.threads;
+
+  if (cnt < (uint64_t) threads * RADIX_INSERT) threads = 1;
+
+  slice_t   slices[MAX_THREADS];
+  pthread_t tids[MAX_THREADS];
+
+  uint i;
+
+  // runlist_add() may move the array, so take the pointers once all runs exist
+
+  for (i = 0; i < threads; i++) runlist_add (runlist);
+
+  run_t *runs = &runlist->runs[runlist->runs_cnt - threads];
+
+  const uint64_t per_slice = cnt / threads;
+
+  uint64_t pos = 0;
+
+  for (i = 0; i < threads; i++)
+  {
+    const uint64_t slice_cnt = (i == threads - 1) ? (cnt - pos) : per_slice;
+
+    slices[i].recs = recs + pos;
+    slices[i].tmp  = tmp  + pos;
+    slices[i].cnt  = slice_cnt;
+    slices[i].run  = &runs[i];
+    slices[i].rc   = 0;
+
+    pos += slice_cnt;
+  }
+
+  for (i = 0; i < threads; i++) pthread_create (&tids[i], NULL, sort_slice, &slices[i]);
+
+  int rc = 0;
+
+  for (i = 0; i < threads; i++)
+  {
+    pthread_join (tids[i], NULL);
+
+    if (slices[i].rc == -1)
+    {
+      fprintf (stderr, "%s: write failed\n", slices[i].run->path);
+
+      rc = -1;
+    }
+  }
+
+  for (i = 0; i < threads; i++)
+  {
+    runs[i].bytes = file_size (runs[i].path);
+
+    tmp_bytes += runs[i].bytes;
+  }
+
+  if (rc == -1) return -1;
+
+  return 0;
+}
+
+static int generate_runs (runlist_t *runlist, FILE *fd, const char *name)
+{
+  // half of the memory budget holds the words, the rest holds rec_t and its radix scratch copy
+
+  const uint64_t arena_size = opts.memory / 2;
+  const uint64_t recs_avail = (opts.memory / 4) / sizeof (rec_t);
+
+  char  *arena = (char *)  malloc (arena_size);
+  rec_t *recs  = (rec_t *) malloc (recs_avail * sizeof (rec_t));
+  rec_t *tmp   = (rec_t *) malloc (recs_avail * sizeof (rec_t));
+
+  if ((arena == NULL) || (recs == NULL) || (tmp == NULL))
+  {
+    fprintf (stderr, "Not enough memory\n");
+
+    free (arena);
+    free (recs);
+    free (tmp);
+
+    return -1;
+  }
+
+  printf ("Reading %s...\n", name);
+
+  uint64_t arena_pos = 0;
+  uint64_t recs_cnt  = 0;
+  uint64_t total     = 0;
+
+  char line_buf[BUFSIZ];
+
+  int line_len;
+
+  int rc = 0;
+
+  while ((rc == 0) && ((line_len = fgetl (fd, BUFSIZ, line_buf)) != -1))
+  {
+    if ((recs_cnt == recs_avail) || ((arena_pos + line_len) > arena_size))
+    {
+      rc = flush_chunk (runlist, recs, tmp, recs_cnt, arena_pos);
+
+      arena_pos = 0;
+      recs_cnt  = 0;
+    }
+
+    memcpy (arena + arena_pos, line_buf, line_len);
+
+    recs[recs_cnt].buf = arena + arena_pos;
+    recs[recs_cnt].len = line_len;
+
+    arena_pos += line_len;
+    recs_cnt++;
+
+    total++;
+
+    if ((total % 1000000) == 0)
+    {
+      printf ("\rRead %" PRIu64 " lines", total);
+
+      fflush (stdout);
+    }
+  }
+
+  if (rc == 0) rc = flush_chunk (runlist, recs, tmp, recs_cnt, arena_pos);
+
+  printf ("\rRead %" PRIu64 " lines, %u runs\n", total, runlist->runs_cnt);
+
+  free (arena);
+  free (recs);
+  free (tmp);
+
+  return rc;
+}
+
+static void usage (const char *program)
+{
+  const char *help_text[] =
+  {
+    "usage: %s [options] infile outfile [removefiles...]",
+    "",
+    "  -u, --unique         only output the first occurrence of each word",
+    "  -c, --count          output \"count word\" for each distinct word (implies -u)",
+    "  -m, --memory=MB      memory used for each chunk of run generation (default: 256)",
+    "  -t, --threads=NUM    number of sort threads (default: 4)",
+    "  -T, --tmpdir=DIR     directory for temporary runs (default: .)",
+    "  -f, --fan-in=NUM     merge runs down once there are more than NUM (default: 64)",
+    "  -l, --tmp-limit=MB   abort rather than let temporary runs take more than MB",
+    "  -h, --help           show this help",
+    "",
+    "use - as infile to read from stdin",
+    "output is sorted, words found in any removefile are not written",
+    NULL
+  };
+
+  int i;
+
+  for (i = 0; help_text[i] != NULL; i++)
+  {
+    fprintf (stderr, help_text[i], program);
+
+    fprintf (stderr, "\n");
+  }
+}
+
+int main (int argc, char *argv[])
+{
+  #define IDX_UNIQUE     'u'
+  #define IDX_COUNT      'c'
+  #define IDX_MEMORY     'm'
+  #define IDX_THREADS    't'
+  #define IDX_TMPDIR     'T'
+  #define IDX_FAN_IN     'f'
+  #define IDX_TMP_LIMIT  'l'
+  #define IDX_HELP       'h'
+
+  opts.tmpdir    = ".";
+  opts.memory    = (uint64_t) DEF_MEMORY * 1024 * 1024;
+  opts.threads   = DEF_THREADS;
+  opts.fan_in    = DEF_FAN_IN;
+  opts.tmp_limit = 0;
+  opts.unique    = 0;
+  opts.count     = 0;
+
+  char short_options[] = "hucm:t:T:f:l:";
+
+  struct option long_options[] =
+  {
+    {"unique",     no_argument,       0, IDX_UNIQUE},
+    {"count",      no_argument,       0, IDX_COUNT},
+    {"memory",     required_argument, 0, IDX_MEMORY},
+    {"threads",    required_argument, 0, IDX_THREADS},
+    {"tmpdir",     required_argument, 0, IDX_TMPDIR},
+    {"fan-in",     required_argument, 0, IDX_FAN_IN},
+    {"tmp-limit",  required_argument, 0, IDX_TMP_LIMIT},
+    {"help",       no_argument,       0, IDX_HELP},
+
+    {NULL, 0, 0, 0}
+  };
+
+  optind = 1;
+
+  int option_index = 0;
+  int help = 0;
+  int c;
+
+  while ((c = getopt_long (argc, argv, short_options, long_options, &option_index)) != -1)
+  {
+    switch (c)
+    {
+      case IDX_UNIQUE:     opts.unique    = 1;                                              break;
+      case IDX_COUNT:      opts.count     = 1;                                              break;
+      case IDX_MEMORY:     opts.memory    = (uint64_t) strtoull (optarg, NULL, 10) << 20;  break;
+      case IDX_THREADS:    opts.threads   = atoi (optarg);                                  break;
+      case IDX_TMPDIR:     opts.tmpdir    = optarg;                                         break;
+      case IDX_FAN_IN:     opts.fan_in    = atoi (optarg);                                  break;
+      case IDX_TMP_LIMIT:  opts.tmp_limit = (uint64_t) strtoull (optarg, NULL, 10) << 20;  break;
+      case IDX_HELP:       help           = 1;                                              break;
+      default:             help           = 1;                                              break;
+    }
+  }
+
+  if ((help == 1) || ((argc - optind) < 2))
+  {
+    usage (argv[0]);
+
+    return (-1);
+  }
+
+  if (opts.count) opts.unique = 1;
+
+  if ((opts.threads < 1) || (opts.threads > MAX_THREADS))
+  {
+    fprintf (stderr, "--threads must be between 1 and %d\n", MAX_THREADS);
+
+    return (-1);
+  }
+
+  if (opts.fan_in < opts.threads + 1) opts.fan_in = opts.threads + 1;
+
+  if (opts.memory < (1 << 20)) opts.memory = 1 << 20;
+
+  char *infile  = argv[optind + 0];
+  char *outfile = argv[optind + 1];
+
+  /* runs for infile */
+
+  runlist_t runlist;
+
+  memset (&runlist, 0, sizeof (runlist));
+
+  FILE *fd;
+
+  if (strcmp (infile, "-") == 0)
+  {
+    #ifdef _WINDOWS
+    _setmode (_fileno (stdin), _O_BINARY);
+    #endif
+
+    fd = stdin;
+  }
+  else if ((fd = fopen (infile, "rb")) == NULL)
+  {
+    fprintf (stderr, "%s: %s\n", infile, strerror (errno));
+
+    return (-1);
+  }
+
+  int rc = generate_runs (&runlist, fd, infile);
+
+  if (fd != stdin) fclose (fd);
+
+  /* runs for removefiles, merged down into one sorted unique stream */
+
+  runlist_t removelist;
+
+  memset (&removelist, 0, sizeof (removelist));
+
+  removelist.runs_seq = 0x80000000;
+
+  int i;
+
+  for (i = optind + 2; (rc == 0) && (i < argc); i++)
+  {
+    char *removefile = argv[i];
+
+    if ((strcmp (removefile, infile) == 0) || (strcmp (removefile, outfile) == 0))
+    {
+      fprintf (stderr, "Skipping check against %s\n", removefile);
+
+      continue;
+    }
+
+    if ((fd = fopen (removefile, "rb")) == NULL)
+    {
+      fprintf (stderr, "%s: %s\n", removefile, strerror (errno));
+
+      rc = -1;
+
+      break;
+    }
+
+    rc = generate_runs (&removelist, fd, removefile);
+
+    fclose (fd);
+  }
+
+  if ((rc == 0) && (removelist.runs_cnt > 1)) rc = merge_tail (&removelist, 0, 0);
+
+  /* final merge */
+
+  out_ctx_t out;
+
+  memset (&out, 0, sizeof (out));
+
+  reader_t remove;
+
+  memset (&remove, 0, sizeof (remove));
+
+  if ((rc == 0) && (removelist.runs_cnt > 0))
+  {
+    rc = reader_open (&remove, removelist.runs[0].path);
+
+    if (rc == 0)
+    {
+      reader_next (&remove);
+
+      out.remove = &remove;
+    }
+  }
+
+  if (rc == 0)
+  {
+    if ((out.fp = fopen (outfile, "wb")) == NULL)
+    {
+      fprintf (stderr, "%s: %s\n", outfile, strerror (errno));
+
+      rc = -1;
+    }
+  }
+
+  if (rc == 0)
+  {
+    setvbuf (out.fp, NULL, _IOFBF, RUN_BUFSIZ);
+
+    printf ("Merging %u runs into %s...\n", runlist.runs_cnt, outfile);
+
+    rc = merge_runs (runlist.runs, runlist.runs_cnt, emit_text, &out);
+
+    if (fclose (out.fp) != 0) rc = -1;
+
+    if (remove.err)
+    {
+      fprintf (stderr, "%s: read failed\n", removelist.runs[0].path);
+
+      rc = -1;
+    }
+
+    if (rc == 0)
+    {
+      printf ("Finished!\n");
+
+      if (out.remove != NULL) printf ("Removed %" PRIu64 " lines\n", out.removed);
+
+      printf ("Wrote %" PRIu64 " lines to %s\n", out.lines, outfile);
+    }
+  }
+
+  reader_close (&remove);
+
+  runlist_drop (&runlist);
+  runlist_drop (&removelist);
+
+  free (runlist.runs);
+  free (removelist.runs);
+
+  return (rc == 0) ? 0 : -1;
+}
@@ -0,0 +1,288 @@
+/*
+    SHA-1 and SHA-256
+
+    These are the straightforward versions from FIPS 180-4. They aren't
+    used for anything secure, just for printing the same fingerprints of
+    certificates that other tools print, so they can be looked up.
+*/
+#include "crypto-sha.h"
+#include <string.h>
+
+#define ROTL(x,n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR(x,n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+sha1_transform(uint32_t state[5], const unsigned char *block)
+{
+    uint32_t w[80];
+    uint32_t a, b, c, d, e;
+    unsigned i;
+
+    for (i=0; i<16; i++)
+        w[i] = (uint32_t)block[i*4+0]<<24 | (uint32_t)block[i*4+1]<<16
+             | (uint32_t)block[i*4+2]<< 8 | (uint32_t)block[i*4+3]<< 0;
+    for (i=16; i<80; i++)
+        w[i] = ROTL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+
+    for (i=0; i<80; i++) {
+        uint32_t f, k, t;
+
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        t = ROTL(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROTL(b, 30);
+        b = a;
+        a = t;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+sha256_transform(uint32_t state[8], const unsigned char *block)
+{
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+    unsigned i;
+
+    for (i=0; i<16; i++)
+        w[i] = (uint32_t)block[i*4+0]<<24 | (uint32_t)block[i*4+1]<<16
+             | (uint32_t)block[i*4+2]<< 8 | (uint32_t)block[i*4+3]<< 0;
+    for (i=16; i<64; i++) {
+        uint32_t s0 = ROTR(w[i-15], 7) ^ ROTR(w[i-15], 18) ^ (w[i-15] >> 3);
+        uint32_t s1 = ROTR(w[i-2], 17) ^ ROTR(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
+
+    for (i=0; i<64; i++) {
+        uint32_t s1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + K256[i] + w[i];
+        uint32_t s0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+sha_pair_init(struct ShaPair *ctx)
+{
+    ctx->sha1[0] = 0x67452301;
+    ctx->sha1[1] = 0xefcdab89;
+    ctx->sha1[2] = 0x98badcfe;
+    ctx->sha1[3] = 0x10325476;
+    ctx->sha1[4] = 0xc3d2e1f0;
+
+    ctx->sha256[0] = 0x6a09e667;
+    ctx->sha256[1] = 0xbb67ae85;
+    ctx->sha256[2] = 0x3c6ef372;
+    ctx->sha256[3] = 0xa54ff53a;
+    ctx->sha256[4] = 0x510e527f;
+    ctx->sha256[5] = 0x9b05688c;
+    ctx->sha256[6] = 0x1f83d9ab;
+    ctx->sha256[7] = 0x5be0cd19;
+
+    ctx->length = 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+sha_pair_update(struct ShaPair *ctx, const void *vpx, size_t length)
+{
+    const unsigned char *px = (const unsigned char *)vpx;
+    unsigned used = (unsigned)(ctx->length & 63);
+
+    ctx->length += length;
+
+    /* finish any partial block left over from the last fragment */
+    if (used) {
+        size_t n = 64 - used;
+        if (n > length)
+            n = length;
+        memcpy(ctx->block + used, px, n);
+        px += n;
+        length -= n;
+        if (used + n < 64)
+            return;
+        sha1_transform(ctx->sha1, ctx->block);
+        sha256_transform(ctx->sha256, ctx->block);
+    }
+
+    /* do whole blocks straight from the input */
+    while (length >= 64) {
+        sha1_transform(ctx->sha1, px);
+        sha256_transform(ctx->sha256, px);
+        px += 64;
+        length -= 64;
+    }
+
+    /* save the rest for next time */
+    memcpy(ctx->block, px, length);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+sha_pair_final(struct ShaPair *ctx,
+               unsigned char sha1[20], unsigned char sha256[32])
+{
+    uint64_t bits = ctx->length * 8;
+    unsigned used = (unsigned)(ctx->length & 63);
+    unsigned i;
+
+    /* pad with 0x80, zeroes, then the length in bits, big-endian */
+    ctx->block[used++] = 0x80;
+    if (used > 56) {
+        memset(ctx->block + used, 0, 64 - used);
+        sha1_transform(ctx->sha1, ctx->block);
+        sha256_transform(ctx->sha256, ctx->block);
+        used = 0;
+    }
+    memset(ctx->block + used, 0, 56 - used);
+    for (i=0; i<8; i++)
+        ctx->block[56 + i] = (unsigned char)(bits >> (56 - i*8));
+    sha1_transform(ctx->sha1, ctx->block);
+    sha256_transform(ctx->sha256, ctx->block);
+
+    for (i=0; i<20; i++)
+        sha1[i] = (unsigned char)(ctx->sha1[i/4] >> (24 - (i%4)*8));
+    for (i=0; i<32; i++)
+        sha256[i] = (unsigned char)(ctx->sha256[i/4] >> (24 - (i%4)*8));
+}
+
+/***************************************************************************
+ * Test vectors from FIPS 180-2, fed in odd-sized fragments so that the
+ * partial block handling gets exercised.
+ ***************************************************************************/
+int
+sha_selftest(void)
+{
+    static const struct {
+        const char *input;
+        unsigned repeat;
+        const char *sha1;
+        const char *sha256;
+    } tests[] = {
+        {"abc", 1,
+         "\xa9\x99\x3e\x36\x47\x06\x81\x6a\xba\x3e"
+         "\x25\x71\x78\x50\xc2\x6c\x9c\xd0\xd8\x9d",
+         "\xba\x78\x16\xbf\x8f\x01\xcf\xea\x41\x41\x40\xde\x5d\xae\x22\x23"
+         "\xb0\x03\x61\xa3\x96\x17\x7a\x9c\xb4\x10\xff\x61\xf2\x00\x15\xad"},
+        {"", 1,
+         "\xda\x39\xa3\xee\x5e\x6b\x4b\x0d\x32\x55"
+         "\xbf\xef\x95\x60\x18\x90\xaf\xd8\x07\x09",
+         "\xe3\xb0\xc4\x42\x98\xfc\x1c\x14\x9a\xfb\xf4\xc8\x99\x6f\xb9\x24"
+         "\x27\xae\x41\xe4\x64\x9b\x93\x4c\xa4\x95\x99\x1b\x78\x52\xb8\x55"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+         "\x84\x98\x3e\x44\x1c\x3b\xd2\x6e\xba\xae"
+         "\x4a\xa1\xf9\x51\x29\xe5\xe5\x46\x70\xf1",
+         "\x24\x8d\x6a\x61\xd2\x06\x38\xb8\xe5\xc0\x26\x93\x0c\x3e\x60\x39"
+         "\xa3\x3c\xe4\x59\x64\xff\x21\x67\xf6\xec\xed\xd4\x19\xdb\x06\xc1"},
+        {"aaaaaaaaaa", 100000,
+         "\x34\xaa\x97\x3c\xd4\xc4\xda\xa4\xf6\x1e"
+         "\xeb\x2b\xdb\xad\x27\x31\x65\x34\x01\x6f",
+         "\xcd\xc7\x6e\x5c\x99\x14\xfb\x92\x81\xa1\xc7\xe2\x84\xd7\x3e\x67"
+         "\xf1\x80\x9a\x48\xa4\x97\x20\x0e\x04\x6d\x39\xcc\xc7\x11\x2c\xd0"},
+        {0}
+    };
+    unsigned i;
+
+    for (i=0; tests[i].input; i++) {
+        struct ShaPair ctx;
+        unsigned char sha1[20];
+        unsigned char sha256[32];
+        size_t length = strlen(tests[i].input);
+        unsigned j;
+
+        sha_pair_init(&ctx);
+        for (j=0; j<tests[i].repeat; j++) {
+            size_t half = length/3;
+            sha_pair_update(&ctx, tests[i].input, half);
+            sha_pair_update(&ctx, tests[i].input + half, length - half);
+        }
+        sha_pair_final(&ctx, sha1, sha256);
+
+        if (memcmp(sha1, tests[i].sha1, 20) != 0
+            || memcmp(sha256, tests[i].sha256, 32) != 0) {
+            fprintf(stderr, "sha: selftest failed: test #%u\n", i);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef CRYPTO_SHA_H
+#define CRYPTO_SHA_H
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * Calculates both the SHA-1 and the SHA-256 of the same input at the same
+ * time. They have the same block size and padding, so they can share one
+ * block buffer. This is used to fingerprint certificates as they arrive
+ * across many packets, without reassembling them, so we want to keep
+ * this small: it's part of the state of every TCP connection.
+ */
+struct ShaPair {
+    uint32_t sha1[5];
+    uint32_t sha256[8];
+    uint64_t length;
+    unsigned char block[64];
+};
+
+void
+sha_pair_init(struct ShaPair *ctx);
+
+/**
+ * Add the next fragment of input. This can be called any number of
+ * times, with any length.
+ */
+void
+sha_pair_update(struct ShaPair *ctx, const void *px, size_t length);
+
+/**
+ * Finish the hashes, after which 'ctx' must be initialized again before
+ * being reused.
+ */
+void
+sha_pair_final(struct ShaPair *ctx,
+               unsigned char sha1[20], unsigned char sha256[32]);
+
+int
+sha_selftest(void);
+
+#endif
@@ -7,21 +7,33 @@
     send a packet, we need to resend it in the future in case we don't
     get a response.
 
-    This design creates a large "ring" of timeouts, and then cycles
-    again and again through the ring. This is a fairly high granularity,
-    just has hundreds, thousands, or 10 thousand entries per second.
-    (I keep adjusting the granularity up and down). Not that at any
-    slot in the ring, there may be entries from the far future.
+    This design is a "hierarchical timing wheel". The lowest level is a
+    ring of 256 slots, one slot per tick of the wheel. Each higher level
+    is another ring of 256 slots, where each slot covers the entire span
+    of the level below it. Entries are inserted at the lowest level that
+    can hold them, and when the lower level wraps around, the next slot
+    of the upper level is "cascaded" down, re-inserting its entries
+    closer to the time they expire. Inserting and cancelling are O(1),
+    and an entry is touched at most once per level before it fires, no
+    matter how far in the future it is. The old design was a single ring
+    with a million slots, where far-future entries were rescanned on
+    every lap around the ring.
+
+    The resolution of the wheel (how many TICKS_PER_SECOND units each
+    slot covers) can be changed at runtime. The coarser it is, the less
+    work we do walking empty slots, but the later (up to one slot) a
+    timeout may fire.
 
     NOTE: a big feature of this system is that the structure that tracks
     the timeout is actually held within the TCB structure. In other
     words, each TCB can have one-and-only-one timeout.
 
     NOTE: a recurring bug is that the TCP code removes a TCB from the
-    timeout ring and forgets to put it back somewhere else. Since the
+    timeout wheel and forgets to put it back somewhere else. Since the
     TCB is cleaned up on a timeout, such TCBs never get cleaned up,
-    leading to a memory leak. I keep fixing this bug, then changing the
-    code and causing the bug to come back again.
+    leading to a memory leak. To catch this, the wheel counts how many
+    entries it holds, so that the TCP code can compare it with the
+    number of TCBs it has (see 'timeouts_pending()').
 */
 #include "event-timeout.h"
 #include "logger.h"
@@ -30,35 +42,194 @@
 #include <string.h>
 #include <time.h>
 
+#define WHEEL_BITS      8
+#define WHEEL_SLOTS     (1 << WHEEL_BITS)
+#define WHEEL_MASK      (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS    4
 
+/** The furthest in the future (in wheel ticks) we can place an entry.
+ * Anything further away is parked in the last level and gets re-inserted
+ * when that slot is cascaded */
+#define WHEEL_MAX_DELTA ((1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
 
 /***************************************************************************
- * The timeout system is a circular ring. We move an index around the 
- * ring. At each slot in the ring is a linked-list of all entries at
- * that time index. Because the ring can wrap, not everything at a given
- * entry will be the same timestamp. Therefore, when doing the timeout
- * logic at a slot, we have to doublecheck the actual timestamp, and skip
- * those things that are further in the future.
  ***************************************************************************/
 struct Timeouts {
     /**
-     * This index is a monotonically increasing number, modulus the mask.
-     * Every time we check timeouts, we simply move it foreward in time.
+     * The next wheel tick that hasn't been processed yet. This is a
+     * timestamp shifted right by 'shift', and it only goes forward.
+     */
+    uint64_t current_tick;
+
+    /**
+     * The resolution of the wheel: each slot covers (1<<shift) units of
+     * TICKS_PER_SECOND.
      */
-    uint64_t current_index;
+    unsigned shift;
 
     /**
-     * The number of slots is a power-of-2, so the mask is just this
-     * number minus 1
+     * The number of entries linked into the wheel, including those
+     * sitting in the 'expired' list.
      */
-    unsigned mask;
+    uint64_t pending;
 
     /**
-     * The ring of entries.
+     * Entries that are due, waiting to be handed out one at a time by
+     * 'timeouts_remove()'. When a slot expires, its entire list is moved
+     * here in one step.
      */
-    struct TimeoutEntry *slots[1024*1024];
+    struct TimeoutEntry *expired;
+
+    /**
+     * The levels of the wheel. Level 0 has one slot per wheel tick,
+     * level 1 has one slot per 256 ticks, and so on.
+     */
+    struct TimeoutEntry *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+
+    /**
+     * One bit per slot, set when something is linked into the slot. This
+     * lets us jump over empty stretches of time instead of visiting every
+     * slot. Bits are cleared lazily: entries can be unlinked without
+     * telling us, so a set bit only means the slot "might" be used.
+     */
+    uint64_t used[WHEEL_LEVELS][WHEEL_SLOTS/64];
 };
 
+/***************************************************************************
+ * Find the first used slot starting at 'from' and going around the ring.
+ * Returns the distance from 'from', or -1 if no slot is used.
+ ***************************************************************************/
+static int
+timeouts_next_used(const uint64_t *used, unsigned from)
+{
+    unsigned i;
+
+    for (i = 0; i <= WHEEL_SLOTS/64; i++) {
+        unsigned w = ((from / 64) + i) % (WHEEL_SLOTS/64);
+        uint64_t word = used[w];
+        int bit = 0;
+
+        if (i == 0)
+            word &= ~0ULL << (from % 64);
+        else if (i == WHEEL_SLOTS/64)
+            word &= (1ULL << (from % 64)) - 1;
+        if (word == 0)
+            continue;
+
+        while ((word & 1) == 0) {
+            word >>= 1;
+            bit++;
+        }
+        return (int)((w * 64 + bit - from) & WHEEL_MASK);
+    }
+    return -1;
+}
+
+/***************************************************************************
+ * The next tick at which something needs doing: either a level-0 slot
+ * that has entries, or the start of an upper-level slot that needs to
+ * be cascaded down.
+ ***************************************************************************/
+static uint64_t
+timeouts_next_tick(const struct Timeouts *timeouts)
+{
+    uint64_t current = timeouts->current_tick;
+    uint64_t next = UINT64_MAX;
+    unsigned level;
+    int k;
+
+    k = timeouts_next_used(timeouts->used[0], (unsigned)(current & WHEEL_MASK));
+    if (k >= 0)
+        next = current + k;
+
+    for (level = 1; level < WHEEL_LEVELS; level++) {
+        unsigned shift = WHEEL_BITS * level;
+        uint64_t slot = current >> shift;
+        uint64_t candidate;
+
+        /* If we're sitting right at the start of a slot, it hasn't been
+         * cascaded yet, otherwise the first candidate is the next slot */
+        if (current & ((1ULL << shift) - 1))
+            slot++;
+
+        k = timeouts_next_used(timeouts->used[level],
+                                (unsigned)(slot & WHEEL_MASK));
+        if (k < 0)
+            continue;
+        candidate = (slot + k) << shift;
+        if (candidate < next)
+            next = candidate;
+    }
+
+    return next;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+timeouts_link(struct TimeoutEntry **head, struct TimeoutEntry *entry)
+{
+    entry->next = *head;
+    *head = entry;
+    entry->prev = head;
+    if (entry->next)
+        entry->next->prev = &entry->next;
+}
+
+/***************************************************************************
+ * Put the entry in the level/slot matching its expiration. Everything is
+ * relative to the current tick, so an entry is always placed in the
+ * lowest level that can hold it.
+ ***************************************************************************/
+static void
+timeouts_place(struct Timeouts *timeouts, struct TimeoutEntry *entry)
+{
+    uint64_t tick = entry->timestamp >> timeouts->shift;
+    uint64_t delta;
+    unsigned level;
+    unsigned index;
+
+    if (tick < timeouts->current_tick) {
+        /* Already in the past, so it's due on the next check */
+        timeouts_link(&timeouts->expired, entry);
+        return;
+    }
+
+    delta = tick - timeouts->current_tick;
+    if (delta > WHEEL_MAX_DELTA) {
+        delta = WHEEL_MAX_DELTA;
+        tick = timeouts->current_tick + delta;
+    }
+
+    for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+        if (delta < (1ULL << (WHEEL_BITS * (level + 1))))
+            break;
+    }
+
+    index = (unsigned)((tick >> (WHEEL_BITS * level)) & WHEEL_MASK);
+    timeouts_link(&timeouts->slots[level][index], entry);
+    timeouts->used[level][index / 64] |= 1ULL << (index % 64);
+}
+
+/***************************************************************************
+ * Detach the list from a slot and re-insert all of its entries, which
+ * moves them down to lower levels of the wheel.
+ ***************************************************************************/
+static void
+timeouts_cascade(struct Timeouts *timeouts, unsigned level, unsigned index)
+{
+    struct TimeoutEntry *entry = timeouts->slots[level][index];
+
+    timeouts->slots[level][index] = NULL;
+    timeouts->used[level][index / 64] &= ~(1ULL << (index % 64));
+
+    while (entry) {
+        struct TimeoutEntry *next = entry->next;
+        timeouts_place(timeouts, entry);
+        entry = next;
+    }
+}
+
 /***************************************************************************
  ***************************************************************************/
 struct Timeouts *
@@ -75,55 +246,106 @@ timeouts_create(uint64_t timestamp)
     memset(timeouts, 0, sizeof(*timeouts));
 
     /*
-     * We just mask off the low order bits to determine wrap. I'm using
-     * a variable here because one of these days I'm going to make
-     * the size of the ring dynamically adjustable depending upon
-     * the speed of the scan.
+     * Default to ~1 millisecond slots. Our TCP timeouts are measured in
+     * seconds, so there's no point in visiting the wheel 16384 times
+     * per second.
      */
-    timeouts->mask = sizeof(timeouts->slots)/sizeof(timeouts->slots[0]) - 1;
+    timeouts->shift = 4;
 
     /*
      * Set the index to the current time. Note that this timestamp is
      * the 'time_t' value multiplied by the number of ticks-per-second,
-     * where 'ticks' is something I've defined for scanning. Right now
-     * I hard-code in the size of the ticks, but eventually they'll be
-     * dynamically resized depending upon the speed of the scan.
+     * where 'ticks' is something I've defined for scanning.
      */
-    timeouts->current_index = timestamp;
-
+    timeouts->current_tick = timestamp >> timeouts->shift;
 
     return timeouts;
 }
 
+/***************************************************************************
+ ***************************************************************************/
+void
+timeouts_destroy(struct Timeouts *timeouts)
+{
+    free(timeouts);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+timeouts_set_resolution(struct Timeouts *timeouts, uint64_t ticks)
+{
+    struct TimeoutEntry *list = NULL;
+    struct TimeoutEntry *entry;
+    uint64_t timestamp;
+    unsigned shift = 0;
+    unsigned level;
+    unsigned i;
+
+    while (shift < 32 && (2ULL << shift) <= ticks)
+        shift++;
+    if (shift == timeouts->shift)
+        return;
+
+    /*
+     * Gather everything in the wheel into a single list, then insert it
+     * all back using the new resolution.
+     */
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+        for (i = 0; i < WHEEL_SLOTS; i++) {
+            while ((entry = timeouts->slots[level][i]) != NULL) {
+                timeouts->slots[level][i] = entry->next;
+                entry->next = list;
+                list = entry;
+            }
+        }
+    }
+    memset(timeouts->used, 0, sizeof(timeouts->used));
+
+    timestamp = timeouts->current_tick << timeouts->shift;
+    timeouts->shift = shift;
+    timeouts->current_tick = timestamp >> shift;
+
+    while (list) {
+        entry = list;
+        list = entry->next;
+        timeouts_place(timeouts, entry);
+    }
+
+    LOG(1, "timeouts: resolution = %u ticks\n", 1U << shift);
+}
+
 /***************************************************************************
  * This inserts the timeout entry into the appropriate place in the
- * timeout ring.
+ * timeout wheel.
  ***************************************************************************/
 void
 timeouts_add(struct Timeouts *timeouts, struct TimeoutEntry *entry,
              size_t offset, uint64_t timestamp)
 {
-    unsigned index;
-
     /* Unlink from wherever the entry came from */
-    timeout_unlink(entry);
-
-    if (entry->prev) {
-        LOG(1, "***CHANGE %d-seconds\n", 
-                    (int)((timestamp-entry->timestamp)/TICKS_PER_SECOND));
-    }
+    if (entry->prev)
+        timeout_unlink(entry);
+    else
+        timeouts->pending++;
 
     /* Initialize the new entry */
     entry->timestamp = timestamp;
     entry->offset = (unsigned)offset;
 
     /* Link it into it's new location */
-    index = timestamp & timeouts->mask;
-    entry->next = timeouts->slots[index];
-    timeouts->slots[index] = entry;
-    entry->prev = &timeouts->slots[index];
-    if (entry->next)
-        entry->next->prev = &entry->next;
+    timeouts_place(timeouts, entry);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+timeouts_cancel(struct Timeouts *timeouts, struct TimeoutEntry *entry)
+{
+    if (entry->prev == 0)
+        return;
+    timeout_unlink(entry);
+    timeouts->pending--;
 }
 
 /***************************************************************************
@@ -132,24 +354,52 @@ timeouts_add(struct Timeouts *timeouts, struct TimeoutEntry *entry,
 void *
 timeouts_remove(struct Timeouts *timeouts, uint64_t timestamp)
 {
-    struct TimeoutEntry *entry = NULL;
-
-    /* Search until we find one */
-    while (timeouts->current_index <= timestamp) {
+    struct TimeoutEntry *entry;
+    uint64_t tick = timestamp >> timeouts->shift;
 
-        /* Start at the current slot */
-        entry = timeouts->slots[timeouts->current_index & timeouts->mask];
+    /*
+     * Walk the wheel forward until something has expired or we've
+     * caught up with the current time. The slot for the current tick
+     * isn't processed, since it may hold entries a bit later than 'now'.
+     * Stretches of time where nothing happens are skipped over.
+     */
+    while (timeouts->expired == NULL && timeouts->current_tick < tick) {
+        uint64_t current = timeouts_next_tick(timeouts);
+        unsigned index;
+        unsigned level;
 
-        /* enumerate through the linked list until we find a used slot */
-        while (entry && entry->timestamp > timestamp)
-            entry = entry->next;
-        if (entry)
+        if (current >= tick) {
+            timeouts->current_tick = tick;
             break;
+        }
+        timeouts->current_tick = current;
 
-        /* found nothing at this slot, so move to next slot */
-        timeouts->current_index++;
+        /*
+         * When a level wraps around, pull down the next slot of the
+         * level above it.
+         */
+        index = (unsigned)(current & WHEEL_MASK);
+        for (level = 1; index == 0 && level < WHEEL_LEVELS; level++) {
+            index = (unsigned)((current >> (WHEEL_BITS * level)) & WHEEL_MASK);
+            timeouts_cascade(timeouts, level, index);
+        }
+
+        /*
+         * Everything in this slot is due, move the whole list at once.
+         */
+        index = (unsigned)(current & WHEEL_MASK);
+        entry = timeouts->slots[0][index];
+        timeouts->slots[0][index] = NULL;
+        timeouts->used[0][index / 64] &= ~(1ULL << (index % 64));
+        if (entry) {
+            timeouts->expired = entry;
+            entry->prev = &timeouts->expired;
+        }
+
+        timeouts->current_tick++;
     }
 
+    entry = timeouts->expired;
     if (entry == NULL) {
         /* we've caught up to the current time, and there's nothing
          * left to timeout, so return NULL */
@@ -158,9 +408,94 @@ timeouts_remove(struct Timeouts *timeouts, uint64_t timestamp)
 
     /* unlink this entry from the timeout system */
     timeout_unlink(entry);
+    timeouts->pending--;
 
     /* return a pointer to the structure holding this entry */
     return ((char*)entry) - entry->offset;
 }
 
+/***************************************************************************
+ ***************************************************************************/
+uint64_t
+timeouts_pending(const struct Timeouts *timeouts)
+{
+    return timeouts->pending;
+}
 
+/***************************************************************************
+ ***************************************************************************/
+struct TimeoutTest {
+    unsigned id;
+    uint64_t expires;
+    struct TimeoutEntry timeout[1];
+};
+
+int
+timeouts_selftest(void)
+{
+    static const uint64_t delays[] = {
+        0, 1, 15, 16, 17, 255*16, 256*16, 4000, 65536*16+3,
+        TICKS_FROM_SECS(30), TICKS_FROM_SECS(3600),
+        TICKS_FROM_SECS(90ULL*24*3600), /* beyond the top level */
+    };
+    size_t count = sizeof(delays)/sizeof(delays[0]);
+    uint64_t start = TICKS_FROM_SECS(1500000000ULL) + 7;
+    struct TimeoutTest tests[sizeof(delays)/sizeof(delays[0])];
+    struct Timeouts *timeouts;
+    struct TimeoutTest *t;
+    uint64_t now;
+    size_t i;
+    size_t fired = 0;
+
+    timeouts = timeouts_create(start);
+    memset(tests, 0, sizeof(tests));
+
+    for (i = 0; i < count; i++) {
+        tests[i].id = (unsigned)i;
+        tests[i].expires = start + delays[i];
+        timeout_init(tests[i].timeout);
+        timeouts_add(timeouts, tests[i].timeout,
+                     offsetof(struct TimeoutTest, timeout), tests[i].expires);
+    }
+    if (timeouts_pending(timeouts) != count)
+        goto fail;
+
+    /* cancel one, and re-arm another further away */
+    timeouts_cancel(timeouts, tests[3].timeout);
+    tests[4].expires += TICKS_FROM_SECS(2);
+    timeouts_add(timeouts, tests[4].timeout,
+                 offsetof(struct TimeoutTest, timeout), tests[4].expires);
+    if (timeouts_pending(timeouts) != count - 1)
+        goto fail;
+
+    /* walk forward in uneven steps, nothing may fire early, and nothing
+     * may fire later than one slot (plus the step) after it's due */
+    for (now = start; fired < count - 1; now += 1 + (now & 0xFFF) * 97) {
+        while ((t = (struct TimeoutTest *)timeouts_remove(timeouts, now)) != NULL) {
+            if (t->id == 3 || t->expires > now)
+                goto fail;
+            fired++;
+        }
+        if (now > start + TICKS_FROM_SECS(91ULL*24*3600))
+            goto fail;
+    }
+    if (timeouts_pending(timeouts) != 0)
+        goto fail;
+
+    /* changing the resolution must keep the entries in the wheel */
+    timeouts_add(timeouts, tests[0].timeout,
+                 offsetof(struct TimeoutTest, timeout), now + 1000);
+    timeouts_set_resolution(timeouts, 1);
+    timeouts_set_resolution(timeouts, 1024);
+    if (timeouts_remove(timeouts, now + 999) != NULL)
+        goto fail;
+    if (timeouts_remove(timeouts, now + 1000 + 2048) != &tests[0])
+        goto fail;
+
+    timeouts_destroy(timeouts);
+    return 0;
+fail:
+    fprintf(stderr, "timeouts: selftest failed\n");
+    timeouts_destroy(timeouts);
+    return 1;
+}
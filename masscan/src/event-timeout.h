@@ -67,15 +67,32 @@ timeout_init(struct TimeoutEntry *entry)
 struct Timeouts *
 timeouts_create(uint64_t timestamp_now);
 
+/**
+ * Free the timeout subsystem. Entries still inside of it are simply
+ * forgotten, since they live inside other structures.
+ */
+void
+timeouts_destroy(struct Timeouts *timeouts);
+
+/**
+ * Change the resolution of the wheel, which is the granularity at which
+ * timeouts fire. Entries already in the wheel are re-inserted.
+ * @param ticks
+ *      The number of TICKS_PER_SECOND units per wheel slot. It's rounded
+ *      down to a power of two.
+ */
+void
+timeouts_set_resolution(struct Timeouts *timeouts, uint64_t ticks);
+
 /**
  * Insert the timeout 'entry' into the future location in the timeout
- * ring, as determined by the timestamp.
+ * wheel, as determined by the timestamp.
  * @param timeouts
- *      A ring of timeouts, with each slot corresponding to a specific
+ *      A wheel of timeouts, with each slot corresponding to a specific
  *      time in the future.
  * @param entry
- *      The entry that we are going to insert into the ring. If it's
- *      already in the ring, it'll be removed from the old location
+ *      The entry that we are going to insert into the wheel. If it's
+ *      already in the wheel, it'll be removed from the old location
  *      first before inserting into the new location.
  * @param offset
  *      The 'entry' field above is part of an existing structure. This
@@ -90,13 +107,20 @@ void
 timeouts_add(struct Timeouts *timeouts, struct TimeoutEntry *entry,
                   size_t offset, uint64_t timestamp_expires);
 
+/**
+ * Take an entry out of the wheel without it firing, such as when the
+ * object holding it is being destroyed.
+ */
+void
+timeouts_cancel(struct Timeouts *timeouts, struct TimeoutEntry *entry);
+
 /**
  * Remove an object from the timestamp system that is older than than
  * the specified timestamp. This function must be called repeatedly
  * until it returns NULL to remove all the objects that are older
  * than the given timestamp.
  * @param timeouts
- *      A ring of timeouts. We'll walk the ring until we've caught
+ *      A wheel of timeouts. We'll walk the wheel until we've caught
  *      up with the current time.
  * @param timestamp_now
  *      Usually, this timestmap will be "now", the current time,
@@ -108,6 +132,17 @@ timeouts_add(struct Timeouts *timeouts, struct TimeoutEntry *entry,
 void *
 timeouts_remove(struct Timeouts *timeouts, uint64_t timestamp_now);
 
+/**
+ * Number of entries currently waiting in the wheel (including those that
+ * are due but haven't been removed yet). Used to detect leaks: everything
+ * that's supposed to time out must be counted here.
+ */
+uint64_t
+timeouts_pending(const struct Timeouts *timeouts);
+
+int
+timeouts_selftest(void);
+
 /*
  * This macros convert a normal "timeval" structure into the timestamp
  * that we use for timeouts. The timeval structure probably will come
@@ -115,7 +150,7 @@ timeouts_remove(struct Timeouts *timeouts, uint64_t timestamp_now);
  */
 #define TICKS_PER_SECOND (16384ULL)
 #define TICKS_FROM_SECS(secs) ((secs)*16384ULL)
-#define TICKS_FROM_USECS(usecs) ((usecs)/16384ULL)
+#define TICKS_FROM_USECS(usecs) (((usecs)*16384ULL)/1000000ULL)
 #define TICKS_FROM_TV(secs,usecs) (TICKS_FROM_SECS(secs)+TICKS_FROM_USECS(usecs))
 
 #endif
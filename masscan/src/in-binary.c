@@ -11,6 +11,13 @@
 #include "string_s.h"
 #include "in-filter.h"
 #include "in-report.h"
+#include "out-indexed.h"
+#include "out-record.h"
+#include "pixie-compress.h"
+#include "pixie-file.h"
+#include "pixie-threads.h"
+#include "pixie-timer.h"
+#include "logger.h"
 
 #include <stdlib.h>
 #include <assert.h>
@@ -449,6 +456,328 @@ end:
 }
 
 
+/***************************************************************************
+ * Reading "indexed" files (-oI). These have the same records as above,
+ * grouped in blocks. We map the file, use the index to skip blocks that
+ * can't pass the filters, then worker threads decompress and filter the
+ * remaining blocks, while this thread outputs the surviving records in
+ * their original order.
+ ***************************************************************************/
+struct IndexedResult {
+    unsigned char *buf;     /* records that passed the filters */
+    size_t length;
+    unsigned records;
+    volatile unsigned is_done;
+};
+
+struct IndexedRead {
+    const unsigned char *px;
+    const struct IndexedBlock *blocks;
+    unsigned count;
+    const struct RangeList *ips;
+    const struct RangeList *ports;
+    const struct RangeList *btypes;
+    struct IndexedResult *results;
+
+    /* next block a worker will take, and blocks already output. Workers
+     * stay within 'window' blocks of the output so memory stays bounded */
+    volatile unsigned next;
+    volatile unsigned emitted;
+    unsigned window;
+};
+
+/***************************************************************************
+ * Parse the [TYPE][LENGTH] prefix of a record.
+ * @return the offset of the record body, or 0 if the record is corrupt
+ ***************************************************************************/
+static size_t
+record_prefix(const unsigned char *px, size_t length, size_t offset,
+              unsigned *type, unsigned *body_length)
+{
+    unsigned x;
+
+    if (offset >= length)
+        return 0;
+    x = px[offset] & 0x7F;
+    while (px[offset++] & 0x80) {
+        if (offset >= length)
+            return 0;
+        x = (x << 7) | (px[offset] & 0x7F);
+    }
+    *type = x;
+
+    if (offset >= length)
+        return 0;
+    x = px[offset] & 0x7F;
+    while (px[offset++] & 0x80) {
+        if (offset >= length)
+            return 0;
+        x = (x << 7) | (px[offset] & 0x7F);
+    }
+    *body_length = x;
+
+    if (offset + x > length)
+        return 0;
+    return offset;
+}
+
+/***************************************************************************
+ * Decompress one block and keep the records that pass the filters. This
+ * runs in the worker threads, so it mustn't touch the output.
+ ***************************************************************************/
+static void
+indexed_decode_block(struct IndexedRead *r, unsigned i)
+{
+    const struct IndexedBlock *block = &r->blocks[i];
+    struct IndexedResult *result = &r->results[i];
+    const unsigned char *px = r->px + block->offset + INDEXED_BLOCK_HEADER_SIZE;
+    unsigned char *unpacked = NULL;
+    size_t length = block->stored_length;
+    size_t offset = 0;
+
+    if (block->codec != Codec_None) {
+        unpacked = (unsigned char *)malloc(block->raw_length + 1);
+        if (unpacked == NULL) {
+            fprintf(stderr, "memory allocation failure\n");
+            exit(1);
+        }
+        length = pixie_decompress(block->codec, unpacked, block->raw_length,
+                                  px, block->stored_length);
+        if (length != block->raw_length) {
+            LOG(0, "readscan: block at offset %" PRIu64 " corrupt\n", block->offset);
+            free(unpacked);
+            return;
+        }
+        px = unpacked;
+    }
+
+    result->buf = (unsigned char *)malloc(length + 1);
+    if (result->buf == NULL) {
+        fprintf(stderr, "memory allocation failure\n");
+        exit(1);
+    }
+
+    while (offset < length) {
+        const unsigned char *body;
+        unsigned type;
+        unsigned body_length;
+        size_t start = offset;
+        unsigned ip;
+        unsigned port;
+        int is_pass = 0;
+
+        offset = record_prefix(px, length, offset, &type, &body_length);
+        if (offset == 0) {
+            LOG(0, "readscan: block at offset %" PRIu64 " corrupt\n", block->offset);
+            break;
+        }
+        body = px + offset;
+        offset += body_length;
+
+        switch (type) {
+        case Out_Open2:
+        case Out_Closed2:
+        case Out_Arp2:
+            if (body_length < 13 || (r->btypes && r->btypes->count))
+                break;
+            ip   = body[4]<<24 | body[5]<<16 | body[6]<<8 | body[7];
+            port = body[9]<<8 | body[10];
+            is_pass = readscan_filter_pass(ip, port, 0, r->ips, r->ports, 0);
+            break;
+        case Out_Banner9:
+            if (body_length < 14)
+                break;
+            ip   = body[4]<<24 | body[5]<<16 | body[6]<<8 | body[7];
+            port = body[9]<<8 | body[10];
+            is_pass = readscan_filter_pass(ip, port, body[11]<<8 | body[12],
+                                           r->ips, r->ports, r->btypes);
+            break;
+        }
+
+        if (is_pass) {
+            memcpy(result->buf + result->length, px + start, offset - start);
+            result->length += offset - start;
+            result->records++;
+        }
+    }
+
+    free(unpacked);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+indexed_worker_thread(void *v)
+{
+    struct IndexedRead *r = (struct IndexedRead *)v;
+
+    for (;;) {
+        unsigned i = r->next;
+
+        if (i >= r->count)
+            break;
+        if (!rte_atomic32_cmpset(&r->next, i, i + 1))
+            continue;
+
+        while (i >= r->emitted + r->window)
+            pixie_usleep(100);
+
+        indexed_decode_block(r, i);
+
+        /* atomic, so the result is visible before the flag */
+        rte_atomic32_cmpset(&r->results[i].is_done, 0, 1);
+    }
+}
+
+/***************************************************************************
+ * Output the records that a worker kept from a block.
+ ***************************************************************************/
+static void
+indexed_output_block(struct Output *out, struct IndexedResult *result)
+{
+    size_t offset = 0;
+
+    while (offset < result->length) {
+        unsigned type;
+        unsigned body_length;
+
+        offset = record_prefix(result->buf, result->length, offset,
+                               &type, &body_length);
+        if (offset == 0)
+            break;
+
+        switch (type) {
+        case Out_Open2:
+            parse_status2(out, PortStatus_Open, result->buf + offset,
+                          body_length, 0, 0);
+            break;
+        case Out_Closed2:
+            parse_status2(out, PortStatus_Closed, result->buf + offset,
+                          body_length, 0, 0);
+            break;
+        case Out_Arp2:
+            parse_status2(out, PortStatus_Arp, result->buf + offset,
+                          body_length, 0, 0);
+            break;
+        case Out_Banner9:
+            parse_banner9(out, result->buf + offset, body_length, 0, 0, 0);
+            break;
+        }
+        offset += body_length;
+    }
+}
+
+/***************************************************************************
+ * @return
+ *      the number of records output, or -1 if this isn't an indexed file,
+ *      in which case the caller should try the older format
+ ***************************************************************************/
+static int64_t
+parse_indexed_file(struct Output *out, const char *filename,
+                   const struct Masscan *masscan)
+{
+    struct IndexedRead r[1];
+    struct IndexedBlock *blocks;
+    const unsigned char *px;
+    uint64_t length;
+    void *handle;
+    unsigned count;
+    unsigned when_scan_started = 0;
+    unsigned threads;
+    size_t thread_handles[64];
+    uint64_t total_records = 0;
+    unsigned total_blocks;
+    unsigned i;
+
+    px = pixie_mmap_file(filename, &length, &handle);
+    if (px == NULL) {
+        perror(filename);
+        return 0;
+    }
+
+    blocks = indexed_read_blocks(px, length, &count, &when_scan_started);
+    if (blocks == NULL) {
+        pixie_munmap_file(handle);
+        return -1;
+    }
+    out->when_scan_started = when_scan_started;
+
+    /* Drop the blocks that can't match. We also need to load the library
+     * for any compression used by the remaining blocks */
+    total_blocks = count;
+    for (i=0, count=0; i<total_blocks; i++) {
+        if (!indexed_block_is_match(&blocks[i], &masscan->targets,
+                                    &masscan->ports, &masscan->banner_types))
+            continue;
+        if (pixie_compress_init(blocks[i].codec) != 0) {
+            LOG(0, "%s: can't decompress %s blocks, skipping\n", filename,
+                pixie_codec_to_name(blocks[i].codec));
+            continue;
+        }
+        blocks[count++] = blocks[i];
+    }
+    LOG(1, "%s: %u blocks, %u skipped by the index\n", filename,
+        total_blocks, total_blocks - count);
+
+    memset(r, 0, sizeof(r));
+    r->px = px;
+    r->blocks = blocks;
+    r->count = count;
+    r->ips = &masscan->targets;
+    r->ports = &masscan->ports;
+    r->btypes = &masscan->banner_types;
+    r->results = (struct IndexedResult *)calloc(count + 1, sizeof(r->results[0]));
+    if (r->results == NULL) {
+        fprintf(stderr, "memory allocation failure\n");
+        exit(1);
+    }
+
+    threads = masscan->readscan_threads;
+    if (threads == 0)
+        threads = pixie_cpu_get_count();
+    if (threads > sizeof(thread_handles)/sizeof(thread_handles[0]))
+        threads = sizeof(thread_handles)/sizeof(thread_handles[0]);
+    if (threads > count)
+        threads = count;
+    r->window = threads * 4;
+
+    if (threads > 1) {
+        for (i=0; i<threads; i++)
+            thread_handles[i] = pixie_begin_thread(indexed_worker_thread, 0, r);
+    }
+
+    for (i=0; i<count; i++) {
+        struct IndexedResult *result = &r->results[i];
+
+        if (threads > 1) {
+            /* atomic read, so we see the result the flag is guarding */
+            while (!rte_atomic32_cmpset(&result->is_done, 1, 1))
+                pixie_usleep(100);
+        } else
+            indexed_decode_block(r, i);
+
+        indexed_output_block(out, result);
+        total_records += result->records;
+        free(result->buf);
+        result->buf = NULL;
+        r->emitted = i + 1;
+
+        if ((i & 0x3F) == 0x3F)
+            fprintf(stderr, "%s: %8" PRIu64 "\r", filename, total_records);
+    }
+
+    if (threads > 1) {
+        for (i=0; i<threads; i++)
+            pixie_thread_join(thread_handles[i]);
+    }
+
+    free(r->results);
+    free(blocks);
+    pixie_munmap_file(handle);
+    return (int64_t)total_records;
+}
+
+
 /*****************************************************************************
  * When masscan is called with the "--readscan" parameter, it doesn't
  * do a scan of the live network, but instead reads scan results from
@@ -484,6 +813,8 @@ read_binary_scanfile(struct Masscan *masscan,
      * Then arg_first=3 and arg_max=5.
      */
     for (i=arg_first; i<arg_max; i++) {
+        if (parse_indexed_file(out, argv[i], masscan) >= 0)
+            continue;
         parse_file(out, argv[i], &masscan->targets, &masscan->ports,
                    &masscan->banner_types);
     }
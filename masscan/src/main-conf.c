@@ -22,6 +22,8 @@
 #include "crypto-base64.h"
 #include "script.h"
 #include "masscan-app.h"
+#include "pixie-compress.h"
+#include "out-indexed.h"
 
 #include <ctype.h>
 #include <limits.h>
@@ -153,6 +155,8 @@ print_nmap_help(void)
 "TARGET SPECIFICATION:\n"
 "  Can pass only IPv4 address, CIDR networks, or ranges (non-nmap style)\n"
 "  Ex: 10.0.0.0/8, 192.168.0.1, 10.0.0.1-10.0.0.254\n"
+"  IPv6 addresses and prefixes work too, for TCP ports only\n"
+"  Ex: 2001:db8::1, 2001:db8::/120\n"
 "  -iL <inputfilename>: Input from list of hosts/networks\n"
 "  --exclude <host1[,host2][,host3],...>: Exclude hosts/networks\n"
 "  --excludefile <exclude_file>: Exclude list from file\n"
@@ -170,8 +174,13 @@ print_nmap_help(void)
 "    Ex: -p22; -p1-65535; -p 111,137,80,139,8080\n"
 "TIMING AND PERFORMANCE:\n"
 "  --max-rate <number>: Send packets no faster than <number> per second\n"
+"  --burst <number>: Send packets in evenly spaced bursts of <number>\n"
+"  --pin <auto|none|cpu-list>: Run transmit and receive threads on these\n"
+"    cpus, a pair per adapter, instead of on the adapter's NUMA node\n"
 "  --connection-timeout <number>: time in seconds a TCP connection will\n"
 "    timeout while waiting for banner data from a port.\n"
+"  --tcp-timer-resolution <msecs>: granularity of the TCP connection\n"
+"    timeouts, coarser values use less CPU on very large scans.\n"
 "FIREWALL/IDS EVASION AND SPOOFING:\n"
 "  -S/--source-ip <IP_Address>: Spoof source address\n"
 "  -e <iface>: Use specified interface\n"
@@ -179,12 +188,17 @@ print_nmap_help(void)
 "  --ttl <val>: Set IP time-to-live field\n"
 "  --spoof-mac <mac address/prefix/vendor name>: Spoof your MAC address\n"
 "OUTPUT:\n"
-"  --output-format <format>: Sets output to binary/list/unicornscan/json/ndjson/grepable/xml\n"
+"  --output-format <format>: Sets output to binary/indexed/list/unicornscan/json/ndjson/grepable/xml\n"
 "  --output-file <file>: Write scan results to file. If --output-format is\n"
 "     not given default is xml\n"
 "  -oL/-oJ/-oD/-oG/-oB/-oX/-oU <file>: Output scan in List/JSON/nDjson/Grepable/Binary/XML/Unicornscan format,\n"
 "     respectively, to the given filename. Shortcut for\n"
 "     --output-format <format> --output-file <file>\n"
+"  -oI <file>: Output in the indexed binary format, for fast --readscan\n"
+"  --indexed-codec <none|zstd|lz4>: compress the blocks of -oI files\n"
+"  --readscan-threads <n>: threads decoding -oI files with --readscan\n"
+"  --output-compress <none|gzip|zstd>: compress the output file, which by\n"
+"     default is done when the filename ends in .gz or .zst\n"
 "  -v: Increase verbosity level (use -vv or more for greater effect)\n"
 "  -d: Increase debugging level (use -dd or more for greater effect)\n"
 "  --open: Only show open (or possibly open) ports\n"
@@ -259,6 +273,11 @@ masscan_echo_nic(struct Masscan *masscan, FILE *fp, unsigned i)
             (masscan->nic[i].src.ip.last>> 8)&0xFF,
             (masscan->nic[i].src.ip.last>> 0)&0xFF
             );
+    if (masscan->nic[i].src.ipv6.hi || masscan->nic[i].src.ipv6.lo) {
+        char buf[64];
+        ipv6address_fmt(buf, sizeof(buf), masscan->nic[i].src.ipv6);
+        fprintf(fp, "adapter-ip%s = %s\n", zzz, buf);
+    }
 
     fprintf(fp, "adapter-mac%s = %02x:%02x:%02x:%02x:%02x:%02x\n", zzz,
             masscan->nic[i].my_mac[0],
@@ -297,6 +316,16 @@ masscan_echo(struct Masscan *masscan, FILE *fp)
     unsigned l = 0;
 
     fprintf(fp, "rate = %10.2f\n", masscan->max_rate);
+    if (masscan->burst)
+        fprintf(fp, "burst = %" PRIu64 "\n", masscan->burst);
+    if (masscan->pin.is_none)
+        fprintf(fp, "pin = none\n");
+    else if (masscan->pin.count) {
+        fprintf(fp, "pin = ");
+        for (i=0; i<masscan->pin.count; i++)
+            fprintf(fp, "%s%u", i?",":"", masscan->pin.cpus[i]);
+        fprintf(fp, "\n");
+    }
     fprintf(fp, "randomize-hosts = true\n");
     fprintf(fp, "seed = %" PRIu64 "\n", masscan->seed);
     fprintf(fp, "shard = %u/%u\n", masscan->shard.one, masscan->shard.of);
@@ -326,6 +355,14 @@ masscan_echo(struct Masscan *masscan, FILE *fp)
     case Output_Unicornscan:fprintf(fp, "output-format = unicornscan\n"); break;
     case Output_XML:        fprintf(fp, "output-format = xml\n"); break;
     case Output_Binary:     fprintf(fp, "output-format = binary\n"); break;
+    case Output_Indexed:
+        fprintf(fp, "output-format = indexed\n");
+        fprintf(fp, "indexed-codec = %s\n",
+            pixie_codec_to_name(masscan->output.indexed.codec));
+        if (masscan->output.indexed.block_size)
+            fprintf(fp, "indexed-block-size = %u\n",
+                masscan->output.indexed.block_size);
+        break;
     case Output_Grepable:   fprintf(fp, "output-format = grepable\n"); break;
     case Output_JSON:       fprintf(fp, "output-format = json\n"); break;
     case Output_NDJSON:     fprintf(fp, "output-format = ndjson\n"); break;
@@ -359,7 +396,21 @@ masscan_echo(struct Masscan *masscan, FILE *fp)
     fprintf(fp, "rotate-dir = %s\n", masscan->output.rotate.directory);
     fprintf(fp, "rotate-offset = %u\n", masscan->output.rotate.offset);
     fprintf(fp, "rotate-filesize = %" PRIu64 "\n", masscan->output.rotate.filesize);
+    if (masscan->output.compress.is_set)
+        fprintf(fp, "output-compress = %s\n",
+            pixie_codec_to_name(masscan->output.compress.codec));
+    if (masscan->output.compress.threads)
+        fprintf(fp, "output-compress-threads = %u\n",
+            masscan->output.compress.threads);
     fprintf(fp, "pcap = %s\n", masscan->pcap_filename);
+    if (masscan->coord.is_worker)
+        fprintf(fp, "worker = %s\n", masscan->coord.address);
+    if (masscan->coord.chunk_size)
+        fprintf(fp, "chunk-size = %" PRIu64 "\n", masscan->coord.chunk_size);
+    if (masscan->metrics.filename[0]) {
+        fprintf(fp, "metrics = %s\n", masscan->metrics.filename);
+        fprintf(fp, "metrics-interval = %u\n", masscan->metrics.interval);
+    }
 
     /*
      * Targets
@@ -429,6 +480,17 @@ masscan_echo(struct Masscan *masscan, FILE *fp)
         }
         fprintf(fp, "\n");
     }
+    for (i=0; i<masscan->targets_ipv6.host_count; i++) {
+        char buf[64];
+        ipv6address_fmt(buf, sizeof(buf), masscan->targets_ipv6.hosts[i]);
+        fprintf(fp, "range = %s\n", buf);
+    }
+    for (i=0; i<masscan->targets_ipv6.count; i++) {
+        char buf1[64], buf2[64];
+        ipv6address_fmt(buf1, sizeof(buf1), masscan->targets_ipv6.list[i].begin);
+        ipv6address_fmt(buf2, sizeof(buf2), masscan->targets_ipv6.list[i].end);
+        fprintf(fp, "range = %s-%s\n", buf1, buf2);
+    }
 
     fprintf(fp, "\n");
     if (masscan->http_user_agent)
@@ -449,6 +511,8 @@ masscan_echo(struct Masscan *masscan, FILE *fp)
 
 
     fprintf(fp, "%scapture = cert\n", masscan->is_capture_cert?"":"no");
+    if (masscan->is_capture_certdigest)
+        fprintf(fp, "capture = certdigest\n");
     fprintf(fp, "%scapture = html\n", masscan->is_capture_html?"":"no");
     fprintf(fp, "%scapture = heartbleed\n", masscan->is_capture_heartbleed?"":"no");
     fprintf(fp, "%scapture = ticketbleed\n", masscan->is_capture_ticketbleed?"":"no");
@@ -513,8 +577,22 @@ masscan_save_state(struct Masscan *masscan)
  * comments are terminated by a newline. Also, it has to count the number
  * of lines correctly to print error messages.
  *****************************************************************************/
+static int
+is_ipv6_spec(const char *str, unsigned offset, unsigned max)
+{
+    while (offset < max && str[offset] != ',' && !isspace(str[offset]&0xFF)) {
+        if (str[offset] == ':')
+            return 1;
+        offset++;
+    }
+    return 0;
+}
+
+/*****************************************************************************
+ *****************************************************************************/
 static void
-ranges_from_file(struct RangeList *ranges, const char *filename)
+ranges_from_file(struct RangeList *ranges, struct Range6List *ranges6,
+                 const char *filename)
 {
     FILE *fp;
     errno_t err;
@@ -540,8 +618,9 @@ ranges_from_file(struct RangeList *ranges, const char *filename)
                 break;
         }
 
-        /* If this is a punctuation, like '#', then it's a comment */
-        if (ispunct(c&0xFF)) {
+        /* If this is a punctuation, like '#', then it's a comment. That
+         * excludes the ':' an IPv6 address like "::1" can start with */
+        if (ispunct(c&0xFF) && c != ':') {
             while (!feof(fp)) {
                 c = getc(fp);
                 line_number += (c == '\n');
@@ -561,7 +640,7 @@ ranges_from_file(struct RangeList *ranges, const char *filename)
          * Read in a single entry
          */
         if (!feof(fp)) {
-            char address[64];
+            char address[128];
             size_t i;
             struct Range range;
             unsigned offset = 0;
@@ -587,6 +666,17 @@ ranges_from_file(struct RangeList *ranges, const char *filename)
             address[i] = '\0';
 
             /* parse the address range */
+            if (is_ipv6_spec(address, 0, (unsigned)i)) {
+                struct Range6 range6;
+
+                if (range6_parse(address, &offset, (unsigned)i, &range6) != 0) {
+                    LOG(0, "%s:%u:%u: bad range spec: \"%.*s\"\n",
+                            filename, line_number, offset, i, address);
+                    exit(1);
+                }
+                range6list_add_range(ranges6, range6.begin, range6.end);
+                continue;
+            }
             range = range_parse_ipv4(address, &offset, (unsigned)i);
             if (range.begin == 0xFFFFFFFF && range.end == 0) {
                 LOG(0, "%s:%u:%u: bad range spec: \"%.*s\"\n",
@@ -1020,6 +1110,18 @@ masscan_set_parameter(struct Masscan *masscan,
         /* Send packets FROM this IP address */
         struct Range range;
 
+        if (strchr(value, ':')) {
+            ipv6address ip;
+
+            if (ipv6address_parse(value, strlen(value), &ip) != 0) {
+                LOG(0, "FAIL: bad source IPv6 address: %s=%s\n",
+                        name, value);
+                exit(1);
+            }
+            masscan->nic[index].src.ipv6 = ip;
+            return;
+        }
+
         range = range_parse_ipv4(value, 0, 0);
 
         /* Check for bad format */
@@ -1124,6 +1226,30 @@ masscan_set_parameter(struct Masscan *masscan,
 
         masscan->nic[index].router_ip = range.begin;
     }
+    else if (EQUALS("burst", name)) {
+        masscan->burst = parseInt(value);
+        if (masscan->burst == 0) {
+            fprintf(stderr, "FAIL: %s: burst must be at least 1\n", value);
+            exit(1);
+        }
+    }
+    else if (EQUALS("pin", name)) {
+        int count;
+
+        masscan->pin.count = 0;
+        masscan->pin.is_none = 0;
+        if (EQUALS("none", value))
+            masscan->pin.is_none = 1;
+        else if (!EQUALS("auto", value)) {
+            count = pin_parse_cpulist(value, masscan->pin.cpus,
+                        sizeof(masscan->pin.cpus)/sizeof(masscan->pin.cpus[0]));
+            if (count <= 0 || count % 2 != 0) {
+                fprintf(stderr, "FAIL: %s: pin expects 'auto', 'none', or pairs of transmit,receive cpus\n", value);
+                exit(1);
+            }
+            masscan->pin.count = (unsigned)count;
+        }
+    }
     else if (EQUALS("rate", name) || EQUALS("max-rate", name) ) {
         double rate = 0.0;
         double point = 10.0;
@@ -1234,7 +1360,11 @@ masscan_set_parameter(struct Masscan *masscan,
     } else if (EQUALS("capture", name)) {
         if (EQUALS("cert", value))
             masscan->is_capture_cert = 1;
-        else if (EQUALS("html", value))
+        else if (EQUALS("certdigest", value)) {
+            /* instead of the whole certificate */
+            masscan->is_capture_certdigest = 1;
+            masscan->is_capture_cert = 0;
+        } else if (EQUALS("html", value))
             masscan->is_capture_html = 1;
         else if (EQUALS("heartbleed", value))
             masscan->is_capture_heartbleed = 1;
@@ -1247,6 +1377,8 @@ masscan_set_parameter(struct Masscan *masscan,
     } else if (EQUALS("nocapture", name)) {
         if (EQUALS("cert", value))
             masscan->is_capture_cert = 0;
+        else if (EQUALS("certdigest", value))
+            masscan->is_capture_certdigest = 0;
         else if (EQUALS("html", value))
             masscan->is_capture_html = 0;
         else if (EQUALS("heartbleed", value))
@@ -1276,6 +1408,18 @@ masscan_set_parameter(struct Masscan *masscan,
         for (;;) {
             struct Range range;
 
+            if (is_ipv6_spec(ranges, offset, max_offset)) {
+                struct Range6 range6;
+
+                if (range6_parse(ranges, &offset, max_offset, &range6) != 0) {
+                    fprintf(stderr, "ERROR: bad IP address/range: %s\n", ranges);
+                    break;
+                }
+                range6list_add_range(&masscan->targets_ipv6,
+                                     range6.begin, range6.end);
+                goto next_target;
+            }
+
             range = range_parse_ipv4(ranges, &offset, max_offset);
             if (range.end < range.begin) {
                 fprintf(stderr, "ERROR: bad IP address/range: %s\n", ranges);
@@ -1284,6 +1428,7 @@ masscan_set_parameter(struct Masscan *masscan,
 
             rangelist_add_range(&masscan->targets, range.begin, range.end);
 
+        next_target:
             if (offset >= max_offset || ranges[offset] != ',')
                 break;
             else
@@ -1306,6 +1451,18 @@ masscan_set_parameter(struct Masscan *masscan,
         for (;;) {
             struct Range range;
 
+            if (is_ipv6_spec(ranges, offset, max_offset)) {
+                struct Range6 range6;
+
+                if (range6_parse(ranges, &offset, max_offset, &range6) != 0) {
+                    fprintf(stderr, "CONF: bad range spec: %s\n", ranges);
+                    exit(1);
+                }
+                range6list_add_range(&masscan->exclude_ipv6,
+                                     range6.begin, range6.end);
+                goto next_exclude;
+            }
+
             range = range_parse_ipv4(ranges, &offset, max_offset);
             if (range.begin == 0 && range.end == 0) {
                 fprintf(stderr, "CONF: bad range spec: %s\n", ranges);
@@ -1314,6 +1471,7 @@ masscan_set_parameter(struct Masscan *masscan,
 
             rangelist_add_range(&masscan->exclude_ip, range.begin, range.end);
 
+        next_exclude:
             if (offset >= max_offset || ranges[offset] != ',')
                 break;
             else
@@ -1342,6 +1500,43 @@ masscan_set_parameter(struct Masscan *masscan,
         masscan->tcp_connection_timeout = (unsigned)parseInt(value);
     } else if (EQUALS("hello-timeout", name)) {
         masscan->tcp_hello_timeout = (unsigned)parseInt(value);
+    } else if (EQUALS("indexed-codec", name)) {
+        int x = pixie_codec_from_name(value);
+        if (x < 0) {
+            fprintf(stderr, "FAIL: %s: unknown codec, expected none, zstd, lz4, or gzip\n", value);
+            exit(1);
+        }
+        if (pixie_compress_init(x) != 0) {
+            fprintf(stderr, "FAIL: %s: couldn't load the library for this codec\n", value);
+            exit(1);
+        }
+        masscan->output.indexed.codec = x;
+    } else if (EQUALS("output-compress-threads", name)) {
+        masscan->output.compress.threads = (unsigned)parseInt(value);
+    } else if (EQUALS("output-compress", name)) {
+        int x = pixie_codec_from_name(value);
+        if (x != Codec_None && x != Codec_Gzip && x != Codec_Zstd) {
+            fprintf(stderr, "FAIL: %s: unknown codec, expected none, gzip, or zstd\n", value);
+            exit(1);
+        }
+        if (pixie_compress_init(x) != 0) {
+            fprintf(stderr, "FAIL: %s: couldn't load the library for this codec\n", value);
+            exit(1);
+        }
+        masscan->output.compress.codec = x;
+        masscan->output.compress.is_set = 1;
+    } else if (EQUALS("indexed-block-size", name)) {
+        uint64_t x = parseSize(value);
+        if (x < 4096 || x > INDEXED_BLOCK_SIZE_MAX) {
+            fprintf(stderr, "FAIL: %s: block size must be between 4k and 64m\n", value);
+            exit(1);
+        }
+        masscan->output.indexed.block_size = (unsigned)x;
+    } else if (EQUALS("readscan-threads", name)) {
+        masscan->readscan_threads = (unsigned)parseInt(value);
+    } else if (EQUALS("tcp-timer-resolution", name)) {
+        /* Granularity, in milliseconds, of the "banners" TCP timeouts */
+        masscan->tcp_timer_resolution = (unsigned)parseInt(value);
     } else if (EQUALS("datadir", name)) {
         strcpy_s(masscan->nmap.datadir, sizeof(masscan->nmap.datadir), value);
     } else if (EQUALS("data-length", name)) {
@@ -1366,7 +1561,7 @@ masscan_set_parameter(struct Masscan *masscan,
         unsigned count1 = masscan->exclude_ip.count;
         unsigned count2;
         LOG(1, "EXCLUDING: %s\n", value);
-        ranges_from_file(&masscan->exclude_ip, value);
+        ranges_from_file(&masscan->exclude_ip, &masscan->exclude_ipv6, value);
         count2 = masscan->exclude_ip.count;
         if (count2 - count1)
         fprintf(stderr, "%s: excluding %u ranges from file\n",
@@ -1474,7 +1669,7 @@ masscan_set_parameter(struct Masscan *masscan,
     } else if (EQUALS("iflist", name)) {
         masscan->op = Operation_List_Adapters;
     } else if (EQUALS("includefile", name)) {
-        ranges_from_file(&masscan->targets, value);
+        ranges_from_file(&masscan->targets, &masscan->targets_ipv6, value);
         if (masscan->op == 0)
             masscan->op = Operation_Scan;
     } else if (EQUALS("infinite", name)) {
@@ -1499,6 +1694,20 @@ masscan_set_parameter(struct Masscan *masscan,
         masscan_set_parameter(masscan, "retries", value);
     } else if (EQUALS("max-rate", name)) {
         masscan_set_parameter(masscan, "rate", value);
+    } else if (EQUALS("coordinator-journal", name)) {
+        strcpy_s(masscan->coord.journal, sizeof(masscan->coord.journal), value);
+    } else if (EQUALS("coordinator", name)) {
+        strcpy_s(masscan->coord.address, sizeof(masscan->coord.address), value);
+        masscan->op = Operation_Coordinator;
+    } else if (EQUALS("worker", name)) {
+        strcpy_s(masscan->coord.address, sizeof(masscan->coord.address), value);
+        masscan->coord.is_worker = 1;
+    } else if (EQUALS("chunk-size", name)) {
+        masscan->coord.chunk_size = parseInt(value);
+    } else if (EQUALS("metrics-interval", name)) {
+        masscan->metrics.interval = (unsigned)parseInt(value);
+    } else if (EQUALS("metrics", name)) {
+        strcpy_s(masscan->metrics.filename, sizeof(masscan->metrics.filename), value);
     } else if (EQUALS("min-hostgroup", name) || EQUALS("max-hostgroup", name)) {
         fprintf(stderr, "nmap(%s): unsupported: we randomize all the groups!\n", name);
         exit(1);
@@ -1602,6 +1811,7 @@ masscan_set_parameter(struct Masscan *masscan,
         else if (EQUALS("unicornscan", value))  x = Output_Unicornscan;
         else if (EQUALS("xml", value))          x = Output_XML;
         else if (EQUALS("binary", value))       x = Output_Binary;
+        else if (EQUALS("indexed", value))      x = Output_Indexed;
         else if (EQUALS("greppable", value))    x = Output_Grepable;
         else if (EQUALS("grepable", value))     x = Output_Grepable;
         else if (EQUALS("json", value))         x = Output_JSON;
@@ -1758,6 +1968,10 @@ masscan_set_parameter(struct Masscan *masscan,
     } else if (EQUALS("benchmark", name)) {
         masscan->op = Operation_Benchmark;
         return;
+    } else if (EQUALS("benchmark-replay", name)) {
+        strcpy_s(masscan->replay_filename, sizeof(masscan->replay_filename), value);
+        masscan->op = Operation_Benchmark;
+        return;
     } else if (EQUALS("source-port", name) || EQUALS("sourceport", name)) {
         masscan_set_parameter(masscan, "adapter-port", value);
     } else if (EQUALS("shard", name) || EQUALS("shards", name)) {
@@ -2105,6 +2319,9 @@ masscan_command_line(struct Masscan *masscan, int argc, char *argv[])
                 case 'G':
                     masscan->output.format = Output_Grepable;
                     break;
+                case 'I':
+                    masscan->output.format = Output_Indexed;
+                    break;
                 case 'L':
                     masscan_set_parameter(masscan, "output-format", "list");
                     break;
@@ -2258,14 +2475,14 @@ masscan_command_line(struct Masscan *masscan, int argc, char *argv[])
             continue;
         }
 
-        if (!isdigit(argv[i][0])) {
+        if (!isdigit(argv[i][0]) && !strchr(argv[i], ':')) {
             fprintf(stderr, "FAIL: unknown command-line parameter \"%s\"\n", argv[i]);
             fprintf(stderr, " [hint] did you want \"--%s\"?\n", argv[i]);
             exit(1);
         }
 
         /* If parameter doesn't start with '-', assume it's an
-         * IPv4 range
+         * IPv4 or IPv6 range
          */
         masscan_set_parameter(masscan, "range", argv[i]);
     }
@@ -0,0 +1,855 @@
+/*
+    Dynamic sharding
+
+    See main-coord.h. The coordinator only hands out numbers: a chunk is a
+    range [begin,end) of the index that 'transmit_thread()' runs through
+    blackrock, so as long as every worker has the same targets, ports and
+    seed, they agree on which addresses that chunk means.
+
+    The protocol is lines of text, so that it can be poked at with netcat:
+
+        HELLO <range>       -> OK <seed> | ERR <reason>
+        NEXT                -> CHUNK <id> <begin> <end> | WAIT <secs> | DONE
+        COMPLETE <id>       -> OK
+
+    A worker holds at most one chunk at a time. If it disconnects while
+    holding one, the chunk goes back on the queue. Once there's nothing
+    left on the queue, an idle worker will be given a copy of the chunk
+    that's been out the longest, if it's taking more than twice as long
+    as chunks usually do, so that one slow machine doesn't hold up the
+    end of the scan. Whichever copy finishes first counts.
+*/
+#include "main-coord.h"
+#include "masscan.h"
+#include "main-globals.h"
+#include "pixie-sockets.h"
+#include "pixie-timer.h"
+#include "logger.h"
+#include "string_s.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#if defined(WIN32)
+#define close_socket(fd) closesocket(fd)
+#else
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#define close_socket(fd) close(fd)
+#define INVALID_SOCKET (-1)
+#endif
+
+#define MAX_WORKERS 256
+
+enum {
+    Chunk_Pending,
+    Chunk_Issued,
+    Chunk_Stolen,   /* issued to a second worker, too */
+    Chunk_Done
+};
+
+struct ChunkLease {
+    uint64_t id;
+    uint64_t issued;    /* usecs */
+    unsigned is_held:1;
+};
+
+/**
+ * The bookkeeping for the coordinator, separate from the sockets so that
+ * it can be tested.
+ */
+struct ChunkTable {
+    uint64_t range;
+    uint64_t chunk_size;
+    uint64_t count;
+    uint64_t done_count;
+    unsigned char *state;
+
+    /* the next chunk that's never been handed out */
+    uint64_t next;
+
+    /* chunks given back by workers that went away */
+    uint64_t *requeue;
+    size_t requeue_count;
+
+    /* for guessing how long a chunk should take */
+    uint64_t completed_usecs;
+    uint64_t completed_count;
+
+    struct ChunkLease leases[MAX_WORKERS];
+    FILE *journal;
+};
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+chunks_init(struct ChunkTable *t, uint64_t range, uint64_t chunk_size)
+{
+    memset(t, 0, sizeof(*t));
+    if (chunk_size == 0)
+        chunk_size = 1;
+
+    /* keep the table to a few tens of megabytes, even for huge scans */
+    while ((range + chunk_size - 1) / chunk_size > 16*1024*1024)
+        chunk_size *= 2;
+
+    t->range = range;
+    t->chunk_size = chunk_size;
+    t->count = (range + chunk_size - 1) / chunk_size;
+    t->state = (unsigned char *)calloc((size_t)t->count + 1, 1);
+    t->requeue = (uint64_t *)malloc(sizeof(t->requeue[0]) * MAX_WORKERS * 2);
+    if (t->state == NULL || t->requeue == NULL)
+        exit(1);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+chunks_cleanup(struct ChunkTable *t)
+{
+    if (t->journal)
+        fclose(t->journal);
+    free(t->state);
+    free(t->requeue);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+chunks_bounds(const struct ChunkTable *t, uint64_t id,
+              uint64_t *begin, uint64_t *end)
+{
+    *begin = id * t->chunk_size;
+    *end = *begin + t->chunk_size;
+    if (*end > t->range)
+        *end = t->range;
+}
+
+/***************************************************************************
+ * A worker went away, or asked for another chunk without finishing the
+ * one it had.
+ ***************************************************************************/
+static void
+chunks_release(struct ChunkTable *t, unsigned slot)
+{
+    struct ChunkLease *lease = &t->leases[slot];
+
+    if (!lease->is_held)
+        return;
+    lease->is_held = 0;
+
+    switch (t->state[lease->id]) {
+    case Chunk_Stolen:
+        /* the other worker still has it */
+        t->state[lease->id] = Chunk_Issued;
+        break;
+    case Chunk_Issued:
+        t->state[lease->id] = Chunk_Pending;
+        t->requeue[t->requeue_count++] = lease->id;
+        LOG(1, "coordinator: chunk %" PRIu64 " will be re-issued\n", lease->id);
+        break;
+    }
+}
+
+/***************************************************************************
+ * Hand out the next chunk to the worker in 'slot'.
+ * @return
+ *      1 if a chunk was issued, 0 if the worker should wait, or -1 if the
+ *      scan is complete
+ ***************************************************************************/
+static int
+chunks_issue(struct ChunkTable *t, unsigned slot, uint64_t now, uint64_t *id)
+{
+    struct ChunkLease *lease = &t->leases[slot];
+    uint64_t oldest = 0;
+    unsigned victim = MAX_WORKERS;
+    unsigned i;
+
+    chunks_release(t, slot);
+
+    if (t->done_count >= t->count)
+        return -1;
+
+    /* first, anything that a dead worker gave back */
+    while (t->requeue_count) {
+        *id = t->requeue[--t->requeue_count];
+        if (t->state[*id] == Chunk_Pending)
+            goto issue;
+    }
+
+    /* next, chunks nobody has seen yet */
+    while (t->next < t->count) {
+        *id = t->next++;
+        if (t->state[*id] == Chunk_Pending)
+            goto issue;
+    }
+
+    /* last, help out whoever is taking too long */
+    if (t->completed_count == 0)
+        return 0;
+    for (i=0; i<MAX_WORKERS; i++) {
+        const struct ChunkLease *other = &t->leases[i];
+        uint64_t limit = 2 * (t->completed_usecs / t->completed_count);
+
+        if (!other->is_held || t->state[other->id] != Chunk_Issued)
+            continue;
+        if (now - other->issued < limit + 1000000)
+            continue;
+        if (victim == MAX_WORKERS || other->issued < oldest) {
+            victim = i;
+            oldest = other->issued;
+        }
+    }
+    if (victim == MAX_WORKERS)
+        return 0;
+    *id = t->leases[victim].id;
+    t->state[*id] = Chunk_Stolen;
+    LOG(1, "coordinator: chunk %" PRIu64 " is slow, issuing it again\n", *id);
+    goto lease;
+
+issue:
+    t->state[*id] = Chunk_Issued;
+lease:
+    lease->id = *id;
+    lease->issued = now;
+    lease->is_held = 1;
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+chunks_complete(struct ChunkTable *t, unsigned slot, uint64_t id, uint64_t now)
+{
+    struct ChunkLease *lease = &t->leases[slot];
+
+    if (id >= t->count)
+        return;
+    if (lease->is_held && lease->id == id) {
+        lease->is_held = 0;
+        t->completed_usecs += now - lease->issued;
+        t->completed_count++;
+    }
+    if (t->state[id] == Chunk_Done)
+        return;
+    t->state[id] = Chunk_Done;
+    t->done_count++;
+
+    if (t->journal) {
+        fprintf(t->journal, "done %" PRIu64 "\n", id);
+        fflush(t->journal);
+    }
+}
+
+/***************************************************************************
+ * Parse a decimal number, returning the position after it, or NULL.
+ ***************************************************************************/
+static const char *
+parse_number(const char *p, uint64_t *result)
+{
+    char *end;
+
+    while (*p == ' ')
+        p++;
+    if (!isdigit(*p & 0xFF))
+        return NULL;
+    *result = strtoull(p, &end, 10);
+    return end;
+}
+
+/***************************************************************************
+ * Read, or start, the journal of completed chunks. It begins with a line
+ * describing the scan, which has to match if we are resuming, followed
+ * by a line for every chunk that was completed.
+ ***************************************************************************/
+static int
+chunks_journal(struct ChunkTable *t, const char *filename, uint64_t *seed)
+{
+    FILE *fp;
+    char line[256];
+    int err;
+
+    err = fopen_s(&fp, filename, "rt");
+    if (err == 0 && fp) {
+        uint64_t range = 0;
+        uint64_t chunk_size = 0;
+        const char *p;
+
+        if (fgets(line, sizeof(line), fp) == NULL
+            || memcmp(line, "masscan-coordinator", 19) != 0
+            || (p = parse_number(line + 19, &range)) == NULL
+            || (p = parse_number(p, &chunk_size)) == NULL
+            || (p = parse_number(p, seed)) == NULL) {
+            LOG(0, "FAIL: %s: not a coordinator journal\n", filename);
+            fclose(fp);
+            return 1;
+        }
+        if (range != t->range) {
+            LOG(0, "FAIL: %s: journal is for a different scan\n", filename);
+            LOG(0, " [hint] it has %" PRIu64 " targets, not %" PRIu64 "\n",
+                range, t->range);
+            fclose(fp);
+            return 1;
+        }
+        if (chunk_size != t->chunk_size) {
+            /* not worth reshuffling, just use what we used before */
+            chunks_cleanup(t);
+            chunks_init(t, range, chunk_size);
+        }
+
+        while (fgets(line, sizeof(line), fp)) {
+            uint64_t id;
+
+            if (memcmp(line, "done", 4) != 0
+                || parse_number(line + 4, &id) == NULL || id >= t->count)
+                continue;
+            if (t->state[id] != Chunk_Done) {
+                t->state[id] = Chunk_Done;
+                t->done_count++;
+            }
+        }
+        fclose(fp);
+        LOG(0, "coordinator: resuming, %" PRIu64 " of %" PRIu64 " chunks done\n",
+            t->done_count, t->count);
+
+        err = fopen_s(&t->journal, filename, "at");
+    } else {
+        err = fopen_s(&t->journal, filename, "wt");
+        if (err == 0 && t->journal)
+            fprintf(t->journal, "masscan-coordinator %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+                    t->range, t->chunk_size, *seed);
+    }
+    if (err || t->journal == NULL) {
+        LOG(0, "FAIL: could not open coordinator journal\n");
+        perror(filename);
+        return 1;
+    }
+    fflush(t->journal);
+    return 0;
+}
+
+
+/***************************************************************************
+ * Create a socket for "<ip>:<port>" or "unix:<path>", either listening on
+ * it or connected to it.
+ ***************************************************************************/
+static SOCKET
+coord_socket(const char *address, int is_listen)
+{
+    SOCKET fd;
+    int err;
+
+    if (memcmp(address, "unix:", 5) == 0) {
+#if defined(WIN32)
+        LOG(0, "coordinator: unix sockets not supported on this platform\n");
+        return INVALID_SOCKET;
+#else
+        struct sockaddr_un sun;
+
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        if (strlen(address+5) >= sizeof(sun.sun_path)) {
+            LOG(0, "coordinator: %s: path too long\n", address+5);
+            return INVALID_SOCKET;
+        }
+        memcpy(sun.sun_path, address+5, strlen(address+5));
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == INVALID_SOCKET)
+            return INVALID_SOCKET;
+        if (is_listen) {
+            unlink(sun.sun_path);
+            err = bind(fd, (struct sockaddr*)&sun, sizeof(sun));
+        } else
+            err = connect(fd, (struct sockaddr*)&sun, sizeof(sun));
+#endif
+    } else {
+        struct sockaddr_in sin;
+        const char *colon = strrchr(address, ':');
+        char host[64] = "127.0.0.1";
+        unsigned port;
+
+        if (colon == NULL)
+            colon = address - 1;
+        else if (colon != address) {
+            if ((size_t)(colon - address) >= sizeof(host)) {
+                LOG(0, "coordinator: bad address: %s\n", address);
+                return INVALID_SOCKET;
+            }
+            memcpy(host, address, colon - address);
+            host[colon - address] = '\0';
+        }
+        port = (unsigned)strtoul(colon + 1, 0, 10);
+        if (port == 0 || port > 65535) {
+            LOG(0, "coordinator: bad port: %s\n", address);
+            return INVALID_SOCKET;
+        }
+
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons((unsigned short)port);
+        sin.sin_addr.s_addr = inet_addr(host);
+        if (sin.sin_addr.s_addr == INADDR_NONE) {
+            LOG(0, "coordinator: bad IP address: %s\n", host);
+            return INVALID_SOCKET;
+        }
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd == INVALID_SOCKET)
+            return INVALID_SOCKET;
+        if (is_listen) {
+            int yes = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char*)&yes, sizeof(yes));
+            err = bind(fd, (struct sockaddr*)&sin, sizeof(sin));
+        } else
+            err = connect(fd, (struct sockaddr*)&sin, sizeof(sin));
+    }
+
+    if (err == 0 && is_listen)
+        err = listen(fd, 16);
+    if (err != 0) {
+        LOG(0, "coordinator: %s: %s failed\n", address,
+            is_listen?"listen":"connect");
+        perror(address);
+        close_socket(fd);
+        return INVALID_SOCKET;
+    }
+    return fd;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static int
+send_line(SOCKET fd, const char *line)
+{
+    size_t length = strlen(line);
+    int flags = 0;
+#if defined(MSG_NOSIGNAL)
+    flags = MSG_NOSIGNAL;
+#endif
+    return send(fd, line, (int)length, flags) == (int)length ? 0 : -1;
+}
+
+
+/***************************************************************************
+ * The coordinator's side of a connection to a worker.
+ ***************************************************************************/
+struct Worker {
+    SOCKET fd;
+    size_t length;
+    char buf[256];
+};
+
+static int
+coordinator_command(struct ChunkTable *t, unsigned slot, const char *line,
+                    uint64_t seed, char *reply, size_t sizeof_reply)
+{
+    uint64_t now = pixie_gettime();
+    uint64_t n;
+
+    if (memcmp(line, "HELLO", 5) == 0) {
+        if (parse_number(line + 5, &n) == NULL || n != t->range) {
+            sprintf_s(reply, sizeof_reply,
+                      "ERR range mismatch, coordinator has %" PRIu64 "\n",
+                      t->range);
+            return -1;
+        }
+        sprintf_s(reply, sizeof_reply, "OK %" PRIu64 "\n", seed);
+    } else if (memcmp(line, "NEXT", 4) == 0) {
+        uint64_t begin;
+        uint64_t end;
+
+        switch (chunks_issue(t, slot, now, &n)) {
+        case 1:
+            chunks_bounds(t, n, &begin, &end);
+            sprintf_s(reply, sizeof_reply,
+                      "CHUNK %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+                      n, begin, end);
+            break;
+        case 0:
+            sprintf_s(reply, sizeof_reply, "WAIT 1\n");
+            break;
+        default:
+            sprintf_s(reply, sizeof_reply, "DONE\n");
+            break;
+        }
+    } else if (memcmp(line, "COMPLETE", 8) == 0) {
+        if (parse_number(line + 8, &n) == NULL) {
+            sprintf_s(reply, sizeof_reply, "ERR bad chunk\n");
+            return -1;
+        }
+        chunks_complete(t, slot, n, now);
+        sprintf_s(reply, sizeof_reply, "OK\n");
+    } else {
+        sprintf_s(reply, sizeof_reply, "ERR unknown command\n");
+        return -1;
+    }
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+main_coordinator(struct Masscan *masscan)
+{
+    struct ChunkTable t[1];
+    struct Worker workers[MAX_WORKERS];
+    uint64_t range;
+    uint64_t chunk_size;
+    uint64_t seed = masscan->seed;
+    unsigned worker_count = 0;
+    time_t last_status = 0;
+    SOCKET fd;
+    unsigned i;
+
+    range = rangelist_count(&masscan->targets) * rangelist_count(&masscan->ports)
+            + range6list_count(&masscan->targets_ipv6) * rangelist_count(&masscan->ports);
+    if (range == 0) {
+        LOG(0, "FAIL: coordinator: no targets or ports\n");
+        LOG(0, " [hint] give it the same targets and ports as the workers\n");
+        return 1;
+    }
+
+    /* By default, each chunk is about 10 seconds of work at --rate */
+    chunk_size = masscan->coord.chunk_size;
+    if (chunk_size == 0)
+        chunk_size = (uint64_t)(masscan->max_rate * 10.0);
+    chunks_init(t, range, chunk_size);
+
+    if (masscan->coord.journal[0]) {
+        if (chunks_journal(t, masscan->coord.journal, &seed) != 0) {
+            chunks_cleanup(t);
+            return 1;
+        }
+    }
+
+    fd = coord_socket(masscan->coord.address, 1);
+    if (fd == INVALID_SOCKET) {
+        chunks_cleanup(t);
+        return 1;
+    }
+    for (i=0; i<MAX_WORKERS; i++)
+        workers[i].fd = INVALID_SOCKET;
+
+    LOG(0, "coordinator: listening on %s, %" PRIu64 " chunks of %" PRIu64
+        ", seed=%" PRIu64 "\n",
+        masscan->coord.address, t->count, t->chunk_size, seed);
+
+    while (t->done_count < t->count || worker_count) {
+        fd_set readset;
+        struct timeval tv;
+        SOCKET nfds = fd;
+        int x;
+
+        FD_ZERO(&readset);
+        FD_SET(fd, &readset);
+        for (i=0; i<MAX_WORKERS; i++) {
+            if (workers[i].fd == INVALID_SOCKET)
+                continue;
+            FD_SET(workers[i].fd, &readset);
+            if (nfds < workers[i].fd)
+                nfds = workers[i].fd;
+        }
+        tv.tv_sec = 1;
+        tv.tv_usec = 0;
+        x = select((int)nfds + 1, &readset, 0, 0, &tv);
+        if (x < 0)
+            break;
+
+        if (time(0) - last_status >= 10) {
+            last_status = time(0);
+            LOG(0, "coordinator: %" PRIu64 "/%" PRIu64 " chunks done, %u workers\n",
+                t->done_count, t->count, worker_count);
+        }
+
+        /* new workers */
+        if (FD_ISSET(fd, &readset)) {
+            SOCKET fd2 = accept(fd, 0, 0);
+
+            for (i=0; i<MAX_WORKERS && fd2 != INVALID_SOCKET; i++) {
+                if (workers[i].fd == INVALID_SOCKET) {
+                    workers[i].fd = fd2;
+                    workers[i].length = 0;
+                    worker_count++;
+                    break;
+                }
+            }
+            if (i == MAX_WORKERS && fd2 != INVALID_SOCKET)
+                close_socket(fd2);
+        }
+
+        /* commands from existing workers */
+        for (i=0; i<MAX_WORKERS; i++) {
+            struct Worker *w = &workers[i];
+            char *eol;
+            int bytes;
+
+            if (w->fd == INVALID_SOCKET || !FD_ISSET(w->fd, &readset))
+                continue;
+
+            bytes = recv(w->fd, w->buf + w->length,
+                         (int)(sizeof(w->buf) - 1 - w->length), 0);
+            if (bytes <= 0)
+                goto disconnect;
+            w->length += bytes;
+            w->buf[w->length] = '\0';
+
+            while ((eol = strchr(w->buf, '\n')) != NULL) {
+                char reply[128];
+                int err;
+
+                *eol = '\0';
+                err = coordinator_command(t, i, w->buf, seed,
+                                          reply, sizeof(reply));
+                if (send_line(w->fd, reply) != 0 || err)
+                    goto disconnect;
+                w->length -= (eol + 1 - w->buf);
+                memmove(w->buf, eol + 1, w->length + 1);
+            }
+            if (w->length >= sizeof(w->buf) - 1)
+                goto disconnect;
+            continue;
+
+        disconnect:
+            chunks_release(t, i);
+            close_socket(w->fd);
+            w->fd = INVALID_SOCKET;
+            worker_count--;
+        }
+    }
+
+    LOG(0, "coordinator: %" PRIu64 "/%" PRIu64 " chunks done\n",
+        t->done_count, t->count);
+    close_socket(fd);
+    chunks_cleanup(t);
+    return 0;
+}
+
+
+/***************************************************************************
+ * The worker's side
+ ***************************************************************************/
+struct CoordClient {
+    SOCKET fd;
+    uint64_t chunk;
+    unsigned is_holding:1;
+    size_t length;
+    char buf[256];
+};
+
+/***************************************************************************
+ * Send a command and wait for the line that comes back.
+ ***************************************************************************/
+static int
+client_request(struct CoordClient *client, const char *command,
+               char *reply, size_t sizeof_reply)
+{
+    if (send_line(client->fd, command) != 0)
+        return -1;
+
+    for (;;) {
+        char *eol = memchr(client->buf, '\n', client->length);
+        int bytes;
+
+        if (eol) {
+            size_t n = eol + 1 - client->buf;
+            if (n > sizeof_reply)
+                return -1;
+            memcpy(reply, client->buf, n - 1);
+            reply[n - 1] = '\0';
+            client->length -= n;
+            memmove(client->buf, eol + 1, client->length);
+            return 0;
+        }
+        if (client->length >= sizeof(client->buf))
+            return -1;
+        bytes = recv(client->fd, client->buf + client->length,
+                     (int)(sizeof(client->buf) - client->length), 0);
+        if (bytes <= 0)
+            return -1;
+        client->length += bytes;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct CoordClient *
+coord_connect(const char *address, uint64_t range, uint64_t *seed)
+{
+    struct CoordClient *client;
+    char command[64];
+    char reply[256] = "no reply";
+
+    client = (struct CoordClient *)malloc(sizeof(*client));
+    if (client == NULL)
+        exit(1);
+    memset(client, 0, sizeof(*client));
+
+    client->fd = coord_socket(address, 0);
+    if (client->fd == INVALID_SOCKET) {
+        free(client);
+        return NULL;
+    }
+
+    sprintf_s(command, sizeof(command), "HELLO %" PRIu64 "\n", range);
+    if (client_request(client, command, reply, sizeof(reply)) != 0
+        || memcmp(reply, "OK", 2) != 0
+        || parse_number(reply + 2, seed) == NULL) {
+        LOG(0, "FAIL: coordinator: %s\n", reply);
+        LOG(0, " [hint] workers need the same targets and ports as the coordinator\n");
+        coord_close(client);
+        return NULL;
+    }
+    return client;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+coord_next_chunk(struct CoordClient *client, uint64_t *begin, uint64_t *end)
+{
+    while (!is_tx_done) {
+        char reply[256];
+
+        if (client_request(client, "NEXT\n", reply, sizeof(reply)) != 0) {
+            LOG(0, "coordinator: lost connection\n");
+            return 0;
+        }
+
+        if (memcmp(reply, "CHUNK", 5) == 0) {
+            const char *p = reply + 5;
+            if ((p = parse_number(p, &client->chunk)) == NULL
+                || (p = parse_number(p, begin)) == NULL
+                || (p = parse_number(p, end)) == NULL
+                || *end <= *begin) {
+                LOG(0, "coordinator: bad reply: %s\n", reply);
+                return 0;
+            }
+            client->is_holding = 1;
+            LOG(2, "coordinator: chunk %" PRIu64 " [%" PRIu64 "..%" PRIu64 ")\n",
+                client->chunk, *begin, *end);
+            return 1;
+        } else if (memcmp(reply, "WAIT", 4) == 0) {
+            /* other workers are finishing the last chunks */
+            unsigned i;
+            for (i=0; i<10 && !is_tx_done; i++)
+                pixie_mssleep(100);
+        } else {
+            if (memcmp(reply, "DONE", 4) != 0)
+                LOG(0, "coordinator: %s\n", reply);
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+coord_chunk_done(struct CoordClient *client)
+{
+    char command[64];
+    char reply[256];
+
+    if (!client->is_holding)
+        return;
+    client->is_holding = 0;
+
+    sprintf_s(command, sizeof(command), "COMPLETE %" PRIu64 "\n", client->chunk);
+    if (client_request(client, command, reply, sizeof(reply)) != 0)
+        LOG(0, "coordinator: lost connection\n");
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+coord_close(struct CoordClient *client)
+{
+    if (client == NULL)
+        return;
+    close_socket(client->fd);
+    free(client);
+}
+
+
+/***************************************************************************
+ * Tests the bookkeeping, without sockets.
+ ***************************************************************************/
+int
+coord_selftest(void)
+{
+    struct ChunkTable t[1];
+    uint64_t id;
+    uint64_t begin;
+    uint64_t end;
+    uint64_t seed = 0;
+    char reply[128];
+
+    chunks_init(t, 1000, 300);
+    if (t->count != 4)
+        goto fail;
+    chunks_bounds(t, 3, &begin, &end);
+    if (begin != 900 || end != 1000)
+        goto fail;
+
+    /* two workers take the first two chunks */
+    if (chunks_issue(t, 0, 0, &id) != 1 || id != 0)
+        goto fail;
+    if (chunks_issue(t, 1, 0, &id) != 1 || id != 1)
+        goto fail;
+
+    /* worker #0 dies, so its chunk is the next one issued */
+    chunks_release(t, 0);
+    if (chunks_issue(t, 2, 0, &id) != 1 || id != 0)
+        goto fail;
+
+    /* worker #2 finishes and gets a new chunk in one request */
+    chunks_complete(t, 2, 0, 1000000);
+    if (chunks_issue(t, 2, 1000000, &id) != 1 || id != 2)
+        goto fail;
+    chunks_complete(t, 2, 2, 2000000);
+    if (chunks_issue(t, 2, 2000000, &id) != 1 || id != 3)
+        goto fail;
+    chunks_complete(t, 2, 3, 3000000);
+
+    /* only worker #1's chunk is left. It's not slow yet... */
+    if (chunks_issue(t, 2, 2500000, &id) != 0)
+        goto fail;
+    /* ...but it is now, so worker #2 does it too and finishes first */
+    if (chunks_issue(t, 2, 5000000, &id) != 1 || id != 1)
+        goto fail;
+    chunks_complete(t, 2, 1, 5500000);
+    if (chunks_issue(t, 2, 5500000, &id) != -1)
+        goto fail;
+    chunks_complete(t, 1, 1, 6000000);
+    if (t->done_count != 4)
+        goto fail;
+
+    /* the text protocol */
+    if (coordinator_command(t, 0, "HELLO 999", 7, reply, sizeof(reply)) == 0)
+        goto fail;
+    if (coordinator_command(t, 0, "HELLO 1000", 7, reply, sizeof(reply)) != 0
+        || strcmp(reply, "OK 7\n") != 0)
+        goto fail;
+    if (coordinator_command(t, 0, "NEXT", 7, reply, sizeof(reply)) != 0
+        || strcmp(reply, "DONE\n") != 0)
+        goto fail;
+    chunks_cleanup(t);
+
+    chunks_init(t, 1000, 300);
+    if (coordinator_command(t, 0, "NEXT", 7, reply, sizeof(reply)) != 0
+        || strcmp(reply, "CHUNK 0 0 300\n") != 0)
+        goto fail;
+    if (parse_number(" 12 x", &seed) == NULL || seed != 12)
+        goto fail;
+    chunks_cleanup(t);
+    return 0;
+
+fail:
+    fprintf(stderr, "coordinator: selftest failed\n");
+    chunks_cleanup(t);
+    return 1;
+}
@@ -0,0 +1,73 @@
+/*
+    Dynamic sharding
+
+    Instead of splitting a scan ahead of time with "--shard 1/3", each
+    machine runs with "--worker <address>" and asks a coordinator, which
+    is just masscan run with "--coordinator <address>", for the next
+    chunk of the scan whenever it finishes one. That way fast machines do
+    more of the work, and if one dies, its chunk is handed to another.
+*/
+#ifndef MAIN_COORD_H
+#define MAIN_COORD_H
+#include <stdint.h>
+struct Masscan;
+
+/**
+ * Run as the coordinator, for "--coordinator <address>", instead of
+ * scanning. This returns once every chunk of the scan has been done
+ * and the workers have disconnected.
+ * @param masscan
+ *      The same targets and ports the workers were given, which is how
+ *      the size of the scan is calculated. If --coordinator-journal is
+ *      set, chunks are recorded there as they are completed, so the
+ *      coordinator can be restarted where it left off.
+ * @return
+ *      0 on success, 1 on failure
+ */
+int
+main_coordinator(struct Masscan *masscan);
+
+
+/**
+ * A transmit thread's connection to the coordinator.
+ */
+struct CoordClient;
+
+/**
+ * Connect to the coordinator at "<ip>:<port>" or "unix:<path>".
+ * @param range
+ *      The number of targets times the number of ports, which has to be
+ *      the same as the coordinator's, or it'll refuse us.
+ * @param seed
+ *      Filled in with the coordinator's --seed, which every worker has
+ *      to use so that they all shuffle the targets the same way.
+ * @return
+ *      a connection, or NULL on failure
+ */
+struct CoordClient *
+coord_connect(const char *address, uint64_t range, uint64_t *seed);
+
+/**
+ * Get the next chunk [begin,end) of the index that the transmit thread
+ * shuffles. This waits while other workers finish the last chunks, in
+ * case they die and their chunks need to be done again.
+ * @return
+ *      1 if we got a chunk, 0 if the scan is done (or we lost the
+ *      coordinator, or the user hit <ctrl-c>)
+ */
+int
+coord_next_chunk(struct CoordClient *client, uint64_t *begin, uint64_t *end);
+
+/**
+ * Tell the coordinator we finished the chunk we were last given.
+ */
+void
+coord_chunk_done(struct CoordClient *client);
+
+void
+coord_close(struct CoordClient *client);
+
+int
+coord_selftest(void);
+
+#endif
@@ -22,9 +22,16 @@ struct DedupEntry
     unsigned ip_me;
     unsigned port_me;
 };
+struct DedupEntry6
+{
+    ipv6address ip_them;
+    unsigned port_them;
+    unsigned port_me;
+};
 struct DedupTable
 {
     struct DedupEntry entries[DEDUP_ENTRIES][4];
+    struct DedupEntry6 (*entries6)[4];
 };
 
 /***************************************************************************
@@ -47,8 +54,10 @@ dedup_create(void)
 void
 dedup_destroy(struct DedupTable *table)
 {
-    if (table)
+    if (table) {
+        free(table->entries6);
         free(table);
+    }
 }
 
 /***************************************************************************
@@ -104,3 +113,50 @@ dedup_is_duplicate(struct DedupTable *dedup,
 
     return 0;
 }
+
+/***************************************************************************
+ ***************************************************************************/
+unsigned
+dedup_is_duplicate_ipv6(struct DedupTable *dedup,
+                        ipv6address ip_them, unsigned port_them,
+                        unsigned port_me)
+{
+    unsigned hash;
+    struct DedupEntry6 *bucket;
+    struct DedupEntry6 tmp;
+    unsigned i;
+
+    if (dedup->entries6 == NULL) {
+        dedup->entries6 = calloc(DEDUP_ENTRIES, sizeof(dedup->entries6[0]));
+        if (dedup->entries6 == NULL)
+            exit(1);
+    }
+
+    hash = (unsigned)(ip_them.lo ^ (ip_them.lo >> 32) ^ (ip_them.hi >> 16));
+    hash ^= port_them ^ (port_me << 8);
+    hash &= DEDUP_ENTRIES-1;
+
+    bucket = dedup->entries6[hash];
+
+    for (i = 0; i < 4; i++) {
+        if (bucket[i].ip_them.lo == ip_them.lo
+            && bucket[i].ip_them.hi == ip_them.hi
+            && bucket[i].port_them == port_them
+            && bucket[i].port_me == port_me) {
+            /* move to front of list so constant repeats get ignored */
+            if (i > 0) {
+                tmp = bucket[i];
+                bucket[i] = bucket[0];
+                bucket[0] = tmp;
+            }
+            return 1;
+        }
+    }
+
+    memmove(bucket+1, bucket, 3*sizeof(*bucket));
+    bucket[0].ip_them = ip_them;
+    bucket[0].port_them = port_them;
+    bucket[0].port_me = port_me;
+
+    return 0;
+}
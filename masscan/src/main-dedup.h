@@ -1,5 +1,6 @@
 #ifndef MAIN_DEDUP_H
 #define MAIN_DEDUP_H
+#include "ranges6.h"
 
 struct DedupTable *
 dedup_create(void);
@@ -12,5 +13,15 @@ dedup_is_duplicate(         struct DedupTable *dedup,
                             unsigned ip_them, unsigned port_them,
                             unsigned ip_me, unsigned port_me);
 
+/**
+ * The same for IPv6 responses, which are kept in a table of their own,
+ * allocated the first time it's needed. There's only ever the one source
+ * address, so that isn't part of the key.
+ */
+unsigned
+dedup_is_duplicate_ipv6(    struct DedupTable *dedup,
+                            ipv6address ip_them, unsigned port_them,
+                            unsigned port_me);
+
 
 #endif
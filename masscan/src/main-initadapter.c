@@ -76,7 +76,7 @@ masscan_initialize_adapter(
         masscan->nic[index].src.ip.last = adapter_ip;
         masscan->nic[index].src.ip.range = 1;
     }
-    if (adapter_ip == 0) {
+    if (adapter_ip == 0 && masscan->targets.count) {
         fprintf(stderr, "FAIL: failed to detect IP of interface \"%s\"\n",
                         ifname);
         fprintf(stderr, " [hint] did you spell the name correctly?\n");
@@ -85,6 +85,31 @@ masscan_initialize_adapter(
         return -1;
     }
 
+    /*
+     * IPv6 ADDRESS
+     *
+     * Only needed when there are IPv6 targets, in which case it's the
+     * adapter's global address, unless configured by the user.
+     */
+    if (masscan->targets_ipv6.count || masscan->targets_ipv6.host_count) {
+        ipv6address *ipv6 = &masscan->nic[index].src.ipv6;
+
+        if (ipv6->hi == 0 && ipv6->lo == 0) {
+            char buf[64];
+
+            if (rawsock_get_adapter_ipv6(ifname, ipv6) != 0) {
+                fprintf(stderr, "FAIL: failed to detect IPv6 address of "
+                                "interface \"%s\"\n", ifname);
+                fprintf(stderr, " [hint] if it has no global IPv6 address, "
+                                "manually set with "
+                                "\"--adapter-ip 2001:db8::5\"\n");
+                return -1;
+            }
+            LOG(2, "auto-detected: adapter-ip=%s\n",
+                ipv6address_fmt(buf, sizeof(buf), *ipv6));
+        }
+    }
+
     /*
      * MAC ADDRESS
      *
@@ -1,11 +1,13 @@
 #include "masscan.h"
 #include "logger.h"
 #include "rand-blackrock.h"
+#include "templ-port.h"
 
 void
 main_listscan(struct Masscan *masscan)
 {
     uint64_t count_ips;
+    uint64_t count_ips6;
     uint64_t count_ports;
     uint64_t i;
     uint64_t range;
@@ -21,7 +23,8 @@ main_listscan(struct Masscan *masscan)
     count_ports = rangelist_count(&masscan->ports);
 
     count_ips = rangelist_count(&masscan->targets);
-    if (count_ips == 0) {
+    count_ips6 = range6list_count(&masscan->targets_ipv6);
+    if (count_ips == 0 && count_ips6 == 0) {
         LOG(0, "FAIL: target IP address list empty\n");
         LOG(0, " [hint] try something like \"--range 10.0.0.0/8\"\n");
         LOG(0, " [hint] try something like \"--range 192.168.0.100-192.168.0.200\"\n");
@@ -29,6 +32,22 @@ main_listscan(struct Masscan *masscan)
     }
 
     range = count_ips * count_ports;
+    if (count_ips6) {
+        /* same checks as main_scan(): IPv6 targets are TCP only, and a
+         * saturated count means the range was too big to number */
+        for (i=0; i<masscan->ports.count; i++) {
+            if (masscan->ports.list[i].end > Templ_TCP + 65535) {
+                LOG(0, "FAIL: only TCP ports can be scanned on IPv6 targets\n");
+                return;
+            }
+        }
+        if (count_ips6 == UINT64_MAX
+                || count_ips6 > (UINT64_MAX - range) / count_ports) {
+            LOG(0, "FAIL: IPv6 target range too big\n");
+            return;
+        }
+        range += count_ips6 * count_ports;
+    }
 
 infinite:
     blackrock_init(&blackrock, range, seed, masscan->blackrock_rounds);
@@ -47,6 +66,23 @@ infinite:
 
         xXx = blackrock_shuffle(&blackrock,  i);
 
+        /* IPv6 targets are numbered after the IPv4 ones */
+        if (xXx >= count_ips * count_ports) {
+            char buf[64];
+            uint64_t index6 = xXx - count_ips * count_ports;
+            ipv6address ip6;
+
+            ip6 = range6list_pick(&masscan->targets_ipv6, index6 % count_ips6);
+            port = rangelist_pick(&masscan->ports, index6 / count_ips6);
+            ipv6address_fmt(buf, sizeof(buf), ip6);
+            if (count_ports == 1)
+                printf("%s\n", buf);
+            else
+                printf("[%s]:%u\n", buf, port);
+            i += increment;
+            continue;
+        }
+
         ip = rangelist_pick(&masscan->targets, xXx % count_ips);
         port = rangelist_pick(&masscan->ports, xXx / count_ips);
 
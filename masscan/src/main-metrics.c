@@ -0,0 +1,425 @@
+/*
+    Per-thread counters and latency histograms
+
+    See main-metrics.h. The histograms are the idea behind "HdrHistogram",
+    cut down to the minimum: a fixed number of log-linear buckets, no
+    auto-resizing, no serialization, and percentiles computed by walking
+    the buckets when they're exported about once a second.
+*/
+#include "main-metrics.h"
+#include "pixie-timer.h"
+#include "pixie-sockets.h"
+#include "logger.h"
+#include "string_s.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(WIN32)
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+const char *metric_stage_names[] = {
+    "setup", "recv", "timeouts", "parse", "dispatch", "tcp", "report",
+    "teardown", "throttle", "flush", "send", 0
+};
+
+struct MetricsExport {
+    FILE *fp;
+    SOCKET fd;
+    unsigned is_socket:1;
+    unsigned interval;
+    time_t next;
+    time_t started;
+};
+
+
+/***************************************************************************
+ * Values 0..7 get their own bucket. Above that, the top bit picks the
+ * group of 8 buckets, and the next 3 bits the bucket within the group.
+ ***************************************************************************/
+static unsigned
+histogram_index(uint64_t value)
+{
+    unsigned msb = 0;
+
+    if (value < 8)
+        return (unsigned)value;
+
+#if defined(__GNUC__)
+    msb = 63 - __builtin_clzll(value);
+#else
+    {
+        uint64_t x = value;
+        while (x >>= 1)
+            msb++;
+    }
+#endif
+    return (msb - 2) * 8 + (unsigned)((value >> (msb - 3)) & 7);
+}
+
+/* The middle of the range of values that go in a bucket */
+static uint64_t
+histogram_value(unsigned index)
+{
+    unsigned msb;
+    uint64_t low;
+
+    if (index < 8)
+        return index;
+    msb = index/8 + 2;
+    low = (uint64_t)(8 + index%8) << (msb - 3);
+    return low + ((1ULL << (msb - 3)) >> 1);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+histogram_record(struct Histogram *h, uint64_t value)
+{
+    h->buckets[histogram_index(value)]++;
+    h->count++;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+uint64_t
+histogram_percentile(const struct Histogram *h, const struct Histogram *prev,
+                     double fraction)
+{
+    uint64_t count = h->count - (prev?prev->count:0);
+    uint64_t target;
+    uint64_t seen = 0;
+    unsigned i;
+
+    if (count == 0)
+        return 0;
+    target = (uint64_t)(count * fraction);
+    if (target >= count)
+        target = count - 1;
+
+    for (i=0; i<HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i] - (prev?prev->buckets[i]:0);
+        if (seen > target)
+            return histogram_value(i);
+    }
+
+    /* the count got ahead of the buckets, since the thread that's writing
+     * them isn't synchronized with us */
+    for (i=HISTOGRAM_BUCKETS; i>0; i--) {
+        if (h->buckets[i-1] != (prev?prev->buckets[i-1]:0))
+            return histogram_value(i-1);
+    }
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+stage_start(struct StageTimer *timer, unsigned stage)
+{
+    timer->last = pixie_nanotime();
+    timer->stage = stage;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+stage_lap(struct StageTimer *timer, unsigned next)
+{
+    uint64_t now = pixie_nanotime();
+    uint64_t elapsed = now - timer->last;
+
+    timer->ns[timer->stage] += elapsed;
+    if (timer->hist && timer->stage < Stage_Done)
+        histogram_record(&timer->hist[timer->stage], elapsed);
+    timer->last = now;
+    timer->stage = next;
+}
+
+
+/***************************************************************************
+ ***************************************************************************/
+struct ThreadMetrics *
+metrics_create(unsigned is_timing)
+{
+    struct ThreadMetrics *metrics;
+
+    metrics = (struct ThreadMetrics *)malloc(sizeof(*metrics));
+    if (metrics == NULL)
+        exit(1);
+    memset(metrics, 0, sizeof(*metrics));
+
+    metrics->is_timing = (is_timing != 0);
+    metrics->tx.hist = metrics->hist;
+    metrics->tx.stage = Stage_Done;
+    metrics->rx.hist = metrics->hist;
+    metrics->rx.stage = Stage_Done;
+    return metrics;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+metrics_destroy(struct ThreadMetrics *metrics)
+{
+    free(metrics);
+}
+
+
+/***************************************************************************
+ ***************************************************************************/
+struct MetricsExport *
+metrics_export_create(const char *name, unsigned interval)
+{
+    struct MetricsExport *x;
+
+    x = (struct MetricsExport *)malloc(sizeof(*x));
+    if (x == NULL)
+        exit(1);
+    memset(x, 0, sizeof(*x));
+    x->interval = interval?interval:1;
+    x->started = time(0);
+
+    if (memcmp(name, "unix:", 5) == 0) {
+#if defined(WIN32)
+        LOG(0, "metrics: unix sockets not supported on this platform\n");
+        free(x);
+        return NULL;
+#else
+        struct sockaddr_un sun;
+
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        if (strlen(name+5) >= sizeof(sun.sun_path)) {
+            LOG(0, "metrics: %s: path too long\n", name+5);
+            free(x);
+            return NULL;
+        }
+        memcpy(sun.sun_path, name+5, strlen(name+5));
+
+        x->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (x->fd < 0 || connect(x->fd, (struct sockaddr*)&sun, sizeof(sun)) != 0) {
+            LOG(0, "metrics: %s: connect() failed\n", name+5);
+            perror(name+5);
+            if (x->fd >= 0)
+                close(x->fd);
+            free(x);
+            return NULL;
+        }
+        x->is_socket = 1;
+#endif
+    } else if (strcmp(name, "-") == 0) {
+        x->fp = stdout;
+    } else {
+        int err;
+
+        err = fopen_s(&x->fp, name, "wt");
+        if (err || x->fp == NULL) {
+            LOG(0, "metrics: could not open file\n");
+            perror(name);
+            free(x);
+            return NULL;
+        }
+    }
+    return x;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+metrics_export_destroy(struct MetricsExport *x)
+{
+    if (x == NULL)
+        return;
+#if !defined(WIN32)
+    if (x->is_socket)
+        close(x->fd);
+#endif
+    if (x->fp && x->fp != stdout)
+        fclose(x->fp);
+    else if (x->fp)
+        fflush(x->fp);
+    free(x);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+metrics_export_is_due(struct MetricsExport *x, time_t now)
+{
+    if (x == NULL || now < x->next)
+        return 0;
+    x->next = now + x->interval;
+    return 1;
+}
+
+
+/***************************************************************************
+ ***************************************************************************/
+struct Line {
+    char buf[4096];
+    size_t length;
+};
+
+static void
+line_append(struct Line *line, const char *fmt, ...)
+{
+    va_list marker;
+    int x;
+
+    if (line->length >= sizeof(line->buf))
+        return;
+    va_start(marker, fmt);
+    x = vsnprintf(line->buf + line->length, sizeof(line->buf) - line->length,
+                  fmt, marker);
+    va_end(marker);
+    if (x > 0)
+        line->length += x;
+    if (line->length > sizeof(line->buf) - 1)
+        line->length = sizeof(line->buf) - 1;
+}
+
+static void
+line_append_stages(struct Line *line, const char *name,
+                   struct ThreadMetrics *metrics,
+                   unsigned first, unsigned last)
+{
+    unsigned i;
+    int is_first = 1;
+
+    line_append(line, ",\"%s\":{", name);
+    for (i=first; i<=last; i++) {
+        const struct Histogram *h = &metrics->hist[i];
+        const struct Histogram *prev = &metrics->exported[i];
+
+        line_append(line, "%s\"%s\":{\"count\":%" PRIu64 ",\"p50\":%" PRIu64
+                    ",\"p90\":%" PRIu64 ",\"p99\":%" PRIu64
+                    ",\"p999\":%" PRIu64 ",\"max\":%" PRIu64 "}",
+                    is_first?"":",",
+                    metric_stage_names[i],
+                    h->count - prev->count,
+                    histogram_percentile(h, prev, 0.50),
+                    histogram_percentile(h, prev, 0.90),
+                    histogram_percentile(h, prev, 0.99),
+                    histogram_percentile(h, prev, 0.999),
+                    histogram_percentile(h, prev, 1.0));
+        is_first = 0;
+    }
+    line_append(line, "}");
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+metrics_export_thread(struct MetricsExport *x, time_t now, unsigned thread,
+                      struct ThreadMetrics *metrics,
+                      const struct MetricsSample *sample)
+{
+    struct Line line;
+
+    if (x == NULL || (!x->is_socket && x->fp == NULL))
+        return;
+
+    line.length = 0;
+    line_append(&line, "{\"time\":%u,\"elapsed\":%u,\"thread\":%u",
+                (unsigned)now, (unsigned)(now - x->started), thread);
+    line_append(&line, ",\"tx\":{\"probes\":%" PRIu64 ",\"rate\":%.0f"
+                ",\"responses\":%" PRIu64 ",\"batches\":%" PRIu64
+                ",\"throttle_sleeps\":%" PRIu64 ",\"throttle_usecs\":%" PRIu64,
+                sample->probes, sample->rate,
+                metrics->tx_responses, metrics->tx_batches,
+                sample->throttle_sleeps, sample->throttle_usecs);
+    line_append_stages(&line, "ns", metrics, Stage_Throttle, Stage_Send);
+    line_append(&line, "}");
+
+    line_append(&line, ",\"ring\":{\"free\":%u,\"queued\":%u"
+                ",\"waits\":%" PRIu64 "}",
+                sample->packet_buffers, sample->transmit_queue,
+                metrics->buffer_waits);
+
+    line_append(&line, ",\"rx\":{\"packets\":%" PRIu64 ",\"bytes\":%" PRIu64
+                ",\"nic_received\":%" PRIu64 ",\"nic_dropped\":%" PRIu64
+                ",\"nic_ifdropped\":%" PRIu64,
+                metrics->rx_packets, metrics->rx_bytes,
+                metrics->nic_received, metrics->nic_dropped,
+                metrics->nic_ifdropped);
+    line_append(&line, ",\"tcb_active\":%" PRIu64 ",\"tcb_buckets\":%" PRIu64
+                ",\"tcb_allocations\":%" PRIu64 ",\"output_bytes\":%" PRIu64,
+                metrics->tcb_active, metrics->tcb_buckets,
+                metrics->tcb_allocations, metrics->output_bytes);
+    line_append_stages(&line, "ns", metrics, Stage_Timeouts, Stage_Report);
+    line_append(&line, "}}\n");
+
+    memcpy(metrics->exported, metrics->hist, sizeof(metrics->exported));
+
+    if (x->is_socket) {
+#if !defined(WIN32)
+        int flags = 0;
+#if defined(MSG_NOSIGNAL)
+        flags = MSG_NOSIGNAL;
+#endif
+        if (send(x->fd, line.buf, line.length, flags) != (ssize_t)line.length) {
+            LOG(0, "metrics: send() failed, no more metrics will be sent\n");
+            close(x->fd);
+            x->is_socket = 0;
+            x->next = (time_t)0x7FFFFFFF;
+        }
+#endif
+    } else {
+        fwrite(line.buf, 1, line.length, x->fp);
+        fflush(x->fp);
+    }
+}
+
+
+/***************************************************************************
+ ***************************************************************************/
+int
+metrics_selftest(void)
+{
+    struct Histogram h;
+    struct Histogram prev;
+    uint64_t x;
+    unsigned i;
+
+    /* every bucket's value must fall back into the same bucket, and the
+     * buckets must be in order */
+    if (histogram_index(~0ULL) >= HISTOGRAM_BUCKETS)
+        goto fail;
+    for (i=0; i<=histogram_index(~0ULL); i++) {
+        if (histogram_index(histogram_value(i)) != i)
+            goto fail;
+        if (i && histogram_value(i) <= histogram_value(i-1))
+            goto fail;
+    }
+
+    /* 1..1000, so the percentiles should be within 12.5% */
+    memset(&h, 0, sizeof(h));
+    for (i=1; i<=1000; i++)
+        histogram_record(&h, i);
+    x = histogram_percentile(&h, NULL, 0.50);
+    if (x < 500*7/8 || x > 500*9/8)
+        goto fail;
+    x = histogram_percentile(&h, NULL, 0.99);
+    if (x < 990*7/8 || x > 990*9/8)
+        goto fail;
+
+    /* only what's been added since 'prev' */
+    memcpy(&prev, &h, sizeof(prev));
+    for (i=0; i<100; i++)
+        histogram_record(&h, 1000000);
+    x = histogram_percentile(&h, &prev, 0.50);
+    if (x < 1000000*7/8 || x > 1000000*9/8)
+        goto fail;
+    if (histogram_percentile(&prev, &prev, 0.5) != 0)
+        goto fail;
+
+    return 0;
+fail:
+    fprintf(stderr, "metrics: selftest failed\n");
+    return 1;
+}
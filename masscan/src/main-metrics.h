@@ -0,0 +1,163 @@
+/*
+    Per-thread counters and latency histograms
+
+    These are for figuring out which part of a scan is the bottleneck:
+    the transmit loop, running out of packet buffers, parsing responses,
+    or writing output. The threads only ever write to their own counters,
+    so no locking is needed, and the status thread reads them and writes
+    them out periodically as NDJSON (--metrics <filename>).
+*/
+#ifndef MAIN_METRICS_H
+#define MAIN_METRICS_H
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * The stages of the transmit and receive threads that we time.
+ */
+enum MetricStage {
+    Stage_Setup,        /* creating the output, dedup and TCB tables */
+    Stage_Recv,         /* reading the frame, recycling packet buffers */
+    Stage_Timeouts,     /* TCP timeouts, driven by packet timestamps */
+    Stage_Parse,        /* preprocess_frame() and the syn-cookie */
+    Stage_Dispatch,     /* address checks, ARP/UDP/ICMP/SCTP handlers */
+    Stage_Tcp,          /* TCB lookup, tcpcon_handle() and banner parsers */
+    Stage_Report,       /* dedup and output_report_status() */
+    Stage_Teardown,     /* destroying TCBs, which flushes their banners */
+    Stage_Throttle,     /* waiting for the --rate limit */
+    Stage_Flush,        /* sending what the receive thread queued */
+    Stage_Send,         /* formatting and sending a batch of probes */
+    Stage_Done
+};
+extern const char *metric_stage_names[];
+
+/**
+ * An HDR-style histogram: buckets are spaced logarithmically, with 8
+ * linear sub-buckets for each power of two, so that values are recorded
+ * within 12.5% across the entire 64-bit range with a fixed 4k of memory.
+ */
+#define HISTOGRAM_BUCKETS 512
+struct Histogram {
+    uint64_t count;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+void
+histogram_record(struct Histogram *h, uint64_t value);
+
+/**
+ * The value below which 'fraction' (like 0.99) of the values recorded
+ * between 'prev' and 'h' fall. The 'prev' is an earlier copy of the same
+ * histogram, which lets us report just what happened in the last period
+ * without the writing thread ever having to reset anything. It can be
+ * NULL for everything that's been recorded.
+ */
+uint64_t
+histogram_percentile(const struct Histogram *h, const struct Histogram *prev,
+                     double fraction);
+
+/**
+ * Times the stages of a thread. Each 'stage_lap()' charges the time since
+ * the previous one to whatever stage was running, so a packet that's
+ * dropped early (with 'continue') only gets charged for the stages it
+ * went through.
+ */
+struct StageTimer {
+    uint64_t ns[Stage_Done + 1];
+    uint64_t last;
+    unsigned stage;
+    struct Histogram *hist; /* per stage, or NULL */
+};
+
+void
+stage_start(struct StageTimer *timer, unsigned stage);
+
+void
+stage_lap(struct StageTimer *timer, unsigned next);
+
+#define STAGE_LAP(timer, next) do { if (timer) stage_lap(timer, next); } while (0)
+
+/**
+ * Everything we count for a transmit/receive thread pair. Counters only
+ * go up, so whoever graphs them should take the difference between
+ * samples.
+ */
+struct ThreadMetrics {
+    /** Whether the threads should time their stages, which is off unless
+     * --metrics or --benchmark-replay was given */
+    unsigned is_timing:1;
+
+    /* transmit thread */
+    uint64_t tx_batches;
+    uint64_t tx_responses;      /* sent from the receive thread's queue */
+    struct StageTimer tx;
+
+    /* receive thread */
+    uint64_t rx_packets;
+    uint64_t rx_bytes;
+    uint64_t nic_received;      /* as counted by libpcap or PF_RING */
+    uint64_t nic_dropped;
+    uint64_t nic_ifdropped;
+    uint64_t tcb_active;
+    uint64_t tcb_buckets;
+    uint64_t tcb_allocations;
+    uint64_t buffer_waits;      /* times we ran out of packet buffers */
+    uint64_t output_bytes;
+    struct StageTimer rx;
+
+    /* per stage, written by the thread, and a copy as of the last time
+     * they were exported, owned by the status thread */
+    struct Histogram hist[Stage_Done];
+    struct Histogram exported[Stage_Done];
+};
+
+struct ThreadMetrics *
+metrics_create(unsigned is_timing);
+
+void
+metrics_destroy(struct ThreadMetrics *metrics);
+
+/**
+ * Things that are sampled by the status thread rather than counted by
+ * the thread itself.
+ */
+struct MetricsSample {
+    uint64_t probes;
+    double rate;
+    uint64_t throttle_sleeps;
+    uint64_t throttle_usecs;
+    unsigned packet_buffers;    /* free */
+    unsigned transmit_queue;    /* waiting to be sent */
+};
+
+/**
+ * Where metrics are sent, either a file or "unix:<path>" for a
+ * unix-domain stream socket.
+ */
+struct MetricsExport;
+
+struct MetricsExport *
+metrics_export_create(const char *name, unsigned interval);
+
+void
+metrics_export_destroy(struct MetricsExport *x);
+
+/**
+ * Whether 'interval' seconds have passed since the last export.
+ */
+int
+metrics_export_is_due(struct MetricsExport *x, time_t now);
+
+/**
+ * Write a line of NDJSON for this thread pair. Histograms are reported
+ * for just the period since the last export.
+ */
+void
+metrics_export_thread(struct MetricsExport *x, time_t now, unsigned thread,
+                      struct ThreadMetrics *metrics,
+                      const struct MetricsSample *sample);
+
+int
+metrics_selftest(void);
+
+#endif
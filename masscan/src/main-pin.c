@@ -0,0 +1,569 @@
+/*
+    Thread placement
+
+    See main-pin.h. On Linux, the topology comes from:
+
+        /sys/devices/system/cpu/cpuN/topology/core_id
+        /sys/devices/system/cpu/cpuN/topology/physical_package_id
+        /sys/devices/system/node/nodeN/cpulist
+        /sys/class/net/<ifname>/device/numa_node
+        /sys/class/net/<ifname>/device/msi_irqs/<irq>
+        /proc/irq/<irq>/smp_affinity_list
+
+    Elsewhere, we know only the number of processors, and treat them as
+    one node of separate cores.
+
+    Each thread goes on the processor with the lowest penalty: being on
+    another node than the adapter is worst, then sharing a physical core
+    with a thread already placed, then handling the adapter's interrupts,
+    then being CPU 0, where the rest of the system tends to run.
+
+    Memory is placed on the right node by first-touch: Linux puts a page
+    on the node of the processor that first writes to it, so the receive
+    thread pins itself before creating the TCP connection table, and the
+    packet buffers are allocated while the main thread is temporarily
+    pinned to the adapter's node. That way we don't need libnuma.
+*/
+#define _GNU_SOURCE
+#include "main-pin.h"
+#include "masscan.h"
+#include "rawsock.h"
+#include "pixie-threads.h"
+#include "logger.h"
+#include "string_s.h"
+#include "unusedparm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#endif
+
+
+/***************************************************************************
+ ***************************************************************************/
+int
+pin_parse_cpulist(const char *str, unsigned *cpus, unsigned max)
+{
+    unsigned count = 0;
+    const char *p = str;
+
+    for (;;) {
+        unsigned long first;
+        unsigned long last;
+        unsigned long i;
+        char *end;
+
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (!isdigit(*p & 0xFF))
+            return -1;
+        first = strtoul(p, &end, 10);
+        p = end;
+        if (*p == '-') {
+            p++;
+            if (!isdigit(*p & 0xFF))
+                return -1;
+            last = strtoul(p, &end, 10);
+            p = end;
+        } else
+            last = first;
+        if (last < first || last >= PIN_MAX_CPUS)
+            return -1;
+
+        for (i=first; i<=last; i++) {
+            if (count >= max)
+                return -1;
+            cpus[count++] = (unsigned)i;
+        }
+
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == ',') {
+            p++;
+            continue;
+        }
+        if (*p == '\0' || *p == '\n' || *p == '\r')
+            return (int)count;
+        return -1;
+    }
+}
+
+/***************************************************************************
+ * Print a list of processors the same way Linux does, like "0-3,8".
+ ***************************************************************************/
+static void
+format_cpulist(char *buf, size_t sizeof_buf, const unsigned *cpus, unsigned count)
+{
+    size_t offset = 0;
+    unsigned i;
+
+    buf[0] = '\0';
+    for (i=0; i<count; ) {
+        unsigned j = i;
+        while (j + 1 < count && cpus[j+1] == cpus[j] + 1)
+            j++;
+        if (offset + 24 > sizeof_buf)
+            break;
+        if (j == i)
+            offset += sprintf_s(buf + offset, sizeof_buf - offset, "%s%u",
+                        offset?",":"", cpus[i]);
+        else
+            offset += sprintf_s(buf + offset, sizeof_buf - offset, "%s%u-%u",
+                        offset?",":"", cpus[i], cpus[j]);
+        i = j + 1;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static unsigned
+penalty(const struct PinTopology *topo, unsigned cpu, int node,
+        const unsigned char *irq, const unsigned char *used)
+{
+    unsigned result = 0;
+    unsigned i;
+
+    if (node >= 0 && topo->cpus[cpu].node != node)
+        result += 8;
+    for (i=0; i<topo->cpu_count; i++) {
+        if (used[i] && i != cpu && topo->cpus[i].core == topo->cpus[cpu].core) {
+            result += 4;
+            break;
+        }
+    }
+    if (irq && irq[cpu])
+        result += 2;
+    if (cpu == 0)
+        result += 1;
+    return result;
+}
+
+static int
+choose(const struct PinTopology *topo, int node,
+       const unsigned char *irq, unsigned char *used)
+{
+    unsigned best_penalty = ~0U;
+    int best = -1;
+    unsigned i;
+
+    for (i=0; i<topo->cpu_count; i++) {
+        unsigned x;
+        if (!topo->cpus[i].is_present || !topo->cpus[i].is_allowed || used[i])
+            continue;
+        x = penalty(topo, i, node, irq, used);
+        if (x < best_penalty) {
+            best_penalty = x;
+            best = (int)i;
+        }
+    }
+    if (best >= 0)
+        used[best] = 1;
+    return best;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+pin_place(const struct PinTopology *topo, unsigned nic_count,
+          const int *nic_nodes, const unsigned char (*irq_cpus)[PIN_MAX_CPUS],
+          const unsigned *explicit_cpus, unsigned explicit_count,
+          struct PinPlace *places)
+{
+    unsigned char used[PIN_MAX_CPUS];
+    unsigned i;
+
+    memset(used, 0, sizeof(used));
+
+    /* Explicit pairs from --pin first, so that automatic placement of
+     * any other adapters stays out of their way */
+    for (i=0; i<nic_count; i++) {
+        places[i].node = nic_nodes[i];
+        places[i].transmit_cpu = -1;
+        places[i].receive_cpu = -1;
+        places[i].helper_count = 0;
+        if (i*2 + 1 < explicit_count) {
+            places[i].transmit_cpu = (int)explicit_cpus[i*2 + 0];
+            places[i].receive_cpu = (int)explicit_cpus[i*2 + 1];
+            used[explicit_cpus[i*2 + 0]] = 1;
+            used[explicit_cpus[i*2 + 1]] = 1;
+        }
+    }
+
+    for (i=0; i<nic_count; i++) {
+        const unsigned char *irq = irq_cpus?irq_cpus[i]:NULL;
+        if (places[i].transmit_cpu >= 0)
+            continue;
+        places[i].transmit_cpu = choose(topo, nic_nodes[i], irq, used);
+        places[i].receive_cpu = choose(topo, nic_nodes[i], irq, used);
+    }
+
+    /* Whatever's left on the adapter's node is for helper threads */
+    for (i=0; i<nic_count; i++) {
+        unsigned j;
+        for (j=0; j<topo->cpu_count; j++) {
+            if (!topo->cpus[j].is_present || !topo->cpus[j].is_allowed || used[j])
+                continue;
+            if (nic_nodes[i] >= 0 && topo->cpus[j].node != nic_nodes[i])
+                continue;
+            if (places[i].helper_count >= sizeof(places[i].helper_cpus)/sizeof(places[i].helper_cpus[0]))
+                break;
+            places[i].helper_cpus[places[i].helper_count++] = j;
+        }
+    }
+}
+
+#if defined(__linux__)
+/***************************************************************************
+ ***************************************************************************/
+static int
+read_file(const char *filename, char *buf, size_t sizeof_buf)
+{
+    FILE *fp;
+    size_t count;
+
+    fp = fopen(filename, "rt");
+    if (fp == NULL)
+        return 0;
+    count = fread(buf, 1, sizeof_buf - 1, fp);
+    fclose(fp);
+    buf[count] = '\0';
+    return count != 0;
+}
+
+static int
+read_int(const char *filename, int default_value)
+{
+    char buf[64];
+    if (!read_file(filename, buf, sizeof(buf)))
+        return default_value;
+    return atoi(buf);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+discover_topology(struct PinTopology *topo)
+{
+    cpu_set_t allowed;
+    char filename[256];
+    char buf[4096];
+    unsigned cpus[PIN_MAX_CPUS];
+    unsigned i;
+    int node;
+
+    memset(topo, 0, sizeof(*topo));
+
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return;
+
+    for (i=0; i<PIN_MAX_CPUS; i++) {
+        int core;
+        int package;
+
+        sprintf_s(filename, sizeof(filename),
+                  "/sys/devices/system/cpu/cpu%u/topology/core_id", i);
+        core = read_int(filename, -1);
+        if (core < 0)
+            continue;
+        sprintf_s(filename, sizeof(filename),
+                  "/sys/devices/system/cpu/cpu%u/topology/physical_package_id", i);
+        package = read_int(filename, 0);
+
+        topo->cpus[i].is_present = 1;
+        topo->cpus[i].is_allowed = CPU_ISSET(i, &allowed) != 0;
+        topo->cpus[i].core = ((unsigned)package << 16) | (unsigned)core;
+        topo->cpu_count = i + 1;
+    }
+
+    for (node=0; node<64; node++) {
+        int count;
+        int j;
+
+        sprintf_s(filename, sizeof(filename),
+                  "/sys/devices/system/node/node%d/cpulist", node);
+        if (!read_file(filename, buf, sizeof(buf)))
+            continue;
+        count = pin_parse_cpulist(buf, cpus, PIN_MAX_CPUS);
+        for (j=0; j<count; j++)
+            topo->cpus[cpus[j]].node = node;
+    }
+}
+
+/***************************************************************************
+ * Mark the processors that service the adapter's interrupts. Drivers
+ * using MSI-X list their interrupts in the device's msi_irqs directory.
+ ***************************************************************************/
+static void
+discover_irqs(const char *ifname, unsigned char *irq)
+{
+    char filename[512];
+    char buf[4096];
+    unsigned cpus[PIN_MAX_CPUS];
+    DIR *dir;
+    struct dirent *entry;
+
+    memset(irq, 0, PIN_MAX_CPUS);
+
+    sprintf_s(filename, sizeof(filename), "/sys/class/net/%s/device/msi_irqs", ifname);
+    dir = opendir(filename);
+    if (dir == NULL)
+        return;
+    while ((entry = readdir(dir)) != NULL) {
+        int count;
+        int j;
+
+        if (!isdigit(entry->d_name[0] & 0xFF))
+            continue;
+        sprintf_s(filename, sizeof(filename),
+                  "/proc/irq/%s/smp_affinity_list", entry->d_name);
+        if (!read_file(filename, buf, sizeof(buf)))
+            continue;
+        count = pin_parse_cpulist(buf, cpus, PIN_MAX_CPUS);
+        for (j=0; j<count; j++)
+            irq[cpus[j]] = 1;
+    }
+    closedir(dir);
+}
+
+static int
+discover_node(const char *ifname)
+{
+    char filename[512];
+
+    sprintf_s(filename, sizeof(filename), "/sys/class/net/%s/device/numa_node", ifname);
+    return read_int(filename, -1);
+}
+
+#else
+static void
+discover_topology(struct PinTopology *topo)
+{
+    unsigned count = pixie_cpu_get_count();
+    unsigned i;
+
+    memset(topo, 0, sizeof(*topo));
+    if (count > PIN_MAX_CPUS)
+        count = PIN_MAX_CPUS;
+    for (i=0; i<count; i++) {
+        topo->cpus[i].is_present = 1;
+        topo->cpus[i].is_allowed = 1;
+        topo->cpus[i].core = i;
+    }
+    topo->cpu_count = count;
+}
+static void
+discover_irqs(const char *ifname, unsigned char *irq)
+{
+    UNUSEDPARM(ifname);
+    memset(irq, 0, PIN_MAX_CPUS);
+}
+static int
+discover_node(const char *ifname)
+{
+    UNUSEDPARM(ifname);
+    return -1;
+}
+#endif
+
+/***************************************************************************
+ ***************************************************************************/
+void
+pin_layout(struct Masscan *masscan)
+{
+    static struct PinTopology topo;
+    static unsigned char irq_cpus[8][PIN_MAX_CPUS];
+    int nic_nodes[8];
+    struct PinPlace places[8];
+    unsigned allowed = 0;
+    unsigned i;
+
+    for (i=0; i<masscan->nic_count; i++) {
+        masscan->nic[i].pin.node = -1;
+        masscan->nic[i].pin.transmit_cpu = -1;
+        masscan->nic[i].pin.receive_cpu = -1;
+        masscan->nic[i].pin.helper_count = 0;
+    }
+
+    if (masscan->pin.is_none) {
+        LOG(1, "pin: not pinning threads (--pin none)\n");
+        return;
+    }
+
+    discover_topology(&topo);
+    for (i=0; i<topo.cpu_count; i++) {
+        if (topo.cpus[i].is_present && topo.cpus[i].is_allowed)
+            allowed++;
+    }
+    if (allowed < 2) {
+        LOG(1, "pin: not pinning threads, only %u cpu\n", allowed);
+        return;
+    }
+    for (i=0; i<masscan->pin.count; i++) {
+        unsigned cpu = masscan->pin.cpus[i];
+        if (cpu >= topo.cpu_count || !topo.cpus[cpu].is_present
+                || !topo.cpus[cpu].is_allowed) {
+            LOG(0, "pin: cpu %u isn't available, not pinning threads\n", cpu);
+            return;
+        }
+    }
+
+    for (i=0; i<masscan->nic_count; i++) {
+        char ifname[256];
+
+        if (masscan->nic[i].ifname[0])
+            strcpy_s(ifname, sizeof(ifname), masscan->nic[i].ifname);
+        else if (rawsock_get_default_interface(ifname, sizeof(ifname)) != 0)
+            ifname[0] = '\0';
+
+        if (ifname[0] == '\0' || strchr(ifname, '/') || strchr(ifname, '.')) {
+            nic_nodes[i] = -1;
+            memset(irq_cpus[i], 0, PIN_MAX_CPUS);
+        } else {
+            nic_nodes[i] = discover_node(ifname);
+            discover_irqs(ifname, irq_cpus[i]);
+        }
+    }
+
+    pin_place(&topo, masscan->nic_count, nic_nodes,
+              (const unsigned char (*)[PIN_MAX_CPUS])irq_cpus,
+              masscan->pin.cpus, masscan->pin.count, places);
+
+    for (i=0; i<masscan->nic_count; i++) {
+        char helpers[256];
+        char node[32];
+
+        masscan->nic[i].pin = places[i];
+
+        format_cpulist(helpers, sizeof(helpers),
+                       places[i].helper_cpus, places[i].helper_count);
+        if (places[i].node >= 0)
+            sprintf_s(node, sizeof(node), "node %d", places[i].node);
+        else
+            sprintf_s(node, sizeof(node), "node unknown");
+        LOG(0, "pin: %s (%s): transmit cpu %d, receive cpu %d, output cpus %s\n",
+            masscan->nic[i].ifname[0]?masscan->nic[i].ifname:"default",
+            node,
+            places[i].transmit_cpu, places[i].receive_cpu,
+            helpers[0]?helpers:"none");
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+#if defined(__linux__)
+static cpu_set_t saved_affinity;
+#endif
+
+int
+pin_to_node(const struct Masscan *masscan, unsigned nic_index)
+{
+#if defined(__linux__)
+    const struct PinPlace *place = &masscan->nic[nic_index].pin;
+    unsigned cpus[2 + 64];
+    unsigned count = 0;
+    unsigned i;
+
+    if (place->transmit_cpu < 0 || place->receive_cpu < 0)
+        return 0;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(saved_affinity), &saved_affinity) != 0)
+        return 0;
+
+    cpus[count++] = (unsigned)place->transmit_cpu;
+    cpus[count++] = (unsigned)place->receive_cpu;
+    for (i=0; i<place->helper_count; i++)
+        cpus[count++] = place->helper_cpus[i];
+    pixie_cpu_set_affinity_list(cpus, count);
+    return 1;
+#else
+    UNUSEDPARM(masscan);
+    UNUSEDPARM(nic_index);
+    return 0;
+#endif
+}
+
+void
+pin_restore(void)
+{
+#if defined(__linux__)
+    pthread_setaffinity_np(pthread_self(), sizeof(saved_affinity), &saved_affinity);
+#endif
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+pin_selftest(void)
+{
+    static struct PinTopology topo;
+    static unsigned char irq_cpus[2][PIN_MAX_CPUS];
+    struct PinPlace places[2];
+    unsigned cpus[16];
+    unsigned explicit_cpus[2];
+    int nic_nodes[2];
+    char buf[64];
+    unsigned i;
+
+    /* lists */
+    if (pin_parse_cpulist("0-3,8,10\n", cpus, 16) != 6
+            || cpus[3] != 3 || cpus[4] != 8 || cpus[5] != 10)
+        goto fail;
+    if (pin_parse_cpulist("3-1", cpus, 16) != -1
+            || pin_parse_cpulist("1,,2", cpus, 16) != -1
+            || pin_parse_cpulist("x", cpus, 16) != -1
+            || pin_parse_cpulist("0-31", cpus, 16) != -1)
+        goto fail;
+    format_cpulist(buf, sizeof(buf), cpus, (unsigned)pin_parse_cpulist("0-3,8,10-11", cpus, 16));
+    if (strcmp(buf, "0-3,8,10-11") != 0)
+        goto fail;
+
+    /* Two nodes of eight processors, hyperthreads numbered next to each
+     * other, with the first adapter on node 1 and its interrupts on 8 */
+    memset(&topo, 0, sizeof(topo));
+    memset(irq_cpus, 0, sizeof(irq_cpus));
+    topo.cpu_count = 16;
+    for (i=0; i<16; i++) {
+        topo.cpus[i].is_present = 1;
+        topo.cpus[i].is_allowed = 1;
+        topo.cpus[i].node = i/8;
+        topo.cpus[i].core = i/2;
+    }
+    nic_nodes[0] = 1;
+    nic_nodes[1] = -1;
+    irq_cpus[0][8] = 1;
+
+    pin_place(&topo, 2, nic_nodes, (const unsigned char (*)[PIN_MAX_CPUS])irq_cpus,
+              NULL, 0, places);
+    if (places[0].transmit_cpu != 9 || places[0].receive_cpu != 10)
+        goto fail;
+    if (places[0].helper_count != 6 || places[0].helper_cpus[0] != 8
+            || places[0].helper_cpus[1] != 11)
+        goto fail;
+    /* unknown node: avoid cpu 0 and the sibling of whatever we took */
+    if (places[1].transmit_cpu != 1 || places[1].receive_cpu != 2)
+        goto fail;
+    if (places[1].helper_count != 12)
+        goto fail;
+
+    /* --pin overrides, and automatic placement steers around it */
+    explicit_cpus[0] = 1;
+    explicit_cpus[1] = 9;
+    topo.cpus[3].is_allowed = 0;
+    pin_place(&topo, 2, nic_nodes, (const unsigned char (*)[PIN_MAX_CPUS])irq_cpus,
+              explicit_cpus, 2, places);
+    if (places[0].transmit_cpu != 1 || places[0].receive_cpu != 9)
+        goto fail;
+    if (places[1].transmit_cpu != 2 || places[1].receive_cpu != 4)
+        goto fail;
+
+    return 0;
+fail:
+    fprintf(stderr, "pin: selftest failed\n");
+    return 1;
+}
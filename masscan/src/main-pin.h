@@ -0,0 +1,98 @@
+/*
+    Thread placement
+
+    Each adapter gets a transmit thread and a receive thread, and the
+    receive thread may have helper threads compressing output. On a
+    machine with more than one NUMA node, these run fastest on the node
+    the adapter is plugged into, with the packet buffers and the TCP
+    connection table in that node's memory, and without the transmit and
+    receive threads fighting over the same core. This works out where
+    they go, from what Linux says in /sys, unless overridden with --pin.
+*/
+#ifndef MAIN_PIN_H
+#define MAIN_PIN_H
+struct Masscan;
+
+#define PIN_MAX_CPUS 256
+
+/**
+ * Where one adapter's threads go. A CPU of -1 means that thread isn't
+ * pinned. The helper CPUs are the rest of the adapter's node, which is
+ * where output compression threads run.
+ */
+struct PinPlace
+{
+    int node;
+    int transmit_cpu;
+    int receive_cpu;
+    unsigned helper_count;
+    unsigned helper_cpus[64];
+};
+
+/**
+ * What we know about the machine's processors. Cores are numbered so
+ * that two hyperthreads of the same physical core have the same number.
+ */
+struct PinTopology
+{
+    unsigned cpu_count;
+    struct {
+        int node;
+        unsigned core;
+        unsigned is_present:1;
+        unsigned is_allowed:1;
+    } cpus[PIN_MAX_CPUS];
+};
+
+/**
+ * Fill in masscan->nic[].pin for every adapter, and print the layout.
+ * This must be called after the adapters have been initialized, since
+ * it needs to know their names. With "--pin none", or when we're only
+ * allowed one processor, nothing is pinned and every CPU is -1.
+ */
+void
+pin_layout(struct Masscan *masscan);
+
+/**
+ * Pin the calling thread to the processors of an adapter's NUMA node,
+ * so that memory it allocates and touches next is placed on that node,
+ * and return to the previous affinity with pin_restore().
+ * @return
+ *      1 if the affinity was changed, 0 otherwise
+ */
+int
+pin_to_node(const struct Masscan *masscan, unsigned nic_index);
+void
+pin_restore(void);
+
+/**
+ * Parse a list of processors like "0-3,8,10", as used by --pin and
+ * by /sys.
+ * @return
+ *      the number of processors in the list, or -1 if it doesn't parse
+ *      or there are more than 'max'
+ */
+int
+pin_parse_cpulist(const char *str, unsigned *cpus, unsigned max);
+
+/**
+ * Choose where each adapter's threads go. Exposed for the selftest.
+ * @param nic_nodes
+ *      The NUMA node of each adapter, or -1 if unknown.
+ * @param irq_cpus
+ *      For each adapter, PIN_MAX_CPUS flags marking the processors that
+ *      handle its interrupts, which we'd rather not put a thread on.
+ * @param explicit_cpus
+ *      From --pin: transmit and receive CPU pairs, one pair per adapter.
+ *      Adapters without a pair are placed automatically.
+ */
+void
+pin_place(const struct PinTopology *topo, unsigned nic_count,
+          const int *nic_nodes, const unsigned char (*irq_cpus)[PIN_MAX_CPUS],
+          const unsigned *explicit_cpus, unsigned explicit_count,
+          struct PinPlace *places);
+
+int
+pin_selftest(void);
+
+#endif
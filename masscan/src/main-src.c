@@ -14,3 +14,8 @@ int is_my_port(const struct Source *src, unsigned port)
 {
     return src->port.first <= port && port <= src->port.last;
 }
+
+int is_my_ipv6(const struct Source *src, ipv6address ip)
+{
+    return src->ipv6.hi == ip.hi && src->ipv6.lo == ip.lo;
+}
@@ -1,5 +1,6 @@
 #ifndef MAIN_SRC_H
 #define MAIN_SRC_H
+#include "ranges6.h"
 
 struct Source
 {
@@ -13,11 +14,16 @@ struct Source
         unsigned last;
         unsigned range;
     } port;
+
+    /* the address IPv6 targets are scanned from, all zeroes when there
+     * aren't any */
+    ipv6address ipv6;
 };
 
 int is_myself(const struct Source *src, unsigned ip, unsigned port);
 int is_my_ip(const struct Source *src, unsigned ip);
 int is_my_port(const struct Source *src, unsigned ip);
+int is_my_ipv6(const struct Source *src, ipv6address ip);
 
 
 
@@ -6,6 +6,8 @@
     - %done
     - estimated time remaining of the scan
     - number of 'tcbs' (TCP control blocks) of active TCP connections
+    - number of 'tcbs' that aren't waiting on a timeout, and therefore
+      leak (this should always be zero)
 
 */
 #include "main-status.h"
@@ -13,6 +15,7 @@
 #include "unusedparm.h"
 #include "main-globals.h"
 #include "string_s.h"
+#include "logger.h"
 #include <stdio.h>
 
 
@@ -29,6 +32,7 @@ status_print(
     uint64_t max_count,
     double x,
     uint64_t total_tcbs,
+    uint64_t total_tcb_leaks,
     uint64_t total_synacks,
     uint64_t total_syns,
     uint64_t exiting)
@@ -44,6 +48,7 @@ status_print(
     double tcb_rate = 0.0;
     double synack_rate = 0.0;
     double syn_rate = 0.0;
+    char leaks[64] = "";
 
 
     /*
@@ -113,6 +118,14 @@ status_print(
         status->total_tcbs = total_tcbs;
         tcb_rate = (1.0*current_tcbs)/elapsed_time;
     }
+    if (total_tcb_leaks > status->total_tcb_leaks) {
+        /* This is a bug in the TCP stack, so make some noise about it
+         * the first time it shows up */
+        if (status->total_tcb_leaks == 0)
+            LOG(0, "\nTCP: %" PRIu64 " connections have no timeout, and will leak\n",
+                total_tcb_leaks);
+        status->total_tcb_leaks = total_tcb_leaks;
+    }
     if (total_synacks) {
         current_synacks = total_synacks - status->total_synacks;
         status->total_synacks = total_synacks;
@@ -125,37 +138,46 @@ status_print(
     }
 
 
+    /*
+     * Only bother the user with leaked TCBs when there are some
+     */
+    if (total_tcb_leaks)
+        sprintf_s(leaks, sizeof(leaks), ", leaks=%" PRIu64, total_tcb_leaks);
+
     /*
      * Print the message to <stderr> so that <stdout> can be redirected
      * to a file (<stdout> reports what systems were found).
      */
     if (status->is_infinite) {
         fprintf(stderr,
-                "rate:%6.2f-kpps, syn/s=%.0f ack/s=%.0f tcb-rate=%.0f, %" PRIu64 "-tcbs,         \r",
+                "rate:%6.2f-kpps, syn/s=%.0f ack/s=%.0f tcb-rate=%.0f, %" PRIu64 "-tcbs, %" PRIu64 "-leaks,         \r",
                         x/1000.0,
                         syn_rate,
                         synack_rate,
                         tcb_rate,
-                        total_tcbs
+                        total_tcbs,
+                        total_tcb_leaks
                         );
     } else {
         if (is_tx_done) {
             fprintf(stderr,
-                "rate:%6.2f-kpps, %5.2f%% done, waiting %d-secs, found=%" PRIu64 "       \r",
+                "rate:%6.2f-kpps, %5.2f%% done, waiting %d-secs, found=%" PRIu64 "%s       \r",
                         x/1000.0,
                         percent_done,
                         (int)exiting,
-                        total_synacks
+                        total_synacks,
+                        leaks
                        );
         } else {
             fprintf(stderr,
-                "rate:%6.2f-kpps, %5.2f%% done,%4u:%02u:%02u remaining, found=%" PRIu64 "       \r",
+                "rate:%6.2f-kpps, %5.2f%% done,%4u:%02u:%02u remaining, found=%" PRIu64 "%s       \r",
                         x/1000.0,
                         percent_done,
                         (unsigned)(time_remaining/60/60),
                         (unsigned)(time_remaining/60)%60,
                         (unsigned)(time_remaining)%60,
-                        total_synacks
+                        total_synacks,
+                        leaks
                        );
         }
     }
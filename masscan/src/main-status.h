@@ -19,12 +19,13 @@ struct Status
     unsigned is_infinite:1;
 
     uint64_t total_tcbs;
+    uint64_t total_tcb_leaks;
     uint64_t total_synacks;
     uint64_t total_syns;
 };
 
 
-void status_print(struct Status *status, uint64_t count, uint64_t max_count, double x, uint64_t total_tcbs, uint64_t total_synacks, uint64_t total_syns, uint64_t exiting);
+void status_print(struct Status *status, uint64_t count, uint64_t max_count, double x, uint64_t total_tcbs, uint64_t total_tcb_leaks, uint64_t total_synacks, uint64_t total_syns, uint64_t exiting);
 void status_finish(struct Status *status);
 void status_start(struct Status *status);
 
@@ -15,149 +15,363 @@
     where somebody suspends the computer for a few days, then wake it up,
     at which point the system tries sending a million packets/secon instead
     of the desired thousand packets/second.
+
+    This is a token bucket: tokens drip in at --rate per second, and each
+    packet sent (including those the receive thread queued for us) takes
+    one. The bucket only holds a --burst worth, which is what stops the
+    flood after a suspend. Rather than sending a packet whenever there's a
+    token, we wait until there's a full burst, so that at a thousand
+    packets/second with a burst of ten, that's ten packets back-to-back
+    every 10 milliseconds, evenly, instead of whatever the scheduler
+    happens to give us. Upstream rate-limiters like that better.
+
+    Time comes from pixie_ticks(), which on x86 is the CPU's timestamp
+    counter, cheap enough to read on every batch. Waits longer than a
+    fraction of a millisecond sleep for most of it, then spin for the
+    rest, because sleeps overshoot by tens of microseconds.
 */
 #include "main-throttle.h"
 #include "pixie-timer.h"
 #include "logger.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+/* waits longer than this sleep, the last part of them spinning */
+#define THROTTLE_SPIN_USECS 200
 
 
 /***************************************************************************
  ***************************************************************************/
-void
-throttler_start(struct Throttler *throttler, double max_rate)
+static void
+throttler_start_clock(struct Throttler *throttler, double max_rate,
+                uint64_t burst, unsigned ring_size,
+                uint64_t (*get_ticks)(void), uint64_t ticks_per_second,
+                void (*sleep)(uint64_t usecs))
 {
-    unsigned i;
-
     memset(throttler, 0, sizeof(*throttler));
+    throttler->get_ticks = get_ticks;
+    throttler->sleep = sleep;
 
     throttler->max_rate = max_rate;
 
-    for (i=0; i<sizeof(throttler->buckets)/sizeof(throttler->buckets[0]); i++) {
-        throttler->buckets[i].timestamp = pixie_gettime();
-        throttler->buckets[i].packet_count = 0;
+    /* By default, a millisecond's worth at a time, but never more than the
+     * adapter can take at once */
+    if (burst == 0) {
+        burst = (uint64_t)(max_rate / 1000.0);
+        if (ring_size && burst > ring_size)
+            burst = ring_size;
     }
+    if (burst == 0)
+        burst = 1;
+    throttler->burst = burst;
 
-    throttler->batch_size = 1;
+    throttler->ticks_per_second = ticks_per_second;
+    throttler->tokens_per_tick = max_rate / throttler->ticks_per_second;
+    throttler->last_ticks = get_ticks();
+    throttler->window_ticks = throttler->last_ticks;
 
-    LOG(1, "maxrate = %0.2f\n", throttler->max_rate);
+    /* start with a full bucket, so the first batch goes right away */
+    throttler->tokens = (double)burst;
+
+    LOG(1, "maxrate = %0.2f, burst = %llu\n", throttler->max_rate,
+        (unsigned long long)burst);
+}
+
+void
+throttler_start(struct Throttler *throttler, double max_rate,
+                uint64_t burst, unsigned ring_size)
+{
+    throttler_start_clock(throttler, max_rate, burst, ring_size,
+                          pixie_ticks, pixie_ticks_per_second(),
+                          pixie_usleep);
 }
 
+/***************************************************************************
+ * Add the tokens that have dripped in since last time.
+ ***************************************************************************/
+static uint64_t
+throttler_refill(struct Throttler *throttler)
+{
+    uint64_t ticks = throttler->get_ticks();
+
+    throttler->tokens += (ticks - throttler->last_ticks) * throttler->tokens_per_tick;
+    throttler->last_ticks = ticks;
+    return ticks;
+}
 
 /***************************************************************************
  * We return the number of packets that can be sent in a batch. Thus,
  * instead of trying to throttle each packet individually, which has a
- * high per-packet cost, we try to throttle a bunch at a time. Normally,
- * this function will return 1, only at high rates does it return larger
- * numbers.
+ * high per-packet cost, we try to throttle a bunch at a time. At slow
+ * rates this returns 1, at high rates a burst's worth.
  *
- * NOTE: The minimum value this returns is 1. When it's less than that,
- * it'll pause and wait until it's ready to send a packet.
+ * NOTE: When there aren't enough tokens, this waits until there are. The
+ * exception is when that's more than 100 milliseconds away, where this
+ * pauses for that long and returns 0, so that the caller can check for
+ * <ctrl-c> and call again.
  ***************************************************************************/
 uint64_t
 throttler_next_batch(struct Throttler *throttler, uint64_t packet_count)
 {
-    uint64_t timestamp;
-    uint64_t index;
-    uint64_t old_timestamp;
-    uint64_t old_packet_count;
-    double current_rate;
-    double max_rate = throttler->max_rate;
+    uint64_t ticks;
+    double burst = (double)throttler->burst;
+    double max_tokens;
 
-again:
+    if (throttler->tokens_per_tick <= 0) {
+        throttler->sleep(100000);
+        throttler->sleep_count++;
+        throttler->sleep_usecs += 100000;
+        return 0;
+    }
 
-    /* NOTE: this uses CLOCK_MONOTONIC_RAW on Linux, so the timstamp doesn't
-     * move forward when the machine is suspended */
-    timestamp = pixie_gettime();
+    /* Everything sent since last time, whether it was in the batch we
+     * returned or not, is paid for */
+    ticks = throttler_refill(throttler);
+    throttler->tokens -= (double)(packet_count - throttler->last_packet_count);
+    throttler->last_packet_count = packet_count;
 
-    /*
-     * We record that last 256 buckets, and average the rate over all of
-     * them.
-     */
-    index = (throttler->index) & 0xFF;
-    throttler->buckets[index].timestamp = timestamp;
-    throttler->buckets[index].packet_count = packet_count;
+    /* Don't save up more than a burst, so that after the machine has been
+     * suspended, or we've been stuck, we don't flood the network catching
+     * up. The extra millisecond's worth absorbs late wake-ups, without
+     * which we'd run a little under the rate. */
+    max_tokens = burst + throttler->max_rate / 1000.0;
+    if (throttler->tokens > max_tokens)
+        throttler->tokens = max_tokens;
 
-    index = (++throttler->index) & 0xFF;
-    old_timestamp = throttler->buckets[index].timestamp;
-    old_packet_count = throttler->buckets[index].packet_count;
+    /* The recent rate, for the status line */
+    if (ticks - throttler->window_ticks >= throttler->ticks_per_second / 4) {
+        throttler->current_rate = (packet_count - throttler->window_packet_count)
+                                * (double)throttler->ticks_per_second
+                                / (ticks - throttler->window_ticks);
+        throttler->window_ticks = ticks;
+        throttler->window_packet_count = packet_count;
+    }
 
     /*
-     * If the delay is more than 1-second, then we should reset the system
-     * in order to avoid transmittting too fast.
+     * If there isn't a full burst yet, wait for one. Sleep for most of
+     * the wait, then spin for the rest.
      */
-    if (timestamp - old_timestamp > 1000000) {
-        //throttler_start(throttler, throttler->max_rate);
-        throttler->batch_size = 1;
-        goto again;
+    if (throttler->tokens < burst) {
+        double wait_ticks = (burst - throttler->tokens) / throttler->tokens_per_tick;
+        uint64_t wait_usecs = (uint64_t)(wait_ticks * 1000000.0
+                                         / throttler->ticks_per_second);
+
+        /* At very slow rates, like 0.5 packets/second, which is great for
+         * testing, come back every 100 milliseconds so the caller still
+         * notices <ctrl-c> */
+        if (wait_usecs > 100000 + THROTTLE_SPIN_USECS) {
+            throttler->sleep(100000);
+            throttler->sleep_count++;
+            throttler->sleep_usecs += 100000;
+            return 0;
+        }
+
+        if (wait_usecs > THROTTLE_SPIN_USECS) {
+            throttler->sleep(wait_usecs - THROTTLE_SPIN_USECS);
+            throttler->sleep_count++;
+            throttler->sleep_usecs += wait_usecs - THROTTLE_SPIN_USECS;
+        }
+
+        while (throttler->tokens < burst)
+            throttler_refill(throttler);
     }
 
-    /*
-     * Calculate the recent rate.
-     * NOTE: this isn't the rate "since start", but only the "recent" rate.
-     * That's so that if the system pauses for a while, we don't flood the
-     * network trying to catch up.
-     */
-    current_rate = 1.0*(packet_count - old_packet_count)/((timestamp - old_timestamp)/1000000.0);
+    if (throttler->tokens > burst)
+        return (uint64_t)burst;
+    return (uint64_t)throttler->tokens;
+}
 
 
-    /*
-     * If we've been going too fast, then <pause> for a moment, then
-     * try again.
-     */
-    if (current_rate > max_rate) {
-        double waittime;
-
-        /* calculate waittime, in seconds */
-        waittime = (current_rate - max_rate) / throttler->max_rate;
-
-        /* At higher rates of speed, we don't actually need to wait the full
-         * interval. It's better to have a much smaller interval, so that
-         * we converge back on the true rate faster */
-        waittime *= 0.1;
-
-        /* This is in case of gross failure of the system. This should never
-         * actually happen, unless there is a bug. Really, I ought to make
-         * this an 'assert()' instead to fail and fix the bug rather than
-         * silently continueing, but I'm too lazy */
-        if (waittime > 0.1)
-            waittime = 0.1;
-
-        /* Since we've exceeded the speed limit, we should reduce the
-         * batch size slightly. We don't do it only by a little bit to
-         * avoid over-correcting. We want to converge on the correct
-         * speed gradually. Note that since this happens hundres or
-         * thousands of times a second, the convergence is very fast
-         * even with 0.1% adjustment */
-        throttler->batch_size *= 0.999;
-
-        /* Now we wait for a bit */
-        pixie_usleep((uint64_t)(waittime * 1000000.0));
-
-        /* There are two choices here. We could either return immediately,
-         * or we can loop around again. Right now, the code loops around
-         * again in order to support very slow rates, such as 0.5 packets
-         * per second. Nobody would want to run a scanner that slowly of
-         * course, but it's great for testing */
-        //return (uint64_t)throttler->batch_size;
-        goto again;
+/***************************************************************************
+ * The selftest's clock, in nanoseconds. Reading it takes 100 nanoseconds,
+ * so that spinning on it moves time along, and sleeping takes exactly as
+ * long as asked. That way the test checks the throttler's arithmetic, not
+ * how busy the machine running it is.
+ ***************************************************************************/
+static uint64_t fake_nanotime;
+
+static uint64_t
+fake_ticks(void)
+{
+    fake_nanotime += 100;
+    return fake_nanotime;
+}
+
+static void
+fake_usleep(uint64_t usecs)
+{
+    fake_nanotime += usecs * 1000;
+}
+
+/***************************************************************************
+ * Run the throttler as the transmit thread would, against the fake clock,
+ * and check both that the rate comes out right and that every batch after
+ * the first comes within a microsecond of its turn.
+ ***************************************************************************/
+static int
+selftest_pacing(double rate, uint64_t burst, uint64_t total)
+{
+    struct Throttler throttler[1];
+    uint64_t interval = (uint64_t)(burst * 1000000000.0 / rate);
+    uint64_t packets_sent = 0;
+    uint64_t start, prev;
+    double achieved;
+
+    fake_nanotime = 0;
+    throttler_start_clock(throttler, rate, burst, 0,
+                          fake_ticks, 1000000000, fake_usleep);
+
+    start = prev = fake_nanotime;
+    while (packets_sent < total) {
+        uint64_t batch = throttler_next_batch(throttler, packets_sent);
+
+        if (batch == 0)
+            continue;
+        if (batch > burst) {
+            fprintf(stderr, "throttle: batch of %llu, burst is %llu\n",
+                    (unsigned long long)batch, (unsigned long long)burst);
+            return 1;
+        }
+        if (packets_sent) {
+            uint64_t gap = fake_nanotime - prev;
+            uint64_t error = (gap > interval) ? (gap - interval) : (interval - gap);
+            if (error > 1000) {
+                fprintf(stderr, "throttle: batch %lluns apart, expected %lluns\n",
+                        (unsigned long long)gap, (unsigned long long)interval);
+                return 1;
+            }
+        }
+        prev = fake_nanotime;
+        packets_sent += batch;
     }
 
-    /*
-     * Calculate how many packets are needed to catch up again to the current
-     * rate, and return that.
-     *
-     * NOTE: this is almost always going to have the value of 1 (one). Only at
-     * very high speeds (above 100,000 packets/second) will this value get
-     * larger.
-     */
-    throttler->batch_size *= 1.005;
-    if (throttler->batch_size > 10000)
-        throttler->batch_size = 10000;
-    throttler->current_rate = current_rate;
-
-    throttler->test_timestamp = timestamp;
-    throttler->test_packet_count = packet_count;
-    return (uint64_t)throttler->batch_size;
+    /* the first batch goes out right away, so don't count it */
+    achieved = (packets_sent - burst) * 1000000000.0 / (prev - start);
+    if (achieved < rate * 0.99 || rate * 1.01 < achieved) {
+        fprintf(stderr, "throttle: rate %0.0f, expected %0.0f\n",
+                achieved, rate);
+        return 1;
+    }
+    return 0;
+}
+
+int
+throttler_selftest(void)
+{
+    struct Throttler throttler[1];
+    uint64_t batch;
+
+    /* Spinning, one packet every 50 microseconds */
+    if (selftest_pacing(20000.0, 1, 2000) != 0)
+        goto fail;
+
+    /* Sleeping, one packet every 2 milliseconds */
+    if (selftest_pacing(500.0, 1, 20) != 0)
+        goto fail;
+
+    /* Bursts of 50 every 5 milliseconds */
+    if (selftest_pacing(10000.0, 50, 1000) != 0)
+        goto fail;
+
+    /* After sitting idle, we mustn't get more than a burst at once */
+    fake_nanotime = 0;
+    throttler_start_clock(throttler, 1000000.0, 100, 0,
+                          fake_ticks, 1000000000, fake_usleep);
+    batch = throttler_next_batch(throttler, 0);
+    fake_usleep(20000);
+    batch = throttler_next_batch(throttler, batch);
+    if (batch != 100)
+        goto fail;
+
+    /* Packets the receive thread sent are paid for too: at 1000/second,
+     * after a batch of one and ten more, the next comes 11ms later */
+    fake_nanotime = 0;
+    throttler_start_clock(throttler, 1000.0, 1, 0,
+                          fake_ticks, 1000000000, fake_usleep);
+    batch = throttler_next_batch(throttler, 0);
+    batch = throttler_next_batch(throttler, batch + 10);
+    if (batch != 1 || fake_nanotime < 10999000 || fake_nanotime > 11001000)
+        goto fail;
+
+    /* At half a packet a second, rather than waiting 2 seconds, come back
+     * after 100ms with nothing, so the caller can check for <ctrl-c> */
+    fake_nanotime = 0;
+    throttler_start_clock(throttler, 0.5, 1, 0,
+                          fake_ticks, 1000000000, fake_usleep);
+    batch = throttler_next_batch(throttler, 0);
+    batch = throttler_next_batch(throttler, batch);
+    if (batch != 0 || throttler->sleep_count != 1
+        || throttler->sleep_usecs != 100000)
+        goto fail;
+
+    /* The default burst is a millisecond's worth, up to the ring size */
+    throttler_start_clock(throttler, 1000000.0, 0, 512,
+                          fake_ticks, 1000000000, fake_usleep);
+    if (throttler->burst != 512)
+        goto fail;
+    throttler_start_clock(throttler, 100000.0, 0, 512,
+                          fake_ticks, 1000000000, fake_usleep);
+    if (throttler->burst != 100)
+        goto fail;
+    throttler_start_clock(throttler, 10.0, 0, 512,
+                          fake_ticks, 1000000000, fake_usleep);
+    if (throttler->burst != 1)
+        goto fail;
+
+    return 0;
+fail:
+    fprintf(stderr, "throttle: selftest failed\n");
+    return 1;
+}
+
+/***************************************************************************
+ * Time each batch with the real clock, rather than the throttler's own
+ * ticks, and report the rate achieved and the percentage of batches more
+ * than a quarter of an interval early or late. This depends on the
+ * scheduler, which is why it's a benchmark and not part of the selftest.
+ ***************************************************************************/
+static void
+benchmark_pacing(double rate, uint64_t burst, uint64_t total)
+{
+    struct Throttler throttler[1];
+    uint64_t interval = (uint64_t)(burst * 1000000000.0 / rate);
+    uint64_t packets_sent = 0;
+    uint64_t batches = 0;
+    uint64_t late = 0;
+    uint64_t start, prev, now;
+
+    throttler_start(throttler, rate, burst, 0);
+
+    start = prev = pixie_nanotime();
+    while (packets_sent < total) {
+        uint64_t batch = throttler_next_batch(throttler, packets_sent);
+
+        if (batch == 0)
+            continue;
+        now = pixie_nanotime();
+        if (packets_sent) {
+            uint64_t gap = now - prev;
+            uint64_t error = (gap > interval) ? (gap - interval) : (interval - gap);
+            if (error > interval / 4)
+                late++;
+            batches++;
+        }
+        prev = now;
+        packets_sent += batch;
+    }
+
+    printf("rate = %7.0f, burst = %2llu: achieved = %7.0f, off schedule = %3u%%\n",
+           rate, (unsigned long long)burst,
+           (packets_sent - burst) * 1000000000.0 / (prev - start),
+           batches ? (unsigned)(late * 100 / batches) : 0);
+}
+
+void
+throttler_benchmark(void)
+{
+    printf("-- throttle -- \n");
+    benchmark_pacing(20000.0, 1, 20000);
+    benchmark_pacing(500.0, 1, 500);
+    benchmark_pacing(10000.0, 50, 10000);
 }
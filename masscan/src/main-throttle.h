@@ -6,22 +6,56 @@ struct Throttler
 {
     double max_rate;
     double current_rate;
-    double batch_size;
 
-    unsigned index;
+    /* the most packets we'll send back-to-back, and the number we wait
+     * to have before sending, so that batches are evenly spaced */
+    uint64_t burst;
+    uint64_t batch_size;
 
-    struct {
-        uint64_t timestamp;
-        uint64_t packet_count;
-    } buckets[256];
+    /* the token bucket, measured in pixie_ticks() */
+    double tokens;
+    double tokens_per_tick;
+    uint64_t ticks_per_second;
+    uint64_t last_ticks;
+    uint64_t last_packet_count;
 
-    uint64_t test_timestamp;
-    uint64_t test_packet_count;
+    /* the recent rate, for the status line, measured four times a second */
+    uint64_t window_ticks;
+    uint64_t window_packet_count;
+
+    /* how often, and for how long, we've slept to stay under the rate */
+    uint64_t sleep_count;
+    uint64_t sleep_usecs;
+
+    /* where the time comes from, pixie_ticks() and pixie_usleep() except
+     * in the selftest, which uses a fake clock */
+    uint64_t (*get_ticks)(void);
+    void (*sleep)(uint64_t usecs);
 
 };
 
 
 uint64_t throttler_next_batch(struct Throttler *throttler, uint64_t count);
-void throttler_start(struct Throttler *status, double max_rate);
+
+/**
+ * @param max_rate
+ *      Packets per second, from --rate.
+ * @param burst
+ *      The most packets to send back-to-back, from --burst, or zero to
+ *      send a millisecond's worth at a time, but no more than 'ring_size'.
+ * @param ring_size
+ *      How many packets the adapter can take at once, from
+ *      rawsock_ring_size().
+ */
+void throttler_start(struct Throttler *status, double max_rate,
+                     uint64_t burst, unsigned ring_size);
+
+int throttler_selftest(void);
+
+/**
+ * Runs the throttler against the real clock at a few rates, printing how
+ * close it came to the rate and how evenly spaced the batches were.
+ */
+void throttler_benchmark(void);
 
 #endif
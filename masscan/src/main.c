@@ -25,6 +25,10 @@
 #include "logger.h"             /* adjust with -v command-line opt */
 #include "main-status.h"        /* printf() regular status updates */
 #include "main-throttle.h"      /* rate limit */
+#include "main-metrics.h"       /* --metrics counters and latencies */
+#include "main-coord.h"         /* --coordinator and --worker */
+#include "main-pin.h"           /* --pin threads to the adapter's node */
+#include "out-compress.h"       /* -oJ scan.json.gz */
 #include "main-dedup.h"         /* ignore duplicate responses */
 #include "main-ptrace.h"        /* for nmap --packet-trace feature */
 #include "proto-arp.h"          /* for responding to ARP requests */
@@ -51,10 +55,14 @@
 #include "siphash24.h"
 #include "proto-x509.h"
 #include "crypto-base64.h"      /* base64 encode/decode */
+#include "crypto-sha.h"         /* certificate fingerprints */
 #include "pixie-backtrace.h"
 #include "proto-sctp.h"
 #include "script.h"
 #include "main-readrange.h"
+#include "event-timeout.h"      /* for tracking future events */
+#include "out-indexed.h"        /* indexed binary output */
+#include "pixie-compress.h"     /* runtime-loaded zstd/lz4 */
 
 #include <assert.h>
 #include <limits.h>
@@ -157,10 +165,23 @@ struct ThreadPair {
 
     uint64_t *total_synacks;
     uint64_t *total_tcbs;
+    uint64_t *total_tcb_leaks;
     uint64_t *total_syns;
 
     size_t thread_handle_xmit;
     size_t thread_handle_recv;
+
+    /** Counters and stage timings, exported with --metrics */
+    struct ThreadMetrics *metrics;
+
+    /** With --worker, the connection to the coordinator that hands out
+     * the chunks of the scan this transmit thread does */
+    struct CoordClient *coord;
+
+    /** Set only when replaying a capture with --benchmark-replay, in
+     * which case there's no transmit thread, and the receive thread
+     * times every packet instead of a sample */
+    unsigned is_replay:1;
 };
 
 
@@ -268,6 +289,9 @@ transmit_thread(void *v) /*aka. scanning_thread() */
     uint64_t range;
     struct BlackRock blackrock;
     uint64_t count_ips = rangelist_count(&masscan->targets);
+    uint64_t count_ips6 = range6list_count(&masscan->targets_ipv6);
+    uint64_t range4;
+    ipv6address src_ipv6 = masscan->nic[parms->nic_index].src.ipv6;
     struct Throttler *throttler = parms->throttler;
     struct TemplateSet pkt_template = templ_copy(parms->tmplset);
     unsigned *picker = parms->picker;
@@ -282,9 +306,17 @@ transmit_thread(void *v) /*aka. scanning_thread() */
     uint64_t repeats = 0; /* --infinite repeats */
     uint64_t *status_syn_count;
     uint64_t entropy = masscan->seed;
+    struct ThreadMetrics *metrics = parms->metrics;
+    struct StageTimer *timer = NULL;
+    struct CoordClient *coord = parms->coord;
+    uint64_t chunk_first;
+    uint64_t chunk_span;
 
     LOG(1, "THREAD: xmit: starting thread #%u\n", parms->nic_index);
 
+    if (masscan->nic[parms->nic_index].pin.transmit_cpu >= 0)
+        pixie_cpu_set_affinity(masscan->nic[parms->nic_index].pin.transmit_cpu);
+
     /* export a pointer to this variable outside this threads so
      * that the 'status' system can print the rate of syns we are
      * sending */
@@ -301,16 +333,25 @@ transmit_thread(void *v) /*aka. scanning_thread() */
 
 
     /* "THROTTLER" rate-limits how fast we transmit, set with the
-     * --max-rate parameter */
-    throttler_start(throttler, masscan->max_rate/masscan->nic_count);
+     * --max-rate parameter, sending --burst packets at a time */
+    throttler_start(throttler, masscan->max_rate/masscan->nic_count,
+                    masscan->burst ? (masscan->burst + masscan->nic_count - 1)/masscan->nic_count : 0,
+                    rawsock_ring_size(adapter));
+
+    /* With --metrics, time each batch. That's at most one clock read
+     * every few thousand packets at high rates */
+    if (metrics->is_timing) {
+        timer = &metrics->tx;
+        stage_start(timer, Stage_Done);
+    }
 
 infinite:
 
     /* Create the shuffler/randomizer. This creates the 'range' variable,
      * which is simply the number of IP addresses times the number of
-     * ports */
-    range = rangelist_count(&masscan->targets)
-            * rangelist_count(&masscan->ports);
+     * ports. IPv6 targets are numbered after the IPv4 ones */
+    range4 = count_ips * rangelist_count(&masscan->ports);
+    range = range4 + count_ips6 * rangelist_count(&masscan->ports);
     blackrock_init(&blackrock, range, seed, masscan->blackrock_rounds);
 
     /* Calculate the 'start' and 'end' of a scan. One reason to do this is
@@ -325,6 +366,22 @@ infinite:
         end = start + masscan->resume.count;
     end += retries * rate;
 
+    /* With --worker, instead of doing all of the range, we do whatever
+     * chunks of it the coordinator gives us. Retries wrap around within
+     * the chunk the same way they wrap around the whole range. */
+    chunk_first = 0;
+    chunk_span = range;
+    if (coord) {
+        increment = 1;
+        start = end = 0;
+        if (coord_next_chunk(coord, &start, &end)) {
+next_chunk:
+            chunk_first = start;
+            chunk_span = end - start;
+            end += retries * (rate < chunk_span ? rate : chunk_span);
+        }
+    }
+
 
     /* -----------------
      * the main loop
@@ -332,6 +389,7 @@ infinite:
     LOG(3, "THREAD: xmit: starting main loop: [%llu..%llu]\n", start, end);
     for (i=start; i<end; ) {
         uint64_t batch_size;
+        uint64_t responses;
 
         /*
          * Do a batch of many packets at a time. That because per-packet
@@ -339,7 +397,9 @@ infinite:
          * per-packet cost by doing batches. At slower rates, the batch
          * size will always be one. (--max-rate)
          */
+        STAGE_LAP(timer, Stage_Throttle);
         batch_size = throttler_next_batch(throttler, packets_sent);
+        metrics->tx_batches++;
 
         /*
          * Transmit packets from other thread, when doing --banners. This
@@ -348,9 +408,12 @@ infinite:
          * then "batch_size" will get decremented to zero, and we won't be
          * able to transmit SYN packets.
          */
+        STAGE_LAP(timer, Stage_Flush);
+        responses = packets_sent;
         flush_packets(adapter, parms->packet_buffers, parms->transmit_queue,
                         &packets_sent, &batch_size);
-
+        metrics->tx_responses += packets_sent - responses;
+        STAGE_LAP(timer, Stage_Send);
 
         /*
          * Transmit a bunch of packets. At any rate slower than 100,000
@@ -359,10 +422,12 @@ infinite:
         while (batch_size && i < end) {
             uint64_t xXx;
             unsigned ip_them;
+            ipv6address ip6_them;
             unsigned port_them;
             unsigned ip_me;
             unsigned port_me;
             uint64_t cookie;
+            unsigned retry = retries + 1 - r; /* 0 on the first attempt */
 
 
             /*
@@ -375,15 +440,22 @@ infinite:
              *  order. Then, once we've shuffled the index, we "pick" the
              *  IP address and port that the index refers to.
              */
-            xXx = (i + (r--) * rate);
-            if (rate > range)
-                xXx %= range;
+            xXx = (i - chunk_first + (r--) * rate);
+            if (rate > chunk_span)
+                xXx %= chunk_span;
             else
-                while (xXx >= range)
-                    xXx -= range;
-            xXx = blackrock_shuffle(&blackrock,  xXx);
-            ip_them = rangelist_pick2(&masscan->targets, xXx % count_ips, picker);
-            port_them = rangelist_pick(&masscan->ports, xXx / count_ips);
+                while (xXx >= chunk_span)
+                    xXx -= chunk_span;
+            xXx = blackrock_shuffle(&blackrock,  xXx + chunk_first);
+            if (xXx < range4) {
+                ip_them = rangelist_pick2(&masscan->targets, xXx % count_ips, picker);
+                port_them = rangelist_pick(&masscan->ports, xXx / count_ips);
+            } else {
+                uint64_t index6 = xXx - range4;
+                ip_them = 0;
+                ip6_them = range6list_pick(&masscan->targets_ipv6, index6 % count_ips6);
+                port_them = rangelist_pick(&masscan->ports, index6 / count_ips6);
+            }
 
             /*
              * SYN-COOKIE LOGIC
@@ -400,7 +472,6 @@ infinite:
                 ip_me = src_ip;
                 port_me = src_port;
             }
-            cookie = syn_cookie(ip_them, port_them, ip_me, port_me, entropy);
 
             /*
              * SEND THE PROBE
@@ -409,14 +480,28 @@ infinite:
              *  be a "raw" transmit that bypasses the kernel, meaning
              *  we can call this function millions of times a second.
              */
-            rawsock_send_probe(
+            if (xXx < range4) {
+                cookie = syn_cookie(ip_them, port_them, ip_me, port_me, entropy);
+                rawsock_send_probe(
                     adapter,
                     ip_them, port_them,
                     ip_me, port_me,
                     (unsigned)cookie,
+                    retry,
                     !batch_size, /* flush queue on last packet in batch */
                     &pkt_template
                     );
+            } else {
+                cookie = syn_cookie_ipv6(ip6_them, port_them, src_ipv6, port_me, entropy);
+                rawsock_send_probe_ipv6(
+                    adapter,
+                    ip6_them, port_them,
+                    src_ipv6, port_me,
+                    (unsigned)cookie,
+                    !batch_size,
+                    &pkt_template
+                    );
+            }
             batch_size--;
             packets_sent++;
             (*status_syn_count)++;
@@ -440,7 +525,7 @@ infinite:
 
         /* save our current location for resuming, if the user pressed
          * <ctrl-c> to exit early */
-        parms->my_index = i;
+        parms->my_index = coord ? chunk_first : i;
 
         /* If the user pressed <ctrl-c>, then we need to exit. but, in case
          * the user wants to --resume the scan later, we save the current
@@ -450,11 +535,25 @@ infinite:
         }
     }
 
+    /*
+     * --worker
+     *  Tell the coordinator we finished this chunk, and get another. Once
+     *  there are none left, tell the status thread we are done.
+     */
+    if (coord) {
+        if (!is_tx_done) {
+            coord_chunk_done(coord);
+            if (coord_next_chunk(coord, &start, &end))
+                goto next_chunk;
+        }
+        parms->my_index = range + retries * rate;
+    }
+
     /*
      * --infinite
      *  For load testing, go around and do this again
      */
-    if (masscan->is_infinite && !is_tx_done) {
+    if (masscan->is_infinite && !is_tx_done && !coord) {
         seed++;
         repeats++;
         goto infinite;
@@ -479,9 +578,11 @@ infinite:
      * packets to arrive. Pressing <ctrl-c> a second time will exit this
      * prematurely.
      */
+    STAGE_LAP(timer, Stage_Done);
     while (!is_rx_done) {
         unsigned k;
         uint64_t batch_size;
+        uint64_t responses;
 
         for (k=0; k<1000; k++) {
             /*
@@ -492,11 +593,13 @@ infinite:
 
 
             /* Transmit packets from the receive thread */
+            responses = packets_sent;
             flush_packets(  adapter,
                             parms->packet_buffers,
                             parms->transmit_queue,
                             &packets_sent,
                             &batch_size);
+            metrics->tx_responses += packets_sent - responses;
 
             /* Make sure they've actually been transmitted, not just queued up for
              * transmit */
@@ -524,6 +627,103 @@ is_nic_port(const struct Masscan *masscan, unsigned ip)
     return 0;
 }
 
+/***************************************************************************
+ * Update the counters that the receive thread can't just increment as it
+ * goes, because they belong to the driver or the TCP connection table.
+ * This is called about once a second, or whenever we are idle.
+ ***************************************************************************/
+static void
+update_metrics(struct ThreadMetrics *metrics, struct Adapter *adapter,
+               struct TCP_ConnectionTable *tcpcon, struct Output *out)
+{
+    uint64_t received;
+    uint64_t dropped;
+    uint64_t ifdropped;
+
+    if (rawsock_get_stats(adapter, &received, &dropped, &ifdropped) == 0) {
+        metrics->nic_received = received;
+        metrics->nic_dropped = dropped;
+        metrics->nic_ifdropped = ifdropped;
+    }
+    if (tcpcon) {
+        tcpcon_get_load(tcpcon, &metrics->tcb_active, &metrics->tcb_buckets,
+                        &metrics->buffer_waits);
+        metrics->tcb_allocations = tcpcon_allocation_count(tcpcon);
+    }
+    metrics->output_bytes = output_bytes_written(out);
+}
+
+/***************************************************************************
+ * Responses to our IPv6 SYNs. There's no IPv6 in the user-mode TCP/IP
+ * stack, so these just get reported as open or closed: no banners, and
+ * no RST afterwards, which leaves that to the target's own timeout.
+ ***************************************************************************/
+static void
+handle_tcp_ipv6(struct Output *out, struct DedupTable *dedup,
+                const struct Source *src, const unsigned char *px,
+                const struct PreprocessedInfo *parsed, uint64_t entropy,
+                uint64_t *status_synack_count)
+{
+    ipv6address ip_them;
+    ipv6address ip_me;
+    unsigned port_them = parsed->port_src;
+    unsigned port_me = parsed->port_dst;
+    unsigned seqno_me;
+    unsigned cookie;
+    unsigned i;
+    int status;
+
+    if (parsed->found != FOUND_TCP)
+        return;
+
+    ip_them.hi = ip_them.lo = ip_me.hi = ip_me.lo = 0;
+    for (i=0; i<8; i++) {
+        ip_them.hi = ip_them.hi<<8 | parsed->ip_src[i];
+        ip_them.lo = ip_them.lo<<8 | parsed->ip_src[8+i];
+        ip_me.hi = ip_me.hi<<8 | parsed->ip_dst[i];
+        ip_me.lo = ip_me.lo<<8 | parsed->ip_dst[8+i];
+    }
+
+    /* verify: my IP address and port number */
+    if (!is_my_ipv6(src, ip_me) || !is_my_port(src, port_me))
+        return;
+
+    if (TCP_IS_SYNACK(px, parsed->transport_offset))
+        status = PortStatus_Open;
+    else if (TCP_IS_RST(px, parsed->transport_offset))
+        status = PortStatus_Closed;
+    else
+        return;
+
+    /* verify: syn-cookies */
+    seqno_me = TCP_ACKNO(px, parsed->transport_offset);
+    cookie = (unsigned)syn_cookie_ipv6(ip_them, port_them, ip_me, port_me, entropy);
+    if (cookie != seqno_me - 1) {
+        char buf[64];
+        LOG(5, "%s - bad cookie: ackno=0x%08x expected=0x%08x\n",
+            ipv6address_fmt(buf, sizeof(buf), ip_them), seqno_me-1, cookie);
+        return;
+    }
+
+    /* verify: ignore duplicates */
+    if (dedup_is_duplicate_ipv6(dedup, ip_them, port_them, port_me))
+        return;
+
+    if (status == PortStatus_Open)
+        (*status_synack_count)++;
+
+    output_report_status_ipv6(
+                out,
+                global_now,
+                status,
+                ip_them,
+                6, /* ip proto = tcp */
+                port_them,
+                px[parsed->transport_offset + 13], /* tcp flags */
+                parsed->ip_src[-1] /* hop limit */
+                );
+}
+
 /***************************************************************************
  *
  * Asynchronous receive thread
@@ -546,7 +746,12 @@ receive_thread(void *v)
     struct TCP_ConnectionTable *tcpcon = 0;
     uint64_t *status_synack_count;
     uint64_t *status_tcb_count;
+    uint64_t *status_tcb_leaks;
     uint64_t entropy = masscan->seed;
+    struct ThreadMetrics *metrics = parms->metrics;
+    struct StageTimer *timer = parms->is_replay ? &metrics->rx : NULL;
+    unsigned metrics_secs = 0;
+    unsigned tick_secs = 0;
 
     /* some status variables */
     status_synack_count = (uint64_t*)malloc(sizeof(uint64_t));
@@ -557,20 +762,17 @@ receive_thread(void *v)
     *status_tcb_count = 0;
     parms->total_tcbs = status_tcb_count;
 
+    status_tcb_leaks = (uint64_t*)malloc(sizeof(uint64_t));
+    *status_tcb_leaks = 0;
+    parms->total_tcb_leaks = status_tcb_leaks;
+
     LOG(1, "THREAD: recv: starting thread #%u\n", parms->nic_index);
 
-    /* Lock this thread to a CPU. Transmit threads are on even CPUs,
-     * receive threads on odd CPUs */
-    if (pixie_cpu_get_count() > 1) {
-        unsigned cpu_count = pixie_cpu_get_count();
-        unsigned cpu = parms->nic_index * 2 + 1;
-        while (cpu >= cpu_count) {
-            cpu -= cpu_count;
-            cpu++;
-        }
-        //TODO:
-        //pixie_cpu_set_affinity(cpu);
-    }
+    /* Lock this thread to the CPU chosen by pin_layout(), before
+     * creating the connection table and such, so that their memory comes
+     * from the adapter's NUMA node */
+    if (masscan->nic[parms->nic_index].pin.receive_cpu >= 0)
+        pixie_cpu_set_affinity(masscan->nic[parms->nic_index].pin.receive_cpu);
 
     /*
      * If configured, open a --pcap file for saving raw packets. This is
@@ -613,6 +815,7 @@ receive_thread(void *v)
             );
         tcpcon_set_banner_flags(tcpcon,
                 masscan->is_capture_cert,
+                masscan->is_capture_certdigest,
                 masscan->is_capture_html,
                 masscan->is_capture_heartbleed,
 				masscan->is_capture_ticketbleed);
@@ -649,6 +852,14 @@ receive_thread(void *v)
                                  strlen(foo),
                                  foo);
         }
+        if (masscan->tcp_timer_resolution) {
+            char foo[64];
+            sprintf_s(foo, sizeof(foo), "%u", masscan->tcp_timer_resolution);
+            tcpcon_set_parameter(   tcpcon,
+                                 "timer-resolution",
+                                 strlen(foo),
+                                 foo);
+        }
         if (masscan->tcp_hello_timeout) {
             char foo[64];
             sprintf_s(foo, sizeof(foo), "%u", masscan->tcp_connection_timeout);
@@ -707,6 +918,25 @@ receive_thread(void *v)
          *
          * This is the boring part of actually receiving a packet
          */
+        STAGE_LAP(timer, Stage_Recv);
+        if (parms->is_replay) {
+            /* with no transmit thread, we have to give the buffers
+             * of anything we "sent" back ourselves */
+            struct PacketBuffer *p;
+            while (rte_ring_sc_dequeue(parms->transmit_queue, (void**)&p) == 0) {
+                rte_ring_sp_enqueue(parms->packet_buffers, p);
+                metrics->tx_responses++;
+            }
+        } else if (metrics->is_timing) {
+            /* When scanning, only time one packet in 16, to keep the
+             * cost of reading the clock out of the way */
+            if ((metrics->rx_packets & 15) != 0)
+                timer = NULL;
+            else if (timer == NULL) {
+                timer = &metrics->rx;
+                stage_start(timer, Stage_Recv);
+            }
+        }
         err = rawsock_recv_packet(
                     adapter,
                     &length,
@@ -715,19 +945,50 @@ receive_thread(void *v)
                     &px);
 
         if (err != 0) {
-            if (tcpcon)
+            /* An empty poll isn't a packet: throw its time away rather
+             * than charging it to Stage_Recv, so the sample is taken from
+             * the next poll that returns one */
+            if (timer)
+                stage_start(timer, Stage_Done);
+            if (parms->is_replay)
+                break;
+            output_tick(out, time(0));
+            if (tcpcon) {
                 tcpcon_timeouts(tcpcon, (unsigned)time(0), 0);
+                *status_tcb_leaks = tcpcon_leaked_tcbs(tcpcon);
+            }
+            if (metrics->is_timing)
+                update_metrics(metrics, adapter, tcpcon, out);
             continue;
         }
 
+        metrics->rx_packets++;
+        metrics->rx_bytes += length;
+        if (metrics->is_timing && secs != metrics_secs) {
+            update_metrics(metrics, adapter, tcpcon, out);
+            metrics_secs = secs;
+        }
+
+        /* Busy with packets that aren't results, we might never be idle,
+         * so also give the output its tick when the second changes */
+        if (secs != tick_secs) {
+            output_tick(out, time(0));
+            tick_secs = secs;
+        }
+
+        /* When replaying, the clock is whatever the recording says */
+        if (parms->is_replay)
+            global_now = secs;
 
         /*
          * Do any TCP event timeouts based on the current timestamp from
          * the packet. For example, if the connection has been open for
          * around 10 seconds, we'll close the connection. (--banners)
          */
+        STAGE_LAP(timer, Stage_Timeouts);
         if (tcpcon) {
             tcpcon_timeouts(tcpcon, secs, usecs);
+            *status_tcb_leaks = tcpcon_leaked_tcbs(tcpcon);
         }
 
         if (length > 1514)
@@ -738,9 +999,15 @@ receive_thread(void *v)
          * figure out where the TCP/IP headers are and the locations of
          * some fields, like IP address and port numbers.
          */
+        STAGE_LAP(timer, Stage_Parse);
         x = preprocess_frame(px, length, data_link, &parsed);
         if (!x)
             continue; /* corrupt packet */
+        if (parsed.ip_version == 6) {
+            handle_tcp_ipv6(out, dedup, &parms->src, px, &parsed, entropy,
+                            status_synack_count);
+            continue;
+        }
         ip_me = parsed.ip_dst[0]<<24 | parsed.ip_dst[1]<<16
             | parsed.ip_dst[2]<< 8 | parsed.ip_dst[3]<<0;
         ip_them = parsed.ip_src[0]<<24 | parsed.ip_src[1]<<16
@@ -766,6 +1033,7 @@ receive_thread(void *v)
         /*
          * Handle non-TCP protocols
          */
+        STAGE_LAP(timer, Stage_Dispatch);
         switch (parsed.found) {
             case FOUND_ARP:
                 LOGip(2, ip_them, 0, "-> ARP [%u] \n", px[parsed.found_offset]);
@@ -808,6 +1076,7 @@ receive_thread(void *v)
                     continue;
                 if (parms->masscan->nmap.packet_trace)
                     packet_trace(stdout, parms->pt_start, px, length, 0);
+                payloads_record_response(masscan->payloads, port_them);
                 handle_udp(out, secs, px, length, &parsed, entropy);
                 continue;
             case FOUND_ICMP:
@@ -850,6 +1119,7 @@ receive_thread(void *v)
         }
 
         /* If recording --banners, create a new "TCP Control Block (TCB)" */
+        STAGE_LAP(timer, Stage_Tcp);
         if (tcpcon) {
             struct TCP_Control_Block *tcb;
 
@@ -921,6 +1191,7 @@ receive_thread(void *v)
 
         }
 
+        STAGE_LAP(timer, Stage_Report);
         if (TCP_IS_SYNACK(px, parsed.transport_offset)
             || TCP_IS_RST(px, parsed.transport_offset)) {
 
@@ -987,12 +1258,16 @@ receive_thread(void *v)
      * cleanup
      */
 end:
+    STAGE_LAP(timer, Stage_Teardown);
+    if (metrics->is_timing)
+        update_metrics(metrics, adapter, tcpcon, out);
     if (tcpcon)
         tcpcon_destroy_table(tcpcon);
     dedup_destroy(dedup);
     output_destroy(out);
     if (pcapfile)
         pcapfile_close(pcapfile);
+    STAGE_LAP(timer, Stage_Done);
 
     for (;;) {
         void *p;
@@ -1036,6 +1311,33 @@ static void control_c_handler(int x)
 
 
 
+/***************************************************************************
+ * Write a line of --metrics for each thread pair, with the things we
+ * sample from here rather than having the threads count them.
+ ***************************************************************************/
+static void
+export_metrics(struct MetricsExport *x, time_t now,
+               struct ThreadPair *parms_array, unsigned count)
+{
+    unsigned i;
+
+    for (i=0; i<count; i++) {
+        struct ThreadPair *parms = &parms_array[i];
+        struct MetricsSample sample;
+
+        memset(&sample, 0, sizeof(sample));
+        if (parms->total_syns)
+            sample.probes = *parms->total_syns;
+        sample.rate = parms->throttler->current_rate;
+        sample.throttle_sleeps = parms->throttler->sleep_count;
+        sample.throttle_usecs = parms->throttler->sleep_usecs;
+        sample.packet_buffers = rte_ring_count(parms->packet_buffers);
+        sample.transmit_queue = rte_ring_count(parms->transmit_queue);
+
+        metrics_export_thread(x, now, i, parms->metrics, &sample);
+    }
+}
+
 /***************************************************************************
  * Called from main() to initiate the scan.
  * Launches the 'transmit_thread()' and 'receive_thread()' and waits for
@@ -1046,7 +1348,9 @@ main_scan(struct Masscan *masscan)
 {
     struct ThreadPair parms_array[8];
     uint64_t count_ips;
+    uint64_t count_ips6;
     uint64_t count_ports;
+    uint64_t scan_size;
     uint64_t range;
     unsigned index;
     unsigned *picker;
@@ -1054,6 +1358,8 @@ main_scan(struct Masscan *masscan)
     struct Status status;
     uint64_t min_index = UINT64_MAX;
     struct MassScript *script = NULL;
+    struct MetricsExport *metrics = NULL;
+    int is_pinned;
 
     memset(parms_array, 0, sizeof(parms_array));
 
@@ -1082,7 +1388,8 @@ main_scan(struct Masscan *masscan)
      * Initialize the task size
      */
     count_ips = rangelist_count(&masscan->targets);
-    if (count_ips == 0) {
+    count_ips6 = range6list_count(&masscan->targets_ipv6);
+    if (count_ips == 0 && count_ips6 == 0) {
         LOG(0, "FAIL: target IP address list empty\n");
         LOG(0, " [hint] try something like \"--range 10.0.0.0/8\"\n");
         LOG(0, " [hint] try something like \"--range 192.168.0.100-192.168.0.200\"\n");
@@ -1095,7 +1402,33 @@ main_scan(struct Masscan *masscan)
         LOG(0, " [hint] try something like \"--ports 0-65535\"\n");
         return 1;
     }
-    range = count_ips * count_ports + (uint64_t)(masscan->retries * masscan->max_rate);
+    scan_size = count_ips * count_ports;
+
+    /*
+     * IPv6 targets come after the IPv4 ones in the same scan. Since they
+     * are only TCP, all the ports must be too. A whole /64 can't be
+     * scanned, and that's caught here as being too big to count: its
+     * count saturates at UINT64_MAX, so that value means overflow too.
+     */
+    if (count_ips6) {
+        unsigned i;
+
+        for (i=0; i<masscan->ports.count; i++) {
+            if (masscan->ports.list[i].end > Templ_TCP + 65535) {
+                LOG(0, "FAIL: only TCP ports can be scanned on IPv6 targets\n");
+                return 1;
+            }
+        }
+        if (count_ips6 == UINT64_MAX
+                || count_ips6 > (UINT64_MAX - scan_size) / count_ports) {
+            LOG(0, "FAIL: IPv6 target range too big\n");
+            LOG(0, " [hint] IPv6 targets should be a list of addresses, "
+                    "given with --includefile\n");
+            return 1;
+        }
+        scan_size += count_ips6 * count_ports;
+    }
+    range = scan_size + (uint64_t)(masscan->retries * masscan->max_rate);
 
     /*
      * If doing an ARP scan, then don't allow port scanning
@@ -1124,6 +1457,35 @@ main_scan(struct Masscan *masscan)
      */
     payloads_trim(masscan->payloads, &masscan->ports);
 
+    /*
+     * Open where we are going to send --metrics, before starting threads,
+     * so that they know whether to time themselves.
+     */
+    if (masscan->metrics.filename[0]) {
+        metrics = metrics_export_create(masscan->metrics.filename,
+                                        masscan->metrics.interval);
+        if (metrics == NULL)
+            return 1;
+    }
+
+    /*
+     * With --worker, each transmit thread gets its chunks of the scan from
+     * the coordinator. It also decides the --seed, so that all the
+     * workers shuffle the targets the same way.
+     */
+    if (masscan->coord.is_worker) {
+        for (index=0; index<masscan->nic_count; index++) {
+            uint64_t seed;
+
+            parms_array[index].coord = coord_connect(masscan->coord.address,
+                                                     scan_size,
+                                                     &seed);
+            if (parms_array[index].coord == NULL)
+                exit(1);
+            masscan->seed = seed;
+        }
+    }
+
     /* Optimize target selection so it's a quick binary search instead
      * of walking large memory tables. When we scan the entire Internet
      * our --excludefile will chop up our pristine 0.0.0.0/0 range into
@@ -1134,6 +1496,17 @@ main_scan(struct Masscan *masscan)
   __AFL_INIT();
 #endif
 
+    /*
+     * Decide which CPUs each adapter's threads run on
+     */
+    pin_layout(masscan);
+
+    /*
+     * Calibrate the throttler's clock now, while there's only one thread,
+     * rather than in every transmit thread at once
+     */
+    pixie_ticks_per_second();
+
     /*
      * Start scanning threats for each adapter
      */
@@ -1147,6 +1520,7 @@ main_scan(struct Masscan *masscan)
         parms->my_index = masscan->resume.index;
         parms->done_transmitting = 0;
         parms->done_receiving = 0;
+        parms->metrics = metrics_create(metrics != NULL);
 
         /* needed for --packet-trace option so that we know when we started
          * the scan */
@@ -1165,7 +1539,7 @@ main_scan(struct Masscan *masscan)
         if (err != 0)
             exit(1);
         parms->adapter = masscan->nic[index].adapter;
-        if (masscan->nic[index].src.ip.range == 0) {
+        if (masscan->nic[index].src.ip.range == 0 && count_ips) {
             LOG(0, "FAIL: failed to detect IP of interface\n");
             LOG(0, " [hint] did you spell the name correctly?\n");
             LOG(0, " [hint] if it has no IP address, "
@@ -1219,8 +1593,10 @@ main_scan(struct Masscan *masscan)
 
 
         /*
-         * Allocate packet buffers for sending
+         * Allocate packet buffers for sending, from the memory of the
+         * adapter's NUMA node, by touching them first from there
          */
+        is_pinned = pin_to_node(masscan, index);
 #define BUFFER_COUNT 16384
         parms->packet_buffers = rte_ring_create(BUFFER_COUNT, RING_F_SP_ENQ|RING_F_SC_DEQ);
         parms->transmit_queue = rte_ring_create(BUFFER_COUNT, RING_F_SP_ENQ|RING_F_SC_DEQ);
@@ -1239,6 +1615,8 @@ main_scan(struct Masscan *masscan)
                 }
             }
         }
+        if (is_pinned)
+            pin_restore();
 
 
         /*
@@ -1275,14 +1653,14 @@ main_scan(struct Masscan *masscan)
             { /* ICMP only */
                 LOG(0, " -- forced options: -sn -n --randomize-hosts -v --send-eth\n");
                 LOG(0, "Initiating ICMP Echo Scan\n");
-                LOG(0, "Scanning %u hosts\n",(unsigned)count_ips);
+                LOG(0, "Scanning %u hosts\n",(unsigned)(count_ips + count_ips6));
              }
         else /* This could actually also be a UDP only or mixed UDP/TCP/ICMP scan */
             {
                 LOG(0, " -- forced options: -sS -Pn -n --randomize-hosts -v --send-eth\n");
                 LOG(0, "Initiating SYN Stealth Scan\n");
                 LOG(0, "Scanning %u hosts [%u port%s/host]\n",
-                    (unsigned)count_ips, (unsigned)count_ports, (count_ports==1)?"":"s");
+                    (unsigned)(count_ips + count_ips6), (unsigned)count_ports, (count_ports==1)?"":"s");
             }
     }
 
@@ -1296,6 +1674,7 @@ main_scan(struct Masscan *masscan)
         unsigned i;
         double rate = 0;
         uint64_t total_tcbs = 0;
+        uint64_t total_tcb_leaks = 0;
         uint64_t total_synacks = 0;
         uint64_t total_syns = 0;
 
@@ -1312,6 +1691,8 @@ main_scan(struct Masscan *masscan)
 
             if (parms->total_tcbs)
                 total_tcbs += *parms->total_tcbs;
+            if (parms->total_tcb_leaks)
+                total_tcb_leaks += *parms->total_tcb_leaks;
             if (parms->total_synacks)
                 total_synacks += *parms->total_synacks;
             if (parms->total_syns)
@@ -1329,9 +1710,12 @@ main_scan(struct Masscan *masscan)
          */
         if (masscan->output.is_status_updates)
             status_print(&status, min_index, range, rate,
-                total_tcbs, total_synacks, total_syns,
+                total_tcbs, total_tcb_leaks, total_synacks, total_syns,
                 0);
 
+        if (metrics_export_is_due(metrics, time(0)))
+            export_metrics(metrics, time(0), parms_array, masscan->nic_count);
+
         /* Sleep for almost a second */
         pixie_mssleep(750);
     }
@@ -1340,7 +1724,7 @@ main_scan(struct Masscan *masscan)
      * If we haven't completed the scan, then save the resume
      * information.
      */
-    if (min_index < count_ips * count_ports) {
+    if (min_index < scan_size && !masscan->coord.is_worker) {
         masscan->resume.index = min_index;
 
         /* Write current settings to "paused.conf" so that the scan can be restarted */
@@ -1359,6 +1743,7 @@ main_scan(struct Masscan *masscan)
         unsigned i;
         double rate = 0;
         uint64_t total_tcbs = 0;
+        uint64_t total_tcb_leaks = 0;
         uint64_t total_synacks = 0;
         uint64_t total_syns = 0;
 
@@ -1375,6 +1760,8 @@ main_scan(struct Masscan *masscan)
 
             if (parms->total_tcbs)
                 total_tcbs += *parms->total_tcbs;
+            if (parms->total_tcb_leaks)
+                total_tcb_leaks += *parms->total_tcb_leaks;
             if (parms->total_synacks)
                 total_synacks += *parms->total_synacks;
             if (parms->total_syns)
@@ -1386,9 +1773,12 @@ main_scan(struct Masscan *masscan)
         if (time(0) - now >= masscan->wait)
             is_rx_done = 1;
 
+        if (metrics_export_is_due(metrics, time(0)))
+            export_metrics(metrics, time(0), parms_array, masscan->nic_count);
+
         if (masscan->output.is_status_updates) {
             status_print(&status, min_index, range, rate,
-                total_tcbs, total_synacks, total_syns,
+                total_tcbs, total_tcb_leaks, total_synacks, total_syns,
                 masscan->wait - (time(0) - now));
 
             for (i=0; i<masscan->nic_count; i++) {
@@ -1430,10 +1820,25 @@ main_scan(struct Masscan *masscan)
 
     LOG(1, "THREAD: status: stopping thread\n");
 
+    for (index=0; index<masscan->nic_count; index++)
+        coord_close(parms_array[index].coord);
+
+    /* One last time, with the final counts */
+    if (metrics) {
+        unsigned i;
+
+        export_metrics(metrics, time(0), parms_array, masscan->nic_count);
+        metrics_export_destroy(metrics);
+        for (i=0; i<masscan->nic_count; i++)
+            metrics_destroy(parms_array[i].metrics);
+    }
+
     /*
      * Now cleanup everything
      */
     status_finish(&status);
+    if (masscan->output.is_status_updates)
+        payloads_print_responses(stderr, masscan->payloads);
     rangelist_pick2_destroy(picker);
 
     if (!masscan->output.is_status_updates) {
@@ -1447,6 +1852,191 @@ main_scan(struct Masscan *masscan)
 
 
 
+/***************************************************************************
+ * Find when the capture starts, so that the clock can start from there.
+ * Also, if the user didn't tell us what address/port the recorded scan
+ * came from, then guess it from the destination of the first TCP or UDP
+ * packet, which is what a --pcap file from an earlier scan contains.
+ ***************************************************************************/
+static int
+replay_peek_capture(const char *filename, struct Source *src, time_t *start)
+{
+    struct PcapFile *pcapfile;
+    unsigned char *px;
+    int is_found = 0;
+    int is_first = 1;
+
+    pcapfile = pcapfile_openread(filename);
+    if (pcapfile == NULL)
+        return 0;
+    px = (unsigned char *)malloc(65536);
+    if (px == NULL)
+        exit(1);
+
+    while (!is_found) {
+        unsigned secs, usecs, original_length, length;
+        struct PreprocessedInfo parsed;
+
+        if (!pcapfile_readframe(pcapfile, &secs, &usecs,
+                                &original_length, &length, px, 65536))
+            break;
+        if (is_first) {
+            *start = secs;
+            is_first = 0;
+        }
+        if (!preprocess_frame(px, length, pcapfile_datalink(pcapfile), &parsed))
+            continue;
+        if (parsed.found != FOUND_TCP && parsed.found != FOUND_UDP
+            && parsed.found != FOUND_DNS)
+            continue;
+
+        if (src->ip.range == 0) {
+            src->ip.first = parsed.ip_dst[0]<<24 | parsed.ip_dst[1]<<16
+                            | parsed.ip_dst[2]<< 8 | parsed.ip_dst[3]<<0;
+            src->ip.last = src->ip.first;
+            src->ip.range = 1;
+        }
+        if (src->port.range == 0) {
+            src->port.first = parsed.port_dst;
+            src->port.last = parsed.port_dst;
+            src->port.range = 1;
+        }
+        is_found = 1;
+    }
+
+    free(px);
+    pcapfile_close(pcapfile);
+    return is_found;
+}
+
+/***************************************************************************
+ * Called for "--benchmark-replay <file>". This runs a recorded capture of
+ * responses through 'receive_thread()', as fast as it'll go, with time
+ * taken from the timestamps in the capture rather than the clock. This is
+ * so that we can regression test the speed of the receive side, such as
+ * new banner parsers, without needing the network.
+ ***************************************************************************/
+static int
+main_benchmark_replay(struct Masscan *masscan)
+{
+    struct ThreadPair parms[1];
+    struct ThreadMetrics *metrics;
+    unsigned char zero_mac[6] = {0};
+    uint64_t banout_start;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t loop = 0;
+    uint64_t total = 0;
+    unsigned i;
+
+    memset(parms, 0, sizeof(parms[0]));
+
+    parms->adapter = rawsock_init_replay(masscan->replay_filename,
+                                         masscan->nmap.packet_trace);
+    if (parms->adapter == NULL)
+        return 1;
+
+    /* Replies to the recorded scan are only accepted if they have the
+     * right address, port, and syn-cookie, so those have to be the same
+     * as when the capture was made */
+    parms->src = masscan->nic[0].src;
+    if (!replay_peek_capture(masscan->replay_filename, &parms->src, &global_now)) {
+        LOG(0, "FAIL: replay: no TCP or UDP packets in capture\n");
+        return 1;
+    }
+
+    /* Unless asked for, don't spend the benchmark printing to the console */
+    if (masscan->output.format == 0)
+        masscan->output.format = Output_None;
+    masscan->is_offline = 0;
+
+    parms->masscan = masscan;
+    parms->nic_index = 0;
+    parms->pt_start = 1.0 * pixie_gettime() / 1000000.0;
+    parms->metrics = metrics = metrics_create(1);
+    parms->is_replay = 1;
+    template_packet_init(
+                parms->tmplset,
+                zero_mac,
+                zero_mac,
+                masscan->payloads,
+                rawsock_datalink(parms->adapter),
+                masscan->seed);
+
+    parms->packet_buffers = rte_ring_create(BUFFER_COUNT, RING_F_SP_ENQ|RING_F_SC_DEQ);
+    parms->transmit_queue = rte_ring_create(BUFFER_COUNT, RING_F_SP_ENQ|RING_F_SC_DEQ);
+    for (i=0; i<BUFFER_COUNT-1; i++) {
+        struct PacketBuffer *p;
+
+        p = (struct PacketBuffer *)malloc(sizeof(*p));
+        if (p == NULL)
+            exit(1);
+        rte_ring_sp_enqueue(parms->packet_buffers, p);
+    }
+
+    /*
+     * Run the receive path in this thread, until it runs out of packets
+     */
+    banout_start = banout_allocation_count();
+    stage_start(&metrics->rx, Stage_Setup);
+    start = metrics->rx.last;
+    receive_thread(parms);
+    elapsed = pixie_nanotime() - start;
+
+    /* the rate is just for the per-packet stages, not setup/teardown */
+    for (i=Stage_Setup; i<=Stage_Teardown; i++) {
+        total += metrics->rx.ns[i];
+        if (i != Stage_Setup && i != Stage_Teardown)
+            loop += metrics->rx.ns[i];
+    }
+    if (total == 0)
+        total = 1;
+    if (loop == 0)
+        loop = 1;
+
+    for (;;) {
+        void *p;
+        if (rte_ring_sc_dequeue(parms->transmit_queue, (void**)&p) != 0)
+            break;
+        free(p);
+    }
+
+    /*
+     * Report
+     */
+    printf("=== replaying %s ===\n", masscan->replay_filename);
+    printf("seed         = %" PRIu64 "\n", masscan->seed);
+    printf("packets      = %" PRIu64 " (%" PRIu64 " bytes)\n",
+           metrics->rx_packets, metrics->rx_bytes);
+    printf("elapsed      = %8.3f-seconds\n", elapsed/1000000000.0);
+    printf("rate         = %8.3f-million packets/second\n",
+           (metrics->rx_packets * 1000.0)/loop);
+    printf("syn-acks     = %" PRIu64 "\n", *parms->total_synacks);
+    printf("tcbs         = %" PRIu64 " created, %" PRIu64 " allocated\n",
+           *parms->total_tcbs, metrics->tcb_allocations);
+    printf("banouts      = %" PRIu64 " allocated\n",
+           banout_allocation_count() - banout_start);
+    printf("responses    = %" PRIu64 " queued for transmit\n",
+           metrics->tx_responses);
+    printf("\n%-14s %12s %8s %8s %12s %7s\n",
+           "stage", "ns/packet", "p50-ns", "p99-ns", "total-ms", "share");
+    for (i=Stage_Setup; i<=Stage_Teardown; i++) {
+        printf("%-14s %12.1f %8" PRIu64 " %8" PRIu64 " %12.3f %6.1f%%\n",
+               metric_stage_names[i],
+               metrics->rx_packets?(1.0*metrics->rx.ns[i]/metrics->rx_packets):0.0,
+               histogram_percentile(&metrics->hist[i], NULL, 0.50),
+               histogram_percentile(&metrics->hist[i], NULL, 0.99),
+               metrics->rx.ns[i]/1000000.0,
+               100.0*metrics->rx.ns[i]/total);
+    }
+
+    free(parms->total_synacks);
+    free(parms->total_tcbs);
+    free(parms->total_tcb_leaks);
+    metrics_destroy(metrics);
+    return 0;
+}
+
 /***************************************************************************
  ***************************************************************************/
 int main(int argc, char *argv[])
@@ -1541,19 +2131,27 @@ int main(int argc, char *argv[])
     {
         uint64_t range = rangelist_count(&masscan->targets) * rangelist_count(&masscan->ports);
         uint64_t range2;
+        uint64_t count6;
+        uint64_t count6_2;
+
+        range6list_optimize(&masscan->targets_ipv6);
+        count6 = range6list_count(&masscan->targets_ipv6);
+
         rangelist_exclude(&masscan->targets, &masscan->exclude_ip);
         rangelist_exclude(&masscan->ports, &masscan->exclude_port);
+        range6list_exclude(&masscan->targets_ipv6, &masscan->exclude_ipv6);
         //rangelist_remove_range2(&masscan->targets, range_parse_ipv4("224.0.0.0/4", 0, 0));
 
         range2 = rangelist_count(&masscan->targets) * rangelist_count(&masscan->ports);
+        count6_2 = range6list_count(&masscan->targets_ipv6);
 
-        if (range != 0 && range2 == 0) {
+        if ((range != 0 || count6 != 0) && range2 == 0 && count6_2 == 0) {
             LOG(0, "FAIL: no ranges left to scan\n");
             LOG(0, "   ...all ranges overlapped something in an excludefile range\n");
             exit(1);
         }
 
-        if (range2 != range && masscan->resume.index) {
+        if ((range2 != range || count6_2 != count6) && masscan->resume.index) {
             LOG(0, "FAIL: Attempted to add additional 'exclude' ranges after scan start.\n");
             LOG(0, "   ...This messes things up the scan randomization, so you have to restart scan\n");
             exit(1);
@@ -1623,11 +2221,18 @@ int main(int argc, char *argv[])
         }
         break;
 
+    case Operation_Coordinator:
+        return main_coordinator(masscan);
+
     case Operation_Benchmark:
+        if (masscan->replay_filename[0])
+            return main_benchmark_replay(masscan);
         printf("=== benchmarking (%u-bits) ===\n\n", (unsigned)sizeof(void*)*8);
         blackrock_benchmark(masscan->blackrock_rounds);
         blackrock2_benchmark(masscan->blackrock_rounds);
         smack_benchmark();
+        tcpcon_benchmark();
+        throttler_benchmark();
         exit(1);
         break;
 
@@ -1638,10 +2243,21 @@ int main(int argc, char *argv[])
         {
             int x = 0;
             x += smack_selftest();
+            x += timeouts_selftest();
             x += sctp_selftest();
             x += base64_selftest();
+            x += sha_selftest();
+            x += metrics_selftest();
+            x += coord_selftest();
+            x += compress_selftest();
+            x += throttler_selftest();
+            x += pin_selftest();
             x += banner1_selftest();
             x += output_selftest();
+            x += redis_selftest();
+            x += tcpcon_selftest();
+            x += indexed_selftest();
+            x += pixie_compress_selftest();
             x += siphash24_selftest();
             x += ntp_selftest();
             x += snmp_selftest();
@@ -1651,6 +2267,7 @@ int main(int argc, char *argv[])
             x += lcg_selftest();
             x += template_selftest();
             x += ranges_selftest();
+            x += ranges6_selftest();
             x += pixie_time_selftest();
             x += rte_ring_selftest();
             x += mainconf_selftest();
@@ -35,6 +35,7 @@ masscan_app_to_string(enum ApplicationProtocol proto)
     case PROTO_VNC_RFB: return "vnc";
     case PROTO_SAFE:    return "safe";
     case PROTO_MEMCACHED: return "memcached";
+    case PROTO_X509_DIGEST: return "X509-digest";
             
     default:
         sprintf_s(tmp, sizeof(tmp), "(%u)", proto);
@@ -74,6 +75,7 @@ masscan_string_to_app(const char *str)
         {"vnc",         PROTO_VNC_RFB},
         {"safe",        PROTO_SAFE},
         {"memcached",   PROTO_MEMCACHED},
+        {"x509-digest", PROTO_X509_DIGEST},
         {0,0}
     };
     size_t i;
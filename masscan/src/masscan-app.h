@@ -30,6 +30,7 @@ enum ApplicationProtocol {
     PROTO_VNC_RFB,
     PROTO_SAFE,
     PROTO_MEMCACHED,
+    PROTO_X509_DIGEST,      /* fingerprints and names instead of the whole cert */
 };
 
 const char *
@@ -2,6 +2,7 @@
 #define MASSCAN_H
 #include "string_s.h"
 #include "main-src.h"
+#include "main-pin.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -31,6 +32,7 @@ enum Operation {
     Operation_ReadScan = 6,         /* --readscan <binary-output> */
     Operation_ReadRange = 7,        /* --readrange */
     Operation_Benchmark = 8,        /* --benchmark */
+    Operation_Coordinator = 9,      /* --coordinator <address> */
 };
 
 /**
@@ -55,6 +57,7 @@ enum OutputFormat {
     Output_Unicornscan  = 0x0200,   /* -oU, "unicornscan" */
     Output_None         = 0x0400,
     Output_Certs        = 0x0800,
+    Output_Indexed      = 0x1000,   /* -oI, "indexed", blocks + index */
     Output_All          = 0xFFBF,   /* not supported */
 };
 
@@ -120,6 +123,7 @@ struct Masscan
         unsigned char my_mac_count;
         unsigned vlan_id;
         unsigned is_vlan:1;
+        struct PinPlace pin; /* which CPUs this adapter's threads run on */
     } nic[8];
     unsigned nic_count;
 
@@ -155,6 +159,15 @@ struct Masscan
     struct RangeList exclude_ip;
     struct RangeList exclude_port;
 
+    /**
+     * IPv6 targets and excludes, which are kept apart from IPv4 because
+     * they are mostly long lists of single addresses from hitlists.
+     * They are numbered after the IPv4 targets, so that both are
+     * shuffled together. Only TCP ports are scanned on them.
+     */
+    struct Range6List targets_ipv6;
+    struct Range6List exclude_ipv6;
+
 
     /**
      * Maximum rate, in packets-per-second (--rate parameter). This can be
@@ -163,6 +176,27 @@ struct Masscan
      */
     double max_rate;
 
+    /**
+     * --burst
+     * The most packets sent back-to-back. Packets go out in bursts of this
+     * many, evenly spaced to keep to --rate. Zero means a millisecond's
+     * worth, up to what the adapter can queue at once.
+     */
+    uint64_t burst;
+
+    /**
+     * --pin <auto|none|cpu-list>
+     * Which processors the transmit and receive threads run on. By default
+     * they are placed on the adapter's NUMA node, away from each other's
+     * hyperthreads. A list gives transmit and receive pairs, in the order
+     * of the adapters.
+     */
+    struct {
+        unsigned cpus[16];
+        unsigned count;
+        unsigned is_none:1;
+    } pin;
+
     /**
      * Number of retries (--retries or --max-retries parameter). Retries
      * happen a few seconds apart.
@@ -178,6 +212,7 @@ struct Masscan
     unsigned is_noreset:1;      /* --noreset */
     unsigned is_gmt:1;          /* --gmt, all times in GMT */
     unsigned is_capture_cert:1; /* --capture cert */
+    unsigned is_capture_certdigest:1; /* --capture certdigest */
     unsigned is_capture_html:1; /* --capture html */
     unsigned is_capture_heartbleed:1; /* --capture heartbleed */
     unsigned is_capture_ticketbleed:1; /* --capture ticket */
@@ -311,6 +346,27 @@ struct Masscan
         */
         unsigned is_status_updates:1;
 
+        /**
+         * --indexed-codec, --indexed-block-size
+         * How the "indexed" binary format compresses its blocks, and how
+         * big they are before compression.
+         */
+        struct {
+            unsigned codec;
+            unsigned block_size;
+        } indexed;
+
+        /**
+         * --output-compress, --output-compress-threads
+         * Compress the output file with gzip or zstd. Unless the codec
+         * is set explicitly, it's guessed from the filename extension.
+         */
+        struct {
+            unsigned codec;
+            unsigned threads;
+            unsigned is_set:1;
+        } compress;
+
         struct {
             /**
              * When we should rotate output into the target directory
@@ -347,6 +403,35 @@ struct Masscan
 
     char pcap_filename[256];
 
+    /**
+     * --benchmark-replay <file>
+     * A capture of responses to run through the receive path, instead of
+     * the usual benchmarks.
+     */
+    char replay_filename[256];
+
+    /**
+     * --metrics <file>, --metrics-interval <secs>
+     * Where to write per-thread counters and stage latencies as NDJSON,
+     * either a file or "unix:<path>" for a unix-domain socket.
+     */
+    struct {
+        char filename[256];
+        unsigned interval;
+    } metrics;
+
+    /**
+     * --coordinator <address>, --worker <address>
+     * Hand out chunks of the scan to workers on demand, or get them from
+     * a coordinator, instead of using a fixed --shard.
+     */
+    struct {
+        char address[256];
+        char journal[256];          /* --coordinator-journal <file> */
+        uint64_t chunk_size;        /* --chunk-size <n> */
+        unsigned is_worker:1;
+    } coord;
+
     struct {
         unsigned timeout;
     } tcb;
@@ -365,6 +450,17 @@ struct Masscan
      * hellos, such as FTP or VNC */
     unsigned tcp_hello_timeout;
 
+    /** Granularity, in milliseconds, of the timeouts of the "banners"
+     * TCP connections. Zero means the default (about 1 millisecond) */
+    unsigned tcp_timer_resolution;
+
+    /**
+     * --readscan-threads
+     * Number of threads decoding blocks of "indexed" files in --readscan,
+     * or zero to use one per CPU.
+     */
+    unsigned readscan_threads;
+
     struct {
         const char *header_name;
         unsigned char *header_value;
@@ -50,15 +50,11 @@ binary_out_close(struct Output *out, FILE *fp)
 
 /****************************************************************************
  ****************************************************************************/
-static void
-binary_out_status(struct Output *out, FILE *fp, time_t timestamp,
-    int status, unsigned ip, unsigned ip_proto, unsigned port, unsigned reason, unsigned ttl)
+unsigned
+binary_record_status(unsigned char *foo, time_t timestamp, int status,
+                     unsigned ip, unsigned ip_proto, unsigned port,
+                     unsigned reason, unsigned ttl)
 {
-    unsigned char foo[256];
-    size_t bytes_written;
-
-    UNUSEDPARM(out);
-
     /* [TYPE] field */
     switch (status) {
     case PortStatus_Open:
@@ -71,7 +67,7 @@ binary_out_status(struct Output *out, FILE *fp, time_t timestamp,
         foo[0] = Out_Arp2;
         break;
     default:
-        return;
+        return 0;
     }
 
     /* [LENGTH] field */
@@ -96,10 +92,26 @@ binary_out_status(struct Output *out, FILE *fp, time_t timestamp,
     foo[13] = (unsigned char)reason;
     foo[14] = (unsigned char)ttl;
 
+    return 15;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+static void
+binary_out_status(struct Output *out, FILE *fp, time_t timestamp,
+    int status, unsigned ip, unsigned ip_proto, unsigned port, unsigned reason, unsigned ttl)
+{
+    unsigned char foo[256];
+    unsigned length;
+    size_t bytes_written;
 
+    length = binary_record_status(foo, timestamp, status, ip, ip_proto,
+                                  port, reason, ttl);
+    if (length == 0)
+        return;
 
-    bytes_written = fwrite(&foo, 1, 15, fp);
-    if (bytes_written != 15) {
+    bytes_written = fwrite(&foo, 1, length, fp);
+    if (bytes_written != length) {
         perror("output");
         exit(1);
     }
@@ -109,25 +121,21 @@ binary_out_status(struct Output *out, FILE *fp, time_t timestamp,
 
 /****************************************************************************
  ****************************************************************************/
-static void
-binary_out_banner(struct Output *out, FILE *fp, time_t timestamp,
-        unsigned ip, unsigned ip_proto, unsigned port,
-        enum ApplicationProtocol proto, unsigned ttl,
-        const unsigned char *px, unsigned length)
+unsigned
+binary_record_banner(unsigned char *foo, time_t timestamp,
+                     unsigned ip, unsigned ip_proto, unsigned port,
+                     enum ApplicationProtocol proto, unsigned ttl,
+                     const unsigned char *px, unsigned length)
 {
-    unsigned char foo[32768];
     unsigned i;
-    size_t bytes_written;
     static const unsigned HeaderLength = 14;
 
-    UNUSEDPARM(out);
-
     /* [TYPE] field */
     foo[0] = Out_Banner9; /*banner*/
 
     /* [LENGTH] field*/
     if (length >= 128 * 128 - HeaderLength)
-        return;
+        return 0;
     if (length < 128 - HeaderLength) {
         foo[1] = (unsigned char)(length + HeaderLength);
         i = 2;
@@ -161,9 +169,28 @@ binary_out_banner(struct Output *out, FILE *fp, time_t timestamp,
     /* Banner */
     memcpy(foo+i+14, px, length);
 
+    return length + i + HeaderLength;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+static void
+binary_out_banner(struct Output *out, FILE *fp, time_t timestamp,
+        unsigned ip, unsigned ip_proto, unsigned port,
+        enum ApplicationProtocol proto, unsigned ttl,
+        const unsigned char *px, unsigned length)
+{
+    unsigned char foo[32768];
+    unsigned record_length;
+    size_t bytes_written;
+
+    record_length = binary_record_banner(foo, timestamp, ip, ip_proto, port,
+                                         proto, ttl, px, length);
+    if (record_length == 0)
+        return;
 
-    bytes_written = fwrite(&foo, 1, length+i+HeaderLength, fp);
-    if (bytes_written != length+i+HeaderLength) {
+    bytes_written = fwrite(&foo, 1, record_length, fp);
+    if (bytes_written != record_length) {
         perror("output");
         exit(1);
     }
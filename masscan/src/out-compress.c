@@ -0,0 +1,456 @@
+/*
+    Compressed output files
+
+    Rather than teach every output module (XML, JSON, grepable, ...) how
+    to compress, we hand them a FILE that compresses whatever is written
+    to it. On Linux that's fopencookie(), and on the BSDs and Mac OS X
+    it's funopen().
+
+    A single thread can't compress as fast as a /0 banner scan produces
+    output, so the data is cut into 1-megabyte blocks that helper threads
+    compress independently. Each block becomes its own zstd frame or gzip
+    member. Both formats allow these to be concatenated, so the normal
+    command-line tools decompress the file as if it were one stream, at a
+    cost of a percent or so in size. Blocks are written in the order they
+    were filled, no matter which helper finishes first.
+*/
+#define _GNU_SOURCE
+#include "out-compress.h"
+#include "pixie-threads.h"
+#include "pixie-timer.h"
+#include "logger.h"
+#include "string_s.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GLIBC__)
+#define COMPRESS_COOKIE 1
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) \
+    || defined(__NetBSD__)
+#define COMPRESS_FUNOPEN 1
+#endif
+
+#define COMPRESS_BLOCK_SIZE (1024 * 1024)
+#define COMPRESS_MAX_THREADS 16
+
+struct CompressBlock {
+    unsigned char *in;
+    size_t in_length;
+    unsigned char *out;
+    size_t out_max;
+    size_t out_length;
+    unsigned is_done;
+};
+
+struct CompressFile {
+    FILE *fp;
+    enum PixieCodec codec;
+
+    /* a ring of blocks, 'submitted' of them having been handed to the
+     * helpers, 'claimed' of those being picked up by a helper, and
+     * 'written' of those written to the file, all counting up forever */
+    struct CompressBlock *blocks;
+    unsigned block_count;
+    unsigned submitted;
+    unsigned claimed;
+    unsigned written;
+
+    /* compressed bytes written so far, which is what ftell() reports,
+     * so that --rotate-size is about the size on disk */
+    uint64_t bytes_written;
+
+    size_t thread_handles[COMPRESS_MAX_THREADS];
+    unsigned thread_count;
+    unsigned cpus[64];
+    unsigned cpu_count;
+    unsigned is_closing;
+    unsigned is_error:1;
+};
+
+
+/***************************************************************************
+ ***************************************************************************/
+enum PixieCodec
+compress_codec_from_filename(const char *filename)
+{
+    size_t length = strlen(filename);
+
+    if (length > 3 && strcmp(filename + length - 3, ".gz") == 0)
+        return Codec_Gzip;
+    if (length > 4 && strcmp(filename + length - 4, ".zst") == 0)
+        return Codec_Zstd;
+    if (length > 5 && strcmp(filename + length - 5, ".zstd") == 0)
+        return Codec_Zstd;
+    return Codec_None;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+compress_block(struct CompressFile *cf, struct CompressBlock *block)
+{
+    block->out_length = pixie_compress(cf->codec, block->out, block->out_max,
+                                       block->in, block->in_length);
+}
+
+/***************************************************************************
+ * Helpers claim the next submitted block, compress it, and flag it as
+ * done for the writing thread to pick up.
+ ***************************************************************************/
+static void
+compress_thread(void *v)
+{
+    struct CompressFile *cf = (struct CompressFile *)v;
+
+    if (cf->cpu_count)
+        pixie_cpu_set_affinity_list(cf->cpus, cf->cpu_count);
+
+    for (;;) {
+        unsigned seqno = cf->claimed;
+        struct CompressBlock *block;
+
+        if (seqno == cf->submitted) {
+            if (cf->is_closing)
+                break;
+            pixie_usleep(1000);
+            continue;
+        }
+        if (!rte_atomic32_cmpset(&cf->claimed, seqno, seqno + 1))
+            continue;
+
+        block = &cf->blocks[seqno % cf->block_count];
+        compress_block(cf, block);
+
+        /* atomic, so the result is visible before the flag */
+        rte_atomic32_cmpset(&block->is_done, 0, 1);
+    }
+}
+
+/***************************************************************************
+ * Write the blocks that are done, in order. If 'is_wait', wait until the
+ * oldest one is done, so there's room for another.
+ ***************************************************************************/
+static void
+compress_drain(struct CompressFile *cf, int is_wait)
+{
+    while (cf->written != cf->submitted) {
+        struct CompressBlock *block = &cf->blocks[cf->written % cf->block_count];
+
+        /* atomic read, so we see the result the flag is guarding */
+        if (!rte_atomic32_cmpset(&block->is_done, 1, 1)) {
+            if (!is_wait)
+                return;
+            pixie_usleep(100);
+            continue;
+        }
+        is_wait = 0;
+
+        if (block->out_length == 0 && block->in_length != 0) {
+            if (!cf->is_error)
+                LOG(0, "output: compression failed\n");
+            cf->is_error = 1;
+        } else if (fwrite(block->out, 1, block->out_length, cf->fp)
+                   != block->out_length) {
+            if (!cf->is_error)
+                LOG(0, "output: write failed\n");
+            cf->is_error = 1;
+        }
+        cf->bytes_written += block->out_length;
+        block->in_length = 0;
+        cf->written++;
+    }
+}
+
+/***************************************************************************
+ * Hand the block being filled to the helpers, and make sure the next one
+ * is free.
+ ***************************************************************************/
+static void
+compress_submit(struct CompressFile *cf)
+{
+    struct CompressBlock *block = &cf->blocks[cf->submitted % cf->block_count];
+
+    if (block->in_length == 0)
+        return;
+    block->is_done = 0;
+    if (cf->thread_count == 0) {
+        compress_block(cf, block);
+        block->is_done = 1;
+    }
+    rte_wmb();
+    pixie_locked_add_u32(&cf->submitted, 1);
+
+    compress_drain(cf, cf->submitted - cf->written >= cf->block_count);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static size_t
+compress_write(struct CompressFile *cf, const char *buf, size_t length)
+{
+    size_t total = length;
+
+    while (length) {
+        struct CompressBlock *block = &cf->blocks[cf->submitted % cf->block_count];
+        size_t n = COMPRESS_BLOCK_SIZE - block->in_length;
+
+        if (n > length)
+            n = length;
+        memcpy(block->in + block->in_length, buf, n);
+        block->in_length += n;
+        buf += n;
+        length -= n;
+
+        if (block->in_length == COMPRESS_BLOCK_SIZE)
+            compress_submit(cf);
+    }
+    return cf->is_error ? 0 : total;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static int
+compress_close(struct CompressFile *cf)
+{
+    unsigned i;
+    int is_error;
+
+    compress_submit(cf);
+    while (cf->written != cf->submitted)
+        compress_drain(cf, 1);
+
+    cf->is_closing = 1;
+    for (i=0; i<cf->thread_count; i++)
+        pixie_thread_join(cf->thread_handles[i]);
+
+    is_error = cf->is_error;
+    if (fclose(cf->fp) != 0)
+        is_error = 1;
+
+    for (i=0; i<cf->block_count; i++) {
+        free(cf->blocks[i].in);
+        free(cf->blocks[i].out);
+    }
+    free(cf->blocks);
+    free(cf);
+    return is_error ? -1 : 0;
+}
+
+/***************************************************************************
+ * The callbacks for fopencookie() and funopen()
+ ***************************************************************************/
+#if defined(COMPRESS_COOKIE)
+static ssize_t
+cookie_write(void *cookie, const char *buf, size_t length)
+{
+    return (ssize_t)compress_write((struct CompressFile *)cookie, buf, length);
+}
+static int
+cookie_seek(void *cookie, off64_t *offset, int whence)
+{
+    struct CompressFile *cf = (struct CompressFile *)cookie;
+    if (whence != SEEK_CUR || *offset != 0)
+        return -1;
+    *offset = (off64_t)cf->bytes_written;
+    return 0;
+}
+static int
+cookie_close(void *cookie)
+{
+    return compress_close((struct CompressFile *)cookie);
+}
+#elif defined(COMPRESS_FUNOPEN)
+static int
+funopen_write(void *cookie, const char *buf, int length)
+{
+    return (int)compress_write((struct CompressFile *)cookie, buf, (size_t)length);
+}
+static fpos_t
+funopen_seek(void *cookie, fpos_t offset, int whence)
+{
+    struct CompressFile *cf = (struct CompressFile *)cookie;
+    if (whence != SEEK_CUR || offset != 0)
+        return -1;
+    return (fpos_t)cf->bytes_written;
+}
+static int
+funopen_close(void *cookie)
+{
+    return compress_close((struct CompressFile *)cookie);
+}
+#endif
+
+/***************************************************************************
+ ***************************************************************************/
+FILE *
+compress_fopen(FILE *fp, enum PixieCodec codec, unsigned threads,
+               const unsigned *cpus, unsigned cpu_count)
+{
+#if defined(COMPRESS_COOKIE) || defined(COMPRESS_FUNOPEN)
+    struct CompressFile *cf;
+    FILE *result;
+    unsigned i;
+
+    if (codec == Codec_None)
+        return fp;
+    if (pixie_compress_init(codec) != 0) {
+        LOG(0, "output: %s: library not found, writing uncompressed\n",
+            pixie_codec_to_name(codec));
+        return fp;
+    }
+
+    cf = (struct CompressFile *)calloc(1, sizeof(*cf));
+    if (cf == NULL)
+        exit(1);
+    if (threads > COMPRESS_MAX_THREADS)
+        threads = COMPRESS_MAX_THREADS;
+    cf->fp = fp;
+    cf->codec = codec;
+    cf->thread_count = threads;
+    if (cpus && cpu_count) {
+        if (cpu_count > sizeof(cf->cpus)/sizeof(cf->cpus[0]))
+            cpu_count = sizeof(cf->cpus)/sizeof(cf->cpus[0]);
+        memcpy(cf->cpus, cpus, cpu_count * sizeof(cpus[0]));
+        cf->cpu_count = cpu_count;
+    }
+    cf->block_count = threads * 2 + 1;
+    cf->blocks = (struct CompressBlock *)calloc(cf->block_count,
+                                                sizeof(cf->blocks[0]));
+    if (cf->blocks == NULL)
+        exit(1);
+    for (i=0; i<cf->block_count; i++) {
+        struct CompressBlock *block = &cf->blocks[i];
+
+        block->out_max = pixie_compress_bound(codec, COMPRESS_BLOCK_SIZE);
+        block->in = (unsigned char *)malloc(COMPRESS_BLOCK_SIZE);
+        block->out = (unsigned char *)malloc(block->out_max);
+        if (block->in == NULL || block->out == NULL)
+            exit(1);
+    }
+
+#if defined(COMPRESS_COOKIE)
+    {
+        cookie_io_functions_t funcs;
+
+        memset(&funcs, 0, sizeof(funcs));
+        funcs.write = cookie_write;
+        funcs.seek = cookie_seek;
+        funcs.close = cookie_close;
+        result = fopencookie(cf, "w", funcs);
+    }
+#else
+    result = funopen(cf, NULL, funopen_write, funopen_seek, funopen_close);
+#endif
+    if (result == NULL) {
+        LOG(0, "output: couldn't create compressed stream\n");
+        for (i=0; i<cf->block_count; i++) {
+            free(cf->blocks[i].in);
+            free(cf->blocks[i].out);
+        }
+        free(cf->blocks);
+        free(cf);
+        return fp;
+    }
+
+    for (i=0; i<threads; i++)
+        cf->thread_handles[i] = pixie_begin_thread(compress_thread, 0, cf);
+    return result;
+#else
+    if (codec != Codec_None)
+        LOG(0, "output: compression not supported on this platform\n");
+    return fp;
+#endif
+}
+
+
+/***************************************************************************
+ * Write several blocks' worth through a compressed stream into memory, and
+ * make sure it's the same as compressing each block on its own, which
+ * means the blocks came out in order and each can be decompressed alone.
+ ***************************************************************************/
+static void
+selftest_records(FILE *fp)
+{
+    unsigned i;
+
+    for (i=0; i<100000; i++)
+        fprintf(fp, "{\"ip\":\"10.0.%u.%u\",\"port\":%u}\n",
+                (i>>8)&0xFF, i&0xFF, i%1000);
+}
+
+int
+compress_selftest(void)
+{
+#if defined(COMPRESS_COOKIE)
+    static const enum PixieCodec codecs[] = {Codec_Zstd, Codec_Gzip};
+    char *plain = NULL;
+    size_t plain_length = 0;
+    unsigned char *expected = NULL;
+    char *buf = NULL;
+    size_t length = 0;
+    unsigned c;
+    FILE *fp;
+
+    if (compress_codec_from_filename("a.json.gz") != Codec_Gzip
+        || compress_codec_from_filename("a.zst") != Codec_Zstd
+        || compress_codec_from_filename("gz") != Codec_None)
+        goto fail;
+
+    fp = open_memstream(&plain, &plain_length);
+    if (fp == NULL)
+        goto fail;
+    selftest_records(fp);
+    fclose(fp);
+    if (plain_length < 2 * COMPRESS_BLOCK_SIZE)
+        goto fail;
+
+    for (c=0; c<sizeof(codecs)/sizeof(codecs[0]); c++) {
+        size_t bound = pixie_compress_bound(codecs[c], COMPRESS_BLOCK_SIZE);
+        size_t expected_length = 0;
+        size_t offset;
+        unsigned threads;
+
+        if (pixie_compress_init(codecs[c]) != 0)
+            continue;
+
+        expected = (unsigned char *)malloc(bound * (plain_length/COMPRESS_BLOCK_SIZE + 1));
+        if (expected == NULL)
+            goto fail;
+        for (offset=0; offset<plain_length; offset += COMPRESS_BLOCK_SIZE) {
+            size_t n = plain_length - offset;
+            if (n > COMPRESS_BLOCK_SIZE)
+                n = COMPRESS_BLOCK_SIZE;
+            expected_length += pixie_compress(codecs[c],
+                                              expected + expected_length, bound,
+                                              plain + offset, n);
+        }
+
+        for (threads=0; threads<=3; threads += 3) {
+            fp = open_memstream(&buf, &length);
+            if (fp == NULL)
+                goto fail;
+            fp = compress_fopen(fp, codecs[c], threads, NULL, 0);
+            selftest_records(fp);
+            if (fclose(fp) != 0)
+                goto fail;
+            if (length != expected_length || memcmp(buf, expected, length) != 0)
+                goto fail;
+            free(buf);
+            buf = NULL;
+        }
+        free(expected);
+        expected = NULL;
+    }
+    free(plain);
+    return 0;
+fail:
+    fprintf(stderr, "compress: selftest failed\n");
+    free(plain);
+    free(expected);
+    free(buf);
+    return 1;
+#else
+    return 0;
+#endif
+}
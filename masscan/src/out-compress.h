@@ -0,0 +1,44 @@
+#ifndef OUT_COMPRESS_H
+#define OUT_COMPRESS_H
+#include <stdio.h>
+#include "pixie-compress.h"
+
+/**
+ * Guess the codec from the output filename, "scan.json.gz" being gzip and
+ * "scan.xml.zst" being zstd.
+ * @return
+ *      the codec, or Codec_None if the extension isn't one we know
+ */
+enum PixieCodec
+compress_codec_from_filename(const char *filename);
+
+/**
+ * Wrap an open file so that everything written to it is compressed,
+ * without the output modules having to know. Data is cut into blocks that
+ * are compressed on helper threads, each block into its own zstd frame
+ * or gzip member, then written to the file in order. Closing the returned
+ * FILE finishes the last block and closes the original, so each file is
+ * complete on its own, which is what we want when rotating.
+ *
+ * This needs fopencookie() or funopen(). Where neither exists, this
+ * prints a warning and returns the original file.
+ *
+ * @param fp
+ *      The open file, which is closed along with the returned one.
+ * @param threads
+ *      The number of helper threads, or zero to compress on the thread
+ *      that's writing.
+ * @param cpus
+ *      The processors the helpers may run on, or NULL for any. This is
+ *      the rest of the adapter's NUMA node, from pin_layout().
+ * @return
+ *      the file to write to, or NULL on failure
+ */
+FILE *
+compress_fopen(FILE *fp, enum PixieCodec codec, unsigned threads,
+               const unsigned *cpus, unsigned cpu_count);
+
+int
+compress_selftest(void);
+
+#endif
@@ -152,6 +152,26 @@ grepable_out_status(struct Output *out, FILE *fp, time_t timestamp,
                 );
 }
 
+/****************************************************************************
+ ****************************************************************************/
+static void
+grepable_out_status6(struct Output *out, FILE *fp, time_t timestamp,
+    int status, ipv6address ip, unsigned ip_proto, unsigned port, unsigned reason, unsigned ttl)
+{
+    char addr[64];
+    UNUSEDPARM(timestamp);
+    UNUSEDPARM(out);
+    UNUSEDPARM(reason);
+    UNUSEDPARM(ttl);
+
+    fprintf(fp, "Host: %s ()", ipv6address_fmt(addr, sizeof(addr), ip));
+    fprintf(fp, "\tPorts: %u/%s/%s/%s/%s/%s/%s\n",
+                port,
+                status_string(status),
+                name_from_ip_proto(ip_proto),
+                "", "", "", "");
+}
+
 /****************************************************************************
  * Prints out "banner" information for a port. This is done when there is
  * a protocol defined for a port, and we do some interaction to find out
@@ -199,5 +219,6 @@ const struct OutputType grepable_output = {
     grepable_out_open,
     grepable_out_close,
     grepable_out_status,
-    grepable_out_banner
+    grepable_out_banner,
+    grepable_out_status6
 };
@@ -0,0 +1,694 @@
+/*
+    INDEXED BINARY OUTPUT
+
+    The "-oB" binary format is a plain stream of records, so reading it
+    back with "--readscan" means parsing every record in order, even to
+    pull out one port from a huge file. This format stores the same
+    records in blocks:
+
+      [file header] "masscan/2.0\ns:<start-time>\n..." padded to 99 bytes
+      [block]       192-byte summary, then the records (maybe compressed)
+      [block]       ...
+      [index]       "MIDX", count, then (offset, summary) for every block
+      [trailer]     "MEND", reserved, offset of the index
+
+    The summary of each block records the range of IP addresses, which
+    ports and banner-types appear, and how it's compressed. A reader can
+    map the file, read the index from the end, skip every block that
+    can't pass its filters, and hand the rest to different threads.
+
+    All integers are big-endian, like the rest of the binary format.
+*/
+#include "out-indexed.h"
+#include "out-record.h"
+#include "output.h"
+#include "masscan-app.h"
+#include "masscan-status.h"
+#include "pixie-compress.h"
+#include "ranges.h"
+#include "logger.h"
+#include "string_s.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct IndexedWriter {
+    enum PixieCodec codec;
+    unsigned block_size;
+
+    /* records for the current block, before compression */
+    unsigned char *raw;
+    unsigned raw_length;
+    struct IndexedBlock current;
+
+    /* scratch buffer for the compressed block */
+    unsigned char *packed;
+    size_t packed_max;
+
+    /* summaries of the blocks written so far, for the index */
+    struct IndexedBlock *index;
+    unsigned index_count;
+    unsigned index_max;
+
+    /* where the next block will go within the file */
+    uint64_t offset;
+};
+
+
+/****************************************************************************
+ ****************************************************************************/
+static void *
+indexed_realloc(void *p, size_t size)
+{
+    p = realloc(p, size?size:1);
+    if (p == NULL) {
+        fprintf(stderr, "indexed: out of memory error\n");
+        exit(1);
+    }
+    return p;
+}
+
+
+/****************************************************************************
+ ****************************************************************************/
+static void
+put32(unsigned char *px, unsigned x)
+{
+    px[0] = (unsigned char)(x>>24);
+    px[1] = (unsigned char)(x>>16);
+    px[2] = (unsigned char)(x>> 8);
+    px[3] = (unsigned char)(x>> 0);
+}
+static void
+put64(unsigned char *px, uint64_t x)
+{
+    put32(px+0, (unsigned)(x>>32));
+    put32(px+4, (unsigned)(x>>0));
+}
+static unsigned
+get32(const unsigned char *px)
+{
+    return px[0]<<24 | px[1]<<16 | px[2]<<8 | px[3];
+}
+static uint64_t
+get64(const unsigned char *px)
+{
+    return ((uint64_t)get32(px+0))<<32 | get32(px+4);
+}
+
+
+/****************************************************************************
+ ****************************************************************************/
+static void
+block_header_encode(unsigned char *px, const struct IndexedBlock *block)
+{
+    memset(px, 0, INDEXED_BLOCK_HEADER_SIZE);
+    memcpy(px, "MBLK", 4);
+    px[4] = (unsigned char)block->codec;
+    put32(px +  8, block->raw_length);
+    put32(px + 12, block->stored_length);
+    put32(px + 16, block->record_count);
+    put32(px + 20, block->min_ip);
+    put32(px + 24, block->max_ip);
+    put32(px + 28, block->flags);
+    memcpy(px + 32, block->ports, sizeof(block->ports));
+    memcpy(px + 160, block->app_protos, sizeof(block->app_protos));
+}
+
+/****************************************************************************
+ * @return 1 if this looks like a block header, 0 otherwise
+ ****************************************************************************/
+static int
+block_header_decode(const unsigned char *px, uint64_t offset,
+                    struct IndexedBlock *block)
+{
+    if (memcmp(px, "MBLK", 4) != 0)
+        return 0;
+    block->offset = offset;
+    block->codec = px[4];
+    block->raw_length = get32(px + 8);
+    block->stored_length = get32(px + 12);
+    block->record_count = get32(px + 16);
+    block->min_ip = get32(px + 20);
+    block->max_ip = get32(px + 24);
+    block->flags = get32(px + 28);
+    memcpy(block->ports, px + 32, sizeof(block->ports));
+    memcpy(block->app_protos, px + 160, sizeof(block->app_protos));
+    if (block->raw_length > INDEXED_BLOCK_SIZE_MAX + BINARY_RECORD_MAX)
+        return 0;
+    return 1;
+}
+
+
+/****************************************************************************
+ ****************************************************************************/
+static void
+block_reset(struct IndexedBlock *block)
+{
+    memset(block, 0, sizeof(*block));
+    block->min_ip = 0xFFFFFFFF;
+}
+
+static void
+block_add(struct IndexedBlock *block, unsigned ip, unsigned port,
+          unsigned app_proto, unsigned flag)
+{
+    if (block->min_ip > ip)
+        block->min_ip = ip;
+    if (block->max_ip < ip)
+        block->max_ip = ip;
+    port &= 0xFFFF;
+    block->ports[port>>9] |= 1 << ((port>>6) & 7);
+    if (flag == INDEXED_HAS_BANNER) {
+        app_proto &= 0xFF;
+        block->app_protos[app_proto>>3] |= 1 << (app_proto & 7);
+    }
+    block->flags |= flag;
+    block->record_count++;
+}
+
+
+/****************************************************************************
+ * Write out the current block, compressing it if configured to, and
+ * remember its summary for the index.
+ ****************************************************************************/
+static void
+indexed_flush(struct Output *out, FILE *fp, struct IndexedWriter *w)
+{
+    unsigned char header[INDEXED_BLOCK_HEADER_SIZE];
+    struct IndexedBlock *block = &w->current;
+    const unsigned char *data = w->raw;
+    size_t bytes_written;
+
+    if (w->raw_length == 0)
+        return;
+
+    block->offset = w->offset;
+    block->codec = Codec_None;
+    block->raw_length = w->raw_length;
+    block->stored_length = w->raw_length;
+
+    /* Keep the compressed version only if it's smaller */
+    if (w->codec != Codec_None) {
+        size_t x;
+        x = pixie_compress(w->codec, w->packed, w->packed_max,
+                           w->raw, w->raw_length);
+        if (x != 0 && x < w->raw_length) {
+            block->codec = w->codec;
+            block->stored_length = (unsigned)x;
+            data = w->packed;
+        }
+    }
+
+    block_header_encode(header, block);
+    bytes_written = fwrite(header, 1, sizeof(header), fp);
+    bytes_written += fwrite(data, 1, block->stored_length, fp);
+    if (bytes_written != sizeof(header) + block->stored_length) {
+        perror("output");
+        exit(1);
+    }
+    out->rotate.bytes_written += bytes_written;
+    w->offset += bytes_written;
+
+    if (w->index_count >= w->index_max) {
+        w->index_max = w->index_max * 2 + 64;
+        w->index = indexed_realloc(w->index, w->index_max * sizeof(w->index[0]));
+    }
+    w->index[w->index_count++] = *block;
+
+    w->raw_length = 0;
+    block_reset(&w->current);
+}
+
+
+/****************************************************************************
+ ****************************************************************************/
+static void
+indexed_out_open(struct Output *out, FILE *fp)
+{
+    char firstrecord[INDEXED_FILE_HEADER_SIZE];
+    struct IndexedWriter *w;
+    size_t bytes_written;
+
+    w = indexed_realloc(0, sizeof(*w));
+    memset(w, 0, sizeof(*w));
+    w->codec = out->indexed.codec;
+    w->block_size = out->indexed.block_size;
+    if (w->block_size == 0 || w->block_size > INDEXED_BLOCK_SIZE_MAX)
+        w->block_size = INDEXED_BLOCK_SIZE_DEFAULT;
+    if (pixie_compress_init(w->codec) != 0)
+        w->codec = Codec_None;
+    w->raw = indexed_realloc(0, w->block_size + BINARY_RECORD_MAX);
+    if (w->codec != Codec_None) {
+        w->packed_max = pixie_compress_bound(w->codec,
+                                    w->block_size + BINARY_RECORD_MAX);
+        w->packed = indexed_realloc(0, w->packed_max);
+    }
+    block_reset(&w->current);
+    out->indexed.writer = w;
+
+    memset(firstrecord, 0, sizeof(firstrecord));
+    sprintf_s(firstrecord, sizeof(firstrecord), "%s\ns:%u\nb:%u\nc:%s\n",
+        INDEXED_MAGIC,
+        (unsigned)out->when_scan_started,
+        w->block_size,
+        pixie_codec_to_name(w->codec));
+    bytes_written = fwrite(firstrecord, 1, sizeof(firstrecord), fp);
+    if (bytes_written != sizeof(firstrecord)) {
+        perror("output");
+        exit(1);
+    }
+    out->rotate.bytes_written += bytes_written;
+    w->offset = bytes_written;
+}
+
+
+/****************************************************************************
+ * Write the last block, then the index and the trailer that points to it.
+ ****************************************************************************/
+static void
+indexed_out_close(struct Output *out, FILE *fp)
+{
+    struct IndexedWriter *w = out->indexed.writer;
+    unsigned char buf[INDEXED_INDEX_ENTRY_SIZE];
+    uint64_t index_offset;
+    size_t bytes_written = 0;
+    unsigned i;
+
+    if (w == NULL)
+        return;
+
+    indexed_flush(out, fp, w);
+    index_offset = w->offset;
+
+    memcpy(buf, "MIDX", 4);
+    put32(buf+4, w->index_count);
+    bytes_written += fwrite(buf, 1, 8, fp);
+    for (i=0; i<w->index_count; i++) {
+        put64(buf, w->index[i].offset);
+        block_header_encode(buf+8, &w->index[i]);
+        bytes_written += fwrite(buf, 1, INDEXED_INDEX_ENTRY_SIZE, fp);
+    }
+
+    memcpy(buf, "MEND", 4);
+    put32(buf+4, 0);
+    put64(buf+8, index_offset);
+    bytes_written += fwrite(buf, 1, INDEXED_TRAILER_SIZE, fp);
+
+    if (bytes_written != 8 + (size_t)w->index_count * INDEXED_INDEX_ENTRY_SIZE
+                          + INDEXED_TRAILER_SIZE) {
+        perror("output");
+        exit(1);
+    }
+    out->rotate.bytes_written += bytes_written;
+
+    free(w->raw);
+    free(w->packed);
+    free(w->index);
+    free(w);
+    out->indexed.writer = NULL;
+}
+
+
+/****************************************************************************
+ ****************************************************************************/
+static void
+indexed_out_status(struct Output *out, FILE *fp, time_t timestamp,
+    int status, unsigned ip, unsigned ip_proto, unsigned port, unsigned reason, unsigned ttl)
+{
+    struct IndexedWriter *w = out->indexed.writer;
+    unsigned length;
+
+    length = binary_record_status(w->raw + w->raw_length, timestamp, status,
+                                  ip, ip_proto, port, reason, ttl);
+    if (length == 0)
+        return;
+    w->raw_length += length;
+    block_add(&w->current, ip, port, 0, INDEXED_HAS_STATUS);
+
+    if (w->raw_length >= w->block_size)
+        indexed_flush(out, fp, w);
+}
+
+
+/****************************************************************************
+ ****************************************************************************/
+static void
+indexed_out_banner(struct Output *out, FILE *fp, time_t timestamp,
+        unsigned ip, unsigned ip_proto, unsigned port,
+        enum ApplicationProtocol proto, unsigned ttl,
+        const unsigned char *px, unsigned length)
+{
+    struct IndexedWriter *w = out->indexed.writer;
+    unsigned record_length;
+
+    record_length = binary_record_banner(w->raw + w->raw_length, timestamp,
+                                         ip, ip_proto, port, proto, ttl,
+                                         px, length);
+    if (record_length == 0)
+        return;
+    w->raw_length += record_length;
+    block_add(&w->current, ip, port, proto, INDEXED_HAS_BANNER);
+
+    if (w->raw_length >= w->block_size)
+        indexed_flush(out, fp, w);
+}
+
+
+/****************************************************************************
+ * Read the index at the end of the file. It's only used if it describes
+ * every block from the start of the file to the index itself.
+ ****************************************************************************/
+static struct IndexedBlock *
+read_index(const unsigned char *px, uint64_t length, unsigned *count)
+{
+    struct IndexedBlock *blocks;
+    uint64_t index_offset;
+    uint64_t expected;
+    unsigned n;
+    unsigned i;
+
+    if (length < INDEXED_FILE_HEADER_SIZE + 8 + INDEXED_TRAILER_SIZE)
+        return NULL;
+    if (memcmp(px + length - INDEXED_TRAILER_SIZE, "MEND", 4) != 0)
+        return NULL;
+    index_offset = get64(px + length - INDEXED_TRAILER_SIZE + 8);
+    if (index_offset < INDEXED_FILE_HEADER_SIZE
+        || index_offset + 8 > length - INDEXED_TRAILER_SIZE)
+        return NULL;
+    if (memcmp(px + index_offset, "MIDX", 4) != 0)
+        return NULL;
+    n = get32(px + index_offset + 4);
+    if (index_offset + 8 + (uint64_t)n * INDEXED_INDEX_ENTRY_SIZE
+        != length - INDEXED_TRAILER_SIZE)
+        return NULL;
+
+    blocks = indexed_realloc(0, (n?n:1) * sizeof(blocks[0]));
+    expected = INDEXED_FILE_HEADER_SIZE;
+    for (i=0; i<n; i++) {
+        const unsigned char *entry = px + index_offset + 8
+                                    + (uint64_t)i * INDEXED_INDEX_ENTRY_SIZE;
+        uint64_t offset = get64(entry);
+
+        if (offset != expected
+            || !block_header_decode(entry + 8, offset, &blocks[i])
+            || memcmp(px + offset, "MBLK", 4) != 0) {
+            free(blocks);
+            return NULL;
+        }
+        expected = offset + INDEXED_BLOCK_HEADER_SIZE + blocks[i].stored_length;
+        if (expected > index_offset) {
+            free(blocks);
+            return NULL;
+        }
+    }
+    if (expected != index_offset) {
+        free(blocks);
+        return NULL;
+    }
+
+    *count = n;
+    return blocks;
+}
+
+/****************************************************************************
+ * Without a usable index, walk the headers. A file that was appended to
+ * has another file header, blocks, index and trailer after the first,
+ * so we step over those. A file that was cut short ends with a partial
+ * block, which we ignore.
+ ****************************************************************************/
+static struct IndexedBlock *
+walk_blocks(const unsigned char *px, uint64_t length, unsigned *count)
+{
+    struct IndexedBlock *blocks = NULL;
+    unsigned n = 0;
+    unsigned max = 0;
+    uint64_t offset = INDEXED_FILE_HEADER_SIZE;
+
+    while (offset + 8 <= length) {
+        const unsigned char *p = px + offset;
+
+        if (memcmp(p, "MBLK", 4) == 0) {
+            struct IndexedBlock block;
+
+            if (offset + INDEXED_BLOCK_HEADER_SIZE > length)
+                break;
+            if (!block_header_decode(p, offset, &block))
+                break;
+            if (offset + INDEXED_BLOCK_HEADER_SIZE + block.stored_length > length) {
+                LOG(0, "readscan: file truncated in the middle of a block\n");
+                break;
+            }
+            if (n >= max) {
+                max = max * 2 + 64;
+                blocks = indexed_realloc(blocks, max * sizeof(blocks[0]));
+            }
+            blocks[n++] = block;
+            offset += INDEXED_BLOCK_HEADER_SIZE + block.stored_length;
+        } else if (memcmp(p, "MIDX", 4) == 0) {
+            offset += 8 + (uint64_t)get32(p+4) * INDEXED_INDEX_ENTRY_SIZE;
+        } else if (memcmp(p, "MEND", 4) == 0) {
+            offset += INDEXED_TRAILER_SIZE;
+        } else if (offset + INDEXED_FILE_HEADER_SIZE <= length
+                    && memcmp(p, INDEXED_MAGIC, strlen(INDEXED_MAGIC)) == 0) {
+            offset += INDEXED_FILE_HEADER_SIZE;
+        } else {
+            LOG(0, "readscan: corrupt block at offset %" PRIu64 "\n", offset);
+            break;
+        }
+    }
+
+    if (blocks == NULL)
+        blocks = indexed_realloc(0, sizeof(blocks[0]));
+    *count = n;
+    return blocks;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+struct IndexedBlock *
+indexed_read_blocks(const unsigned char *px, uint64_t length,
+                    unsigned *count, unsigned *when_scan_started)
+{
+    struct IndexedBlock *blocks;
+    unsigned i;
+
+    *count = 0;
+    if (length < INDEXED_FILE_HEADER_SIZE)
+        return NULL;
+    if (memcmp(px, INDEXED_MAGIC, strlen(INDEXED_MAGIC)) != 0)
+        return NULL;
+
+    /* Look for the start time */
+    for (i=0; i+3<INDEXED_FILE_HEADER_SIZE && px[i]; i++) {
+        if (px[i] == '\n' && px[i+1] == 's' && px[i+2] == ':') {
+            *when_scan_started = (unsigned)strtoul((const char*)px+i+3, 0, 0);
+            break;
+        }
+    }
+
+    blocks = read_index(px, length, count);
+    if (blocks == NULL) {
+        LOG(1, "readscan: no usable index, walking blocks\n");
+        blocks = walk_blocks(px, length, count);
+    }
+    return blocks;
+}
+
+
+/****************************************************************************
+ ****************************************************************************/
+int
+indexed_block_is_match(const struct IndexedBlock *block,
+                       const struct RangeList *ips,
+                       const struct RangeList *ports,
+                       const struct RangeList *btypes)
+{
+    unsigned i;
+
+    if (block->record_count == 0)
+        return 0;
+
+    if (ips && ips->count) {
+        for (i=0; i<ips->count; i++) {
+            if (ips->list[i].begin <= block->max_ip
+                && block->min_ip <= ips->list[i].end)
+                break;
+        }
+        if (i == ips->count)
+            return 0;
+    }
+
+    if (ports && ports->count) {
+        for (i=0; i<ports->count; i++) {
+            unsigned group;
+            unsigned begin = ports->list[i].begin;
+            unsigned end = ports->list[i].end;
+
+            if (begin > 0xFFFF)
+                continue;
+            if (end > 0xFFFF)
+                end = 0xFFFF;
+            for (group=begin>>6; group<=(end>>6); group++) {
+                if (block->ports[group>>3] & (1 << (group & 7)))
+                    break;
+            }
+            if (group <= (end>>6))
+                break;
+        }
+        if (i == ports->count)
+            return 0;
+    }
+
+    /* When filtering by banner-type, status records are never shown */
+    if (btypes && btypes->count) {
+        if (!(block->flags & INDEXED_HAS_BANNER))
+            return 0;
+        for (i=0; i<btypes->count; i++) {
+            unsigned type;
+            unsigned end = btypes->list[i].end;
+
+            if (end - btypes->list[i].begin >= 255)
+                end = btypes->list[i].begin + 255;
+            for (type=btypes->list[i].begin; type<=end; type++) {
+                unsigned bit = type & 0xFF;
+                if (block->app_protos[bit>>3] & (1 << (bit & 7)))
+                    break;
+            }
+            if (type <= end)
+                break;
+        }
+        if (i == btypes->count)
+            return 0;
+    }
+
+    return 1;
+}
+
+
+/****************************************************************************
+ ****************************************************************************/
+const struct OutputType indexed_output = {
+    "scan",
+    0,
+    indexed_out_open,
+    indexed_out_close,
+    indexed_out_status,
+    indexed_out_banner,
+};
+
+
+/****************************************************************************
+ * Write a small file with tiny blocks, then make sure we find the same
+ * blocks through the index, and by walking a truncated copy, and that
+ * the summaries let us skip blocks.
+ ****************************************************************************/
+int
+indexed_selftest(void)
+{
+    static const enum PixieCodec codecs[] = {Codec_None, Codec_Zstd, Codec_LZ4};
+    unsigned c;
+
+    for (c=0; c<sizeof(codecs)/sizeof(codecs[0]); c++) {
+        struct Output out[1];
+        struct IndexedBlock *blocks = NULL;
+        struct RangeList ips = {0};
+        struct RangeList ports = {0};
+        struct RangeList btypes = {0};
+        unsigned char *buf = NULL;
+        unsigned char *raw = NULL;
+        unsigned count;
+        unsigned when = 0;
+        unsigned records = 0;
+        unsigned matches;
+        long length;
+        FILE *fp;
+        unsigned i;
+
+        if (pixie_compress_init(codecs[c]) != 0)
+            continue;
+
+        fp = tmpfile();
+        if (fp == NULL)
+            return 0; /* can't test on this system */
+
+        memset(out, 0, sizeof(out));
+        out->when_scan_started = 1234567;
+        out->indexed.codec = codecs[c];
+        out->indexed.block_size = 512;
+
+        indexed_out_open(out, fp);
+        for (i=0; i<1000; i++) {
+            indexed_out_status(out, fp, 1234567 + i, PortStatus_Open,
+                               0x0A000000 + i, 6, 80 + (i/100)*1000, 0, 64);
+            if (i % 10 == 0)
+                indexed_out_banner(out, fp, 1234567 + i,
+                                   0x0A000000 + i, 6, 80 + (i/100)*1000,
+                                   PROTO_HTTP, 64,
+                                   (const unsigned char*)"HTTP/1.0 200 OK\r\n", 17);
+        }
+        indexed_out_close(out, fp);
+
+        length = ftell(fp);
+        buf = indexed_realloc(0, length + 1);
+        fseek(fp, 0, SEEK_SET);
+        if (fread(buf, 1, length, fp) != (size_t)length)
+            goto fail;
+        fclose(fp);
+        fp = NULL;
+
+        /* through the index */
+        blocks = indexed_read_blocks(buf, length, &count, &when);
+        if (blocks == NULL || count < 10 || when != 1234567)
+            goto fail;
+        raw = indexed_realloc(0, 512 + BINARY_RECORD_MAX);
+        for (i=0; i<count; i++) {
+            size_t x;
+            records += blocks[i].record_count;
+            x = pixie_decompress(blocks[i].codec, raw, 512 + BINARY_RECORD_MAX,
+                                 buf + blocks[i].offset + INDEXED_BLOCK_HEADER_SIZE,
+                                 blocks[i].stored_length);
+            if (x != blocks[i].raw_length)
+                goto fail;
+        }
+        if (records != 1100)
+            goto fail;
+
+        /* filtering by one IP and port should leave only one block */
+        rangelist_add_range(&ips, 0x0A000000 + 555, 0x0A000000 + 555);
+        rangelist_add_range(&ports, 5080, 5080);
+        for (i=0, matches=0; i<count; i++)
+            matches += indexed_block_is_match(&blocks[i], &ips, &ports, 0);
+        if (matches != 1)
+            goto fail;
+        rangelist_add_range(&btypes, PROTO_SSH2, PROTO_SSH2);
+        for (i=0, matches=0; i<count; i++)
+            matches += indexed_block_is_match(&blocks[i], 0, 0, &btypes);
+        if (matches != 0)
+            goto fail;
+        free(blocks);
+
+        /* a copy cut short in the index has to be walked instead, and
+         * must still find every block */
+        blocks = indexed_read_blocks(buf, length - INDEXED_TRAILER_SIZE
+                                    - count * INDEXED_INDEX_ENTRY_SIZE,
+                                    &i, &when);
+        if (blocks == NULL || i != count)
+            goto fail;
+
+        free(blocks);
+        free(raw);
+        free(buf);
+        rangelist_remove_all(&ips);
+        rangelist_remove_all(&ports);
+        rangelist_remove_all(&btypes);
+        continue;
+    fail:
+        fprintf(stderr, "indexed: selftest failed: %s\n",
+                pixie_codec_to_name(codecs[c]));
+        if (fp)
+            fclose(fp);
+        return 1;
+    }
+    return 0;
+}
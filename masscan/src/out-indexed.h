@@ -0,0 +1,84 @@
+/*
+    The "indexed" binary format: the same records as "-oB", grouped into
+    blocks that each carry a summary of what's inside them, optionally
+    compressed, with an index of all the blocks at the end of the file.
+    This lets "--readscan" skip blocks that can't pass its filters, and
+    decode the rest in parallel.
+*/
+#ifndef OUT_INDEXED_H
+#define OUT_INDEXED_H
+#include <stdint.h>
+#include <stddef.h>
+struct RangeList;
+
+/** The file starts with this string, padded to INDEXED_FILE_HEADER_SIZE */
+#define INDEXED_MAGIC "masscan/2.0"
+#define INDEXED_FILE_HEADER_SIZE ('a'+2)
+
+/** Size of the summary at the start of every block, and of every entry
+ * in the index (offset + summary) */
+#define INDEXED_BLOCK_HEADER_SIZE 192
+#define INDEXED_INDEX_ENTRY_SIZE (8 + INDEXED_BLOCK_HEADER_SIZE)
+
+/** Size of the trailer at the very end of the file that points to
+ * the index */
+#define INDEXED_TRAILER_SIZE 16
+
+/** Default and maximum number of bytes of records in a block, before
+ * compression */
+#define INDEXED_BLOCK_SIZE_DEFAULT (1024*1024)
+#define INDEXED_BLOCK_SIZE_MAX (64*1024*1024)
+
+enum {
+    INDEXED_HAS_STATUS = 0x01,
+    INDEXED_HAS_BANNER = 0x02,
+};
+
+/**
+ * The summary of one block. Ports are summarized in groups of 64, and
+ * banner types by their low 8 bits, so a set bit means "might contain"
+ * while a clear bit means "definitely doesn't contain".
+ */
+struct IndexedBlock {
+    uint64_t offset;        /* of the block header within the file */
+    unsigned codec;
+    unsigned raw_length;
+    unsigned stored_length;
+    unsigned record_count;
+    unsigned min_ip;
+    unsigned max_ip;
+    unsigned flags;
+    unsigned char ports[128];
+    unsigned char app_protos[32];
+};
+
+/**
+ * Find all the blocks in a file that has been read or mapped into memory.
+ * This uses the index at the end of the file when it's there and covers
+ * the whole file, otherwise it walks from one block header to the next,
+ * which handles files that were cut short or appended to.
+ *
+ * @param when_scan_started
+ *      receives the timestamp from the file header
+ * @return
+ *      an array of '*count' blocks that the caller must free(),
+ *      or NULL if this isn't an indexed file
+ */
+struct IndexedBlock *
+indexed_read_blocks(const unsigned char *px, uint64_t length,
+                    unsigned *count, unsigned *when_scan_started);
+
+/**
+ * Whether a block might contain records that pass these filters, any
+ * of which may be NULL or empty.
+ */
+int
+indexed_block_is_match(const struct IndexedBlock *block,
+                       const struct RangeList *ips,
+                       const struct RangeList *ports,
+                       const struct RangeList *btypes);
+
+int
+indexed_selftest(void);
+
+#endif
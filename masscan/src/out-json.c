@@ -52,6 +52,30 @@ json_out_status(struct Output *out, FILE *fp, time_t timestamp, int status,
 
 }
 
+/****************************************************************************
+ ****************************************************************************/
+static void
+json_out_status6(struct Output *out, FILE *fp, time_t timestamp, int status,
+               ipv6address ip, unsigned ip_proto, unsigned port, unsigned reason, unsigned ttl)
+{
+    char reason_buffer[128];
+    char addr[64];
+    UNUSEDPARM(out);
+
+    fprintf(fp, "{ ");
+    fprintf(fp, "  \"ip\": \"%s\", ", ipv6address_fmt(addr, sizeof(addr), ip));
+    fprintf(fp, "  \"timestamp\": \"%d\", \"ports\": [ {\"port\": %u, \"proto\": \"%s\", \"status\": \"%s\","
+                " \"reason\": \"%s\", \"ttl\": %u} ] ",
+                (int) timestamp,
+                port,
+                name_from_ip_proto(ip_proto),
+                status_string(status),
+                reason_string(reason, reason_buffer, sizeof(reason_buffer)),
+                ttl
+            );
+    fprintf(fp, "},\n");
+}
+
 /*****************************************************************************
  * Remove bad characters from the banner, especially new lines and HTML
  * control codes.
@@ -146,5 +170,6 @@ const struct OutputType json_output = {
     json_out_open,
     json_out_close,
     json_out_status,
-    json_out_banner
+    json_out_banner,
+    json_out_status6
 };
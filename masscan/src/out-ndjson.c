@@ -52,6 +52,30 @@ ndjson_out_status(struct Output *out, FILE *fp, time_t timestamp, int status,
 
 }
 
+/****************************************************************************
+ ****************************************************************************/
+static void
+ndjson_out_status6(struct Output *out, FILE *fp, time_t timestamp, int status,
+                 ipv6address ip, unsigned ip_proto, unsigned port, unsigned reason, unsigned ttl)
+{
+    char reason_buffer[128];
+    char addr[64];
+    UNUSEDPARM(out);
+
+    fprintf(fp, "{");
+    fprintf(fp, "\"ip\":\"%s\",", ipv6address_fmt(addr, sizeof(addr), ip));
+    fprintf(fp, "\"timestamp\":\"%d\",\"port\":%u,\"proto\":\"%s\",\"rec_type\":\"status\",\"data\":{\"status\":\"%s\","
+                "\"reason\":\"%s\",\"ttl\":%u}",
+                (int) timestamp,
+                port,
+                name_from_ip_proto(ip_proto),
+                status_string(status),
+                reason_string(reason, reason_buffer, sizeof(reason_buffer)),
+                ttl
+            );
+    fprintf(fp, "}\n");
+}
+
 /*****************************************************************************
  * Remove bad characters from the banner, especially new lines and HTML
  * control codes.
@@ -158,5 +182,6 @@ const struct OutputType ndjson_output = {
     ndjson_out_open,
     ndjson_out_close,
     ndjson_out_status,
-    ndjson_out_banner
+    ndjson_out_banner,
+    ndjson_out_status6
 };
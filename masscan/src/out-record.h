@@ -1,5 +1,7 @@
 #ifndef OUT_RECORD_H
 #define OUT_RECORD_H
+#include <time.h>
+#include "masscan-app.h"
 
 enum OutputRecordType {
     Out_Open = 1,
@@ -10,4 +12,37 @@ enum OutputRecordType {
     Out_Arp2 = 8,
     Out_Banner9 = 9,
 };
+
+/**
+ * The largest record that binary_record_banner() will produce: a banner
+ * whose [LENGTH] still fits in two bytes, plus the [TYPE] byte.
+ */
+#define BINARY_RECORD_MAX (3 + 128*128)
+
+/**
+ * Encode a status record the way the "-oB" binary output writes it,
+ * as [TYPE][LENGTH][fields]. The indexed format stores these same
+ * records inside its blocks.
+ *
+ * @return
+ *      the number of bytes written to 'buf', or 0 if the status isn't
+ *      one that gets recorded
+ */
+unsigned
+binary_record_status(unsigned char *buf, time_t timestamp, int status,
+                     unsigned ip, unsigned ip_proto, unsigned port,
+                     unsigned reason, unsigned ttl);
+
+/**
+ * Encode a banner record. 'buf' must hold BINARY_RECORD_MAX bytes.
+ *
+ * @return
+ *      the number of bytes written to 'buf', or 0 if the banner is too
+ *      long to be recorded
+ */
+unsigned
+binary_record_banner(unsigned char *buf, time_t timestamp,
+                     unsigned ip, unsigned ip_proto, unsigned port,
+                     enum ApplicationProtocol proto, unsigned ttl,
+                     const unsigned char *px, unsigned length);
 #endif
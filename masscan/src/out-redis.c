@@ -1,148 +1,285 @@
+/*
+    Redis output
+
+    Each result becomes a few SADD commands: the address goes in the set
+    "host", the port in the set named by the address, and the details in
+    the set named by "address:port".
+
+    At a hundred thousand results a second, we can't wait for a reply to
+    each command, or even make a system call for each one. Instead,
+    commands are pipelined: they're appended to a buffer that's sent in
+    one big write, and the replies are read whenever there are some,
+    without waiting. The addresses for "host" are collected into one
+    SADD with many members. To keep a slow server from falling ever
+    further behind, once too many commands are waiting for replies, we
+    stop and wait for it to catch up.
+*/
 #include "output.h"
 #include "masscan.h"
+#include "masscan-status.h"
 #include "pixie-sockets.h"
 #include "logger.h"
+#include "string_s.h"
 #include <ctype.h>
+#include <stdlib.h>
+
+/* send when this much is buffered, or once a second */
+#define REDIS_FLUSH_SIZE        (64 * 1024)
+
+/* the most addresses in one "SADD host ..." */
+#define REDIS_HOST_BATCH        1024
+#define REDIS_HOSTS_SIZE        (REDIS_HOST_BATCH * 24)
+
+/* room for a flush's worth, plus the host batch, plus one more result */
+#define REDIS_BUF_SIZE          (REDIS_FLUSH_SIZE + REDIS_HOSTS_SIZE + 4096)
+
+/* when this many commands are waiting for replies, wait until half are */
+#define REDIS_MAX_OUTSTANDING   65536
+
 
 /****************************************************************************
- * Receive a full line from the socket
+ * Append a RESP bulk string, "$<length>\r\n<string>\r\n"
  ****************************************************************************/
 static size_t
-recv_line(SOCKET fd, void *buf, size_t buf_size)
+append_bulk(unsigned char *buf, size_t offset, const char *str, size_t length)
 {
-    size_t count = 0;
+    char digits[24];
+    size_t value = length;
+    size_t n = 0;
+    size_t i;
+
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    buf[offset++] = '$';
+    for (i=0; i<n; i++)
+        buf[offset++] = digits[n - i - 1];
+    buf[offset++] = '\r';
+    buf[offset++] = '\n';
+    memcpy(buf + offset, str, length);
+    offset += length;
+    buf[offset++] = '\r';
+    buf[offset++] = '\n';
+    return offset;
+}
 
-    while (count < buf_size) {
-        size_t bytes_received;
+/****************************************************************************
+ * Append "SADD <key> <member>" to the pipeline.
+ ****************************************************************************/
+static void
+append_sadd(struct Output *out, const char *key, const char *member)
+{
+    size_t offset = out->redis.buf_length;
 
-        bytes_received = recv(fd, (char*)buf+count, 1, 0);
-        if (bytes_received == 0) {
-            LOG(0, "redis: recv_line() failed\n");
-            exit(1);
-        }
-        count++;
-        if (((unsigned char*)buf)[count-1] == '\n')
-            break;
-    }
+    memcpy(out->redis.buf + offset, "*3\r\n$4\r\nSADD\r\n", 14);
+    offset += 14;
+    offset = append_bulk(out->redis.buf, offset, key, strlen(key));
+    offset = append_bulk(out->redis.buf, offset, member, strlen(member));
+    out->redis.buf_length = offset;
+    out->redis.outstanding++;
+}
+
+/****************************************************************************
+ * Move the addresses we've collected into one "SADD host ..." command in
+ * the pipeline.
+ ****************************************************************************/
+static void
+append_hosts(struct Output *out)
+{
+    char header[32];
+    size_t length;
+
+    if (out->redis.host_count == 0)
+        return;
+
+    sprintf_s(header, sizeof(header), "*%u\r\n$4\r\nSADD\r\n$4\r\nhost\r\n",
+              out->redis.host_count + 2);
+    length = strlen(header);
+    memcpy(out->redis.buf + out->redis.buf_length, header, length);
+    out->redis.buf_length += length;
+    memcpy(out->redis.buf + out->redis.buf_length,
+           out->redis.hosts, out->redis.hosts_length);
+    out->redis.buf_length += out->redis.hosts_length;
+    out->redis.outstanding++;
+
+    out->redis.hosts_length = 0;
+    out->redis.host_count = 0;
+}
+
+/****************************************************************************
+ * Format a result into the pipeline, without sending anything.
+ ****************************************************************************/
+static void
+append_status(struct Output *out, time_t timestamp, int status,
+              unsigned ip, unsigned ip_proto, unsigned port,
+              unsigned reason, unsigned ttl)
+{
+    char ip_string[16];
+    char port_string[16];
+    char ip_port[32];
+    char values[64];
+
+    sprintf_s(ip_string, sizeof(ip_string), "%u.%u.%u.%u",
+        (unsigned char)(ip>>24),
+        (unsigned char)(ip>>16),
+        (unsigned char)(ip>> 8),
+        (unsigned char)(ip>> 0));
+    sprintf_s(port_string, sizeof(port_string), "%u/%s", port, name_from_ip_proto(ip_proto));
+    sprintf_s(ip_port, sizeof(ip_port), "%s:%s", ip_string, port_string);
+    sprintf_s(values, sizeof(values), "%u:%u:%u:%u",
+        (unsigned)timestamp, status, reason, ttl);
+
+    /*
+     * KEY: "host"
+     * VALUE: ip
+     */
+    out->redis.hosts_length = append_bulk(out->redis.hosts,
+                                          out->redis.hosts_length,
+                                          ip_string, strlen(ip_string));
+    out->redis.host_count++;
+    if (out->redis.host_count >= REDIS_HOST_BATCH)
+        append_hosts(out);
 
-    return count;
+    /*
+     * KEY: ip
+     * VALUE: port
+     */
+    append_sadd(out, ip_string, port_string);
+
+    /*
+     * KEY: ip:port
+     * VALUE: timestamp:status:reason:ttl
+     */
+    append_sadd(out, ip_port, values);
 }
 
 /****************************************************************************
+ * Count off the replies to our commands. We get ":<n>" from SADD and
+ * "+PONG" from PING, and "-<error>" if the server didn't like something,
+ * which we report and carry on.
  ****************************************************************************/
-static int
-parse_state_machine(struct Output *out, const unsigned char *px, size_t length)
+static void
+parse_replies(struct Output *out, const unsigned char *px, size_t length)
 {
-    unsigned state = out->redis.state;
-    unsigned i;
-    enum {
-        START,
-        NUMBER,
-        P,
-        PO,
-        PON,
-        PONG,
-        PONG_CR,
-        PONG_CR_LF
-    };
-
-    for (i=0; i<length; i++)
-    switch (state) {
-    case START:
-        switch (px[i]) {
+    size_t i;
+
+    for (i=0; i<length; i++) {
+        char *reply = out->redis.reply;
+
+        if (out->redis.reply_length < sizeof(out->redis.reply) - 1)
+            reply[out->redis.reply_length++] = (char)px[i];
+        if (px[i] != '\n')
+            continue;
+
+        reply[out->redis.reply_length] = '\0';
+        out->redis.reply_length = 0;
+
+        switch (reply[0]) {
+        case ':':
         case '+':
-            state = P;
             break;
-        case ':':
-            state = NUMBER;
+        case '-':
+            LOG(0, "redis: %s", reply + 1);
             break;
         default:
-            LOG(0, "redis: unexpected data: %.*s\n", length-i, px+i);
-            exit(1);
-            break;
-        }
-        break;
-    case NUMBER:
-        if (isdigit(px[i]) || px[i] == '\r')
-            ;
-        else if (px[i] == '\n') {
-            state = 0;
-            if (out->redis.outstanding == 0) {
-                LOG(0, "redis: out of sync\n");
-                exit(1);
-            }
-            out->redis.outstanding--;
-        } else {
-            LOG(0, "redis: unexpected data: %.*s\n", length-i, px+i);
+            LOG(0, "redis: unexpected data: %s\n", reply);
             exit(1);
         }
-        break;
-    case P:
-    case PO:
-    case PON:
-    case PONG_CR:
-    case PONG_CR_LF:
-        if ("PONG+\r\n"[i-P] == px[i]) {
-            state++;
-            if (px[i] == '\n') {
-                out->redis.state = 0;
-                return 1;
-            }
-        } else {
-            LOG(0, "redis: unexpected data: %.*s\n", length-i, px+i);
+
+        if (out->redis.outstanding == 0) {
+            LOG(0, "redis: out of sync\n");
             exit(1);
         }
-    default:
-        LOG(0, "redis: unexpected state: %u\n", state);
-        exit(1);
+        out->redis.outstanding--;
     }
-    out->redis.state = state;
-    return 0;
 }
 
 /****************************************************************************
+ * Read whatever replies have arrived. If 'is_wait', keep reading until
+ * no more than 'max_outstanding' commands are waiting for replies.
  ****************************************************************************/
-static int
-clean_response_queue(struct Output *out, SOCKET fd)
+static void
+drain_replies(struct Output *out, SOCKET fd, int is_wait, uint64_t max_outstanding)
 {
-    fd_set readfds;
-    struct timeval tv = {0,0};
-    int x;
-    int nfds;
-    unsigned char buf[1024];
-    size_t bytes_read;
-
-    FD_ZERO(&readfds);
+    unsigned char buf[16384];
+
+    for (;;) {
+        fd_set readfds;
+        struct timeval tv = {0,0};
+        int x;
+        int bytes_read;
+
+        if (is_wait && out->redis.outstanding <= max_outstanding)
+            is_wait = 0;
+
+        FD_ZERO(&readfds);
 #ifdef _MSC_VER
 #pragma warning(disable:4127)
 #endif
-    FD_SET(fd, &readfds);
-    nfds = (int)fd;
+        FD_SET(fd, &readfds);
 
-    x = select(nfds, &readfds, 0, 0, &tv);
-    if (x == 0)
-        return 1;
-    if (x < 0) {
-        LOG(0, "redis:select() failed\n");
-        exit(1);
-    }
-    if (x != 1) {
-        LOG(0, "redis:select() failed\n");
-        exit(1);
+        x = select((int)fd + 1, &readfds, 0, 0, is_wait ? NULL : &tv);
+        if (x == 0)
+            return;
+        if (x < 0) {
+            LOG(0, "redis:select() failed\n");
+            exit(1);
+        }
+
+        bytes_read = recv(fd, (char*)buf, sizeof(buf), 0);
+        if (bytes_read <= 0) {
+            LOG(0, "redis:recv() failed\n");
+            exit(1);
+        }
+        parse_replies(out, buf, bytes_read);
     }
+}
 
-    /*
-     * Data exists, so parse it
-     */
-    bytes_read = recv(fd, (char*)buf, sizeof(buf), 0);
-    if (bytes_read == 0) {
-        LOG(0, "redis:recv() failed\n");
-        exit(1);
+/****************************************************************************
+ * Send everything we've buffered in one write, then read what replies
+ * there are, waiting for some if the server has fallen too far behind.
+ ****************************************************************************/
+static void
+flush_commands(struct Output *out, SOCKET fd)
+{
+    size_t offset = 0;
+
+    append_hosts(out);
+
+    while (offset < out->redis.buf_length) {
+        int count;
+
+        count = send(fd, (const char*)out->redis.buf + offset,
+                     (int)(out->redis.buf_length - offset), 0);
+        if (count <= 0) {
+            LOG(0, "redis: error sending data\n");
+            exit(1);
+        }
+        offset += count;
     }
+    out->redis.buf_length = 0;
+    out->redis.last_flush = time(0);
 
-    return parse_state_machine(out, buf, bytes_read);
+    if (out->redis.outstanding > REDIS_MAX_OUTSTANDING)
+        drain_replies(out, fd, 1, REDIS_MAX_OUTSTANDING/2);
+    else
+        drain_replies(out, fd, 0, 0);
 }
 
+/****************************************************************************
+ * Make sure the server's there, and wait for it to answer everything
+ ****************************************************************************/
+static void
+ping(struct Output *out, SOCKET fd)
+{
+    memcpy(out->redis.buf + out->redis.buf_length, "PING\r\n", 6);
+    out->redis.buf_length += 6;
+    out->redis.outstanding++;
+    flush_commands(out, fd);
+    drain_replies(out, fd, 1, 0);
+}
 
 /****************************************************************************
  ****************************************************************************/
@@ -150,22 +287,17 @@ static void
 redis_out_open(struct Output *out, FILE *fp)
 {
     ptrdiff_t fd = (ptrdiff_t)fp;
-    size_t count;
-    unsigned char line[1024];
-
-    UNUSEDPARM(out);
 
-    count = send(fd, "PING\r\n", 6, 0);
-    if (count != 6) {
-        LOG(0, "redis: send(ping) failed\n");
-        exit(1);
+    if (out->redis.buf == NULL) {
+        out->redis.buf = (unsigned char *)malloc(REDIS_BUF_SIZE);
+        out->redis.hosts = (unsigned char *)malloc(REDIS_HOSTS_SIZE);
+        if (out->redis.buf == NULL || out->redis.hosts == NULL) {
+            LOG(0, "redis: out of memory\n");
+            exit(1);
+        }
     }
 
-    count = recv_line(fd, line, sizeof(line));
-    if (count != 7 && memcmp(line, "+PONG\r\n", 7) != 0) {
-        LOG(0, "redis: unexpected response from redis server: %s\n", line);
-        exit(1);
-    }
+    ping(out, fd);
 }
 
 /****************************************************************************
@@ -174,22 +306,13 @@ static void
 redis_out_close(struct Output *out, FILE *fp)
 {
     ptrdiff_t fd = (ptrdiff_t)fp;
-    size_t count;
-    unsigned char line[1024];
 
-    UNUSEDPARM(out);
+    ping(out, fd);
 
-    count = send(fd, "PING\r\n", 6, 0);
-    if (count != 6) {
-        LOG(0, "redis: send(ping) failed\n");
-        exit(1);
-    }
-
-    count = recv_line(fd, line, sizeof(line));
-    if (count != 7 && memcmp(line, "+PONG\r\n", 7) != 0) {
-        LOG(0, "redis: unexpected response from redis server: %s\n", line);
-        exit(1);
-    }
+    free(out->redis.buf);
+    free(out->redis.hosts);
+    out->redis.buf = NULL;
+    out->redis.hosts = NULL;
 }
 
 /****************************************************************************
@@ -199,96 +322,27 @@ redis_out_status(struct Output *out, FILE *fp, time_t timestamp,
     int status, unsigned ip, unsigned ip_proto, unsigned port, unsigned reason, unsigned ttl)
 {
     ptrdiff_t fd = (ptrdiff_t)fp;
-    char line[1024];
-    char ip_string[16];
-    char port_string[10];
-    size_t count;
-    char values[64];
-
-    sprintf_s(ip_string, sizeof(ip_string), "%u.%u.%u.%u",
-        (unsigned char)(ip>>24),
-        (unsigned char)(ip>>16),
-        (unsigned char)(ip>> 8),
-        (unsigned char)(ip>> 0));
-    sprintf_s(port_string, sizeof(port_string), "%u/%s", port, name_from_ip_proto(ip_proto));
 
-/**3
-$3
-SET
-$5
-mykey
-$7
-myvalue
-*/
-
-    /*
-     * KEY: "host"
-     * VALUE: ip
-     */
-    sprintf_s(line, sizeof(line),
-            "*3\r\n"
-            "$4\r\nSADD\r\n"
-            "$%u\r\n%s\r\n"
-            "$%u\r\n%s\r\n"
-            ,
-            (unsigned)strlen("host"), "host",
-            (unsigned)strlen(ip_string), ip_string
-            );
-
-    count = send(fd, line, (int)strlen(line), 0);
-    if (count != strlen(line)) {
-        LOG(0, "redis: error sending data\n");
-        exit(1);
-    }
-    out->redis.outstanding++;
+    append_status(out, timestamp, status, ip, ip_proto, port, reason, ttl);
 
-    /*
-     * KEY: ip
-     * VALUE: port
-     */
-    sprintf_s(line, sizeof(line),
-            "*3\r\n"
-            "$4\r\nSADD\r\n"
-            "$%u\r\n%s\r\n"
-            "$%u\r\n%s\r\n"
-            ,
-            (unsigned)strlen(ip_string), ip_string,
-            (unsigned)strlen(port_string), port_string);
-
-    count = send(fd, line, (int)strlen(line), 0);
-    if (count != strlen(line)) {
-        LOG(0, "redis: error sending data\n");
-        exit(1);
-    }
-    out->redis.outstanding++;
-
-
-    /*
-     * KEY: ip:port
-     * VALUE: timestamp:status:reason:ttl
-     */
-    sprintf_s(values, sizeof(values), "%u:%u:%u:%u",
-        (unsigned)timestamp, status, reason, ttl);
-    sprintf_s(line, sizeof(line),
-            "*3\r\n"
-            "$4\r\nSADD\r\n"
-            "$%u\r\n%s:%s\r\n"
-            "$%u\r\n%s\r\n"
-            ,
-            (unsigned)(strlen(ip_string) + 1 + strlen(port_string)),
-            ip_string,port_string,
-            (unsigned)strlen(values), values
-            );
-
-    count = send(fd, line, (int)strlen(line), 0);
-    if (count != strlen(line)) {
-        LOG(0, "redis: error sending data\n");
-        exit(1);
-    }
-    out->redis.outstanding++;
+    if (out->redis.buf_length >= REDIS_FLUSH_SIZE
+        || time(0) != out->redis.last_flush)
+        flush_commands(out, fd);
+}
 
-    clean_response_queue(out, fd);
+/****************************************************************************
+ * When results stop coming, the last of them would otherwise sit in the
+ * buffer until the scan ends, so send them once they're a second old.
+ ****************************************************************************/
+static void
+redis_out_tick(struct Output *out, FILE *fp, time_t now)
+{
+    ptrdiff_t fd = (ptrdiff_t)fp;
 
+    if (out->redis.buf_length == 0 && out->redis.host_count == 0)
+        return;
+    if (now != out->redis.last_flush)
+        flush_commands(out, fd);
 }
 
 /****************************************************************************
@@ -321,8 +375,61 @@ const struct OutputType redis_output = {
     redis_out_open,
     redis_out_close,
     redis_out_status,
-    redis_out_banner
+    redis_out_banner,
+    0,
+    redis_out_tick
 };
 
 
+/****************************************************************************
+ ****************************************************************************/
+int
+redis_selftest(void)
+{
+    static const char expected[] =
+        "*3\r\n$4\r\nSADD\r\n$8\r\n10.0.0.1\r\n$6\r\n80/tcp\r\n"
+        "*3\r\n$4\r\nSADD\r\n$15\r\n10.0.0.1:80/tcp\r\n$11\r\n100:1:18:64\r\n"
+        "*3\r\n$4\r\nSADD\r\n$8\r\n10.0.0.2\r\n$6\r\n53/udp\r\n"
+        "*3\r\n$4\r\nSADD\r\n$15\r\n10.0.0.2:53/udp\r\n$10\r\n101:1:0:60\r\n"
+        "*4\r\n$4\r\nSADD\r\n$4\r\nhost\r\n"
+        "$8\r\n10.0.0.1\r\n$8\r\n10.0.0.2\r\n";
+    static const char replies[] = ":1\r\n:1\r\n:0\r\n+OK\r\n:12\r\n";
+    struct Output *out;
+    size_t i;
+
+    out = (struct Output *)calloc(1, sizeof(*out));
+    if (out == NULL)
+        return 1;
+    out->redis.buf = (unsigned char *)malloc(REDIS_BUF_SIZE);
+    out->redis.hosts = (unsigned char *)malloc(REDIS_HOSTS_SIZE);
+    if (out->redis.buf == NULL || out->redis.hosts == NULL)
+        goto fail;
+
+    append_status(out, 100, PortStatus_Open, 0x0A000001, 6, 80, 0x12, 64);
+    append_status(out, 101, PortStatus_Open, 0x0A000002, 17, 53, 0, 60);
+    append_hosts(out);
+    if (out->redis.buf_length != sizeof(expected) - 1
+        || memcmp(out->redis.buf, expected, out->redis.buf_length) != 0)
+        goto fail;
+    if (out->redis.outstanding != 5)
+        goto fail;
+
+    /* replies can be split anywhere */
+    for (i=0; i<sizeof(replies) - 1; i += 3) {
+        size_t n = sizeof(replies) - 1 - i;
+        parse_replies(out, (const unsigned char *)replies + i, n < 3 ? n : 3);
+    }
+    if (out->redis.outstanding != 0 || out->redis.reply_length != 0)
+        goto fail;
 
+    free(out->redis.buf);
+    free(out->redis.hosts);
+    free(out);
+    return 0;
+fail:
+    fprintf(stderr, "redis: selftest failed\n");
+    free(out->redis.buf);
+    free(out->redis.hosts);
+    free(out);
+    return 1;
+}
@@ -47,6 +47,26 @@ text_out_status(struct Output *out, FILE *fp, time_t timestamp,
         );
 }
 
+/****************************************************************************
+ ****************************************************************************/
+static void
+text_out_status6(struct Output *out, FILE *fp, time_t timestamp,
+    int status, ipv6address ip, unsigned ip_proto, unsigned port, unsigned reason, unsigned ttl)
+{
+    char addr[64];
+    UNUSEDPARM(ttl);
+    UNUSEDPARM(reason);
+    UNUSEDPARM(out);
+
+    fprintf(fp, "%s %s %u %s %u\n",
+        status_string(status),
+        name_from_ip_proto(ip_proto),
+        port,
+        ipv6address_fmt(addr, sizeof(addr), ip),
+        (unsigned)timestamp
+        );
+}
+
 
 /*************************************** *************************************
  ****************************************************************************/
@@ -85,7 +105,8 @@ const struct OutputType text_output = {
     text_out_open,
     text_out_close,
     text_out_status,
-    text_out_banner
+    text_out_banner,
+    text_out_status6
 };
 
 
@@ -90,6 +90,34 @@ xml_out_status(struct Output *out, FILE *fp, time_t timestamp, int status,
         );
 }
 
+/****************************************************************************
+ ****************************************************************************/
+static void
+xml_out_status6(struct Output *out, FILE *fp, time_t timestamp, int status,
+               ipv6address ip, unsigned ip_proto, unsigned port, unsigned reason, unsigned ttl)
+{
+    char reason_buffer[128];
+    char addr[64];
+    UNUSEDPARM(out);
+    fprintf(fp, "<host endtime=\"%u\">"
+                    "<address addr=\"%s\" addrtype=\"ipv6\"/>"
+                    "<ports>"
+                    "<port protocol=\"%s\" portid=\"%u\">"
+                    "<state state=\"%s\" reason=\"%s\" reason_ttl=\"%u\"/>"
+                    "</port>"
+                    "</ports>"
+                "</host>"
+                "\r\n",
+        (unsigned)timestamp,
+        ipv6address_fmt(addr, sizeof(addr), ip),
+        name_from_ip_proto(ip_proto),
+        port,
+        status_string(status),
+        reason_string(reason, reason_buffer, sizeof(reason_buffer)),
+        ttl
+        );
+}
+
 /****************************************************************************
  ****************************************************************************/
 static void
@@ -140,6 +168,7 @@ const struct OutputType xml_output = {
     xml_out_open,
     xml_out_close,
     xml_out_status,
-    xml_out_banner
+    xml_out_banner,
+    xml_out_status6
 };
 
@@ -41,6 +41,8 @@
 #include "main-globals.h"
 #include "pixie-file.h"
 #include "pixie-sockets.h"
+#include "pixie-threads.h"
+#include "out-compress.h"
 
 #include <limits.h>
 #include <ctype.h>
@@ -59,6 +61,41 @@ static int64_t ftell_x(FILE *fp)
 #endif
 }
 
+/*****************************************************************************
+ * The number of bytes we've written to this file since we opened it,
+ * including what's still buffered. Pipes and sockets can't tell us.
+ *****************************************************************************/
+static uint64_t
+file_bytes(const struct Output *out, FILE *fp)
+{
+    int64_t offset;
+
+    if (fp == NULL || out->format == Output_Redis)
+        return 0;
+    offset = ftell_x(fp);
+    if (offset < out->bytes.at_open)
+        return 0;
+    return (uint64_t)(offset - out->bytes.at_open);
+}
+
+/*****************************************************************************
+ *****************************************************************************/
+void
+output_tick(struct Output *out, time_t now)
+{
+    if (out->fp == NULL || out->funcs->tick == NULL)
+        return;
+    out->funcs->tick(out, out->fp, now);
+}
+
+/*****************************************************************************
+ *****************************************************************************/
+uint64_t
+output_bytes_written(const struct Output *out)
+{
+    return out->bytes.closed + file_bytes(out, out->fp);
+}
+
 /*****************************************************************************
  * The 'status' variable contains both the open/closed info as well as the
  * protocol info. This splits it back out into two values.
@@ -211,11 +248,29 @@ open_rotate(struct Output *out, const char *filename)
         }
     }
 
+    /* Compress as it's written, for "-oJ scan.json.gz". The indexed format
+     * already compresses its own blocks, and seeks back to patch them. */
+    if (out->compress.codec != Codec_None && out->format != Output_Indexed) {
+        FILE *fp_compress = compress_fopen(fp, out->compress.codec,
+                                           out->compress.threads,
+                                           out->compress.cpus,
+                                           out->compress.cpu_count);
+        if (fp_compress == NULL) {
+            fclose(fp);
+            is_tx_done = 1;
+            return NULL;
+        }
+        fp = fp_compress;
+    }
+
     /*
      * Mark the file as newly opened. That way, before writing any data
      * to it, we'll first have to write headers
      */
     out->is_virgin_file = 1;
+    out->bytes.at_open = ftell_x(fp);
+    if (out->bytes.at_open < 0)
+        out->bytes.at_open = 0;
 
     return fp;
 }
@@ -246,6 +301,7 @@ close_rotate(struct Output *out, FILE *fp)
     if (out->format == Output_Redis)
         return;
 
+    out->bytes.closed += file_bytes(out, fp);
     fflush(fp);
     fclose(fp);
 }
@@ -405,6 +461,22 @@ output_create(const struct Masscan *masscan, unsigned thread_index)
     out->is_show_host = masscan->output.is_show_host;
     out->is_append = masscan->output.is_append;
     out->xml.stylesheet = duplicate_string(masscan->output.stylesheet);
+    out->indexed.codec = masscan->output.indexed.codec;
+    out->indexed.block_size = masscan->output.indexed.block_size;
+    if (masscan->output.compress.is_set)
+        out->compress.codec = masscan->output.compress.codec;
+    else if (masscan->output.filename[0])
+        out->compress.codec = compress_codec_from_filename(masscan->output.filename);
+    out->compress.threads = masscan->output.compress.threads;
+    if (out->compress.threads == 0) {
+        out->compress.threads = pixie_cpu_get_count();
+        if (out->compress.threads > 4)
+            out->compress.threads = 4;
+    }
+    if (thread_index < masscan->nic_count) {
+        out->compress.cpus = masscan->nic[thread_index].pin.helper_cpus;
+        out->compress.cpu_count = masscan->nic[thread_index].pin.helper_count;
+    }
     out->rotate.directory = duplicate_string(masscan->output.rotate.directory);
     if (masscan->nic_count <= 1)
         out->filename = duplicate_string(masscan->output.filename);
@@ -442,6 +514,9 @@ output_create(const struct Masscan *masscan, unsigned thread_index)
     case Output_Binary:
         out->funcs = &binary_output;
         break;
+    case Output_Indexed:
+        out->funcs = &indexed_output;
+        break;
     case Output_Grepable:
         out->funcs = &grepable_output;
         break;
@@ -525,12 +600,10 @@ output_do_rotate(struct Output *out, int is_closing)
     /* Remove directory prefix from filename, we just want the root filename
      * to start with */
     while (strchr(filename, '/') || strchr(filename, '\\')) {
-        filename = strchr(filename, '/');
-        if (*filename == '/')
-            filename++;
-        filename = strchr(filename, '\\');
-        if (*filename == '\\')
-            filename++;
+        if (strchr(filename, '/'))
+            filename = strchr(filename, '/') + 1;
+        if (strchr(filename, '\\'))
+            filename = strchr(filename, '\\') + 1;
     }
 
     /* Allocate memory for the new filename */
@@ -569,6 +642,15 @@ again:
         size_t x_off=0, x_len=0;
         if (strrchr(filename, '.')) {
             x_off = strrchr(filename, '.') - filename;
+            /* "scan.json.gz" becomes "scan-00000.json.gz" */
+            if (compress_codec_from_filename(filename) != Codec_None) {
+                while (x_off > 0 && filename[x_off - 1] != '.')
+                    x_off--;
+                if (x_off > 0)
+                    x_off--;
+                else
+                    x_off = strrchr(filename, '.') - filename;
+            }
             x_len = strlen(filename + x_off);
         } else {
             x_off = strlen(filename);
@@ -628,16 +710,26 @@ again:
     /*
      * Now create a new file
      */
-    if (is_closing)
-        out->fp = NULL; /* program shutting down, so don't create new file */
-    else {
+    if (is_closing) {
+        /* program shutting down, so don't create new file */
+        close_rotate(out, out->fp);
+        out->fp = NULL;
+    } else {
         FILE *fp;
+        int64_t at_open = out->bytes.at_open;
 
         fp = open_rotate(out, filename);
         if (fp == NULL) {
             LOG(0, "rotate: %s: failed: %s\n", filename, strerror_x(errno));
         } else {
+            /* Opening the new file reset these, but we want the old file to
+             * get its trailer, which also ends its compressed stream */
+            int64_t new_at_open = out->bytes.at_open;
+            out->is_virgin_file = 0;
+            out->bytes.at_open = at_open;
             close_rotate(out, out->fp);
+            out->is_virgin_file = 1;
+            out->bytes.at_open = new_at_open;
             out->fp = fp;
             out->rotate.last = time(0);
             LOG(1, "rotate: started new file: %s\n", filename);
@@ -690,6 +782,86 @@ oui_from_mac(const unsigned char mac[6])
     }
 }
 
+/***************************************************************************
+ * The part of reporting a status that's the same for IPv4 and IPv6:
+ * rotating the file, counting, and writing the header of a new file.
+ * @return
+ *      the file to write to, or NULL if there's nothing to write
+ ***************************************************************************/
+static FILE *
+status_prepare(struct Output *out, time_t now, int status, unsigned ip_proto)
+{
+    FILE *fp = out->fp;
+
+    if (fp == NULL)
+        return NULL;
+
+    /* Rotate, if we've pass the time limit. Rotating the log files happens
+     * inline while writing output, whenever there's output to write to the
+     * file, rather than in a separate thread right at the time interval.
+     * Thus, if results are coming in slowly, the rotation won't happen
+     * on precise boundaries */
+    if (is_rotate_time(out, now, fp)) {
+        fp = output_do_rotate(out, 0);
+        if (fp == NULL)
+            return NULL;
+    }
+
+    /* Keep some statistics so that the user can monitor how much stuff is
+     * being found. */
+    switch (status) {
+        case PortStatus_Open:
+            switch (ip_proto) {
+            case 1:
+                out->counts.icmp.echo++;
+                break;
+            case 6:
+                out->counts.tcp.open++;
+                break;
+            case 17:
+                out->counts.udp.open++;
+                break;
+            case 132:
+                out->counts.sctp.open++;
+                break;
+            }
+            if (!out->is_show_open)
+                return NULL;
+            break;
+        case PortStatus_Closed:
+            switch (ip_proto) {
+            case 6:
+                out->counts.tcp.closed++;
+                break;
+            case 17:
+                out->counts.udp.closed++;
+                break;
+            case 132:
+                out->counts.sctp.closed++;
+                break;
+            }
+            if (!out->is_show_closed)
+                return NULL;
+            break;
+        case PortStatus_Arp:
+            out->counts.arp.open++;
+            break;
+        default:
+            LOG(0, "unknown status type: %u\n", status);
+            return NULL;
+    }
+
+    /*
+     * If this is a newly opened file, then write file headers
+     */
+    if (out->is_virgin_file) {
+        out->funcs->open(out, fp);
+        out->is_virgin_file = 0;
+    }
+
+    return fp;
+}
+
 /***************************************************************************
  * Report simply "open" or "closed", with little additional information.
  * This is called directly from the receive thread when responses come
@@ -756,78 +928,74 @@ output_report_status(struct Output *out, time_t timestamp, int status,
     }
 
 
+    fp = status_prepare(out, now, status, ip_proto);
     if (fp == NULL)
         return;
 
-    /* Rotate, if we've pass the time limit. Rotating the log files happens
-     * inline while writing output, whenever there's output to write to the
-     * file, rather than in a separate thread right at the time interval.
-     * Thus, if results are coming in slowly, the rotation won't happen
-     * on precise boundaries */
-    if (is_rotate_time(out, now, fp)) {
-        fp = output_do_rotate(out, 0);
-        if (fp == NULL)
-            return;
-    }
+    /*
+     * Now do the actual output, whether it be XML, binary, JSON, ndjson, Redis,
+     * and so on.
+     */
+    out->funcs->status(out, fp, timestamp, status, ip, ip_proto, port, reason, ttl);
+}
 
 
-    /* Keep some statistics so that the user can monitor how much stuff is
-     * being found. */
-    switch (status) {
-        case PortStatus_Open:
-            switch (ip_proto) {
-            case 1:
-                out->counts.icmp.echo++;
-                break;
-            case 6:
-                out->counts.tcp.open++;
-                break;
-            case 17:
-                out->counts.udp.open++;
-                break;
-            case 132:
-                out->counts.sctp.open++;
-                break;
-            }
-            if (!out->is_show_open)
-                return;
-            break;
-        case PortStatus_Closed:
-            switch (ip_proto) {
-            case 6:
-                out->counts.tcp.closed++;
-                break;
-            case 17:
-                out->counts.udp.closed++;
-                break;
-            case 132:
-                out->counts.sctp.closed++;
-                break;
-            }
-            if (!out->is_show_closed)
-                return;
-            break;
-        case PortStatus_Arp:
-            out->counts.arp.open++;
-            break;
-        default:
-            LOG(0, "unknown status type: %u\n", status);
-            return;
+/***************************************************************************
+ * The IPv6 version of output_report_status(). Not every format can
+ * hold an IPv6 address, so those that can't are warned about once and
+ * skipped.
+ ***************************************************************************/
+void
+output_report_status_ipv6(struct Output *out, time_t timestamp, int status,
+        ipv6address ip, unsigned ip_proto, unsigned port, unsigned reason,
+        unsigned ttl)
+{
+    FILE *fp;
+    time_t now = time(0);
+    char addr[64];
+
+    global_now = now;
+
+    if (!out->is_show_closed && status == PortStatus_Closed)
+        return;
+    if (!out->is_show_open && status == PortStatus_Open)
+        return;
+
+    ipv6address_fmt(addr, sizeof(addr), ip);
+
+    if (out->is_interactive || out->format == 0 || out->format == Output_Interactive) {
+        unsigned count;
+
+        count = fprintf(stdout, "Discovered %s port %u/%s on %s",
+                        status_string(status),
+                        port,
+                        name_from_ip_proto(ip_proto),
+                        addr);
+        if (count < 80)
+            fprintf(stdout, "%.*s", (int)(79-count),
+                    "                                          "
+                    "                                          ");
+        fprintf(stdout, "\n");
+        fflush(stdout);
     }
 
-    /*
-     * If this is a newly opened file, then write file headers
-     */
-    if (out->is_virgin_file) {
-        out->funcs->open(out, fp);
-        out->is_virgin_file = 0;
+    if (out->fp == NULL)
+        return;
+
+    if (out->funcs->status6 == NULL) {
+        static int is_warned = 0;
+        if (!is_warned) {
+            is_warned = 1;
+            LOG(0, "output: this format can't hold IPv6 results, skipping them\n");
+        }
+        return;
     }
 
-    /*
-     * Now do the actual output, whether it be XML, binary, JSON, ndjson, Redis,
-     * and so on.
-     */
-    out->funcs->status(out, fp, timestamp, status, ip, ip_proto, port, reason, ttl);
+    fp = status_prepare(out, now, status, ip_proto);
+    if (fp == NULL)
+        return;
+
+    out->funcs->status6(out, fp, timestamp, status, ip, ip_proto, port, reason, ttl);
 }
 
 
@@ -35,6 +35,16 @@ struct OutputType {
                    unsigned port, enum ApplicationProtocol proto,
                    unsigned ttl,
                    const unsigned char *px, unsigned length);
+
+    /* Optional: IPv6 results, for the formats that can hold them */
+    void (*status6)(struct Output *out, FILE *fp,
+                   time_t timestamp, int status,
+                   ipv6address ip, unsigned ip_proto, unsigned port,
+                   unsigned reason, unsigned ttl);
+
+    /* Optional: called from the receive thread about once a second, even
+     * when nothing's been found, for formats that buffer results */
+    void (*tick)(struct Output *out, FILE *fp, time_t now);
 };
 
 /**
@@ -72,6 +82,13 @@ struct Output
         char *directory;
     } rotate;
 
+    /* for --metrics, what's been written to files we've already closed,
+     * and where the current one started */
+    struct {
+        uint64_t closed;
+        int64_t at_open;
+    } bytes;
+
     unsigned is_banner:1;
     unsigned is_gmt:1; /* --gmt */
     unsigned is_interactive:1; /* echo to command line */
@@ -107,11 +124,36 @@ struct Output
         unsigned port;
         ptrdiff_t fd;
         uint64_t outstanding;
-        unsigned state;
+
+        /* commands waiting to be sent in one big write */
+        unsigned char *buf;
+        size_t buf_length;
+
+        /* the members of one "SADD host ..." that's being built up */
+        unsigned char *hosts;
+        size_t hosts_length;
+        unsigned host_count;
+
+        /* the part of a reply line we haven't seen the end of yet */
+        char reply[256];
+        size_t reply_length;
+
+        time_t last_flush;
     } redis;
     struct {
         char *stylesheet;
     } xml;
+    struct {
+        unsigned codec;
+        unsigned block_size;
+        struct IndexedWriter *writer;
+    } indexed;
+    struct {
+        unsigned codec;
+        unsigned threads;
+        const unsigned *cpus; /* the helpers run on these, see main-pin.c */
+        unsigned cpu_count;
+    } compress;
 };
 
 const char *name_from_ip_proto(unsigned ip_proto);
@@ -128,6 +170,7 @@ extern const struct OutputType json_output;
 extern const struct OutputType ndjson_output;
 extern const struct OutputType certs_output;
 extern const struct OutputType binary_output;
+extern const struct OutputType indexed_output;
 extern const struct OutputType null_output;
 extern const struct OutputType redis_output;
 extern const struct OutputType grepable_output;
@@ -153,6 +196,10 @@ void output_report_status(struct Output *output, time_t timestamp,
     int status, unsigned ip, unsigned ip_proto, unsigned port, unsigned reason, unsigned ttl,
     const unsigned char mac[6]);
 
+void output_report_status_ipv6(struct Output *output, time_t timestamp,
+    int status, ipv6address ip, unsigned ip_proto, unsigned port,
+    unsigned reason, unsigned ttl);
+
 
 typedef void (*OUTPUT_REPORT_BANNER)(
                 struct Output *output, time_t timestamp,
@@ -168,6 +215,20 @@ void output_report_banner(
                 unsigned ttl,
                 const unsigned char *px, unsigned length);
 
+/**
+ * Lets formats that buffer results, like Redis, send what they've got
+ * when results stop coming. The receive thread calls this about once a
+ * second, whether or not there were any packets.
+ */
+void output_tick(struct Output *output, time_t now);
+
+/**
+ * The number of bytes written to output files so far, for --metrics. This
+ * doesn't count what's sent to Redis or written to pipes.
+ */
+uint64_t
+output_bytes_written(const struct Output *output);
+
 /**
  * Regression tests this unit.
  * @return
@@ -176,6 +237,13 @@ void output_report_banner(
 int
 output_selftest(void);
 
+/**
+ * Regression tests for the Redis output, the commands it formats and the
+ * replies it parses, without needing a server.
+ */
+int
+redis_selftest(void);
+
 
 
 
@@ -0,0 +1,469 @@
+/*
+    COMPRESSION
+
+    This loads the 'zstd', 'lz4' and 'zlib' compression libraries at runtime
+    rather than compile time, in the same way that we load 'libpcap'.
+    That way, building the project doesn't require the '-dev' packages,
+    and the program still runs (without compression) on systems where
+    the libraries aren't installed.
+
+    Only the simple one-shot block APIs are used, since their binary
+    interfaces have been stable for years.
+*/
+#include "pixie-compress.h"
+#include "logger.h"
+#include "string_s.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef size_t (*ZSTD_COMPRESS)(void *dst, size_t dst_max,
+                                const void *src, size_t src_length,
+                                int level);
+typedef size_t (*ZSTD_DECOMPRESS)(void *dst, size_t dst_max,
+                                  const void *src, size_t src_length);
+typedef size_t (*ZSTD_COMPRESSBOUND)(size_t length);
+typedef unsigned (*ZSTD_ISERROR)(size_t code);
+
+typedef int (*LZ4_COMPRESS_DEFAULT)(const char *src, char *dst,
+                                    int src_length, int dst_max);
+typedef int (*LZ4_DECOMPRESS_SAFE)(const char *src, char *dst,
+                                   int src_length, int dst_max);
+typedef int (*LZ4_COMPRESSBOUND)(int length);
+
+/* The layout of zlib's 'z_stream', which has been the same since 1.0 */
+struct ZStream {
+    const unsigned char *next_in;
+    unsigned avail_in;
+    unsigned long total_in;
+    unsigned char *next_out;
+    unsigned avail_out;
+    unsigned long total_out;
+    const char *msg;
+    void *state;
+    void *zalloc;
+    void *zfree;
+    void *opaque;
+    int data_type;
+    unsigned long adler;
+    unsigned long reserved;
+};
+typedef int (*ZLIB_DEFLATEINIT2)(struct ZStream *strm, int level, int method,
+                                 int window_bits, int mem_level, int strategy,
+                                 const char *version, int stream_size);
+typedef int (*ZLIB_DEFLATE)(struct ZStream *strm, int flush);
+typedef int (*ZLIB_DEFLATEEND)(struct ZStream *strm);
+typedef int (*ZLIB_INFLATEINIT2)(struct ZStream *strm, int window_bits,
+                                 const char *version, int stream_size);
+typedef int (*ZLIB_INFLATE)(struct ZStream *strm, int flush);
+typedef int (*ZLIB_INFLATEEND)(struct ZStream *strm);
+
+static struct {
+    unsigned is_zstd_loaded:1;
+    unsigned is_zstd_available:1;
+    unsigned is_lz4_loaded:1;
+    unsigned is_lz4_available:1;
+    unsigned is_zlib_loaded:1;
+    unsigned is_zlib_available:1;
+
+    ZSTD_COMPRESS       zstd_compress;
+    ZSTD_DECOMPRESS     zstd_decompress;
+    ZSTD_COMPRESSBOUND  zstd_compressbound;
+    ZSTD_ISERROR        zstd_iserror;
+
+    LZ4_COMPRESS_DEFAULT lz4_compress;
+    LZ4_DECOMPRESS_SAFE  lz4_decompress;
+    LZ4_COMPRESSBOUND    lz4_compressbound;
+
+    ZLIB_DEFLATEINIT2   deflate_init2;
+    ZLIB_DEFLATE        deflate;
+    ZLIB_DEFLATEEND     deflate_end;
+    ZLIB_INFLATEINIT2   inflate_init2;
+    ZLIB_INFLATE        inflate;
+    ZLIB_INFLATEEND     inflate_end;
+} Z;
+
+/* Level 3 is zstd's own default, a good speed/size balance for scan
+ * records, which are very repetitive */
+static const int ZSTD_LEVEL = 3;
+
+/* zlib's default level. Window bits of 15, plus 16 for a gzip header
+ * rather than a zlib one */
+static const int GZIP_LEVEL = 6;
+#define GZIP_WINDOW_BITS (15 + 16)
+#define Z_FINISH        4
+#define Z_STREAM_END    1
+#define Z_DEFLATED      8
+
+/***************************************************************************
+ * Try each of the possible library names in turn.
+ ***************************************************************************/
+static void *
+load_library(const char *codec_name, const char **possible_names)
+{
+    void *h = NULL;
+    unsigned i;
+
+    for (i=0; possible_names[i]; i++) {
+#ifdef WIN32
+        h = (void*)LoadLibraryA(possible_names[i]);
+#else
+        h = dlopen(possible_names[i], RTLD_LAZY);
+#endif
+        if (h) {
+            LOG(1, "%s: found library: %s\n", codec_name, possible_names[i]);
+            break;
+        } else {
+            LOG(2, "%s: failed to load: %s\n", codec_name, possible_names[i]);
+        }
+    }
+    return h;
+}
+
+static void *
+load_symbol(void *h, const char *name)
+{
+#ifdef WIN32
+    return (void*)GetProcAddress((HMODULE)h, name);
+#else
+    return dlsym(h, name);
+#endif
+}
+
+
+/***************************************************************************
+ ***************************************************************************/
+int
+pixie_compress_init(enum PixieCodec codec)
+{
+    switch (codec) {
+    case Codec_None:
+        return 0;
+    case Codec_Zstd:
+        if (!Z.is_zstd_loaded) {
+            static const char *possible_names[] = {
+                "libzstd.so.1",
+                "libzstd.so",
+                "libzstd.1.dylib",
+                "libzstd.dylib",
+                "libzstd.dll",
+                "zstd.dll",
+                0
+            };
+            void *h;
+
+            Z.is_zstd_loaded = 1;
+            h = load_library("zstd", possible_names);
+            if (h == NULL) {
+                LOG(1, "zstd: failed to load libzstd shared library\n");
+                return -1;
+            }
+            Z.zstd_compress = (ZSTD_COMPRESS)load_symbol(h, "ZSTD_compress");
+            Z.zstd_decompress = (ZSTD_DECOMPRESS)load_symbol(h, "ZSTD_decompress");
+            Z.zstd_compressbound = (ZSTD_COMPRESSBOUND)load_symbol(h, "ZSTD_compressBound");
+            Z.zstd_iserror = (ZSTD_ISERROR)load_symbol(h, "ZSTD_isError");
+            if (Z.zstd_compress && Z.zstd_decompress
+                && Z.zstd_compressbound && Z.zstd_iserror)
+                Z.is_zstd_available = 1;
+            else
+                LOG(0, "zstd: library is missing functions\n");
+        }
+        return Z.is_zstd_available?0:-1;
+    case Codec_LZ4:
+        if (!Z.is_lz4_loaded) {
+            static const char *possible_names[] = {
+                "liblz4.so.1",
+                "liblz4.so",
+                "liblz4.1.dylib",
+                "liblz4.dylib",
+                "liblz4.dll",
+                "lz4.dll",
+                0
+            };
+            void *h;
+
+            Z.is_lz4_loaded = 1;
+            h = load_library("lz4", possible_names);
+            if (h == NULL) {
+                LOG(1, "lz4: failed to load liblz4 shared library\n");
+                return -1;
+            }
+            Z.lz4_compress = (LZ4_COMPRESS_DEFAULT)load_symbol(h, "LZ4_compress_default");
+            Z.lz4_decompress = (LZ4_DECOMPRESS_SAFE)load_symbol(h, "LZ4_decompress_safe");
+            Z.lz4_compressbound = (LZ4_COMPRESSBOUND)load_symbol(h, "LZ4_compressBound");
+            if (Z.lz4_compress && Z.lz4_decompress && Z.lz4_compressbound)
+                Z.is_lz4_available = 1;
+            else
+                LOG(0, "lz4: library is missing functions\n");
+        }
+        return Z.is_lz4_available?0:-1;
+    case Codec_Gzip:
+        if (!Z.is_zlib_loaded) {
+            static const char *possible_names[] = {
+                "libz.so.1",
+                "libz.so",
+                "libz.1.dylib",
+                "libz.dylib",
+                "zlib1.dll",
+                "zlib.dll",
+                0
+            };
+            void *h;
+
+            Z.is_zlib_loaded = 1;
+            h = load_library("zlib", possible_names);
+            if (h == NULL) {
+                LOG(1, "zlib: failed to load zlib shared library\n");
+                return -1;
+            }
+            Z.deflate_init2 = (ZLIB_DEFLATEINIT2)load_symbol(h, "deflateInit2_");
+            Z.deflate = (ZLIB_DEFLATE)load_symbol(h, "deflate");
+            Z.deflate_end = (ZLIB_DEFLATEEND)load_symbol(h, "deflateEnd");
+            Z.inflate_init2 = (ZLIB_INFLATEINIT2)load_symbol(h, "inflateInit2_");
+            Z.inflate = (ZLIB_INFLATE)load_symbol(h, "inflate");
+            Z.inflate_end = (ZLIB_INFLATEEND)load_symbol(h, "inflateEnd");
+            if (Z.deflate_init2 && Z.deflate && Z.deflate_end
+                && Z.inflate_init2 && Z.inflate && Z.inflate_end)
+                Z.is_zlib_available = 1;
+            else
+                LOG(0, "zlib: library is missing functions\n");
+        }
+        return Z.is_zlib_available?0:-1;
+    }
+    return -1;
+}
+
+
+/***************************************************************************
+ ***************************************************************************/
+int
+pixie_codec_from_name(const char *name)
+{
+    if (strcmp(name, "none") == 0 || strcmp(name, "0") == 0)
+        return Codec_None;
+    if (strcmp(name, "zstd") == 0)
+        return Codec_Zstd;
+    if (strcmp(name, "lz4") == 0)
+        return Codec_LZ4;
+    if (strcmp(name, "gzip") == 0 || strcmp(name, "gz") == 0)
+        return Codec_Gzip;
+    return -1;
+}
+
+const char *
+pixie_codec_to_name(enum PixieCodec codec)
+{
+    switch (codec) {
+    case Codec_None: return "none";
+    case Codec_Zstd: return "zstd";
+    case Codec_LZ4: return "lz4";
+    case Codec_Gzip: return "gzip";
+    }
+    return "unknown";
+}
+
+
+/***************************************************************************
+ ***************************************************************************/
+size_t
+pixie_compress_bound(enum PixieCodec codec, size_t length)
+{
+    switch (codec) {
+    case Codec_Zstd:
+        if (Z.is_zstd_available)
+            return Z.zstd_compressbound(length);
+        break;
+    case Codec_LZ4:
+        if (Z.is_lz4_available && length < 0x7E000000)
+            return (size_t)Z.lz4_compressbound((int)length);
+        break;
+    case Codec_Gzip:
+        /* zlib's compressBound(), plus the gzip header and trailer */
+        return length + (length >> 12) + (length >> 14) + (length >> 25)
+                + 13 + 18;
+    case Codec_None:
+        break;
+    }
+    return length;
+}
+
+
+/***************************************************************************
+ ***************************************************************************/
+size_t
+pixie_compress(enum PixieCodec codec,
+               void *dst, size_t dst_max,
+               const void *src, size_t src_length)
+{
+    switch (codec) {
+    case Codec_None:
+        if (src_length > dst_max)
+            return 0;
+        memcpy(dst, src, src_length);
+        return src_length;
+    case Codec_Zstd:
+        if (Z.is_zstd_available) {
+            size_t x;
+            x = Z.zstd_compress(dst, dst_max, src, src_length, ZSTD_LEVEL);
+            if (Z.zstd_iserror(x))
+                return 0;
+            return x;
+        }
+        break;
+    case Codec_LZ4:
+        if (Z.is_lz4_available && src_length < 0x7E000000) {
+            int x;
+            if (dst_max > 0x7FFFFFFF)
+                dst_max = 0x7FFFFFFF;
+            x = Z.lz4_compress((const char*)src, (char*)dst,
+                               (int)src_length, (int)dst_max);
+            if (x <= 0)
+                return 0;
+            return (size_t)x;
+        }
+        break;
+    case Codec_Gzip:
+        if (Z.is_zlib_available && src_length < 0xFFFFFFFF) {
+            struct ZStream strm;
+            int x;
+
+            memset(&strm, 0, sizeof(strm));
+            if (Z.deflate_init2(&strm, GZIP_LEVEL, Z_DEFLATED, GZIP_WINDOW_BITS,
+                                8, 0, "1.2.11", sizeof(strm)) != 0)
+                return 0;
+            strm.next_in = (const unsigned char *)src;
+            strm.avail_in = (unsigned)src_length;
+            strm.next_out = (unsigned char *)dst;
+            strm.avail_out = dst_max > 0xFFFFFFFF ? 0xFFFFFFFF : (unsigned)dst_max;
+            x = Z.deflate(&strm, Z_FINISH);
+            Z.deflate_end(&strm);
+            if (x != Z_STREAM_END)
+                return 0;
+            return (size_t)strm.total_out;
+        }
+        break;
+    }
+    return 0;
+}
+
+
+/***************************************************************************
+ ***************************************************************************/
+size_t
+pixie_decompress(enum PixieCodec codec,
+                 void *dst, size_t dst_max,
+                 const void *src, size_t src_length)
+{
+    switch (codec) {
+    case Codec_None:
+        if (src_length > dst_max)
+            return 0;
+        memcpy(dst, src, src_length);
+        return src_length;
+    case Codec_Zstd:
+        if (Z.is_zstd_available) {
+            size_t x;
+            x = Z.zstd_decompress(dst, dst_max, src, src_length);
+            if (Z.zstd_iserror(x))
+                return 0;
+            return x;
+        }
+        break;
+    case Codec_LZ4:
+        if (Z.is_lz4_available && src_length < 0x7FFFFFFF) {
+            int x;
+            if (dst_max > 0x7FFFFFFF)
+                dst_max = 0x7FFFFFFF;
+            x = Z.lz4_decompress((const char*)src, (char*)dst,
+                                 (int)src_length, (int)dst_max);
+            if (x < 0)
+                return 0;
+            return (size_t)x;
+        }
+        break;
+    case Codec_Gzip:
+        if (Z.is_zlib_available && src_length < 0xFFFFFFFF) {
+            struct ZStream strm;
+            int x;
+
+            memset(&strm, 0, sizeof(strm));
+            if (Z.inflate_init2(&strm, GZIP_WINDOW_BITS, "1.2.11", sizeof(strm)) != 0)
+                return 0;
+            strm.next_in = (const unsigned char *)src;
+            strm.avail_in = (unsigned)src_length;
+            strm.next_out = (unsigned char *)dst;
+            strm.avail_out = dst_max > 0xFFFFFFFF ? 0xFFFFFFFF : (unsigned)dst_max;
+            x = Z.inflate(&strm, Z_FINISH);
+            Z.inflate_end(&strm);
+            if (x != Z_STREAM_END)
+                return 0;
+            return (size_t)strm.total_out;
+        }
+        break;
+    }
+    return 0;
+}
+
+
+/***************************************************************************
+ * Round-trip a buffer through each codec whose library is installed.
+ * Codecs that aren't installed are skipped, not failed.
+ ***************************************************************************/
+int
+pixie_compress_selftest(void)
+{
+    static const enum PixieCodec codecs[] = {Codec_None, Codec_Zstd, Codec_LZ4,
+                                             Codec_Gzip};
+    unsigned char src[4096];
+    unsigned char packed[8192];
+    unsigned char unpacked[4096];
+    unsigned i;
+
+    for (i=0; i<sizeof(src); i++)
+        src[i] = (unsigned char)((i % 13) * (i % 7));
+
+    for (i=0; i<sizeof(codecs)/sizeof(codecs[0]); i++) {
+        size_t packed_length;
+        size_t unpacked_length;
+
+        if (pixie_compress_init(codecs[i]) != 0)
+            continue;
+        if (pixie_compress_bound(codecs[i], sizeof(src)) > sizeof(packed))
+            goto fail;
+
+        packed_length = pixie_compress(codecs[i], packed, sizeof(packed),
+                                       src, sizeof(src));
+        if (packed_length == 0)
+            goto fail;
+        if (codecs[i] != Codec_None && packed_length >= sizeof(src))
+            goto fail;
+
+        unpacked_length = pixie_decompress(codecs[i], unpacked, sizeof(unpacked),
+                                           packed, packed_length);
+        if (unpacked_length != sizeof(src))
+            goto fail;
+        if (memcmp(src, unpacked, sizeof(src)) != 0)
+            goto fail;
+
+        /* corrupt input must fail, not crash */
+        if (codecs[i] != Codec_None) {
+            packed[packed_length/2] ^= 0xA5;
+            packed[0] ^= 0xFF;
+            pixie_decompress(codecs[i], unpacked, sizeof(unpacked),
+                             packed, packed_length);
+        }
+        continue;
+    fail:
+        fprintf(stderr, "compress: selftest failed: %s\n",
+                pixie_codec_to_name(codecs[i]));
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+#ifndef PIXIE_COMPRESS_H
+#define PIXIE_COMPRESS_H
+#include <stdio.h>
+
+/**
+ * Compression codecs. These values are stored in files, so don't change
+ * them. Add new ones onto the end.
+ */
+enum PixieCodec {
+    Codec_None  = 0,
+    Codec_Zstd  = 1,
+    Codec_LZ4   = 2,
+    Codec_Gzip  = 3,
+};
+
+/**
+ * Runtime-load the library for the codec (libzstd, liblz4, zlib), in the same
+ * way we load libpcap, so that building masscan doesn't need their
+ * development packages. Call this from the main thread before using the
+ * codec from worker threads.
+ *
+ * @return
+ *      0 if the codec can be used, -1 if the library couldn't be loaded
+ */
+int
+pixie_compress_init(enum PixieCodec codec);
+
+/**
+ * Converts a name like "zstd", "lz4" or "gzip" to a codec.
+ *
+ * @return
+ *      the codec, or -1 if the name is unknown
+ */
+int
+pixie_codec_from_name(const char *name);
+
+const char *
+pixie_codec_to_name(enum PixieCodec codec);
+
+/**
+ * The largest number of bytes that compressing 'length' bytes can
+ * produce, for sizing the output buffer.
+ */
+size_t
+pixie_compress_bound(enum PixieCodec codec, size_t length);
+
+/**
+ * Compress a block of data in one go. For zstd and gzip, the result is a
+ * complete frame (or gzip "member"), so blocks compressed separately can
+ * be concatenated into a file that the normal command-line tools can
+ * decompress.
+ *
+ * @return
+ *      the compressed length, or 0 on failure
+ */
+size_t
+pixie_compress(enum PixieCodec codec,
+               void *dst, size_t dst_max,
+               const void *src, size_t src_length);
+
+/**
+ * Decompress a block created by pixie_compress(). The caller must know
+ * the decompressed size, and 'dst_max' must be at least that big.
+ *
+ * @return
+ *      the decompressed length, or 0 on failure
+ */
+size_t
+pixie_decompress(enum PixieCodec codec,
+                 void *dst, size_t dst_max,
+                 const void *src, size_t src_length);
+
+int
+pixie_compress_selftest(void);
+
+#endif
@@ -8,7 +8,21 @@
 #else
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+struct PixieMapping {
+    const unsigned char *px;
+    uint64_t size;
+#if defined(WIN32)
+    HANDLE hFile;
+    HANDLE hMapping;
 #endif
+};
 
 int
 pixie_fopen_shareable(FILE **in_fp, const char *filename, unsigned is_append)
@@ -65,3 +79,100 @@ pixie_fopen_shareable(FILE **in_fp, const char *filename, unsigned is_append)
     *in_fp = fp;
     return 0;
 }
+
+/***************************************************************************
+ ***************************************************************************/
+const unsigned char *
+pixie_mmap_file(const char *filename, uint64_t *size, void **handle)
+{
+    struct PixieMapping *map;
+
+    *handle = NULL;
+    *size = 0;
+
+    map = (struct PixieMapping *)malloc(sizeof(*map));
+    if (map == NULL)
+        return NULL;
+    memset(map, 0, sizeof(*map));
+
+#if defined(WIN32)
+    {
+        LARGE_INTEGER li;
+
+        map->hFile = CreateFileA(filename, GENERIC_READ,
+                                 FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                 NULL, OPEN_EXISTING,
+                                 FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (map->hFile == INVALID_HANDLE_VALUE)
+            goto fail;
+        if (!GetFileSizeEx(map->hFile, &li))
+            goto fail;
+        map->size = (uint64_t)li.QuadPart;
+        if (map->size) {
+            map->hMapping = CreateFileMappingA(map->hFile, NULL, PAGE_READONLY,
+                                               0, 0, NULL);
+            if (map->hMapping == NULL)
+                goto fail;
+            map->px = (const unsigned char *)MapViewOfFile(map->hMapping,
+                                               FILE_MAP_READ, 0, 0, 0);
+            if (map->px == NULL)
+                goto fail;
+        }
+    }
+#else
+    {
+        struct stat st;
+        int fd;
+        void *p;
+
+        fd = open(filename, O_RDONLY);
+        if (fd < 0)
+            goto fail;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            goto fail;
+        }
+        map->size = (uint64_t)st.st_size;
+        if (map->size) {
+            p = mmap(0, (size_t)map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                close(fd);
+                goto fail;
+            }
+            map->px = (const unsigned char *)p;
+        }
+        close(fd);
+    }
+#endif
+
+    *handle = map;
+    *size = map->size;
+    return map->px?map->px:(const unsigned char *)"";
+
+fail:
+    pixie_munmap_file(map);
+    return NULL;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+pixie_munmap_file(void *handle)
+{
+    struct PixieMapping *map = (struct PixieMapping *)handle;
+
+    if (map == NULL)
+        return;
+#if defined(WIN32)
+    if (map->px)
+        UnmapViewOfFile(map->px);
+    if (map->hMapping)
+        CloseHandle(map->hMapping);
+    if (map->hFile && map->hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(map->hFile);
+#else
+    if (map->px)
+        munmap((void*)map->px, (size_t)map->size);
+#endif
+    free(map);
+}
@@ -1,6 +1,7 @@
 #ifndef PIXIE_FILE_H
 #define PIXIE_FILE_H
 #include <stdio.h>
+#include <stdint.h>
 
 #if defined(WIN32)
 #include <io.h>
@@ -16,4 +17,21 @@
 int
 pixie_fopen_shareable(FILE **in_fp, const char *filename, unsigned is_append);
 
+/**
+ * Map an entire file into memory, read-only. This is for reading large
+ * files in random order, or from several threads at once.
+ *
+ * @param size
+ *      receives the size of the file
+ * @param handle
+ *      receives the handle to pass to pixie_munmap_file()
+ * @return
+ *      the start of the mapping, or NULL on error (with errno set)
+ */
+const unsigned char *
+pixie_mmap_file(const char *filename, uint64_t *size, void **handle);
+
+void
+pixie_munmap_file(void *handle);
+
 #endif
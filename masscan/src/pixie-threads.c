@@ -61,13 +61,28 @@ DWORD_PTR result;
  ****************************************************************************/
 void
 pixie_cpu_set_affinity(unsigned processor)
+{
+    pixie_cpu_set_affinity_list(&processor, 1);
+}
+
+/****************************************************************************
+ * Set the current thread to run on any of the listed processors, numbered
+ * from zero.
+ ****************************************************************************/
+void
+pixie_cpu_set_affinity_list(const unsigned *processors, unsigned count)
 {
 #if defined WIN32
-    DWORD_PTR mask;
+    DWORD_PTR mask = 0;
     DWORD_PTR result;
-    if (processor > 0)
-        processor--;
-    mask = ((size_t)1)<<processor;
+    unsigned i;
+
+    for (i=0; i<count; i++) {
+        if (processors[i] < sizeof(mask) * 8)
+            mask |= ((DWORD_PTR)1)<<processors[i];
+    }
+    if (mask == 0)
+        return;
 
     //printf("mask(%u) = 0x%08x\n", processor, mask);
     result = SetThreadAffinityMask(GetCurrentThread(), mask);
@@ -78,15 +93,24 @@ pixie_cpu_set_affinity(unsigned processor)
     int x;
     pthread_t thread = pthread_self();
     cpu_set_t cpuset;
+    unsigned i;
 
     CPU_ZERO(&cpuset);
 
-    CPU_SET(processor+1, &cpuset);
+    for (i=0; i<count; i++) {
+        if (processors[i] < CPU_SETSIZE)
+            CPU_SET(processors[i], &cpuset);
+    }
+    if (CPU_COUNT(&cpuset) == 0)
+        return;
 
     x = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
     if (x != 0) {
-        fprintf(stderr, "set_affinity: returned error linux:%d\n", errno);
+        fprintf(stderr, "set_affinity: returned error linux:%d\n", x);
     }
+#else
+    UNUSEDPARM(processors);
+    UNUSEDPARM(count);
 #endif
 }
 
@@ -23,7 +23,12 @@ size_t pixie_begin_thread(void (*worker_thread)(void*),
 
 void pixie_thread_join(size_t thread_handle);
 
+/**
+ * Pin the calling thread to one processor, or to any of a list of them,
+ * numbered from zero as Linux numbers them.
+ */
 void pixie_cpu_set_affinity(unsigned processor);
+void pixie_cpu_set_affinity_list(const unsigned *processors, unsigned count);
 void pixie_cpu_raise_priority(void);
 
 void pixie_locked_subtract_u32(unsigned *lhs, unsigned rhs);
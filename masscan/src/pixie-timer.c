@@ -243,6 +243,101 @@ pixie_nanotime(void)
 }
 #endif
 
+
+/***************************************************************************
+ * The timestamp counter only counts time if it's "invariant", running at
+ * the same rate regardless of the CPU's power state, which CPUID tells us.
+ * On anything else we fall back to the clock.
+ ***************************************************************************/
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+static uint64_t
+pixie_rdtsc(void)
+{
+    return __rdtsc();
+}
+static int
+is_tsc_invariant(void)
+{
+    int regs[4];
+    __cpuid(regs, 0x80000000);
+    if ((unsigned)regs[0] < 0x80000007)
+        return 0;
+    __cpuid(regs, 0x80000007);
+    return (regs[3] >> 8) & 1;
+}
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+static uint64_t
+pixie_rdtsc(void)
+{
+    unsigned hi = 0, lo = 0;
+    __asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)lo) | (((uint64_t)hi)<<32);
+}
+static int
+is_tsc_invariant(void)
+{
+    unsigned eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0)
+        return 0;
+    return (edx >> 8) & 1;
+}
+#else
+static uint64_t
+pixie_rdtsc(void)
+{
+    return 0;
+}
+static int
+is_tsc_invariant(void)
+{
+    return 0;
+}
+#endif
+
+static uint64_t ticks_per_second;
+static int is_tsc;
+
+uint64_t
+pixie_ticks_per_second(void)
+{
+    uint64_t ns0, ns1, tsc0, tsc1;
+
+    if (ticks_per_second)
+        return ticks_per_second;
+
+    if (!is_tsc_invariant()) {
+        ticks_per_second = 1000000000;
+        return ticks_per_second;
+    }
+
+    ns0 = pixie_nanotime();
+    tsc0 = pixie_rdtsc();
+    pixie_usleep(10000);
+    ns1 = pixie_nanotime();
+    tsc1 = pixie_rdtsc();
+
+    /* if the counter doesn't seem to be running, don't trust it */
+    if (ns1 <= ns0 || tsc1 <= tsc0) {
+        ticks_per_second = 1000000000;
+        return ticks_per_second;
+    }
+
+    is_tsc = 1;
+    ticks_per_second = (uint64_t)((tsc1 - tsc0) * (1000000000.0 / (ns1 - ns0)));
+    return ticks_per_second;
+}
+
+uint64_t
+pixie_ticks(void)
+{
+    if (is_tsc)
+        return pixie_rdtsc();
+    else
+        return pixie_nanotime();
+}
+
 int pixie_time_selftest(void)
 {
     static const uint64_t duration = 123456;
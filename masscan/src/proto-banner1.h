@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include "proto-banout.h"
 #include "proto-x509.h"
+#include "crypto-sha.h"
 
 struct InteractiveData;
 
@@ -18,6 +19,7 @@ struct Banner1
 
     unsigned is_capture_html:1;
     unsigned is_capture_cert:1;
+    unsigned is_capture_certdigest:1;
     unsigned is_capture_heartbleed:1;
     unsigned is_capture_ticketbleed:1;
     unsigned is_heartbleed:1;
@@ -51,6 +53,7 @@ struct SSL_SERVER_CERT {
         unsigned remaining;
     } sub;
     struct CertDecode x509;
+    struct ShaPair digest;
 };
 struct SSL_SERVER_ALERT {
     unsigned char level;
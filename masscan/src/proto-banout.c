@@ -16,6 +16,18 @@
 #include <string.h>
 #include <stdlib.h>
 
+/* Only used for --benchmark-replay, so it's not worth making this atomic
+ * for the case of several receive threads */
+static uint64_t banout_allocations;
+
+/***************************************************************************
+ ***************************************************************************/
+uint64_t
+banout_allocation_count(void)
+{
+    return banout_allocations;
+}
+
 /***************************************************************************
  ***************************************************************************/
 void
@@ -189,6 +201,7 @@ banout_new_proto(struct BannerOutput *banout, unsigned proto)
     }
 
     p = (struct BannerOutput *)malloc(sizeof(*p));
+    banout_allocations++;
     memset(p, 0, sizeof(*p));
     p->protocol = proto;
     p->max_length = sizeof(p->banner);
@@ -210,6 +223,7 @@ banout_expand(struct BannerOutput *banout, struct BannerOutput *p)
                                         + 2 * p->max_length);
     if (n == NULL)
         exit(1);
+    banout_allocations++;
 
     /* Copy the old structure */
     memcpy(n, p, offsetof(struct BannerOutput, banner) + p->max_length);
@@ -1,5 +1,6 @@
 #ifndef PROTO_BANOUT_H
 #define PROTO_BANOUT_H
+#include <stdint.h>
 struct BannerBase64;
 
 /**
@@ -117,6 +118,14 @@ unsigned
 banout_is_contains(const struct BannerOutput *banout, unsigned proto,
                 const char *string);
 
+/**
+ * The number of times any banner has had to allocate memory, because it
+ * had more than one protocol or outgrew its space. This is for
+ * --benchmark-replay, and only counts correctly with one receive thread.
+ */
+uint64_t
+banout_allocation_count(void);
+
 /**
  * Do the typical unit/regression test, for this module.
  */
@@ -338,6 +338,43 @@ parse_server_hello(
 }
 
 
+/*****************************************************************************
+ * With "--capture certdigest", we hash each certificate as it goes by
+ * instead of capturing it. When it's finished, add the fingerprints onto
+ * the names that the X.509 parser has already written to the banner,
+ * then end the banner so the next certificate gets its own.
+ *****************************************************************************/
+static void
+append_cert_digest(struct BannerOutput *banout, struct ShaPair *digest)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned char sha1[20];
+    unsigned char sha256[32];
+    char buf[sizeof(" sha1: sha256:") + 2*20 + 2*32];
+    size_t offset = 0;
+    unsigned i;
+
+    sha_pair_final(digest, sha1, sha256);
+
+    if (banout_string_length(banout, PROTO_X509_DIGEST))
+        buf[offset++] = ' ';
+    memcpy(buf+offset, "sha1:", 5);
+    offset += 5;
+    for (i=0; i<sizeof(sha1); i++) {
+        buf[offset++] = hex[sha1[i]>>4];
+        buf[offset++] = hex[sha1[i]&0xF];
+    }
+    memcpy(buf+offset, " sha256:", 8);
+    offset += 8;
+    for (i=0; i<sizeof(sha256); i++) {
+        buf[offset++] = hex[sha256[i]>>4];
+        buf[offset++] = hex[sha256[i]&0xF];
+    }
+
+    banout_append(banout, PROTO_X509_DIGEST, buf, offset);
+    banout_end(banout, PROTO_X509_DIGEST);
+}
+
 /*****************************************************************************
  * This parses the certificates from the server. Thise contains an outer
  * length field for all certificates, and then uses a length field for
@@ -365,6 +402,7 @@ parse_server_hello(
  * Called by ssl_parser_record()->parse_handshake()
  * Calls x509_decode() to parse the certificate
  * Calls banout_append_base64() to capture the certificate
+ * Calls sha_pair_update() to fingerprint it instead (--capture certdigest)
  *****************************************************************************/
 static void
 parse_server_cert(
@@ -427,6 +465,10 @@ parse_server_cert(
             x509_decode_init(&data->x509, cert_remaining);
             data->x509.count = (unsigned char)count + 1;
         }
+        if (banner1->is_capture_certdigest) {
+            data->x509.is_digest = 1;
+            sha_pair_init(&data->digest);
+        }
         DROPDOWN(i,length,state);
 
     case CERT:
@@ -445,6 +487,9 @@ parse_server_cert(
                              &pstate->base64);
             }
 
+            if (banner1->is_capture_certdigest)
+                sha_pair_update(&data->digest, px+i, len);
+
             x509_decode(&data->x509, px+i, len, banout);
 
 
@@ -461,6 +506,8 @@ parse_server_cert(
                                            &pstate->base64);        
                     banout_end(banout, PROTO_X509_CERT);
                 }
+                if (banner1->is_capture_certdigest)
+                    append_cert_digest(banout, &data->digest);
                 state = CLEN0;
                 if (remaining == 0) {
                     if (!banner1->is_heartbleed)
@@ -1391,6 +1438,62 @@ ssl_selftest(void)
     banner1_destroy(banner1);
     banout_release(banout2);
 
+    /*
+     * Fingerprint the certificate instead of capturing it, a byte at a
+     * time, so that the hashes have to carry across fragments
+     */
+    banner1 = banner1_create();
+    banner1->is_capture_certdigest = 1;
+    memset(state, 0, sizeof(state));
+    banout_init(banout2);
+    for (ii=0; ii<ssl_test_case_3_size; ii++)
+    ssl_parse_record(  banner1,
+                0,
+                state,
+                (const unsigned char *)ssl_test_case_3+ii,
+                1,
+                banout2,
+                &more
+                );
+    {
+        static const char *expected[] = {
+            "issuer:Puppet CA: ubuntu.localdomain cn:ubuntu.localdomain"
+            " san:puppet san:puppet.localdomain san:ubuntu.localdomain"
+            " sha1:f7d7e645f5f6e62755c145d9afc1311e72b9a9bc"
+            " sha256:9af736dfb3805ef817dbccd9d03b4a03"
+                    "fe1564033a0c37f3f56a5bf34652d458",
+            "issuer:Puppet CA: ubuntu.localdomain"
+            " cn:Puppet CA: ubuntu.localdomain"
+            " sha1:612f8df7054c1e860fe372aa452959595204dbda"
+            " sha256:d6e1d51ff73e11b9a275290f9795dd52"
+                    "9d3db92af8f6aca235bd14063a584d32",
+        };
+        const struct BannerOutput *b;
+        unsigned found = 0;
+
+        /* each certificate gets its own banner, which has been ended, so
+         * look for them by hand */
+        for (b = banout2; b; b = b->next) {
+            unsigned j;
+            if ((b->protocol & 0xFFFF) == PROTO_X509_CERT)
+                found = 100;
+            if ((b->protocol & 0xFFFF) != PROTO_X509_DIGEST)
+                continue;
+            for (j=0; j<2; j++) {
+                if (b->length == strlen(expected[j])
+                    && memcmp(b->banner, expected[j], b->length) == 0)
+                    found++;
+            }
+        }
+        x = (found == 2);
+    }
+    if (!x) {
+        fprintf(stderr, "ssl: certificate digest failed\n");
+        return 1;
+    }
+    banner1_destroy(banner1);
+    banout_release(banout2);
+
     /*
      * Do checking
      */
@@ -64,15 +64,42 @@ struct TCP_Control_Block
     struct ProtocolState banner1_state;
 };
 
+/***************************************************************************
+ * The index of TCBs, looked up on every packet during a banner scan. It's
+ * an open-addressing table using "Robin Hood" hashing: entries are kept
+ * in order of how far they are from the slot they hash to, so a lookup
+ * can stop as soon as it sees an entry closer to home than the one it's
+ * looking for. Each slot holds a copy of the connection's addresses and
+ * ports, so we only touch the TCB itself when we've found it. Probing is
+ * through neighboring slots in the same cache lines, instead of chasing
+ * a linked list of TCBs scattered across memory.
+ ***************************************************************************/
+struct TCB_Slot {
+    unsigned ip_me;
+    unsigned ip_them;
+    unsigned short port_me;
+    unsigned short port_them;
+    unsigned hash;
+    struct TCP_Control_Block *tcb; /* NULL if the slot is empty */
+};
+
+struct TCB_Index {
+    struct TCB_Slot *slots;
+    size_t mask;
+    size_t count;
+    size_t grow_at;
+};
+
 struct TCP_ConnectionTable {
-    struct TCP_Control_Block **entries;
+    struct TCB_Index index;
     struct TCP_Control_Block *freed_list;
-    unsigned count;
-    unsigned mask;
     unsigned timeout_connection;
     unsigned timeout_hello;
 
     uint64_t active_count;
+    uint64_t orphan_count;
+    uint64_t allocation_count;
+    uint64_t buffer_waits;
     uint64_t entropy;
 
     struct Timeouts *timeouts;
@@ -138,6 +165,9 @@ tcpcon_timeouts(struct TCP_ConnectionTable *tcpcon, unsigned secs, unsigned usec
          * deleted, but hasn't been inserted back into the timeout system,
          * then insert it here. */
         if (tcb->timeout->prev == 0 && tcb->ip_them != 0 && tcb->port_them != 0) {
+            tcpcon->orphan_count++;
+            LOG(1, "TCB orphaned by timeout handler (%" PRIu64 " so far)\n",
+                tcpcon->orphan_count);
             timeouts_add(   tcpcon->timeouts,
                             tcb->timeout,
                             offsetof(struct TCP_Control_Block, timeout),
@@ -146,6 +176,43 @@ tcpcon_timeouts(struct TCP_ConnectionTable *tcpcon, unsigned secs, unsigned usec
     }
 }
 
+/***************************************************************************
+ * Every TCB must be waiting on a timeout, otherwise it'll never be cleaned
+ * up. Count the ones that aren't (the difference between the TCBs we have
+ * and the entries in the timeout wheel), plus the ones that the timeout
+ * handler forgot to re-arm and that had to be caught above.
+ ***************************************************************************/
+uint64_t
+tcpcon_leaked_tcbs(const struct TCP_ConnectionTable *tcpcon)
+{
+    uint64_t pending = timeouts_pending(tcpcon->timeouts);
+    uint64_t unarmed = 0;
+
+    if (tcpcon->active_count > pending)
+        unarmed = tcpcon->active_count - pending;
+
+    return unarmed + tcpcon->orphan_count;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+uint64_t
+tcpcon_allocation_count(const struct TCP_ConnectionTable *tcpcon)
+{
+    return tcpcon->allocation_count;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+tcpcon_get_load(const struct TCP_ConnectionTable *tcpcon,
+                uint64_t *active, uint64_t *buckets, uint64_t *buffer_waits)
+{
+    *active = tcpcon->active_count;
+    *buckets = tcpcon->index.mask + 1;
+    *buffer_waits = tcpcon->buffer_waits;
+}
+
 /***************************************************************************
  ***************************************************************************/
 static int
@@ -220,6 +287,13 @@ tcpcon_set_parameter(struct TCP_ConnectionTable *tcpcon,
         LOG(1, "TCP connection-timeout = %u\n", tcpcon->timeout_connection);
         return;
     }
+    if (name_equals(name, "timer-resolution")) {
+        /* in milliseconds */
+        uint64_t n = parseInt(value, value_length);
+        timeouts_set_resolution(tcpcon->timeouts, (n * TICKS_PER_SECOND) / 1000);
+        LOG(1, "TCP timer-resolution = %u-msecs\n", (unsigned)n);
+        return;
+    }
     if (name_equals(name, "hello-timeout")) {
         uint64_t n = parseInt(value, value_length);
         tcpcon->timeout_hello = (unsigned)n;
@@ -337,16 +411,214 @@ tcpcon_set_parameter(struct TCP_ConnectionTable *tcpcon,
 void
 tcpcon_set_banner_flags(struct TCP_ConnectionTable *tcpcon,
     unsigned is_capture_cert,
+    unsigned is_capture_certdigest,
     unsigned is_capture_html,
     unsigned is_capture_heartbleed,
 	unsigned is_capture_ticketbleed)
 {
     tcpcon->banner1->is_capture_cert = is_capture_cert;
+    tcpcon->banner1->is_capture_certdigest = is_capture_certdigest;
     tcpcon->banner1->is_capture_html = is_capture_html;
     tcpcon->banner1->is_capture_heartbleed = is_capture_heartbleed;
     tcpcon->banner1->is_capture_ticketbleed = is_capture_ticketbleed;
 }
 
+/***************************************************************************
+ ***************************************************************************/
+static unsigned
+tcb_hash(   unsigned ip_me, unsigned port_me, 
+            unsigned ip_them, unsigned port_them,
+            uint64_t entropy)
+{
+    unsigned index;
+
+    /* TCB hash table uses symmetric hash, so incoming/outgoing packets
+     * get the same hash. FIXME: does this really nee to be symmetric? */
+    index = (unsigned)syn_cookie(   ip_me   ^ ip_them,
+                                    port_me ^ port_them,
+                                    ip_me   ^ ip_them,
+                                    port_me ^ port_them,
+                                    entropy
+                                    );
+    return index;
+}
+
+#define TCB_INDEX_MIN (1<<10)
+
+/***************************************************************************
+ * Make room for at least 'count' connections, while staying under the
+ * load factor of 80%, after which lookups for connections that aren't
+ * there get slow.
+ ***************************************************************************/
+static int
+tcbindex_init(struct TCB_Index *index, size_t count)
+{
+    size_t capacity = TCB_INDEX_MIN;
+
+    while (capacity / 5 * 4 < count)
+        capacity *= 2;
+
+    index->slots = (struct TCB_Slot *)calloc(capacity, sizeof(index->slots[0]));
+    if (index->slots == NULL)
+        return -1;
+    index->mask = capacity - 1;
+    index->count = 0;
+    index->grow_at = capacity / 5 * 4;
+    return 0;
+}
+
+/***************************************************************************
+ * How far a slot's entry is from where it hashes to.
+ ***************************************************************************/
+static size_t
+tcbindex_distance(const struct TCB_Index *index, size_t i)
+{
+    return (i - (index->slots[i].hash & index->mask)) & index->mask;
+}
+
+/***************************************************************************
+ * Find the slot for a connection, or NULL if we aren't tracking it.
+ ***************************************************************************/
+static struct TCB_Slot *
+tcbindex_find(const struct TCB_Index *index, unsigned hash,
+              unsigned ip_me, unsigned ip_them,
+              unsigned port_me, unsigned port_them)
+{
+    size_t i = hash & index->mask;
+    size_t distance;
+
+    for (distance=0; ; distance++) {
+        struct TCB_Slot *slot = &index->slots[i];
+
+        if (slot->tcb == NULL)
+            return NULL;
+
+        /* Had it been here, it would've displaced this one */
+        if (tcbindex_distance(index, i) < distance)
+            return NULL;
+
+        if (slot->hash == hash
+            && slot->ip_them == ip_them && slot->port_them == port_them
+            && slot->ip_me == ip_me && slot->port_me == port_me)
+            return slot;
+
+        i = (i + 1) & index->mask;
+    }
+}
+
+/***************************************************************************
+ * Add an entry that isn't already in the index. Going along from where it
+ * hashes to, it takes the place of the first entry that's closer to its
+ * home than it is, and that entry moves along in its place.
+ ***************************************************************************/
+static void
+tcbindex_place(struct TCB_Index *index, struct TCB_Slot entry)
+{
+    size_t i = entry.hash & index->mask;
+    size_t distance;
+
+    for (distance=0; ; distance++) {
+        struct TCB_Slot *slot = &index->slots[i];
+        size_t their_distance;
+
+        if (slot->tcb == NULL) {
+            *slot = entry;
+            index->count++;
+            return;
+        }
+
+        their_distance = tcbindex_distance(index, i);
+        if (their_distance < distance) {
+            struct TCB_Slot tmp = *slot;
+            *slot = entry;
+            entry = tmp;
+            distance = their_distance;
+        }
+
+        i = (i + 1) & index->mask;
+    }
+}
+
+/***************************************************************************
+ * Double the size of the index. If there isn't the memory, carry on with
+ * the one we have for as long as there's room, since a nearly full index
+ * is only slow, not wrong.
+ ***************************************************************************/
+static void
+tcbindex_grow(struct TCB_Index *index)
+{
+    struct TCB_Index bigger;
+    size_t i;
+
+    bigger.slots = (struct TCB_Slot *)calloc((index->mask + 1) * 2,
+                                             sizeof(bigger.slots[0]));
+    if (bigger.slots == NULL) {
+        if (index->grow_at < index->mask) {
+            LOG(0, "tcb: out of memory growing to %llu connections, continuing slowly\n",
+                (unsigned long long)(index->mask + 1) * 2);
+            index->grow_at = index->mask;
+            return;
+        }
+        fprintf(stderr, "tcb: out of memory\n");
+        exit(1);
+    }
+    bigger.mask = index->mask * 2 + 1;
+    bigger.count = 0;
+    bigger.grow_at = (bigger.mask + 1) / 5 * 4;
+
+    for (i=0; i<=index->mask; i++) {
+        if (index->slots[i].tcb)
+            tcbindex_place(&bigger, index->slots[i]);
+    }
+
+    free(index->slots);
+    *index = bigger;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+tcbindex_insert(struct TCB_Index *index, unsigned hash,
+                unsigned ip_me, unsigned ip_them,
+                unsigned port_me, unsigned port_them,
+                struct TCP_Control_Block *tcb)
+{
+    struct TCB_Slot entry;
+
+    if (index->count >= index->grow_at)
+        tcbindex_grow(index);
+
+    entry.ip_me = ip_me;
+    entry.ip_them = ip_them;
+    entry.port_me = (unsigned short)port_me;
+    entry.port_them = (unsigned short)port_them;
+    entry.hash = hash;
+    entry.tcb = tcb;
+    tcbindex_place(index, entry);
+}
+
+/***************************************************************************
+ * Remove an entry, shifting the ones after it back a slot, until we get
+ * to one that's already where it hashes to. That way there are no
+ * "deleted" markers for lookups to step over.
+ ***************************************************************************/
+static void
+tcbindex_remove(struct TCB_Index *index, struct TCB_Slot *slot)
+{
+    size_t i = slot - index->slots;
+
+    for (;;) {
+        size_t next = (i + 1) & index->mask;
+
+        if (index->slots[next].tcb == NULL || tcbindex_distance(index, next) == 0)
+            break;
+        index->slots[i] = index->slots[next];
+        i = next;
+    }
+    memset(&index->slots[i], 0, sizeof(index->slots[i]));
+    index->count--;
+}
+
 /***************************************************************************
  * Called at startup, by a receive thread, to create a TCP connection
  * table.
@@ -376,43 +648,21 @@ tcpcon_create_table(    size_t entry_count,
     tcpcon->timeout_hello = 2;
     tcpcon->entropy = entropy;
 
-    /* Find nearest power of 2 to the tcb count, but don't go
-     * over the number 16-million */
-    {
-        size_t new_entry_count;
-        new_entry_count = 1;
-        while (new_entry_count < entry_count) {
-            new_entry_count *= 2;
-            if (new_entry_count == 0) {
-                new_entry_count = (1<<24);
-                break;
-            }
-        }
-        if (new_entry_count > (1<<24))
-            new_entry_count = (1<<24);
-        if (new_entry_count < (1<<10))
-            new_entry_count = (1<<10);
-        entry_count = new_entry_count;
-    }
-
-    /* Create the table. If we can't allocate enough memory, then shrink
-     * the desired size of the table */
-    while (tcpcon->entries == 0) {
-        tcpcon->entries = (struct TCP_Control_Block**)
-                            malloc(entry_count * sizeof(*tcpcon->entries));
-        if (tcpcon->entries == NULL) {
-            entry_count >>= 1;
+    /* Create the index, big enough for the expected number of
+     * connections. It grows as needed, so if there isn't the memory for
+     * that now, start smaller */
+    while (tcbindex_init(&tcpcon->index, entry_count) != 0) {
+        LOG(0, "tcb: not enough memory for %llu connections\n",
+            (unsigned long long)entry_count);
+        entry_count >>= 1;
+        if (entry_count < TCB_INDEX_MIN) {
+            fprintf(stderr, "tcb: out of memory\n");
+            exit(1);
         }
     }
-    memset(tcpcon->entries, 0, entry_count * sizeof(*tcpcon->entries));
-
-
-    /* fill in the table structure */
-    tcpcon->count = (unsigned)entry_count;
-    tcpcon->mask = (unsigned)(entry_count-1);
 
     /* create an event/timeouts structure */
-    tcpcon->timeouts = timeouts_create(TICKS_FROM_SECS(time(0)));
+    tcpcon->timeouts = timeouts_create(TICKS_FROM_SECS(global_now));
 
 
     tcpcon->pkt_template = pkt_template;
@@ -428,28 +678,6 @@ tcpcon_create_table(    size_t entry_count,
     return tcpcon;
 }
 
-#define EQUALS(lhs,rhs) (memcmp((lhs),(rhs),12)==0)
-
-/***************************************************************************
- ***************************************************************************/
-static unsigned
-tcb_hash(   unsigned ip_me, unsigned port_me, 
-            unsigned ip_them, unsigned port_them,
-            uint64_t entropy)
-{
-    unsigned index;
-
-    /* TCB hash table uses symmetric hash, so incoming/outgoing packets
-     * get the same hash. FIXME: does this really nee to be symmetric? */
-    index = (unsigned)syn_cookie(   ip_me   ^ ip_them,
-                                    port_me ^ port_them,
-                                    ip_me   ^ ip_them,
-                                    port_me ^ port_them,
-                                    entropy
-                                    );
-    return index;
-}
-
 enum DestroyReason {
     Reason_Timeout = 1,
     Reason_FIN = 2,
@@ -471,8 +699,8 @@ tcpcon_destroy_tcb(
     struct TCP_Control_Block *tcb,
     enum DestroyReason reason)
 {
-    unsigned index;
-    struct TCP_Control_Block **r_entry;
+    unsigned hash;
+    struct TCB_Slot *slot;
     struct BannerOutput *banout;
 
     UNUSEDPARM(reason);
@@ -481,21 +709,16 @@ tcpcon_destroy_tcb(
 
     /*
      * The TCB doesn't point to it's location in the table. Therefore, we
-     * have to do a lookup to find the head pointer in the table.
-     */
-    index = tcb_hash(   tcb->ip_me, tcb->port_me, 
-                        tcb->ip_them, tcb->port_them, 
-                        tcpcon->entropy);
-
-    /*
-     * At this point, we have the head of a linked list of TCBs. Now,
-     * traverse that linked list until we find our TCB
+     * have to do a lookup to find its slot in the index.
      */
-    r_entry = &tcpcon->entries[index & tcpcon->mask];
-    while (*r_entry && *r_entry != tcb)
-        r_entry = &(*r_entry)->next;
-
-    if (*r_entry == NULL) {
+    hash = tcb_hash(tcb->ip_me, tcb->port_me,
+                    tcb->ip_them, tcb->port_them,
+                    tcpcon->entropy);
+    slot = tcbindex_find(&tcpcon->index, hash,
+                         tcb->ip_me, tcb->ip_them,
+                         tcb->port_me, tcb->port_them);
+
+    if (slot == NULL || slot->tcb != tcb) {
         /* TODO: this should be impossible, but it's happening anyway, about
          * 20 times on a full Internet scan. I don't know why, and I'm too
          * lazy to fix it right now, but I'll get around to eventually */
@@ -537,14 +760,14 @@ tcpcon_destroy_tcb(
     /*
      * Unlink this from the timeout system.
      */
-    timeout_unlink(tcb->timeout);
+    timeouts_cancel(tcpcon->timeouts, tcb->timeout);
 
     tcb->ip_them = 0;
     tcb->port_them = 0;
     tcb->ip_me = 0;
     tcb->port_me = 0;
 
-    (*r_entry) = tcb->next;
+    tcbindex_remove(&tcpcon->index, slot);
     tcb->next = tcpcon->freed_list;
     tcpcon->freed_list = tcb;
     tcpcon->active_count--;
@@ -558,18 +781,23 @@ tcpcon_destroy_tcb(
 void
 tcpcon_destroy_table(struct TCP_ConnectionTable *tcpcon)
 {
-    unsigned i;
+    size_t i;
 
     if (tcpcon == NULL)
         return;
 
     /*
      * Do a graceful destruction of all the entires. If they have banners,
-     * they will be sent to the output
+     * they will be sent to the output. Removing one shifts the entries
+     * after it back, so look at the same slot again.
      */
-    for (i=0; i<=tcpcon->mask; i++) {
-        while (tcpcon->entries[i])
-            tcpcon_destroy_tcb(tcpcon, tcpcon->entries[i], Reason_Shutdown);
+    for (i=0; i<=tcpcon->index.mask; ) {
+        struct TCP_Control_Block *tcb = tcpcon->index.slots[i].tcb;
+        if (tcb == NULL) {
+            i++;
+            continue;
+        }
+        tcpcon_destroy_tcb(tcpcon, tcb, Reason_Shutdown);
     }
 
     /*
@@ -582,7 +810,8 @@ tcpcon_destroy_table(struct TCP_ConnectionTable *tcpcon)
     }
 
     banner1_destroy(tcpcon->banner1);
-    free(tcpcon->entries);
+    timeouts_destroy(tcpcon->timeouts);
+    free(tcpcon->index.slots);
     free(tcpcon);
 }
 
@@ -600,21 +829,19 @@ tcpcon_create_tcb(
     unsigned seqno_me, unsigned seqno_them,
     unsigned ttl)
 {
-    unsigned index;
-    struct TCP_Control_Block tmp;
+    unsigned hash;
+    struct TCB_Slot *slot;
     struct TCP_Control_Block *tcb;
 
-    tmp.ip_me = ip_me;
-    tmp.ip_them = ip_them;
-    tmp.port_me = (unsigned short)port_me;
-    tmp.port_them = (unsigned short)port_them;
+    port_me &= 0xFFFF;
+    port_them &= 0xFFFF;
 
-    index = tcb_hash(ip_me, port_me, ip_them, port_them, tcpcon->entropy);
-    tcb = tcpcon->entries[index & tcpcon->mask];
-    while (tcb && !EQUALS(tcb, &tmp)) {
-        tcb = tcb->next;
-    }
-    if (tcb == NULL) {
+    hash = tcb_hash(ip_me, port_me, ip_them, port_them, tcpcon->entropy);
+    slot = tcbindex_find(&tcpcon->index, hash,
+                         ip_me, ip_them, port_me, port_them);
+    if (slot) {
+        tcb = slot->tcb;
+    } else {
         if (tcpcon->freed_list) {
             tcb = tcpcon->freed_list;
             tcpcon->freed_list = tcb->next;
@@ -624,17 +851,21 @@ tcpcon_create_tcb(
                 fprintf(stderr, "tcb: out of memory\n");
                 exit(1);
             }
+            tcpcon->allocation_count++;
         }
         memset(tcb, 0, sizeof(*tcb));
-        tcb->next = tcpcon->entries[index & tcpcon->mask];
-        tcpcon->entries[index & tcpcon->mask] = tcb;
-        memcpy(tcb, &tmp, 12);
+        tcb->ip_me = ip_me;
+        tcb->ip_them = ip_them;
+        tcb->port_me = (unsigned short)port_me;
+        tcb->port_them = (unsigned short)port_them;
+        tcbindex_insert(&tcpcon->index, hash,
+                        ip_me, ip_them, port_me, port_them, tcb);
         tcb->seqno_me = seqno_me;
         tcb->seqno_them = seqno_them;
         tcb->ackno_me = seqno_them;
         tcb->ackno_them = seqno_me;
         tcb->when_created = global_now;
-        tcb->banner1_state.port = tmp.port_them;
+        tcb->banner1_state.port = tcb->port_them;
         tcb->ttl = (unsigned char)ttl;
 
         timeout_init(tcb->timeout);
@@ -656,23 +887,18 @@ tcpcon_lookup_tcb(
     unsigned ip_me, unsigned ip_them,
     unsigned port_me, unsigned port_them)
 {
-    unsigned index;
-    struct TCP_Control_Block tmp;
-    struct TCP_Control_Block *tcb;
-
-    tmp.ip_me = ip_me;
-    tmp.ip_them = ip_them;
-    tmp.port_me = (unsigned short)port_me;
-    tmp.port_them = (unsigned short)port_them;
-
-    index = tcb_hash(ip_me, port_me, ip_them, port_them, tcpcon->entropy);
-
-    tcb = tcpcon->entries[index & tcpcon->mask];
-    while (tcb && !EQUALS(tcb, &tmp)) {
-        tcb = tcb->next;
-    }
-
-    return tcb;
+    unsigned hash;
+    struct TCB_Slot *slot;
+
+    port_me &= 0xFFFF;
+    port_them &= 0xFFFF;
+
+    hash = tcb_hash(ip_me, port_me, ip_them, port_them, tcpcon->entropy);
+    slot = tcbindex_find(&tcpcon->index, hash,
+                         ip_me, ip_them, port_me, port_them);
+    if (slot == NULL)
+        return NULL;
+    return slot->tcb;
 }
 
 
@@ -698,6 +924,7 @@ tcpcon_send_packet(
         err = rte_ring_sc_dequeue(tcpcon->packet_buffers, (void**)&response);
         if (err != 0) {
             static int is_warning_printed = 0;
+            tcpcon->buffer_waits++;
             if (!is_warning_printed) {
                 LOG(0, "packet buffers empty (should be impossible)\n");
                 is_warning_printed = 1;
@@ -1263,3 +1490,139 @@ tcpcon_handle(struct TCP_ConnectionTable *tcpcon,
 
 }
 
+
+/***************************************************************************
+ * Put entries in the index with hashes that collide a lot, so that they
+ * get pushed around, then make sure they can all be found, and that they
+ * can all be removed.
+ ***************************************************************************/
+int
+tcpcon_selftest(void)
+{
+    struct TCB_Index index[1];
+    static const size_t COUNT = 5000;
+    struct TCP_Control_Block *tcbs;
+    size_t i;
+
+    tcbs = (struct TCP_Control_Block *)calloc(COUNT, sizeof(tcbs[0]));
+    if (tcbs == NULL || tcbindex_init(index, 0) != 0)
+        return 1;
+
+    for (i=0; i<COUNT; i++) {
+        unsigned hash = (unsigned)((i * 2654435761u) & 0xFFF0);
+        tcbindex_insert(index, hash, 0x0A000001, (unsigned)i,
+                        40000, (unsigned)(i % 3), &tcbs[i]);
+    }
+    if (index->count != COUNT || index->mask + 1 < COUNT)
+        goto fail;
+
+    /* remove every other one */
+    for (i=0; i<COUNT; i++) {
+        unsigned hash = (unsigned)((i * 2654435761u) & 0xFFF0);
+        struct TCB_Slot *slot;
+
+        slot = tcbindex_find(index, hash, 0x0A000001, (unsigned)i,
+                             40000, (unsigned)(i % 3));
+        if (slot == NULL || slot->tcb != &tcbs[i])
+            goto fail;
+        if (tcbindex_find(index, hash, 0x0A000001, (unsigned)i,
+                          40001, (unsigned)(i % 3)) != NULL)
+            goto fail;
+        if (i & 1)
+            tcbindex_remove(index, slot);
+    }
+    for (i=0; i<COUNT; i++) {
+        unsigned hash = (unsigned)((i * 2654435761u) & 0xFFF0);
+        struct TCB_Slot *slot;
+
+        slot = tcbindex_find(index, hash, 0x0A000001, (unsigned)i,
+                             40000, (unsigned)(i % 3));
+        if ((slot != NULL) != !(i & 1))
+            goto fail;
+        if (slot)
+            tcbindex_remove(index, slot);
+    }
+    if (index->count != 0)
+        goto fail;
+    for (i=0; i<=index->mask; i++) {
+        if (index->slots[i].tcb)
+            goto fail;
+    }
+
+    free(index->slots);
+    free(tcbs);
+    return 0;
+fail:
+    fprintf(stderr, "tcb: selftest failed\n");
+    free(index->slots);
+    free(tcbs);
+    return 1;
+}
+
+/***************************************************************************
+ * Time the index with 10-million connections, about what a full-speed
+ * banner scan of the Internet has open at once. The index never looks
+ * inside the TCBs, so we don't need the memory for 10-million of them.
+ ***************************************************************************/
+void
+tcpcon_benchmark(void)
+{
+    struct TCB_Index index[1];
+    static const size_t COUNT = 10000000;
+    uint64_t entropy = 0x1234567890abcdefULL;
+    uint64_t start, stop;
+    size_t found = 0;
+    size_t i;
+
+    printf("-- tcb index -- \n");
+    if (tcbindex_init(index, 0) != 0)
+        return;
+
+    start = pixie_nanotime();
+    for (i=0; i<COUNT; i++) {
+        unsigned ip_them = (unsigned)(i * 2654435761u);
+        unsigned hash = tcb_hash(0x0A000001, 40000, ip_them, 80, entropy);
+        tcbindex_insert(index, hash, 0x0A000001, ip_them, 40000, 80,
+                        (struct TCP_Control_Block *)(size_t)(i + 1));
+    }
+    stop = pixie_nanotime();
+    printf("connections = %u-million, slots = %u-million\n",
+           (unsigned)(COUNT/1000000), (unsigned)((index->mask + 1)/1000000));
+    printf("insert = %5.1f-nanoseconds\n", (double)(stop - start)/COUNT);
+
+    /* look them up in a different order than they were added */
+    start = pixie_nanotime();
+    for (i=0; i<COUNT; i++) {
+        unsigned ip_them = (unsigned)(((i * 7919) % COUNT) * 2654435761u);
+        unsigned hash = tcb_hash(0x0A000001, 40000, ip_them, 80, entropy);
+        found += tcbindex_find(index, hash, 0x0A000001, ip_them, 40000, 80) != NULL;
+    }
+    stop = pixie_nanotime();
+    printf("lookup (found) = %5.1f-nanoseconds\n", (double)(stop - start)/COUNT);
+
+    start = pixie_nanotime();
+    for (i=0; i<COUNT; i++) {
+        unsigned ip_them = (unsigned)(i * 2654435761u);
+        unsigned hash = tcb_hash(0x0A000001, 40000, ip_them, 443, entropy);
+        found += tcbindex_find(index, hash, 0x0A000001, ip_them, 40000, 443) != NULL;
+    }
+    stop = pixie_nanotime();
+    printf("lookup (missing) = %5.1f-nanoseconds\n", (double)(stop - start)/COUNT);
+
+    start = pixie_nanotime();
+    for (i=0; i<COUNT; i++) {
+        unsigned ip_them = (unsigned)(i * 2654435761u);
+        unsigned hash = tcb_hash(0x0A000001, 40000, ip_them, 80, entropy);
+        struct TCB_Slot *slot;
+        slot = tcbindex_find(index, hash, 0x0A000001, ip_them, 40000, 80);
+        if (slot)
+            tcbindex_remove(index, slot);
+    }
+    stop = pixie_nanotime();
+    printf("remove = %5.1f-nanoseconds\n", (double)(stop - start)/COUNT);
+
+    if (found != COUNT || index->count != 0)
+        printf("tcb index: FAILED\n");
+    printf("\n");
+    free(index->slots);
+}
@@ -34,12 +34,11 @@ tcpcon_set_parameter(struct TCP_ConnectionTable *tcpcon,
  * the desired initial size.
  *
  * @param entry_count
- *      A hint about the desired initial size. This should be about twice
- *      the number of oustanding connections, so you should base this number
- *      on your transmit rate (the faster the transmit rate, the more
- *      outstanding connections you'll have). This function will automatically
- *      round this number up to the nearest power of 2, or round it down
- *      if it causes malloc() to not be able to allocate enoug memory.
+ *      A hint about the number of outstanding connections, so you should
+ *      base this number on your transmit rate (the faster the transmit
+ *      rate, the more outstanding connections you'll have). The table
+ *      grows past this as needed, and if there isn't the memory for this
+ *      many up front, it starts smaller, with a warning.
  * @param entropy
  *      Seed for syn-cookie randomization
  */
@@ -56,6 +55,7 @@ tcpcon_create_table(    size_t entry_count,
 
 void tcpcon_set_banner_flags(struct TCP_ConnectionTable *tcpcon,
     unsigned is_capture_cert,
+    unsigned is_capture_certdigest,
     unsigned is_capture_html,
     unsigned is_capture_heartbleed,
 	unsigned is_capture_ticketbleed);
@@ -76,6 +76,40 @@ tcpcon_destroy_table(struct TCP_ConnectionTable *tcpcon);
 void
 tcpcon_timeouts(struct TCP_ConnectionTable *tcpcon, unsigned secs, unsigned usecs);
 
+/**
+ * Leak detection: the number of TCBs that aren't waiting on a timeout
+ * (and thus would never be freed), plus the number of times the timeout
+ * handler had to re-arm a TCB that was left without one.
+ */
+uint64_t
+tcpcon_leaked_tcbs(const struct TCP_ConnectionTable *tcpcon);
+
+/**
+ * The number of TCBs that had to be allocated from the heap, rather than
+ * being recycled from ones that were closed earlier.
+ */
+uint64_t
+tcpcon_allocation_count(const struct TCP_ConnectionTable *tcpcon);
+
+/**
+ * How loaded the table is: the number of open connections, the number of
+ * slots in the index they are spread across, and the number of times we had to
+ * wait for the transmit thread to give us back a packet buffer.
+ */
+void
+tcpcon_get_load(const struct TCP_ConnectionTable *tcpcon,
+                uint64_t *active, uint64_t *buckets, uint64_t *buffer_waits);
+
+int
+tcpcon_selftest(void);
+
+/**
+ * For --benchmark, time lookups in the index of connections when it's
+ * holding 10-million of them.
+ */
+void
+tcpcon_benchmark(void);
+
 enum TCP_What {
     TCP_WHAT_NOTHING,
     TCP_WHAT_TIMEOUT,
@@ -116,6 +116,27 @@ enum {
     Subject_Common,
 };
 
+/****************************************************************************
+ * With --capture certdigest, which name we are copying to the digest
+ * banner, and the label it's given there.
+ ****************************************************************************/
+enum {
+    Digest_None,
+    Digest_Subject,
+    Digest_Issuer,
+    Digest_AltName,
+};
+
+static void
+digest_label(struct BannerOutput *banout, unsigned field)
+{
+    static const char *labels[] = {"", "cn:", "issuer:", "san:"};
+
+    if (banout_string_length(banout, PROTO_X509_DIGEST))
+        banout_append_char(banout, PROTO_X509_DIGEST, ' ');
+    banout_append(banout, PROTO_X509_DIGEST, labels[field], AUTO_LEN);
+}
+
 /****************************************************************************
  * See "global_mib" above.
  ****************************************************************************/
@@ -583,6 +604,8 @@ x509_decode(struct CertDecode *x,
             state++;
             break;
         case ISSUERNAME_TAG:
+            if (x->digest_field == Digest_Issuer)
+                digest_label(banout, Digest_Issuer);
             if (px[i] != 0x13 && px[i] != 0x0c) {
                 state++;
                 continue;
@@ -593,6 +616,8 @@ x509_decode(struct CertDecode *x,
             state++;
             break;
         case SUBJECTNAME_TAG:
+            if (x->digest_field == Digest_Subject)
+                digest_label(banout, Digest_Subject);
             if (px[i] != 0x13 && px[i] != 0x0c) {
                 state++;
                 continue;
@@ -605,6 +630,7 @@ x509_decode(struct CertDecode *x,
         case ISSUER1_TAG:
         case SUBJECT1_TAG:
             x->subject.type = 0;
+            x->digest_field = Digest_None;
             if (px[i] != 0x31) {
                 state++;
                 continue;
@@ -652,9 +678,13 @@ x509_decode(struct CertDecode *x,
                 if (x->stack.remainings[0] == 0)
                     banout_append(banout, PROTO_SSL3, "]", 1);
             }
+            if (x->digest_field == Digest_Issuer)
+                banout_append(banout, PROTO_X509_DIGEST, px+i, 1);
             break;
         case SUBJECTNAME_CONTENTS:
         case EXT_DNSNAME_CONTENTS:
+            if (x->digest_field != Digest_None)
+                banout_append(banout, PROTO_X509_DIGEST, px+i, 1);
             if (x->is_capture_subject) {
                 banout_append(banout, PROTO_SSL3, px+i, 1);
                 if (x->stack.remainings[0] == 0)
@@ -712,6 +742,14 @@ x509_decode(struct CertDecode *x,
                     } else {
                         //printf("%s [%u]\n", mib[x->u.oid.last_id].name, mib[x->u.oid.last_id].id);
                         x->subject.type = mib[id].id;
+                        if (x->is_digest && mib[id].id == Subject_Common) {
+                            if (state == SUBJECTID_CONTENTS1)
+                                x->digest_field = Digest_Subject;
+                            else if (state == ISSUERID_CONTENTS1)
+                                x->digest_field = Digest_Issuer;
+                            else if (state == EXTENSION_ID_CONTENTS1)
+                                x->digest_field = Digest_AltName;
+                        }
                         if (x->subject.type == Subject_Common 
                                             && state == SUBJECTID_CONTENTS1) {
                             if (x->count <= 1) {
@@ -765,6 +803,8 @@ x509_decode(struct CertDecode *x,
                 state = ERROR;
                 continue;
             }
+            if (state == EXTENSION_TAG)
+                x->digest_field = Digest_None;
             state++;
             break;
         case EXTENSIONS_A_TAG:
@@ -789,10 +829,14 @@ x509_decode(struct CertDecode *x,
         */
       
         case EXTVALUE3_TAG:
-            if (x->subject.type == Subject_Common) {
+            if (x->subject.type == Subject_Common
+                || x->digest_field == Digest_AltName) {
                 switch (px[i]) {
                 case 0x82: /* dNSName */
-                    banout_append(banout, PROTO_SSL3, ", ", 2);
+                    if (x->subject.type == Subject_Common)
+                        banout_append(banout, PROTO_SSL3, ", ", 2);
+                    if (x->digest_field == Digest_AltName)
+                        digest_label(banout, Digest_AltName);
                     state = EXT_DNSNAME_LEN;
                     break;
                 default:
@@ -29,6 +29,13 @@ struct CertDecode {
     unsigned is_capture_subject:1;
     unsigned is_capture_issuer:1;
 
+    /** When set, the subject and issuer common names and the DNS alt-names
+     * of every certificate in the chain are also written to the
+     * PROTO_X509_DIGEST banner, which is ended after each certificate.
+     * The 'digest_field' is which of those we are in the middle of. */
+    unsigned is_digest:1;
+    unsigned char digest_field;
+
 
 
     /** Number of certificates we've processed */
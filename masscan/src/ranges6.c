@@ -0,0 +1,807 @@
+/*
+    for tracking IPv6 address ranges
+
+    See ranges6.h. The difference from the IPv4 'RangeList' is that
+    IPv6 targets are mostly single addresses, tens of millions of them
+    from a hitlist, so they are stored as a flat sorted array of 16 bytes
+    apiece rather than as 32-byte ranges. A 50-million address hitlist
+    thus takes 800 megabytes. Picking an address from the index is just
+    an array lookup for those, and a binary search for the few ranges.
+*/
+#include "ranges6.h"
+#include "string_s.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REGRESS(x) if (!(x)) return (fprintf(stderr, "regression failed %s:%u\n", __FILE__, __LINE__)|1)
+
+
+/***************************************************************************
+ * 128-bit arithmetic on addresses
+ ***************************************************************************/
+static int
+ip6_cmp(ipv6address lhs, ipv6address rhs)
+{
+    if (lhs.hi != rhs.hi)
+        return lhs.hi < rhs.hi ? -1 : 1;
+    if (lhs.lo != rhs.lo)
+        return lhs.lo < rhs.lo ? -1 : 1;
+    return 0;
+}
+
+static ipv6address
+ip6_add(ipv6address ip, uint64_t n)
+{
+    ipv6address result;
+    result.lo = ip.lo + n;
+    result.hi = ip.hi + (result.lo < ip.lo);
+    return result;
+}
+
+static ipv6address
+ip6_sub1(ipv6address ip)
+{
+    ipv6address result;
+    result.lo = ip.lo - 1;
+    result.hi = ip.hi - (ip.lo == 0);
+    return result;
+}
+
+static int
+ip6_is_max(ipv6address ip)
+{
+    return ip.hi == UINT64_MAX && ip.lo == UINT64_MAX;
+}
+
+/* the number of addresses in the range, or UINT64_MAX if it's more */
+static uint64_t
+range6_size(const struct Range6 *range)
+{
+    uint64_t lo = range->end.lo - range->begin.lo;
+    uint64_t hi = range->end.hi - range->begin.hi - (range->end.lo < range->begin.lo);
+
+    if (hi != 0 || lo == UINT64_MAX)
+        return UINT64_MAX;
+    return lo + 1;
+}
+
+static uint64_t
+add_saturate(uint64_t lhs, uint64_t rhs)
+{
+    if (lhs + rhs < lhs)
+        return UINT64_MAX;
+    return lhs + rhs;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static unsigned
+hexval(char c)
+{
+    if ('0' <= c && c <= '9')
+        return (unsigned)(c - '0');
+    if ('a' <= c && c <= 'f')
+        return (unsigned)(c - 'a' + 10);
+    return (unsigned)(c - 'A' + 10);
+}
+
+/***************************************************************************
+ * Parse the dotted-decimal tail of an address like "::ffff:10.0.0.1"
+ ***************************************************************************/
+static int
+parse_ipv4_tail(const char *str, size_t length, unsigned *result)
+{
+    unsigned ip = 0;
+    unsigned octets = 0;
+    size_t i = 0;
+
+    while (i < length) {
+        unsigned val = 0;
+        size_t digits = 0;
+
+        while (i < length && isdigit(str[i] & 0xFF) && digits < 4) {
+            val = val * 10 + (str[i] - '0');
+            digits++;
+            i++;
+        }
+        if (digits == 0 || digits > 3 || val > 255 || octets >= 4)
+            return -1;
+        ip = ip << 8 | val;
+        octets++;
+        if (i < length) {
+            if (str[i] != '.')
+                return -1;
+            i++;
+            if (i == length)
+                return -1;
+        }
+    }
+    if (octets != 4)
+        return -1;
+    *result = ip;
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+ipv6address_parse(const char *str, size_t length, ipv6address *result)
+{
+    unsigned words[8];
+    unsigned count = 0;
+    int gap = -1;
+    size_t i = 0;
+    unsigned j;
+
+    if (length >= 2 && str[0] == ':' && str[1] == ':') {
+        gap = 0;
+        i = 2;
+    } else if (length == 0 || str[0] == ':')
+        return -1;
+
+    while (i < length) {
+        unsigned val = 0;
+        size_t digits = 0;
+        size_t start = i;
+
+        while (i < length && isxdigit(str[i] & 0xFF)) {
+            val = val * 16 + hexval(str[i]);
+            digits++;
+            i++;
+            if (digits > 4)
+                return -1;
+        }
+
+        /* embedded IPv4 address, which takes the last two words */
+        if (i < length && str[i] == '.') {
+            unsigned ipv4;
+            if (count + 2 > 8 || parse_ipv4_tail(str + start, length - start, &ipv4) != 0)
+                return -1;
+            words[count++] = ipv4 >> 16;
+            words[count++] = ipv4 & 0xFFFF;
+            break;
+        }
+
+        if (digits == 0 || count >= 8)
+            return -1;
+        words[count++] = val;
+        if (i == length)
+            break;
+        if (str[i] != ':')
+            return -1;
+        i++;
+        if (i < length && str[i] == ':') {
+            if (gap >= 0)
+                return -1;
+            gap = (int)count;
+            i++;
+        } else if (i == length)
+            return -1;
+    }
+
+    /* expand the "::" into however many zero words are missing */
+    if (gap >= 0) {
+        unsigned missing;
+        if (count >= 8)
+            return -1;
+        missing = 8 - count;
+        memmove(&words[gap + missing], &words[gap], (count - gap) * sizeof(words[0]));
+        for (j=0; j<missing; j++)
+            words[gap + j] = 0;
+    } else if (count != 8)
+        return -1;
+
+    result->hi = 0;
+    result->lo = 0;
+    for (j=0; j<4; j++) {
+        result->hi = result->hi << 16 | words[j];
+        result->lo = result->lo << 16 | words[j + 4];
+    }
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+const char *
+ipv6address_fmt(char *buf, size_t sizeof_buf, ipv6address ip)
+{
+    unsigned words[8];
+    int best = -1;
+    int best_length = 1;
+    size_t offset = 0;
+    int i;
+
+    for (i=0; i<4; i++) {
+        words[i] = (unsigned)(ip.hi >> (48 - 16*i)) & 0xFFFF;
+        words[i + 4] = (unsigned)(ip.lo >> (48 - 16*i)) & 0xFFFF;
+    }
+
+    /* find the longest run of zeroes, at least two long, the first one
+     * if there's a tie */
+    for (i=0; i<8; ) {
+        int j = i;
+        while (j < 8 && words[j] == 0)
+            j++;
+        if (j - i > best_length) {
+            best = i;
+            best_length = j - i;
+        }
+        i = (j > i) ? j : i + 1;
+    }
+
+    buf[0] = '\0';
+    for (i=0; i<8 && offset + 6 < sizeof_buf; i++) {
+        if (i == best) {
+            offset += sprintf_s(buf + offset, sizeof_buf - offset, "::");
+            i += best_length - 1;
+            continue;
+        }
+        offset += sprintf_s(buf + offset, sizeof_buf - offset, "%s%x",
+                           (i == 0 || i == best + best_length) ? "" : ":",
+                           words[i]);
+    }
+    return buf;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+range6_parse(const char *line, unsigned *inout_offset, unsigned max,
+             struct Range6 *range)
+{
+    unsigned offset = 0;
+    unsigned start;
+    ipv6address ip;
+
+    if (inout_offset)
+        offset = *inout_offset;
+    if (max == 0)
+        max = (unsigned)strlen(line);
+
+    while (offset < max && isspace(line[offset] & 0xFF))
+        offset++;
+
+    start = offset;
+    while (offset < max && (isxdigit(line[offset] & 0xFF)
+                            || line[offset] == ':' || line[offset] == '.'))
+        offset++;
+    if (ipv6address_parse(line + start, offset - start, &ip) != 0)
+        goto fail;
+    range->begin = ip;
+    range->end = ip;
+
+    if (offset < max && line[offset] == '/') {
+        unsigned prefix = 0;
+        unsigned digits = 0;
+
+        offset++;
+        while (offset < max && isdigit(line[offset] & 0xFF) && digits < 4) {
+            prefix = prefix * 10 + (line[offset] - '0');
+            offset++;
+            digits++;
+        }
+        if (digits == 0 || prefix > 128)
+            goto fail;
+        if (prefix <= 64) {
+            uint64_t mask = prefix ? (~0ULL << (64 - prefix)) : 0;
+            range->begin.hi = ip.hi & mask;
+            range->begin.lo = 0;
+            range->end.hi = ip.hi | ~mask;
+            range->end.lo = ~0ULL;
+        } else {
+            uint64_t mask = (prefix == 128) ? ~0ULL : (~0ULL << (128 - prefix));
+            range->begin.lo = ip.lo & mask;
+            range->end.lo = ip.lo | ~mask;
+        }
+    } else if (offset < max && line[offset] == '-') {
+        offset++;
+        start = offset;
+        while (offset < max && (isxdigit(line[offset] & 0xFF)
+                                || line[offset] == ':' || line[offset] == '.'))
+            offset++;
+        if (ipv6address_parse(line + start, offset - start, &range->end) != 0)
+            goto fail;
+        if (ip6_cmp(range->end, range->begin) < 0)
+            goto fail;
+    }
+
+    if (inout_offset)
+        *inout_offset = offset;
+    return 0;
+fail:
+    if (inout_offset)
+        *inout_offset = offset;
+    return -1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+range6list_add_range(struct Range6List *targets,
+                     ipv6address begin, ipv6address end)
+{
+    if (ip6_cmp(begin, end) == 0) {
+        if (targets->host_count >= targets->host_max) {
+            size_t new_max = targets->host_max + targets->host_max/2 + 1024;
+            ipv6address *new_hosts;
+
+            if (new_max >= SIZE_MAX/sizeof(*new_hosts))
+                exit(1); /* integer overflow */
+            new_hosts = (ipv6address *)realloc(targets->hosts,
+                                               new_max * sizeof(*new_hosts));
+            if (new_hosts == NULL) {
+                fprintf(stderr, "out of memory: %llu IPv6 targets\n",
+                        (unsigned long long)targets->host_count);
+                exit(1);
+            }
+            targets->hosts = new_hosts;
+            targets->host_max = new_max;
+        }
+        targets->hosts[targets->host_count++] = begin;
+    } else {
+        if (targets->count >= targets->max) {
+            unsigned new_max = targets->max * 2 + 16;
+            struct Range6 *new_list;
+
+            new_list = (struct Range6 *)realloc(targets->list,
+                                                new_max * sizeof(*new_list));
+            if (new_list == NULL)
+                exit(1); /* out of memory */
+            targets->list = new_list;
+            targets->max = new_max;
+        }
+        targets->list[targets->count].begin = begin;
+        targets->list[targets->count].end = end;
+        targets->count++;
+    }
+    targets->is_sorted = 0;
+}
+
+/***************************************************************************
+ * Sort the hosts in place. This is a plain quicksort rather than qsort(),
+ * which is several times slower at this with its callbacks, and which in
+ * glibc allocates a copy of the array to do a merge sort, which for a
+ * big hitlist is most of a gigabyte we don't have.
+ ***************************************************************************/
+#define IP6_LESS(a, b) ((a).hi < (b).hi || ((a).hi == (b).hi && (a).lo < (b).lo))
+
+static void
+sort_hosts(ipv6address *list, size_t count)
+{
+    while (count > 16) {
+        ipv6address pivot;
+        ipv6address tmp;
+        size_t mid = count/2;
+        size_t i;
+        size_t j;
+
+        /* median of three, which also puts sentinels at both ends */
+        if (IP6_LESS(list[mid], list[0])) {
+            tmp = list[mid]; list[mid] = list[0]; list[0] = tmp;
+        }
+        if (IP6_LESS(list[count-1], list[0])) {
+            tmp = list[count-1]; list[count-1] = list[0]; list[0] = tmp;
+        }
+        if (IP6_LESS(list[count-1], list[mid])) {
+            tmp = list[count-1]; list[count-1] = list[mid]; list[mid] = tmp;
+        }
+        pivot = list[mid];
+
+        i = 0;
+        j = count - 1;
+        for (;;) {
+            do i++; while (IP6_LESS(list[i], pivot));
+            do j--; while (IP6_LESS(pivot, list[j]));
+            if (i >= j)
+                break;
+            tmp = list[i]; list[i] = list[j]; list[j] = tmp;
+        }
+
+        /* recurse on the smaller side, loop on the larger, so that the
+         * stack stays shallow */
+        if (j + 1 < count - j - 1) {
+            sort_hosts(list, j + 1);
+            list += j + 1;
+            count -= j + 1;
+        } else {
+            sort_hosts(list + j + 1, count - j - 1);
+            count = j + 1;
+        }
+    }
+
+    /* insertion sort the small pieces */
+    {
+        size_t i;
+        for (i=1; i<count; i++) {
+            ipv6address x = list[i];
+            size_t j = i;
+            while (j > 0 && IP6_LESS(x, list[j-1])) {
+                list[j] = list[j-1];
+                j--;
+            }
+            list[j] = x;
+        }
+    }
+}
+
+static int
+compare_ranges(const void *lhs, const void *rhs)
+{
+    return ip6_cmp(((const struct Range6 *)lhs)->begin,
+                   ((const struct Range6 *)rhs)->begin);
+}
+
+/* sort, then merge overlapping and adjacent ranges, returning the count */
+static size_t
+merge_ranges(struct Range6 *list, size_t count)
+{
+    size_t i;
+    size_t n = 0;
+
+    if (count == 0)
+        return 0;
+    qsort(list, count, sizeof(list[0]), compare_ranges);
+    for (i=1; i<count; i++) {
+        struct Range6 *prev = &list[n];
+        if (ip6_is_max(prev->end)
+                || ip6_cmp(ip6_add(prev->end, 1), list[i].begin) >= 0) {
+            if (ip6_cmp(list[i].end, prev->end) > 0)
+                prev->end = list[i].end;
+        } else
+            list[++n] = list[i];
+    }
+    return n + 1;
+}
+
+/* index of the last range starting at or before 'ip', or -1 */
+static int
+find_range(const struct Range6 *list, unsigned count, ipv6address ip)
+{
+    unsigned min = 0;
+    unsigned max = count;
+
+    while (min < max) {
+        unsigned mid = min + (max - min)/2;
+        if (ip6_cmp(list[mid].begin, ip) <= 0)
+            min = mid + 1;
+        else
+            max = mid;
+    }
+    return (int)min - 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+range6list_optimize(struct Range6List *targets)
+{
+    uint64_t total;
+    size_t i;
+    size_t n;
+
+    if (targets->is_sorted)
+        return;
+
+    targets->count = (unsigned)merge_ranges(targets->list, targets->count);
+
+    /* sort the hosts and remove duplicates, and those that are already
+     * in a range */
+    sort_hosts(targets->hosts, targets->host_count);
+    n = 0;
+    for (i=0; i<targets->host_count; i++) {
+        ipv6address ip = targets->hosts[i];
+        int r;
+
+        if (n && ip6_cmp(targets->hosts[n-1], ip) == 0)
+            continue;
+        r = find_range(targets->list, targets->count, ip);
+        if (r >= 0 && ip6_cmp(ip, targets->list[r].end) <= 0)
+            continue;
+        targets->hosts[n++] = ip;
+    }
+    targets->host_count = n;
+
+    /* give back what the hitlist didn't need */
+    if (n && n + 1024 < targets->host_max) {
+        ipv6address *hosts = (ipv6address *)realloc(targets->hosts, n * sizeof(*hosts));
+        if (hosts) {
+            targets->hosts = hosts;
+            targets->host_max = n;
+        }
+    }
+
+    free(targets->picker);
+    targets->picker = NULL;
+    if (targets->count) {
+        targets->picker = (uint64_t *)malloc(targets->count * sizeof(targets->picker[0]));
+        if (targets->picker == NULL)
+            exit(1); /* out of memory */
+    }
+    total = targets->host_count;
+    for (i=0; i<targets->count; i++) {
+        targets->picker[i] = total;
+        total = add_saturate(total, range6_size(&targets->list[i]));
+    }
+
+    targets->is_sorted = 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+uint64_t
+range6list_count(const struct Range6List *targets)
+{
+    if (targets->count == 0)
+        return targets->host_count;
+    return add_saturate(targets->picker[targets->count - 1],
+                        range6_size(&targets->list[targets->count - 1]));
+}
+
+/***************************************************************************
+ ***************************************************************************/
+ipv6address
+range6list_pick(const struct Range6List *targets, uint64_t index)
+{
+    unsigned min = 0;
+    unsigned max = targets->count;
+
+    if (index < targets->host_count)
+        return targets->hosts[index];
+
+    while (max - min > 1) {
+        unsigned mid = min + (max - min)/2;
+        if (targets->picker[mid] <= index)
+            min = mid;
+        else
+            max = mid;
+    }
+    return ip6_add(targets->list[min].begin, index - targets->picker[min]);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+range6list_is_contains(const struct Range6List *targets, ipv6address ip)
+{
+    size_t min = 0;
+    size_t max = targets->host_count;
+    int r;
+
+    while (min < max) {
+        size_t mid = min + (max - min)/2;
+        int c = ip6_cmp(targets->hosts[mid], ip);
+        if (c == 0)
+            return 1;
+        if (c < 0)
+            min = mid + 1;
+        else
+            max = mid;
+    }
+
+    r = find_range(targets->list, targets->count, ip);
+    return r >= 0 && ip6_cmp(ip, targets->list[r].end) <= 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+uint64_t
+range6list_exclude(struct Range6List *targets, struct Range6List *excludes)
+{
+    struct Range6 *holes;
+    size_t hole_count;
+    struct Range6List result;
+    uint64_t before;
+    uint64_t after;
+    size_t i;
+    size_t n;
+
+    range6list_optimize(targets);
+    range6list_optimize(excludes);
+    before = range6list_count(targets);
+    if (excludes->count == 0 && excludes->host_count == 0)
+        return 0;
+
+    /* hosts: keep the ones not excluded, in place */
+    n = 0;
+    for (i=0; i<targets->host_count; i++) {
+        if (!range6list_is_contains(excludes, targets->hosts[i]))
+            targets->hosts[n++] = targets->hosts[i];
+    }
+    targets->host_count = n;
+
+    /* ranges: cut out every excluded address, whether an excluded range
+     * or host, which can split a range in several */
+    hole_count = excludes->count + excludes->host_count;
+    holes = (struct Range6 *)malloc(hole_count * sizeof(holes[0]));
+    if (holes == NULL)
+        exit(1); /* out of memory */
+    memcpy(holes, excludes->list, excludes->count * sizeof(holes[0]));
+    for (i=0; i<excludes->host_count; i++) {
+        holes[excludes->count + i].begin = excludes->hosts[i];
+        holes[excludes->count + i].end = excludes->hosts[i];
+    }
+    hole_count = merge_ranges(holes, hole_count);
+
+    memset(&result, 0, sizeof(result));
+    for (i=0; i<targets->count; i++) {
+        struct Range6 r = targets->list[i];
+        ipv6address cur = r.begin;
+        int is_done = 0;
+        size_t lo = 0;
+        size_t hi = hole_count;
+
+        /* first hole that ends at or after the start of this range */
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo)/2;
+            if (ip6_cmp(holes[mid].end, cur) < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        for (; lo < hole_count && !is_done; lo++) {
+            const struct Range6 *h = &holes[lo];
+            if (ip6_cmp(h->begin, r.end) > 0)
+                break;
+            if (ip6_cmp(h->begin, cur) > 0)
+                range6list_add_range(&result, cur, ip6_sub1(h->begin));
+            if (ip6_cmp(h->end, r.end) >= 0)
+                is_done = 1;
+            else
+                cur = ip6_add(h->end, 1);
+        }
+        if (!is_done) {
+            /* add_range() treats begin == end as a host, which goes
+             * straight into the hosts */
+            if (ip6_cmp(cur, r.end) == 0)
+                range6list_add_range(targets, cur, cur);
+            else
+                range6list_add_range(&result, cur, r.end);
+        }
+    }
+    free(holes);
+
+    /* the single addresses that splitting left behind went into result's
+     * hosts, so move them over */
+    for (i=0; i<result.host_count; i++)
+        range6list_add_range(targets, result.hosts[i], result.hosts[i]);
+    free(result.hosts);
+    free(targets->list);
+    targets->list = result.list;
+    targets->count = result.count;
+    targets->max = result.max;
+    targets->is_sorted = 0;
+    range6list_optimize(targets);
+
+    after = range6list_count(targets);
+    if (before == UINT64_MAX)
+        return UINT64_MAX;
+    return before - after;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+range6list_remove_all(struct Range6List *targets)
+{
+    free(targets->list);
+    free(targets->hosts);
+    free(targets->picker);
+    memset(targets, 0, sizeof(*targets));
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static int
+regress_parse(const char *str, const char *expected)
+{
+    ipv6address ip;
+    char buf[64];
+
+    if (ipv6address_parse(str, strlen(str), &ip) != 0)
+        return expected != NULL;
+    if (expected == NULL)
+        return 1;
+    ipv6address_fmt(buf, sizeof(buf), ip);
+    if (strcmp(buf, expected) != 0) {
+        fprintf(stderr, "ranges6: %s: got %s, expected %s\n", str, buf, expected);
+        return 1;
+    }
+    return 0;
+}
+
+int
+ranges6_selftest(void)
+{
+    struct Range6List targets[1];
+    struct Range6List excludes[1];
+    struct Range6 r;
+    ipv6address prev;
+    uint64_t count;
+    uint64_t i;
+
+    /* parsing and formatting */
+    REGRESS(regress_parse("2001:db8::1", "2001:db8::1") == 0);
+    REGRESS(regress_parse("::", "::") == 0);
+    REGRESS(regress_parse("::1", "::1") == 0);
+    REGRESS(regress_parse("1::", "1::") == 0);
+    REGRESS(regress_parse("2001:DB8:0:0:1:0:0:1", "2001:db8::1:0:0:1") == 0);
+    REGRESS(regress_parse("2001:db8:0:1:1:1:1:1", "2001:db8:0:1:1:1:1:1") == 0);
+    REGRESS(regress_parse("::ffff:10.1.2.3", "::ffff:a01:203") == 0);
+    REGRESS(regress_parse("1:::2", NULL) == 0);
+    REGRESS(regress_parse("1:2:3:4:5:6:7:8:9", NULL) == 0);
+    REGRESS(regress_parse("1:2:3:4::5:6:7:8", NULL) == 0);
+    REGRESS(regress_parse("12345::", NULL) == 0);
+    REGRESS(regress_parse("1:2", NULL) == 0);
+    REGRESS(regress_parse(":1::", NULL) == 0);
+    REGRESS(regress_parse("1::2:", NULL) == 0);
+    REGRESS(regress_parse("::1.2.3.256", NULL) == 0);
+    REGRESS(regress_parse("10.0.0.1", NULL) == 0);
+
+    REGRESS(range6_parse("2001:db8::/126", 0, 0, &r) == 0);
+    REGRESS(range6_size(&r) == 4 && r.begin.lo == 0 && r.end.lo == 3);
+    REGRESS(range6_parse("2001:db8::/32", 0, 0, &r) == 0);
+    REGRESS(range6_size(&r) == UINT64_MAX);
+    REGRESS(r.begin.hi == 0x20010db800000000ULL && r.end.hi == 0x20010db8FFFFFFFFULL);
+    REGRESS(range6_parse("::/0", 0, 0, &r) == 0 && ip6_is_max(r.end));
+    REGRESS(range6_parse("::1-::10", 0, 0, &r) == 0 && range6_size(&r) == 16);
+    REGRESS(range6_parse("::10-::1", 0, 0, &r) != 0);
+    REGRESS(range6_parse("::1/129", 0, 0, &r) != 0);
+
+    /* duplicates, hosts inside ranges, and adjacent ranges are removed */
+    memset(targets, 0, sizeof(targets));
+    memset(excludes, 0, sizeof(excludes));
+    for (i=0; i<3000; i++) {
+        ipv6address ip;
+        ip.hi = 0x20010db800000000ULL;
+        ip.lo = (i * 7919) % 2000 + 0x1000;
+        range6list_add_range(targets, ip, ip);
+    }
+    range6_parse("2001:db8::1500/120", 0, 0, &r);   /* overlaps the hosts */
+    range6list_add_range(targets, r.begin, r.end);
+    range6_parse("2001:db8::1600/120", 0, 0, &r);   /* adjacent */
+    range6list_add_range(targets, r.begin, r.end);
+    range6_parse("2001:db8:1::-2001:db8:1::ff", 0, 0, &r);
+    range6list_add_range(targets, r.begin, r.end);
+    range6list_optimize(targets);
+    REGRESS(targets->count == 2);
+    REGRESS(targets->host_count == 2000 - 512);
+    count = range6list_count(targets);
+    REGRESS(count == 2000 - 512 + 512 + 256);
+
+    /* every index picks a different address, in order */
+    prev.hi = prev.lo = 0;
+    for (i=0; i<count; i++) {
+        ipv6address ip = range6list_pick(targets, i);
+        REGRESS(range6list_is_contains(targets, ip));
+        if (i != targets->host_count)
+            REGRESS(ip6_cmp(prev, ip) < 0);
+        prev = ip;
+    }
+    prev.lo += 1;
+    REGRESS(!range6list_is_contains(targets, prev));
+
+    /* excluding hosts and a range from the middle of another */
+    range6_parse("2001:db8::1000-2001:db8::100f", 0, 0, &r);
+    range6list_add_range(excludes, r.begin, r.end);
+    range6_parse("2001:db8::1580/121", 0, 0, &r);
+    range6list_add_range(excludes, r.begin, r.end);
+    range6_parse("2001:db8:1::10", 0, 0, &r);
+    range6list_add_range(excludes, r.begin, r.end);
+    range6_parse("2001:db8:1::ff", 0, 0, &r);
+    range6list_add_range(excludes, r.begin, r.end);
+    REGRESS(range6list_exclude(targets, excludes) == 16 + 128 + 2);
+    REGRESS(range6list_count(targets) == count - 16 - 128 - 2);
+    REGRESS(!range6list_is_contains(targets, r.begin));
+    r.begin.lo--;
+    REGRESS(range6list_is_contains(targets, r.begin));
+    /* ::1500-157f, ::1600-16ff, :1::0-f, :1::11-fe */
+    REGRESS(targets->count == 4);
+    REGRESS(targets->host_count == 2000 - 512 - 16);
+
+    range6list_remove_all(targets);
+    range6list_remove_all(excludes);
+    return 0;
+}
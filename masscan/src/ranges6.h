@@ -0,0 +1,128 @@
+#ifndef RANGES6_H
+#define RANGES6_H
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * An IPv6 address, as two halves in host byte order, so that they
+ * compare and add like a 128-bit number.
+ */
+typedef struct ipv6address {
+    uint64_t hi;
+    uint64_t lo;
+} ipv6address;
+
+/**
+ * A range of IPv6 addresses, usually a prefix like "2001:db8::/32"
+ */
+struct Range6
+{
+    ipv6address begin;
+    ipv6address end; /* inclusive */
+};
+
+/**
+ * The IPv6 targets. IPv6 is too big to scan by range, so these are
+ * mostly lists of single addresses, from "hitlists" of tens of millions
+ * of addresses known to be in use. Those are kept in their own flat
+ * array of 16 bytes apiece, since that's where all the memory goes, with
+ * the ranges kept apart.
+ *
+ * Add to the list with 'range6list_add_range()', then call
+ * 'range6list_optimize()' before counting or picking, which sorts the
+ * list and removes duplicates.
+ */
+struct Range6List
+{
+    struct Range6 *list;
+    unsigned count;
+    unsigned max;
+
+    ipv6address *hosts;
+    size_t host_count;
+    size_t host_max;
+
+    /* for each range, the index of its first address, after the hosts */
+    uint64_t *picker;
+    unsigned is_sorted:1;
+};
+
+/**
+ * Parse an IPv6 address, like "2001:db8::1".
+ * @return
+ *      0 on success, -1 if it isn't an IPv6 address
+ */
+int
+ipv6address_parse(const char *str, size_t length, ipv6address *result);
+
+/**
+ * Format an IPv6 address the way RFC 5952 says to, with the longest run
+ * of zeroes shortened to "::".
+ * @return
+ *      'buf'
+ */
+const char *
+ipv6address_fmt(char *buf, size_t sizeof_buf, ipv6address ip);
+
+/**
+ * Parse an address, a prefix like "2001:db8::/32", or a range like
+ * "2001:db8::1-2001:db8::ff" out of a string. This is the IPv6
+ * equivalent of 'range_parse_ipv4()', stopping at a comma or space.
+ * @return
+ *      0 on success, -1 on a bad range
+ */
+int
+range6_parse(const char *line, unsigned *inout_offset, unsigned max,
+             struct Range6 *range);
+
+/**
+ * Add an address or range to the list. Duplicates and overlaps are fine,
+ * since they are removed by 'range6list_optimize()'.
+ */
+void
+range6list_add_range(struct Range6List *targets,
+                     ipv6address begin, ipv6address end);
+
+/**
+ * Sort and merge the list, so that it can be counted, searched, and
+ * picked from.
+ */
+void
+range6list_optimize(struct Range6List *targets);
+
+/**
+ * Remove the excluded addresses from the targets, the IPv6 version of
+ * 'rangelist_exclude()'. Both lists are optimized first.
+ * @return
+ *      the number of addresses removed, or UINT64_MAX if more than that
+ */
+uint64_t
+range6list_exclude(struct Range6List *targets, struct Range6List *excludes);
+
+/**
+ * The number of addresses in the list, or UINT64_MAX if there are more
+ * than that, such as with a /64 prefix, which is too many to scan.
+ */
+uint64_t
+range6list_count(const struct Range6List *targets);
+
+/**
+ * Given an index in [0..count), pick the address, the IPv6 version of
+ * 'rangelist_pick2()'. Hosts come first, then ranges.
+ */
+ipv6address
+range6list_pick(const struct Range6List *targets, uint64_t index);
+
+/**
+ * Whether the address is one of the targets, searched in O(log n).
+ */
+int
+range6list_is_contains(const struct Range6List *targets, ipv6address ip);
+
+void
+range6list_remove_all(struct Range6List *targets);
+
+int
+ranges6_selftest(void);
+
+#endif
@@ -6,6 +6,7 @@ struct Adapter
     struct pcap *pcap;
     struct pcap_send_queue *sendq;
     struct __pfring *ring;
+    struct AdapterReplay *replay;   /* --benchmark-replay */
     unsigned is_packet_trace:1; /* is --packet-trace option set? */
     unsigned is_vlan:1;
     unsigned vlan_id;
@@ -14,6 +14,7 @@
 #include "rawsock.h"
 #include "string_s.h"
 #include "ranges.h" /*for parsing IPv4 addresses */
+#include "unusedparm.h"
 
 /*****************************************************************************
  *****************************************************************************/
@@ -191,3 +192,64 @@ error:
 
 #endif
 
+
+/*****************************************************************************
+ * The IPv6 address, for scanning IPv6 targets. We want a global address,
+ * not the link-local fe80::/10 one that every adapter has.
+ *****************************************************************************/
+#if defined(WIN32)
+int
+rawsock_get_adapter_ipv6(const char *ifname, ipv6address *ipv6)
+{
+    UNUSEDPARM(ifname);
+    UNUSEDPARM(ipv6);
+    return -1; /* set it with --adapter-ip */
+}
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <ifaddrs.h>
+#include <netinet/in.h>
+
+int
+rawsock_get_adapter_ipv6(const char *ifname, ipv6address *ipv6)
+{
+    struct ifaddrs *ifap;
+    struct ifaddrs *p;
+    int result = -1;
+
+    if (getifaddrs(&ifap) != 0) {
+        perror("getifaddrs");
+        return -1;
+    }
+
+    for (p = ifap; p; p = p->ifa_next) {
+        const unsigned char *px;
+        unsigned i;
+
+        if (strcmp(ifname, p->ifa_name) != 0
+            || p->ifa_addr == NULL
+            || p->ifa_addr->sa_family != AF_INET6)
+            continue;
+        px = ((struct sockaddr_in6 *)p->ifa_addr)->sin6_addr.s6_addr;
+        if (px[0] == 0xfe && (px[1] & 0xC0) == 0x80)
+            continue; /* link-local */
+        for (i=0; i<15 && px[i] == 0; i++)
+            ;
+        if (i == 15 && px[15] <= 1)
+            continue; /* :: or ::1 */
+
+        ipv6->hi = 0;
+        ipv6->lo = 0;
+        for (i=0; i<8; i++) {
+            ipv6->hi = ipv6->hi << 8 | px[i];
+            ipv6->lo = ipv6->lo << 8 | px[i + 8];
+        }
+        result = 0;
+        break;
+    }
+
+    freeifaddrs(ifap);
+    return result;
+}
+#endif
@@ -233,6 +233,14 @@ static void null_PCAP_PERROR(pcap_t *p, char *prefix)
 	fprintf(stderr, "%s\n", prefix);
     perror("pcap");
 }
+static int null_PCAP_STATS(pcap_t *p, struct pcap_stat *ps)
+{
+#ifdef STATICPCAP
+    return pcap_stats(p, ps);
+#endif
+    my_null(2, p, ps);
+    return -1;
+}
 static const char *null_PCAP_DEV_NAME(const pcap_if_t *dev)
 {
     return dev->name;
@@ -379,6 +387,7 @@ pl->func_err=0, pl->datalink = null_##PCAP_DATALINK;
     DOLINK(PCAP_SETDIRECTION    , setdirection);
     DOLINK(PCAP_DATALINK_VAL_TO_NAME , datalink_val_to_name);
     DOLINK(PCAP_PERROR          , perror);
+    DOLINK(PCAP_STATS           , stats);
 
     DOLINK(PCAP_DEV_NAME        , dev_name);
     DOLINK(PCAP_DEV_DESCRIPTION , dev_description);
@@ -46,6 +46,13 @@ typedef enum {
     PCAP_D_OUT      = 2,
 } pcap_direction_t;
 
+/* Counters from pcap_stats(), which are only 32-bits */
+struct pcap_stat {
+    unsigned ps_recv;
+    unsigned ps_drop;
+    unsigned ps_ifdrop;
+};
+
 /* The packet header for capturing packets. Apple macOS inexplicably adds
  * an extra comment-field onto the end of this, so the definition needs
  * to be careful to match the real definition */
@@ -83,6 +90,7 @@ typedef void        (*PCAP_PERROR)(pcap_t *p, char *prefix);
 typedef const char *(*PCAP_DEV_NAME)(const pcap_if_t *dev);
 typedef const char *(*PCAP_DEV_DESCRIPTION)(const pcap_if_t *dev);
 typedef const pcap_if_t *(*PCAP_DEV_NEXT)(const pcap_if_t *dev);
+typedef int         (*PCAP_STATS)(pcap_t *p, struct pcap_stat *ps);
 
 /*
  * PORTABILITY: Windows supports the "sendq" feature, and is really slow
@@ -126,6 +134,7 @@ struct PcapFunctions {
     PCAP_SETDIRECTION       setdirection;
     PCAP_DATALINK_VAL_TO_NAME datalink_val_to_name;
     PCAP_PERROR             perror;
+    PCAP_STATS              stats;
     
     /* Accessor functions for opaque data structure, don't really
      * exist in libpcap */
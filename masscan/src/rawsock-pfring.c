@@ -84,6 +84,9 @@ PFRING_init(void)
     LOADSYM(set_application_name);
     //LOADSYM(get_bound_device);
 
+    /* optional, only for --metrics */
+    PFRING.stats = (PFRING_STATS)dlsym(h, "pfring_stats");
+
     if (err) {
         memset(&PFRING, 0, sizeof(PFRING));
         LOG(2, "pfring: failed to load\n");
@@ -71,6 +71,14 @@ typedef int (*PFRING_SET_DIRECTION)(pfring *ring, int direction);
 typedef int (*PFRING_SET_APPLICATION_NAME)(pfring *ring, char *name);
 typedef int (*PFRING_GET_BOUND_DEVICE)(pfring *ring, unsigned char mac_address[6]);
 
+/* Newer versions of PF_RING add more counters to the end of this */
+typedef struct {
+    uint64_t recv;
+    uint64_t drop;
+    uint64_t reserved[8];
+} pfring_stat;
+typedef int (*PFRING_STATS)(pfring *ring, pfring_stat *stats);
+
 /*
  * scoped object
  */
@@ -85,6 +93,7 @@ extern struct PFRING {
     PFRING_SET_DIRECTION            set_direction;
     PFRING_SET_APPLICATION_NAME     set_application_name;
     PFRING_GET_BOUND_DEVICE         get_bound_device;
+    PFRING_STATS                    stats;
 } PFRING;
 
 /*
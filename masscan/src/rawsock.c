@@ -14,12 +14,32 @@
 #include "main-globals.h"
 
 #include "rawsock-pcap.h"
+#include "rawsock-pcapfile.h"
 
 #include <assert.h>
 #include <ctype.h>
 
 static int is_pcap_file = 0;
 
+/**
+ * The frames of a --benchmark-replay file, all read into memory up front
+ * so that disk reads don't get counted as time spent receiving.
+ */
+struct AdapterReplay {
+    unsigned char *buf;
+    size_t buf_length;
+    size_t buf_max;
+    struct ReplayFrame {
+        size_t offset;
+        unsigned length;
+        unsigned secs;
+        unsigned usecs;
+    } *frames;
+    size_t count;
+    size_t max;
+    size_t next;
+};
+
 #ifdef WIN32
 #include <winsock.h>
 #include <iphlpapi.h>
@@ -268,6 +288,22 @@ rawsock_flush(struct Adapter *adapter)
 
 }
 
+/***************************************************************************
+ ***************************************************************************/
+unsigned
+rawsock_ring_size(const struct Adapter *adapter)
+{
+    if (adapter == NULL)
+        return 1000;
+    if (adapter->ring)
+        return 4096;
+    if (adapter->sendq) {
+        /* a minimum-sized frame plus the header the queue puts in front */
+        return SENDQ_SIZE / (60 + sizeof(struct pcap_pkthdr));
+    }
+    return 1000;
+}
+
 /***************************************************************************
  * wrapper for libpcap's sendpacket
  *
@@ -341,7 +377,23 @@ int rawsock_recv_packet(
     const unsigned char **packet)
 {
     
-    if (adapter->ring) {
+    if (adapter->replay) {
+        /* --benchmark-replay: frames straight from memory */
+        struct AdapterReplay *replay = adapter->replay;
+        const struct ReplayFrame *frame;
+
+        if (replay->next >= replay->count) {
+            is_tx_done = 1;
+            is_rx_done = 1;
+            return 1;
+        }
+        frame = &replay->frames[replay->next++];
+        *packet = replay->buf + frame->offset;
+        *length = frame->length;
+        *secs = frame->secs;
+        *usecs = frame->usecs;
+
+    } else if (adapter->ring) {
         /* This is for doing libpfring instead of libpcap */
         struct pfring_pkthdr hdr;
         int err;
@@ -390,6 +442,39 @@ int rawsock_recv_packet(
 }
 
 
+/***************************************************************************
+ ***************************************************************************/
+int
+rawsock_get_stats(struct Adapter *adapter, uint64_t *received,
+                  uint64_t *dropped, uint64_t *ifdropped)
+{
+    if (adapter->ring) {
+        pfring_stat stats;
+
+        if (PFRING.stats == NULL)
+            return 1;
+        memset(&stats, 0, sizeof(stats));
+        if (PFRING.stats(adapter->ring, &stats) != 0)
+            return 1;
+        *received = stats.recv;
+        *dropped = stats.drop;
+        *ifdropped = 0;
+        return 0;
+    } else if (adapter->pcap) {
+        struct pcap_stat stats;
+
+        memset(&stats, 0, sizeof(stats));
+        if (PCAP.stats(adapter->pcap, &stats) != 0)
+            return 1;
+        *received = stats.ps_recv;
+        *dropped = stats.ps_drop;
+        *ifdropped = stats.ps_ifdrop;
+        return 0;
+    }
+    return 1;
+}
+
+
 /***************************************************************************
  * Sends the TCP SYN probe packet.
  *
@@ -401,7 +486,7 @@ rawsock_send_probe(
     struct Adapter *adapter,
     unsigned ip_them, unsigned port_them,
     unsigned ip_me, unsigned port_me,
-    unsigned seqno, unsigned flush,
+    unsigned seqno, unsigned retry, unsigned flush,
     struct TemplateSet *tmplset)
 {
     unsigned char px[2048];
@@ -411,7 +496,7 @@ rawsock_send_probe(
      * Construct the destination packet
      */
     template_set_target(tmplset, ip_them, port_them, ip_me, port_me, seqno,
-        px, sizeof(px), &packet_length);
+        retry, px, sizeof(px), &packet_length);
     
     /*
      * Send it
@@ -419,6 +504,27 @@ rawsock_send_probe(
     rawsock_send_packet(adapter, px, (unsigned)packet_length, flush);
 }
 
+/***************************************************************************
+ ***************************************************************************/
+void
+rawsock_send_probe_ipv6(
+    struct Adapter *adapter,
+    ipv6address ip_them, unsigned port_them,
+    ipv6address ip_me, unsigned port_me,
+    unsigned seqno, unsigned flush,
+    struct TemplateSet *tmplset)
+{
+    unsigned char px[2048];
+    size_t packet_length;
+
+    template_set_target_ipv6(tmplset, ip_them, port_them, ip_me, port_me,
+        seqno, px, sizeof(px), &packet_length);
+    if (packet_length == 0)
+        return;
+
+    rawsock_send_packet(adapter, px, (unsigned)packet_length, flush);
+}
+
 
 /***************************************************************************
  * Used on Windows: network adapters have horrible names, so therefore we
@@ -611,6 +717,76 @@ rawsock_datalink(struct Adapter *adapter)
     }
 }
 
+/***************************************************************************
+ ***************************************************************************/
+struct Adapter *
+rawsock_init_replay(const char *filename, unsigned is_packet_trace)
+{
+    struct Adapter *adapter;
+    struct AdapterReplay *replay;
+    struct PcapFile *pcapfile;
+    unsigned char *frame;
+
+    pcapfile = pcapfile_openread(filename);
+    if (pcapfile == NULL) {
+        LOG(0, "FAIL: replay: %s: couldn't read capture file\n", filename);
+        return 0;
+    }
+
+    adapter = (struct Adapter *)malloc(sizeof(*adapter));
+    replay = (struct AdapterReplay *)malloc(sizeof(*replay));
+    frame = (unsigned char *)malloc(65536);
+    if (adapter == NULL || replay == NULL || frame == NULL)
+        exit(1);
+    memset(adapter, 0, sizeof(*adapter));
+    memset(replay, 0, sizeof(*replay));
+    adapter->replay = replay;
+    adapter->is_packet_trace = is_packet_trace;
+    adapter->pt_start = 1.0 * pixie_gettime() / 1000000.0;
+    adapter->link_type = pcapfile_datalink(pcapfile);
+
+    for (;;) {
+        unsigned secs, usecs, original_length, captured_length;
+        struct ReplayFrame *f;
+
+        if (!pcapfile_readframe(pcapfile, &secs, &usecs,
+                                &original_length, &captured_length,
+                                frame, 65536))
+            break;
+
+        if (replay->count >= replay->max) {
+            replay->max = replay->max * 2 + 1024;
+            replay->frames = (struct ReplayFrame *)realloc(replay->frames,
+                                    replay->max * sizeof(replay->frames[0]));
+            if (replay->frames == NULL)
+                exit(1);
+        }
+        if (replay->buf_length + captured_length > replay->buf_max) {
+            replay->buf_max = replay->buf_max * 2 + 1024 * 1024;
+            replay->buf = (unsigned char *)realloc(replay->buf,
+                                                   replay->buf_max);
+            if (replay->buf == NULL)
+                exit(1);
+        }
+
+        f = &replay->frames[replay->count++];
+        f->offset = replay->buf_length;
+        f->length = captured_length;
+        f->secs = secs;
+        f->usecs = usecs;
+        memcpy(replay->buf + replay->buf_length, frame, captured_length);
+        replay->buf_length += captured_length;
+    }
+
+    free(frame);
+    pcapfile_close(pcapfile);
+
+    LOG(1, "replay: %s: %u frames, %u bytes, link-type %d\n", filename,
+        (unsigned)replay->count, (unsigned)replay->buf_length,
+        adapter->link_type);
+    return adapter;
+}
+
 /***************************************************************************
  ***************************************************************************/
 struct Adapter *
@@ -4,9 +4,11 @@
 #ifndef RAWSOCK_H
 #define RAWSOCK_H
 #include <stdio.h>
+#include <stdint.h>
 struct Adapter;
 struct TemplateSet;
 #include "packet-queue.h"
+#include "ranges6.h"
 
 
 /**
@@ -50,6 +52,19 @@ rawsock_init_adapter(const char *adapter_name,
                      unsigned is_vlan,
                      unsigned vlan_id);
 
+/**
+ * Instead of opening a network adapter, read all the frames from a
+ * recorded capture file into memory, so that they can be replayed
+ * through the receive path as fast as possible. When the last frame has
+ * been received, the receive side will be told to stop.
+ * @return
+ *      an adapter from which 'rawsock_recv_packet()' returns the recorded
+ *      frames, with their recorded timestamps, and that discards anything
+ *      that is transmitted; or NULL if the file couldn't be read
+ */
+struct Adapter *
+rawsock_init_replay(const char *filename, unsigned is_packet_trace);
+
 /**
  * Retrieve the datalink type of the adapter
  *
@@ -59,6 +74,17 @@ rawsock_init_adapter(const char *adapter_name,
 int
 rawsock_datalink(struct Adapter *adapter);
 
+/**
+ * Get the counts of packets the driver received and dropped, for
+ * --metrics. These are per adapter, so when multiple threads share the
+ * same adapter, they'll each get the same counts.
+ * @return
+ *      0 on success, or something else if the driver doesn't count them
+ */
+int
+rawsock_get_stats(struct Adapter *adapter, uint64_t *received,
+                  uint64_t *dropped, uint64_t *ifdropped);
+
 /**
  * Print to the command-line the list of available adapters. It's called
  * when the "--iflist" option is specified on the command-line.
@@ -70,10 +96,28 @@ rawsock_send_probe(
     struct Adapter *adapter,
     unsigned ip_them, unsigned port_them,
     unsigned ip_me, unsigned port_me,
+    unsigned seqno, unsigned retry, unsigned flush,
+    struct TemplateSet *tmplset);
+
+/**
+ * Send a TCP SYN to an IPv6 target, see template_set_target_ipv6().
+ */
+void
+rawsock_send_probe_ipv6(
+    struct Adapter *adapter,
+    ipv6address ip_them, unsigned port_them,
+    ipv6address ip_me, unsigned port_me,
     unsigned seqno, unsigned flush,
     struct TemplateSet *tmplset);
 
 unsigned rawsock_get_adapter_ip(const char *ifname);
+
+/**
+ * Get the adapter's global IPv6 address, skipping link-local ones.
+ * @return
+ *      0 on success, -1 if it doesn't have one
+ */
+int rawsock_get_adapter_ipv6(const char *ifname, ipv6address *ipv6);
 int rawsock_get_adapter_mac(const char *ifname, unsigned char *mac);
 
 int rawsock_get_default_gateway(const char *ifname, unsigned *ipv4);
@@ -83,6 +127,17 @@ const char *rawsock_win_name(const char *ifname);
 
 int rawsock_is_adapter_names_equal(const char *lhs, const char *rhs);
 
+/**
+ * How many packets the adapter can usefully take in one go, which the
+ * throttler uses as the most it'll send back-to-back. For the Windows
+ * send-queue, that's how many small packets fit before it has to flush.
+ * For PF_RING, it's the default number of transmit slots. For plain
+ * libpcap, where each packet is its own system call, it's the default
+ * length of the kernel's transmit queue.
+ */
+unsigned
+rawsock_ring_size(const struct Adapter *adapter);
+
 /**
  * Transmit any queued (but not yet transmitted) packets. Useful only when
  * using a high-speed transmit mechanism. Since flushing happens automatically
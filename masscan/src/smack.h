@@ -100,6 +100,35 @@ smack_search_next(      struct SMACK *  smack,
                         unsigned        length
                         );
 
+/**
+ * One input for "smack_search_next_multi()". The fields 'px', 'length',
+ * 'offset' and 'state' have the same meaning as the parameters of
+ * "smack_search_next()", and the result is returned in 'id'.
+ */
+struct SmackStream {
+    const void *px;
+    unsigned length;
+    unsigned offset;
+    unsigned state;
+    size_t id;
+};
+
+/**
+ * The number of streams walked in lock-step at a time.
+ */
+#define SMACK_MULTI_MAX 8
+
+/**
+ * Calls "smack_search_next()" on each of 'count' streams, interleaving
+ * them to hide the latency of the table lookups. Each stream's 'id',
+ * 'offset' and 'state' end up the same as they would from separate
+ * calls.
+ */
+void
+smack_search_next_multi(struct SMACK *smack,
+                        struct SmackStream *streams,
+                        unsigned count);
+
 /**
  * If there are multiple matches at the current state, returns the next
  * one. Otherwise, returns NOT_FOUND. Used with "smack_search_next()".
@@ -97,6 +97,30 @@
   be 16-bits, which means the tables will still be small.
 
 
+  PREFILTER
+
+  When nothing is partially matched, the state-machine sits in a single
+  "idle" row, and most bytes of typical input (banners, HTTP headers)
+  leave it there, because they can't be the first byte of any pattern.
+  After compilation, we record that row and the set of bytes that leave
+  it. While searching from the idle row, we skip ahead to the next such
+  byte instead of doing a table lookup per byte. On x86 with SSSE3, the
+  skip tests 16 bytes at a time with the "Teddy" nibble-shuffle trick
+  (two PSHUFB lookups on the low/high nibbles, AND'ed together). The
+  nibble tables may produce false positives when more than 8 distinct
+  high-nibble classes exist, so candidates are confirmed with a byte
+  table. This is purely an optimization: the state after a skip is
+  exactly the state the DFA would've reached.
+
+
+  MULTI-STREAM
+
+  A single DFA walk is bound by the latency of the dependent table lookup,
+  one per byte. The function "smack_search_next_multi()" walks several
+  independent inputs in lock-step, so that the lookups for different
+  streams overlap in the CPU's pipeline.
+
+
   TODO
   Make it so that the longest match triggers first.
 
@@ -120,8 +144,8 @@
 #elif defined(__GNUC__)
 static __inline__ unsigned long long __rdtsc(void)
 {
-#if defined(i386) || defined(__i386__)
-    unsigned long hi = 0, lo = 0;
+#if defined(i386) || defined(__i386__) || defined(__x86_64__)
+    unsigned hi = 0, lo = 0;
     __asm__ __volatile__ ("lfence\n\trdtsc" : "=a"(lo), "=d"(hi));
     return ( (unsigned long long)lo)|( ((unsigned long long)hi)<<32 );
 #else
@@ -131,6 +155,28 @@ static __inline__ unsigned long long __rdtsc(void)
 #endif
 #endif
 
+/*
+ * The SSSE3 prefilter is compiled in on x86 for compilers that let us
+ * build one function for SSSE3 without building the whole program that
+ * way, and selected at runtime if the CPU supports it.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SMACK_SSSE3 1
+#include <tmmintrin.h>
+#define SMACK_TARGET_SSSE3 __attribute__((target("ssse3")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define SMACK_SSSE3 1
+#include <intrin.h>
+#include <tmmintrin.h>
+#define SMACK_TARGET_SSSE3
+#endif
+
+/**
+ * The value of "prefilter_row" when the prefilter is disabled. It must
+ * never equal a real row.
+ */
+#define SMACK_NO_PREFILTER 0xFFFFFFFF
+
 /**
  * By default, the table holds only 64k states using 2-byte
  * integers. If you want more states, simply change this to
@@ -271,6 +317,12 @@ struct SMACK {
      */
     unsigned            is_anchor_end:1;
 
+    /**
+     * Whether the prefilter can use the SSSE3 version of the skip loop,
+     * because both the compiler and the CPU support it.
+     */
+    unsigned            is_prefilter_ssse3:1;
+
 
     /**
      * Temporary pattern list. Patterns are added here at the beginning.
@@ -330,6 +382,23 @@ struct SMACK {
      * sub-pattern, and each row is wide enough to hold all the symbols
      * (must be a power of two) */
     transition_t *       table;
+
+    /**
+     * PREFILTER: the row the state-machine sits in when nothing is
+     * partially matched, or SMACK_NO_PREFILTER if there's no such row
+     * worth skipping from. From this row, only the bytes marked in
+     * "prefilter_start" cause a transition to a different row.
+     */
+    unsigned            prefilter_row;
+    unsigned char       prefilter_start[256];
+
+    /**
+     * "Teddy" nibble tables for the SSSE3 prefilter. A byte 'c' is a
+     * candidate if (lo[c & 0xF] & hi[c >> 4]) != 0. Candidates are a
+     * superset of "prefilter_start".
+     */
+    unsigned char       prefilter_lo[16];
+    unsigned char       prefilter_hi[16];
 };
 
 
@@ -368,6 +437,7 @@ smack_create(const char *name, unsigned nocase)
     memset (smack, 0, sizeof (struct SMACK));
 
     smack->is_nocase = nocase;
+    smack->prefilter_row = SMACK_NO_PREFILTER;
     smack->name = (char*)malloc(strlen(name)+1);
     if (smack->name == NULL) {
         fprintf(stderr, "%s: out of memory error\n", "smack");
@@ -993,6 +1063,104 @@ smack_stage4_make_final_table(struct SMACK *smack)
 }
 
 
+/****************************************************************************
+ * Test whether the CPU we are running on has SSSE3 (for PSHUFB).
+ ****************************************************************************/
+#if defined(SMACK_SSSE3)
+static int
+cpu_has_ssse3(void)
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] >> 9) & 1;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3") != 0;
+#endif
+}
+#endif
+
+/****************************************************************************
+ * Build the prefilter from the final table. The "idle" row is where the
+ * state-machine goes on a byte that isn't in any pattern (symbol 0) from
+ * the start state. It's only useful if it loops back to itself on such
+ * bytes, and isn't a match. Every byte that keeps us in the idle row can
+ * be skipped without a lookup, so the prefilter only has to find the
+ * others. This is calculated from the final table rather than the
+ * patterns so that it's correct regardless of case-folding or anchors.
+ ****************************************************************************/
+static void
+smack_stage5_make_prefilter(struct SMACK *smack)
+{
+    const transition_t *table = smack->table;
+    unsigned row_shift = smack->row_shift;
+    unsigned idle;
+    unsigned rows[16];
+    unsigned bucket_of[16];
+    unsigned bucket_count = 0;
+    unsigned start_count = 0;
+    unsigned c;
+
+    smack->prefilter_row = SMACK_NO_PREFILTER;
+    memset(smack->prefilter_start, 0, sizeof(smack->prefilter_start));
+    memset(smack->prefilter_lo, 0, sizeof(smack->prefilter_lo));
+    memset(smack->prefilter_hi, 0, sizeof(smack->prefilter_hi));
+    memset(rows, 0, sizeof(rows));
+
+    idle = *(table + (0<<row_shift) + 0);
+    if (idle >= smack->m_match_limit)
+        return;
+    if (*(table + (idle<<row_shift) + 0) != idle)
+        return;
+
+    for (c=0; c<256; c++) {
+        unsigned symbol = smack->char_to_symbol[c];
+        if (*(table + (idle<<row_shift) + symbol) != idle) {
+            smack->prefilter_start[c] = 1;
+            rows[c >> 4] |= 1 << (c & 0xF);
+            start_count++;
+        }
+    }
+
+    /* If most bytes start a pattern, skipping won't help */
+    if (start_count > 192)
+        return;
+    smack->prefilter_row = idle;
+
+    /*
+     * Teddy tables: group the high-nibbles that have the same set of
+     * low-nibbles into buckets (one bit each). With more than 8 distinct
+     * sets, buckets are shared, which only adds false positives.
+     */
+    for (c=0; c<16; c++) {
+        unsigned j;
+
+        bucket_of[c] = 0;
+        if (rows[c] == 0)
+            continue;
+        for (j=0; j<c; j++) {
+            if (rows[j] == rows[c])
+                break;
+        }
+        if (j < c)
+            bucket_of[c] = bucket_of[j];
+        else
+            bucket_of[c] = 1 << (bucket_count++ % 8);
+
+        smack->prefilter_hi[c] |= (unsigned char)bucket_of[c];
+        for (j=0; j<16; j++) {
+            if (rows[c] & (1 << j))
+                smack->prefilter_lo[j] |= (unsigned char)bucket_of[c];
+        }
+    }
+
+#if defined(SMACK_SSSE3)
+    smack->is_prefilter_ssse3 = cpu_has_ssse3();
+#endif
+}
+
+
 /****************************************************************************
  ****************************************************************************/
 static void
@@ -1112,6 +1280,7 @@ smack_compile(struct SMACK *smack)
      * Build the final table we use for evaluation
      */
     smack_stage4_make_final_table(smack);
+    smack_stage5_make_prefilter(smack);
 
     /*
      * Get rid of the original pattern tables, since we no longer need them.
@@ -1158,6 +1327,84 @@ handle_match(    struct SMACK * smack,
 
 
 
+/*****************************************************************************
+ * Return the index of the first byte at or after 'i' that can leave the
+ * idle row, or 'length' if there is none.
+ *****************************************************************************/
+static size_t
+prefilter_skip_scalar(const unsigned char *start, const unsigned char *px,
+                      size_t i, size_t length)
+{
+    while (i + 4 <= length) {
+        if (start[px[i+0]]) return i + 0;
+        if (start[px[i+1]]) return i + 1;
+        if (start[px[i+2]]) return i + 2;
+        if (start[px[i+3]]) return i + 3;
+        i += 4;
+    }
+    while (i < length && !start[px[i]])
+        i++;
+    return i;
+}
+
+#if defined(SMACK_SSSE3)
+static unsigned
+lowest_bit(unsigned mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+/*****************************************************************************
+ * Same as above, 16 bytes at a time: look up each byte's low and high
+ * nibble in the Teddy tables with PSHUFB, AND them, and confirm any
+ * candidates against the exact byte table.
+ *****************************************************************************/
+SMACK_TARGET_SSSE3 static size_t
+prefilter_skip_ssse3(const struct SMACK *smack, const unsigned char *px,
+                     size_t i, size_t length)
+{
+    const __m128i lo_table = _mm_loadu_si128((const __m128i *)smack->prefilter_lo);
+    const __m128i hi_table = _mm_loadu_si128((const __m128i *)smack->prefilter_hi);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+
+    while (i + 16 <= length) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(px + i));
+        __m128i lo = _mm_shuffle_epi8(lo_table, _mm_and_si128(v, nibble));
+        __m128i hi = _mm_shuffle_epi8(hi_table,
+                            _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        __m128i miss = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), zero);
+        unsigned mask = ~(unsigned)_mm_movemask_epi8(miss) & 0xFFFF;
+
+        while (mask) {
+            unsigned k = lowest_bit(mask);
+            if (smack->prefilter_start[px[i + k]])
+                return i + k;
+            mask &= mask - 1;
+        }
+        i += 16;
+    }
+    return prefilter_skip_scalar(smack->prefilter_start, px, i, length);
+}
+#endif
+
+static size_t
+prefilter_skip(const struct SMACK *smack, const unsigned char *px,
+               size_t i, size_t length)
+{
+#if defined(SMACK_SSSE3)
+    if (smack->is_prefilter_ssse3)
+        return prefilter_skip_ssse3(smack, px, i, length);
+#endif
+    return prefilter_skip_scalar(smack->prefilter_start, px, i, length);
+}
+
 /****************************************************************************
  ****************************************************************************/
 unsigned
@@ -1186,6 +1433,14 @@ smack_search(    struct SMACK * smack,
         unsigned char column;
         unsigned char c;
 
+        /* If nothing is partially matched, skip bytes that can't start
+         * a pattern */
+        if (row == smack->prefilter_row && !smack->prefilter_start[px[i]]) {
+            i = (unsigned)prefilter_skip(smack, px, i + 1, length);
+            if (i >= length)
+                break;
+        }
+
         /* Get the next character of input */
         c = px[i];
 
@@ -1232,6 +1487,71 @@ smack_search(    struct SMACK * smack,
     return found_count;
 }
 
+/*****************************************************************************
+ * Like "inner_match()", but whenever the DFA is back in the idle row, jump
+ * ahead to the next byte that can start a pattern. Returns the index of
+ * the byte that caused a match, or 'length'.
+ *
+ * On input dense with pattern characters, the skips are too short to pay
+ * for themselves, so after a few of them we check the average distance
+ * and fall back to the plain walk for the rest of the input.
+ *****************************************************************************/
+static size_t
+inner_match_prefilter(  const struct SMACK *smack,
+                        const unsigned char *px,
+                        size_t i,
+                        size_t length,
+                        unsigned *state)
+{
+    const unsigned char *char_to_symbol = smack->char_to_symbol;
+    const unsigned char *start = smack->prefilter_start;
+    const transition_t *table = smack->table;
+    unsigned row_shift = smack->row_shift;
+    unsigned match_limit = smack->m_match_limit;
+    unsigned idle = smack->prefilter_row;
+    unsigned row = *state;
+    size_t skips = 0;
+    size_t skipped = 0;
+
+    while (i < length) {
+        if (row == idle && !start[px[i]]) {
+            size_t next = prefilter_skip(smack, px, i + 1, length);
+
+            skipped += next - i;
+            i = next;
+            if (i >= length)
+                break;
+            if (++skips >= 16 && skipped < 8 * skips)
+                break;
+        }
+
+        /* Run the DFA until a match, or until we fall back to idle */
+        for ( ; i<length; i++) {
+            row = *(table + (row<<row_shift) + char_to_symbol[px[i]]);
+            if (row >= match_limit) {
+                *state = row;
+                return i;
+            }
+            if (row == idle) {
+                i++;
+                break;
+            }
+        }
+    }
+
+    /* Dense input: plain walk */
+    for ( ; i<length; i++) {
+        row = *(table + (row<<row_shift) + char_to_symbol[px[i]]);
+        if (row >= match_limit) {
+            *state = row;
+            return i;
+        }
+    }
+
+    *state = row;
+    return length;
+}
+
 /*****************************************************************************
  *****************************************************************************/
 static size_t
@@ -1331,7 +1651,13 @@ smack_search_next(      struct SMACK *  smack,
     current_matches = (*current_state)>>24;
  
     /* 'for all bytes in this block' */
-    if (!current_matches) {
+    if (!current_matches && smack->prefilter_row != SMACK_NO_PREFILTER) {
+        i = inner_match_prefilter(smack, px, i, length, &row);
+        if (match[row].m_count) {
+            i++; /* points to first byte after match */
+            current_matches = match[row].m_count;
+        }
+    } else if (!current_matches) {
         /*if ((length-i) & 1)
             i += inner_match(px + i, 
                              length - i,
@@ -1411,6 +1737,115 @@ smack_next_match(struct SMACK *smack, unsigned *current_state)
 }
 
 
+/****************************************************************************
+ * Runs "smack_search_next()" on several independent streams at once. Each
+ * stream ends up exactly as if "smack_search_next()" had been called on
+ * it alone. Streams are walked in lock-step in groups, so that the table
+ * lookups for one stream overlap those of the others instead of waiting
+ * on each other.
+ ****************************************************************************/
+void
+smack_search_next_multi(struct SMACK *smack,
+                        struct SmackStream *streams,
+                        unsigned count)
+{
+    const unsigned char *char_to_symbol = smack->char_to_symbol;
+    const transition_t *table = smack->table;
+    const struct SmackMatches *match = smack->m_match;
+    unsigned row_shift = smack->row_shift;
+    unsigned match_limit = smack->m_match_limit;
+    unsigned base;
+
+    for (base=0; base<count; base += SMACK_MULTI_MAX) {
+        const unsigned char *px[SMACK_MULTI_MAX];
+        unsigned offset[SMACK_MULTI_MAX];
+        unsigned length[SMACK_MULTI_MAX];
+        unsigned row[SMACK_MULTI_MAX];
+        unsigned slot[SMACK_MULTI_MAX];
+        unsigned active = 0;
+        unsigned n = count - base;
+        unsigned k;
+
+        if (n > SMACK_MULTI_MAX)
+            n = SMACK_MULTI_MAX;
+
+        /* Streams with pending matches from a previous call (or with
+         * nothing left to search) don't need the lock-step loop */
+        for (k=0; k<n; k++) {
+            struct SmackStream *stream = &streams[base + k];
+
+            if ((stream->state >> 24) || stream->offset >= stream->length) {
+                stream->id = smack_search_next(smack, &stream->state,
+                                stream->px, &stream->offset, stream->length);
+                continue;
+            }
+            stream->id = SMACK_NOT_FOUND;
+            px[active] = (const unsigned char *)stream->px;
+            offset[active] = stream->offset;
+            length[active] = stream->length;
+            row[active] = stream->state & 0xFFFFFF;
+            slot[active] = k;
+            active++;
+        }
+
+        /* Step every remaining stream one byte per round, for as many
+         * rounds as the shortest stream has left, or until one of them
+         * hits a match. Then retire the streams that are done for this
+         * call, moving the last stream into their place. */
+        while (active) {
+            unsigned rounds = length[0] - offset[0];
+            unsigned r;
+
+            for (k=1; k<active; k++) {
+                if (rounds > length[k] - offset[k])
+                    rounds = length[k] - offset[k];
+            }
+
+            for (r=0; r<rounds; ) {
+                unsigned hit = 0;
+
+                for (k=0; k<active; k++) {
+                    row[k] = *(table + (row[k]<<row_shift)
+                                     + char_to_symbol[px[k][offset[k] + r]]);
+                    hit |= (row[k] >= match_limit);
+                }
+                r++;
+                if (hit)
+                    break;
+            }
+
+            for (k=0; k<active; ) {
+                offset[k] += r;
+                if (row[k] < match_limit && offset[k] < length[k]) {
+                    k++;
+                    continue;
+                }
+
+                /* This stream is done for this call */
+                {
+                    struct SmackStream *stream = &streams[base + slot[k]];
+                    unsigned current_matches = match[row[k]].m_count;
+
+                    stream->offset = offset[k];
+                    if (current_matches) {
+                        stream->id = match[row[k]].m_ids[current_matches-1];
+                        current_matches--;
+                    }
+                    stream->state = row[k] | (current_matches<<24);
+                }
+
+                active--;
+                px[k] = px[active];
+                offset[k] = offset[active];
+                length[k] = length[active];
+                row[k] = row[active];
+                slot[k] = slot[active];
+            }
+        }
+    }
+}
+
+
 /****************************************************************************
  ****************************************************************************/
 unsigned
@@ -1454,20 +1889,102 @@ r_rand(unsigned *seed)
     return (*seed)>>16 & 0x7fff;
 }
 
+/****************************************************************************
+ * Times one way of searching the buffer. The modes are the plain DFA
+ * walk, the DFA with the prefilter, and the multi-stream walk over the
+ * buffer cut into SMACK_MULTI_MAX pieces.
+ ****************************************************************************/
+enum {BENCH_DFA, BENCH_PREFILTER, BENCH_MULTI};
+
+static void
+smack_benchmark_run(struct SMACK *s, const char *name, unsigned mode,
+                    const char *buf, unsigned buf_size, unsigned iterations)
+{
+    unsigned prefilter_row = s->prefilter_row;
+    uint64_t start, stop;
+    uint64_t cycle1, cycle2;
+    uint64_t result = 0;
+    unsigned i;
+    double elapsed;
+
+    if (mode != BENCH_PREFILTER)
+        s->prefilter_row = SMACK_NO_PREFILTER;
+
+    start = pixie_nanotime();
+    cycle1 = __rdtsc();
+    for (i=0; i<iterations; i++) {
+        if (mode == BENCH_MULTI) {
+            struct SmackStream streams[SMACK_MULTI_MAX];
+            unsigned piece = buf_size/SMACK_MULTI_MAX;
+            unsigned remaining = SMACK_MULTI_MAX;
+            unsigned j;
+
+            for (j=0; j<SMACK_MULTI_MAX; j++) {
+                streams[j].px = buf + j*piece;
+                streams[j].length = piece;
+                streams[j].offset = 0;
+                streams[j].state = 0;
+            }
+            while (remaining) {
+                smack_search_next_multi(s, streams, remaining);
+                for (j=0; j<remaining; ) {
+                    if (streams[j].id != SMACK_NOT_FOUND)
+                        result += streams[j].id;
+                    if (streams[j].offset >= streams[j].length
+                        && (streams[j].state>>24) == 0)
+                        streams[j] = streams[--remaining];
+                    else
+                        j++;
+                }
+            }
+        } else {
+            unsigned state = 0;
+            unsigned offset = 0;
+
+            while (offset < buf_size) {
+                size_t id = smack_search_next(s, &state, buf, &offset, buf_size);
+                if (id != SMACK_NOT_FOUND)
+                    result += id;
+            }
+        }
+    }
+    cycle2 = __rdtsc();
+    stop = pixie_nanotime();
+
+    s->prefilter_row = prefilter_row;
+
+    elapsed = ((double)(stop - start))/(1000000000.0);
+    printf("%-8s %-10s %9.1f-Mbps", name,
+            (mode==BENCH_DFA)?"dfa":(mode==BENCH_PREFILTER)?"prefilter":"multi",
+            ((buf_size*(double)iterations*8.0)/elapsed)/1000000.0);
+    if (cycle2 > cycle1)
+        printf("  %6.3f bytes/cycle", (buf_size*(double)iterations)/(cycle2-cycle1));
+    printf("  (%llu)\n", (unsigned long long)result);
+}
+
 /****************************************************************************
  ****************************************************************************/
 int
 smack_benchmark(void)
 {
+    static const char *methods[] = {
+        "GET",      "PUT",      "POST",     "OPTIONS",
+        "HEAD",     "DELETE",   "TRACE",    "CONNECT",
+        "PROPFIND", "PROPPATCH","MKCOL",    "MKWORKSPACE",
+        "MOVE",     "LOCK",     "UNLOCK",   "VERSION-CONTROL",
+        0};
     char *buf;
+    char *text;
     unsigned seed = 0;
     static unsigned BUF_SIZE = 1024*1024;
-    static uint64_t ITERATIONS = 30;
+    static unsigned ITERATIONS = 30;
     unsigned i;
     struct SMACK *s;
+    struct SMACK *http;
     uint64_t start, stop;
-    uint64_t result = 0;
     uint64_t cycle1, cycle2;
+    unsigned state = 0;
+    unsigned offset = 0;
 
     printf("-- smack-1 -- \n");
     
@@ -1478,6 +1995,11 @@ smack_benchmark(void)
     for (i=0; i<BUF_SIZE; i++)
         buf[i] = (char)r_rand(&seed)&0x7F;
 
+    /* And one with printable text */
+    text = (char*)malloc(BUF_SIZE);
+    for (i=0; i<BUF_SIZE; i++)
+        text[i] = (char)(' ' + r_rand(&seed)%95);
+
 
     /* Create 20 patterns */
     for (i=0; i<20; i++) {
@@ -1493,32 +2015,221 @@ smack_benchmark(void)
 
     smack_compile(s);
 
+    http = smack_create("benchmark2", 1);
+    for (i=0; methods[i]; i++)
+        smack_add_pattern(http, methods[i], (unsigned)strlen(methods[i]), i, 0);
+    smack_compile(http);
+
+    /* Measure the clock rate with a plain search */
     start = pixie_nanotime();
     cycle1 = __rdtsc();
-    for (i=0; i<ITERATIONS; i++) {
-        unsigned state = 0;
+    while (offset < BUF_SIZE)
+        smack_search_next(s, &state, buf, &offset, BUF_SIZE);
+    cycle2 = __rdtsc();
+    stop = pixie_nanotime();
+    if (cycle2 > cycle1 && stop > start) {
+        double elapsed = ((double)(stop - start))/(1000000000.0);
+        printf("clockrate = %5.3f-GHz\n", ((cycle2-cycle1)*1.0/elapsed)/1000000000.0);
+    }
+
+    smack_benchmark_run(s, "junk", BENCH_DFA, buf, BUF_SIZE, ITERATIONS);
+    smack_benchmark_run(s, "junk", BENCH_PREFILTER, buf, BUF_SIZE, ITERATIONS);
+    smack_benchmark_run(s, "junk", BENCH_MULTI, buf, BUF_SIZE, ITERATIONS);
+    smack_benchmark_run(http, "text", BENCH_DFA, text, BUF_SIZE, ITERATIONS);
+    smack_benchmark_run(http, "text", BENCH_PREFILTER, text, BUF_SIZE, ITERATIONS);
+    smack_benchmark_run(http, "text", BENCH_MULTI, text, BUF_SIZE, ITERATIONS);
+
+    smack_destroy(http);
+    smack_destroy(s);
+    free(text);
+    free(buf);
+    return 0;
+}
+
+/****************************************************************************
+ * Search 'text' and fold every (id, offset) match into a checksum, so that
+ * the different ways of searching can be compared with each other.
+ ****************************************************************************/
+static uint64_t
+smack_selftest_digest(struct SMACK *s, const char *text, unsigned length,
+                      unsigned fragment)
+{
+    uint64_t digest = 0;
+    unsigned state = 0;
+    unsigned base;
+
+    for (base=0; base<length; base += fragment) {
+        unsigned n = (length - base < fragment) ? (length - base) : fragment;
         unsigned offset = 0;
 
-        while (offset < BUF_SIZE)
-            result += smack_search_next(s, &state, buf, &offset, BUF_SIZE);
+        while (offset < n) {
+            size_t id = smack_search_next(s, &state, text + base, &offset, n);
+            if (id != SMACK_NOT_FOUND)
+                digest = digest * 1000003 + (id + 1) * 65537 + base + offset;
+        }
+        for (;;) {
+            size_t id = smack_next_match(s, &state);
+            if (id == SMACK_NOT_FOUND)
+                break;
+            digest = digest * 1000003 + (id + 1) * 65537 + base + offset;
+        }
     }
-    cycle2 = __rdtsc();
-    stop = pixie_nanotime();
+    return digest;
+}
 
-    if (result) {
-        double elapsed = ((double)(stop - start))/(1000000000.0);
-        double rate = (BUF_SIZE*ITERATIONS*8ULL)/elapsed;
-        double cycles = (BUF_SIZE*ITERATIONS*1.0)/(1.0*(cycle2-cycle1));
+static uint64_t
+smack_selftest_digest_multi(struct SMACK *s, const char *text, unsigned length,
+                            unsigned count, uint64_t *digests)
+{
+    struct SmackStream streams[SMACK_MULTI_MAX * 2];
+    unsigned remaining = count;
+    unsigned piece = length / count;
+    unsigned j;
+
+    for (j=0; j<count; j++) {
+        streams[j].px = text + j*piece;
+        streams[j].length = piece;
+        streams[j].offset = 0;
+        streams[j].state = 0;
+        digests[j] = 0;
+    }
 
-        rate /= 1000000.0;
+    /* Streams get reordered as they finish, so track where each went */
+    {
+        unsigned which[SMACK_MULTI_MAX * 2];
+        for (j=0; j<count; j++)
+            which[j] = j;
+
+        while (remaining) {
+            smack_search_next_multi(s, streams, remaining);
+            for (j=0; j<remaining; ) {
+                if (streams[j].id != SMACK_NOT_FOUND)
+                    digests[which[j]] = digests[which[j]] * 1000003
+                                + (streams[j].id + 1) * 65537
+                                + streams[j].offset;
+                if (streams[j].offset >= streams[j].length
+                    && (streams[j].state>>24) == 0) {
+                    remaining--;
+                    streams[j] = streams[remaining];
+                    which[j] = which[remaining];
+                } else
+                    j++;
+            }
+        }
+    }
+    return piece;
+}
 
-        printf("bits/second = %5.3f-million\n", rate);
-        printf("clocks/byte = %5.3f\n", (1.0/cycles));
-        printf("clockrate = %5.3f-GHz\n", ((cycle2-cycle1)*1.0/elapsed)/1000000000.0);
+/****************************************************************************
+ * The prefilter, the plain DFA walk, fragmented input and the
+ * multi-stream walk must all find exactly the same matches.
+ ****************************************************************************/
+static int
+smack_selftest_prefilter(void)
+{
+    static const struct {
+        const char *pattern;
+        unsigned flags;
+    } sets[3][8] = {
+        {{"GET",0}, {"POST",0}, {"HEAD",0}, {"options",0}, {"PATCH",0},
+         {"ATC",0}, {0,0}},
+        {{"SSH-",SMACK_ANCHOR_BEGIN}, {"HTTP/1.",0}, {"220 ",SMACK_ANCHOR_BEGIN},
+         {"ftp",0}, {"x",0}, {"\xff\xfb",0}, {0,0}},
+        {{"\x80\x81",0}, {"zz",0}, {"z",0}, {"\x10",0}, {0,0}},
+    };
+    static const char filler[] = "GETPOSTHEADoptionsPATCHSH-220 ftpxHTTP/1.z\x80\x81\x10\xff\xfb";
+    unsigned seed = 1;
+    unsigned length = 40000;
+    char *text;
+    unsigned set;
+    unsigned i;
 
-        
+    text = (char*)malloc(length);
+    if (text == NULL)
+        return 1;
+
+    for (set=0; set<3; set++) {
+        struct SMACK *s;
+        unsigned round;
+
+        s = smack_create("prefilter", set==0);
+        for (i=0; sets[set][i].pattern; i++)
+            smack_add_pattern(s, sets[set][i].pattern,
+                              (unsigned)strlen(sets[set][i].pattern),
+                              i, sets[set][i].flags);
+        smack_compile(s);
+
+        for (round=0; round<4; round++) {
+            unsigned prefilter_row = s->prefilter_row;
+            unsigned is_ssse3 = s->is_prefilter_ssse3;
+            uint64_t expected;
+            uint64_t digests[SMACK_MULTI_MAX * 2];
+            unsigned piece;
+            unsigned j;
+
+            /* Mostly bytes that can't start anything, with bursts of
+             * pattern text, so the prefilter has work to do */
+            for (i=0; i<length; i++) {
+                unsigned r = r_rand(&seed);
+                if ((r % (2 + round*8)) == 0)
+                    text[i] = filler[r_rand(&seed) % (sizeof(filler)-1)];
+                else
+                    text[i] = (char)(r_rand(&seed) % 256);
+            }
+
+            s->prefilter_row = SMACK_NO_PREFILTER;
+            expected = smack_selftest_digest(s, text, length, length);
+            s->prefilter_row = prefilter_row;
+
+            if (smack_selftest_digest(s, text, length, length) != expected)
+                goto fail;
+            if (smack_selftest_digest(s, text, length, 7) != expected)
+                goto fail;
+            s->is_prefilter_ssse3 = 0;
+            if (smack_selftest_digest(s, text, length, length) != expected)
+                goto fail;
+            s->is_prefilter_ssse3 = is_ssse3;
+
+            /* Each stream of the multi-stream walk must match a plain
+             * search of its own piece */
+            piece = (unsigned)smack_selftest_digest_multi(s, text, length,
+                                                SMACK_MULTI_MAX + 3, digests);
+            for (j=0; j<SMACK_MULTI_MAX + 3; j++) {
+                unsigned state = 0;
+                unsigned offset = 0;
+                uint64_t digest = 0;
+
+                while (offset < piece) {
+                    size_t id = smack_search_next(s, &state, text + j*piece,
+                                                  &offset, piece);
+                    if (id != SMACK_NOT_FOUND)
+                        digest = digest * 1000003 + (id + 1) * 65537 + offset;
+                }
+                for (;;) {
+                    size_t id = smack_next_match(s, &state);
+                    if (id == SMACK_NOT_FOUND)
+                        break;
+                    digest = digest * 1000003 + (id + 1) * 65537 + offset;
+                }
+                if (digest != digests[j])
+                    goto fail;
+            }
+        }
+
+        /* Set 0 has patterns starting with only a few letters, set 2 has
+         * patterns that are all rare bytes: both should be prefiltered */
+        if (set != 1 && s->prefilter_row == SMACK_NO_PREFILTER)
+            goto fail;
+        smack_destroy(s);
+        continue;
+    fail:
+        fprintf(stderr, "smack: prefilter mismatch, set=%u round=%u\n", set, round);
+        smack_destroy(s);
+        free(text);
+        return 1;
     }
 
+    free(text);
     return 0;
 }
 
@@ -1591,6 +2302,8 @@ smack_selftest(void)
 
     }
 
+    if (smack_selftest_prefilter())
+        return 1;
 
     return 0;
 }
@@ -127,3 +127,24 @@ syn_cookie( unsigned ip_them, unsigned port_them,
     data[3] = port_me;
     return siphash24(data, sizeof(data), x);
 }
+
+/***************************************************************************
+ ***************************************************************************/
+uint64_t
+syn_cookie_ipv6(ipv6address ip_them, unsigned port_them,
+                ipv6address ip_me, unsigned port_me,
+                uint64_t entropy)
+{
+    uint64_t data[5];
+    uint64_t x[2];
+
+    x[0] = entropy;
+    x[1] = entropy;
+
+    data[0] = ip_them.hi;
+    data[1] = ip_them.lo;
+    data[2] = ip_me.hi;
+    data[3] = ip_me.lo;
+    data[4] = (uint64_t)port_them << 32 | port_me;
+    return siphash24(data, sizeof(data), x);
+}
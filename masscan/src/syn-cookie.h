@@ -1,6 +1,7 @@
 #ifndef SYN_COOKIE_H
 #define SYN_COOKIE_H
 #include <stdint.h>
+#include "ranges6.h"
 
 /**
  * Create a hash of the src/dst IP/port combination. This allows us to match
@@ -12,6 +13,15 @@ syn_cookie( unsigned ip_dst, unsigned port_dst,
             uint64_t entropy);
 
 
+/**
+ * The same, for IPv6. The result is different from the IPv4 cookie of
+ * an IPv4-mapped address, which doesn't matter, since we never send one.
+ */
+uint64_t
+syn_cookie_ipv6(ipv6address ip_them, unsigned port_them,
+                ipv6address ip_me, unsigned port_me,
+                uint64_t entropy);
+
 /**
  * Called on startup to set a secret key
  */
@@ -15,6 +15,7 @@
 #include "proto-preprocess.h"   /* parse packets */
 #include "ranges.h"             /* for parsing IP addresses */
 #include "logger.h"
+#include "string_s.h"
 #include "proto-zeroaccess.h"   /* botnet p2p protocol */
 #include "proto-snmp.h"
 #include "proto-memcached.h"
@@ -32,6 +33,7 @@ struct Payload {
     unsigned length;
     unsigned xsum;
     SET_COOKIE set_cookie;
+    unsigned is_builtin:1;
     unsigned char buf[1];
 };
 struct Payload2 {
@@ -44,10 +46,22 @@ struct Payload2 {
 
 };
 
+/*
+ * For every UDP port, where its payloads start in the sorted list and
+ * how many there are, so that we can find them without searching. This
+ * is 1-megabyte, but it's looked up for every UDP probe we send.
+ */
+struct PayloadIndex {
+    unsigned first;
+    unsigned count;
+    uint64_t responses;
+};
+
 struct NmapPayloads {
     unsigned count;
     size_t max;
     struct Payload **list;
+    struct PayloadIndex *index;
 };
 
 
@@ -149,35 +163,112 @@ partial_checksum(const unsigned char *px, size_t icmp_length)
 }
 
 /***************************************************************************
- * If we have the port, return the payload
+ * Rebuild the port index after the list has changed. The list is sorted
+ * by port, so all the payloads for a port are next to each other. This
+ * keeps any response counts we already have.
+ ***************************************************************************/
+static void
+payloads_reindex(struct NmapPayloads *payloads)
+{
+    unsigned i;
+
+    if (payloads->index == NULL) {
+        payloads->index = (struct PayloadIndex *)calloc(65536,
+                                            sizeof(payloads->index[0]));
+        if (payloads->index == NULL)
+            exit(1); /* out of memory */
+    }
+
+    for (i=0; i<65536; i++) {
+        payloads->index[i].first = 0;
+        payloads->index[i].count = 0;
+    }
+
+    for (i=0; i<payloads->count; i++) {
+        struct PayloadIndex *entry = &payloads->index[payloads->list[i]->port];
+        if (entry->count == 0)
+            entry->first = i;
+        entry->count++;
+    }
+}
+
+/***************************************************************************
+ * If we have the port, return the payload. When there are several for
+ * the port, each retransmission of the probe uses the next one.
  ***************************************************************************/
 int
 payloads_lookup(
         const struct NmapPayloads *payloads,
         unsigned port,
+        unsigned retry,
         const unsigned char **px,
         unsigned *length,
         unsigned *source_port,
         uint64_t *xsum,
         SET_COOKIE *set_cookie)
 {
+    const struct PayloadIndex *entry;
+    const struct Payload *p;
     unsigned i;
-    if (payloads == 0)
+
+    if (payloads == 0 || payloads->index == 0)
         return 0;
 
-    port &= 0xFFFF;
+    entry = &payloads->index[port & 0xFFFF];
+    if (entry->count == 0)
+        return 0;
 
-    for (i=0; i<payloads->count; i++) {
-        if (payloads->list[i]->port == port) {
-            *px = payloads->list[i]->buf;
-            *length = payloads->list[i]->length;
-            *source_port = payloads->list[i]->source_port;
-            *xsum = payloads->list[i]->xsum;
-            *set_cookie = payloads->list[i]->set_cookie;
-            return 1;
+    i = entry->first;
+    if (entry->count > 1)
+        i += retry % entry->count;
+    p = payloads->list[i];
+
+    *px = p->buf;
+    *length = p->length;
+    *source_port = p->source_port;
+    *xsum = p->xsum;
+    *set_cookie = p->set_cookie;
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+payloads_record_response(struct NmapPayloads *payloads, unsigned port)
+{
+    if (payloads == 0 || payloads->index == 0)
+        return;
+    payloads->index[port & 0xFFFF].responses++;
+}
+
+/***************************************************************************
+ * At the end of a scan, print how many responses each port got to its
+ * payloads. Responses are matched to the probe by the same cookie no
+ * matter which of the port's payloads was sent, so the count is shared
+ * by all the payloads on the port.
+ ***************************************************************************/
+void
+payloads_print_responses(FILE *fp, const struct NmapPayloads *payloads)
+{
+    unsigned port;
+
+    if (payloads == 0 || payloads->index == 0)
+        return;
+
+    for (port=0; port<65536; port++) {
+        const struct PayloadIndex *entry = &payloads->index[port];
+        unsigned i;
+
+        if (entry->responses == 0)
+            continue;
+
+        fprintf(fp, "udp/%-5u %10" PRIu64 " responses", port, entry->responses);
+        for (i=0; i<entry->count; i++) {
+            const struct Payload *p = payloads->list[entry->first + i];
+            fprintf(fp, "%s%u-bytes", i?", ":" to ", p->length);
         }
+        fprintf(fp, "\n");
     }
-    return 0;
 }
 
 
@@ -196,6 +287,9 @@ payloads_destroy(struct NmapPayloads *payloads)
     if (payloads->list)
         free(payloads->list);
 
+    if (payloads->index)
+        free(payloads->index);
+
     free(payloads);
 }
 
@@ -238,6 +332,8 @@ payloads_trim(struct NmapPayloads *payloads, const struct RangeList *target_port
     free(payloads->list);
     payloads->list = list2;
     payloads->count = count2;
+
+    payloads_reindex(payloads);
 }
 
 /***************************************************************************
@@ -421,14 +517,46 @@ static unsigned
 payload_add(struct NmapPayloads *payloads,
             const unsigned char *buf, size_t length,
             struct RangeList *ports, unsigned source_port,
-            SET_COOKIE set_cookie)
+            SET_COOKIE set_cookie, unsigned is_builtin)
 {
-    unsigned count = 1;
+    unsigned count = 0;
     struct Payload *p;
     uint64_t port_count = rangelist_count(ports);
     uint64_t i;
 
     for (i=0; i<port_count; i++) {
+        unsigned port = rangelist_pick(ports, i);
+        unsigned j;
+        unsigned k;
+
+        /* The built-in payloads are only defaults: the first payload the
+         * user gives us for a port replaces them, and any more are added
+         * alongside, to be rotated through on retries */
+        if (!is_builtin) {
+            for (j=0, k=0; j<payloads->count; j++) {
+                struct Payload *q = payloads->list[j];
+                if (q->port == port && q->is_builtin)
+                    free(q);
+                else
+                    payloads->list[k++] = q;
+            }
+            payloads->count = k;
+        }
+
+        /* Find where to insert, after any others for the same port, so
+         * that they are tried in the order they were given. Skip exact
+         * duplicates, which are common when reading packet captures */
+        for (j=0; j<payloads->count; j++) {
+            const struct Payload *q = payloads->list[j];
+            if (q->port > port)
+                break;
+            if (q->port == port && q->length == length
+                && memcmp(q->buf, buf, length) == 0)
+                break;
+        }
+        if (j < payloads->count && payloads->list[j]->port == port)
+            continue;
+
         /* grow the list if we need to */
         if (payloads->count + 1 > payloads->max) {
             size_t new_max = payloads->max*2 + 1;
@@ -451,37 +579,23 @@ payload_add(struct NmapPayloads *payloads,
         if (p == NULL)
             exit(1); /* out of memory */
 
-        p->port = rangelist_pick(ports, i);
+        p->port = port;
         p->source_port = source_port;
         p->length = (unsigned)length;
         memcpy(p->buf, buf, length);
         p->xsum = partial_checksum(buf, length);
         p->set_cookie = set_cookie;
+        p->is_builtin = is_builtin;
 
         /* insert in sorted order */
-        {
-            unsigned j;
-
-            for (j=0; j<payloads->count; j++) {
-                if (p->port <= payloads->list[j]->port)
-                    break;
-            }
-
-            if (j < payloads->count) {
-                if (p->port == payloads->list[j]->port) {
-                    free(payloads->list[j]);
-                    count = 0; /* don't increment count */
-                } else
-                    memmove(payloads->list + j + 1,
-                            payloads->list + j,
-                            (payloads->count-j) * sizeof(payloads->list[0]));
-            }
-            payloads->list[j] = p;
-
-            payloads->count += count;
-        }
+        memmove(payloads->list + j + 1,
+                payloads->list + j,
+                (payloads->count-j) * sizeof(payloads->list[0]));
+        payloads->list[j] = p;
+        payloads->count++;
+        count++;
     }
-    return count; /* zero or one */
+    return count;
 }
 
 /***************************************************************************
@@ -571,12 +685,15 @@ payloads_read_pcap(const char *filename,
                                 parsed.app_length,
                                 ports,
                                 0x10000,
+                                0,
                                 0);
     }
 
     LOG(2, "payloads:'%s': imported %u unique payloads\n", filename, count);
     LOG(2, "payloads:'%s': closed packet capture\n", filename);
     pcapfile_close(pcap);
+
+    payloads_reindex(payloads);
 }
 
 /***************************************************************************
@@ -657,7 +774,7 @@ payloads_read_file(FILE *fp, const char *filename,
          * Now we've completely parsed the record, so add it to our
          * list of payloads
          */
-        payload_add(payloads, buf, buf_length, ports, source_port, 0);
+        payload_add(payloads, buf, buf_length, ports, source_port, 0, 0);
 
         rangelist_remove_all(ports);
     }
@@ -688,7 +805,7 @@ payloads_read_file(FILE *fp, const char *filename,
 #endif
 
 end:
-    ;//fclose(fp);
+    payloads_reindex(payloads);
 }
 
 /***************************************************************************
@@ -725,8 +842,10 @@ payloads_create(void)
                     length,
                     &list,
                     hard_coded_payloads[i].source_port,
-                    hard_coded_payloads[i].set_cookie);
+                    hard_coded_payloads[i].set_cookie,
+                    1);
     }
+    payloads_reindex(payloads);
     return payloads;
 }
 
@@ -743,6 +862,81 @@ payloads_selftest(void)
     parse_c_string(buf, &buf_length, sizeof(buf), "\"\\t\\n\\r\\x1f\\123\"");
     if (memcmp(buf, "\t\n\r\x1f\123", 5) != 0)
         return 1;
+
+    /*
+     * The user's payloads replace the built-in one for the port, are
+     * rotated through on retries, and are found through the index
+     */
+    {
+        struct NmapPayloads *payloads = payloads_create();
+        struct RangeList ports[1];
+        struct Range range[1];
+        const unsigned char *px;
+        unsigned length;
+        unsigned source_port;
+        uint64_t xsum;
+        SET_COOKIE set_cookie;
+        unsigned retry;
+        unsigned x;
+
+        ports->list = range;
+        ports->count = 1;
+        ports->max = 1;
+        range->begin = 161;
+        range->end = 162;
+
+        payload_add(payloads, (const unsigned char*)"one", 3, ports, 0x10000, 0, 0);
+        payload_add(payloads, (const unsigned char*)"two", 3, ports, 0x10000, 0, 0);
+        payload_add(payloads, (const unsigned char*)"one", 3, ports, 0x10000, 0, 0);
+        payload_add(payloads, (const unsigned char*)"three", 5, ports, 0x10000, 0, 0);
+        payloads_reindex(payloads);
+
+        for (retry=0; retry<6; retry++) {
+            static const char *expected[] = {"one", "two", "three"};
+            x = payloads_lookup(payloads, 161, retry, &px, &length,
+                                &source_port, &xsum, &set_cookie);
+            if (!x || set_cookie != 0
+                || length != strlen(expected[retry%3])
+                || memcmp(px, expected[retry%3], length) != 0
+                || xsum != partial_checksum(px, length))
+                goto fail;
+        }
+
+        /* the built-in DNS payload is still there, nothing on port 1 */
+        x = payloads_lookup(payloads, 53, 1, &px, &length,
+                            &source_port, &xsum, &set_cookie);
+        if (!x || set_cookie != dns_set_cookie)
+            goto fail;
+        x = payloads_lookup(payloads, 1, 0, &px, &length,
+                            &source_port, &xsum, &set_cookie);
+        if (x)
+            goto fail;
+
+        /* trimming keeps the index in step with the list */
+        range->begin = Templ_UDP + 162;
+        range->end = Templ_UDP + 162;
+        ports->count = 1;
+        payloads_trim(payloads, ports);
+        if (payloads->count != 3)
+            goto fail;
+        x = payloads_lookup(payloads, 53, 0, &px, &length,
+                            &source_port, &xsum, &set_cookie);
+        if (x)
+            goto fail;
+        x = payloads_lookup(payloads, 162, 4, &px, &length,
+                            &source_port, &xsum, &set_cookie);
+        if (!x || length != 3 || memcmp(px, "two", 3) != 0)
+            goto fail;
+
+        payloads_destroy(payloads);
+        goto success;
+    fail:
+        fprintf(stderr, "payloads: selftest failed\n");
+        payloads_destroy(payloads);
+        return 1;
+    success:
+        ;
+    }
     return 0;
 
         /*
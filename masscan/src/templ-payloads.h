@@ -62,11 +62,15 @@ typedef unsigned (*SET_COOKIE)(unsigned char *px, size_t length,
 
 /**
  * Given a UDP port number, return the payload we have that is associated
- * with that port number.
+ * with that port number. This is a direct lookup in a table indexed by
+ * port, since it's done for every UDP probe we send.
  * @param payloads
  *      A table full over payloadsd.
  * @param port
  *      The input port number.
+ * @param retry
+ *      Which attempt this is at the target, 0 for the first. When a port
+ *      has several payloads, each retry (--retries) sends the next one.
  * @param px
  *      The returned payload bytes.
  * @param length
@@ -84,12 +88,25 @@ int
 payloads_lookup(
                 const struct NmapPayloads *payloads,
                 unsigned port,
+                unsigned retry,
                 const unsigned char **px,
                 unsigned *length,
                 unsigned *source_port,
                 uint64_t *xsum,
                 SET_COOKIE *set_cookie);
 
+/**
+ * Count a response from this UDP port, called by the receive thread.
+ */
+void
+payloads_record_response(struct NmapPayloads *payloads, unsigned port);
+
+/**
+ * Print the number of responses for each port, along with the payloads
+ * we had for that port, at the end of the scan.
+ */
+void
+payloads_print_responses(FILE *fp, const struct NmapPayloads *payloads);
 
 
 #endif
@@ -232,7 +232,33 @@ tcp_checksum2(const unsigned char *px, unsigned offset_ip,
 }
 
 /***************************************************************************
+ * The same, over the IPv6 pseudo-header: the two 16-byte addresses, the
+ * length, and the protocol.
  ***************************************************************************/
+static unsigned
+tcp_checksum_ipv6(const unsigned char *px, unsigned offset_ip,
+                  unsigned offset_tcp, size_t tcp_length)
+{
+    uint64_t xsum = 0;
+    unsigned i;
+
+    xsum = 6;
+    xsum += tcp_length;
+    for (i=8; i<40; i += 2)
+        xsum += px[offset_ip + i] << 8 | px[offset_ip + i + 1];
+
+    for (i=0; i+1<tcp_length; i += 2)
+        xsum += px[offset_tcp + i]<<8 | px[offset_tcp + i + 1];
+    if (tcp_length & 1)
+        xsum += px[offset_tcp + i]<<8;
+
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+
+    return (unsigned)xsum;
+}
+
 /***************************************************************************
  ***************************************************************************/
 static unsigned
@@ -502,37 +528,50 @@ tcp_create_packet(
 }
 
 /***************************************************************************
+ * Append the payload for this port onto the UDP headers already copied
+ * into the packet, returning the new length of the packet, and the
+ * checksum of the payload. The checksum was calculated when the payload
+ * was loaded, and only needs to be redone when we've put a cookie in it.
  ***************************************************************************/
-static void
-udp_payload_fixup(struct TemplatePacket *tmpl, unsigned port, unsigned seqno)
+static unsigned
+udp_payload_fixup(struct TemplatePacket *tmpl, unsigned port, unsigned seqno,
+                  unsigned retry,
+                  unsigned char *px, size_t sizeof_px, uint64_t *r_xsum)
 {
     const unsigned char *px2 = 0;
     unsigned length2 = 0;
     unsigned source_port2 = 0x1000;
     uint64_t xsum2 = 0;
-    unsigned char *px = tmpl->packet;
     SET_COOKIE set_cookie = 0;
 
-    UNUSEDPARM(seqno);
-
     payloads_lookup(tmpl->payloads,
                     port,
+                    retry,
                     &px2,
                     &length2,
                     &source_port2,
                     &xsum2,
                     &set_cookie);
 
+    if (length2 > sizeof_px - tmpl->offset_app) {
+        length2 = (unsigned)(sizeof_px - tmpl->offset_app);
+        set_cookie = 0;
+        xsum2 = icmp_checksum2(px2, 0, length2);
+    }
+
     memcpy( px+tmpl->offset_app,
             px2,
             length2);
 
-    if (set_cookie)
-        xsum2 += set_cookie(px+tmpl->offset_app,
+    if (set_cookie) {
+        set_cookie(px+tmpl->offset_app,
                     length2,
                     seqno);
+        xsum2 = icmp_checksum2(px, tmpl->offset_app, length2);
+    }
 
-    tmpl->length = tmpl->offset_app + length2;
+    *r_xsum = xsum2;
+    return tmpl->offset_app + length2;
 }
 
 
@@ -546,7 +585,7 @@ template_set_target(
     struct TemplateSet *tmplset,
     unsigned ip_them, unsigned port_them,
     unsigned ip_me, unsigned port_me,
-    unsigned seqno,
+    unsigned seqno, unsigned retry,
     unsigned char *px, size_t sizeof_px, size_t *r_length
     )
 {
@@ -556,6 +595,8 @@ template_set_target(
     unsigned ip_id;
     struct TemplatePacket *tmpl = NULL;
     unsigned xsum2;
+    unsigned length;
+    uint64_t payload_xsum = 0;
     uint64_t entropy = tmplset->entropy;
     //unsigned xsum3;
     
@@ -572,7 +613,6 @@ template_set_target(
     else if (port_them < Templ_UDP + 65536) {
         tmpl = &tmplset->pkts[Proto_UDP];
         port_them &= 0xFFFF;
-        udp_payload_fixup(tmpl, port_them, seqno);
     } else if (port_them < Templ_SCTP + 65536) {
         tmpl = &tmplset->pkts[Proto_SCTP];
         port_them &= 0xFFFF;
@@ -602,10 +642,20 @@ template_set_target(
         return;
     }
 
-    /* Create some shorter local variables to work with */
-    if (*r_length > tmpl->length)
-        *r_length = tmpl->length;
-    memcpy(px, tmpl->packet, *r_length);
+    /* Create some shorter local variables to work with. The UDP
+     * template is just the headers: the payload depends upon the port,
+     * and is written straight into the packet rather than the template */
+    if (tmpl->proto == Proto_UDP) {
+        memcpy(px, tmpl->packet, tmpl->offset_app);
+        length = udp_payload_fixup(tmpl, port_them, seqno, retry,
+                                   px, sizeof_px, &payload_xsum);
+        *r_length = length;
+    } else {
+        if (*r_length > tmpl->length)
+            *r_length = tmpl->length;
+        memcpy(px, tmpl->packet, *r_length);
+        length = tmpl->length;
+    }
     offset_ip = tmpl->offset_ip;
     offset_tcp = tmpl->offset_tcp;
     ip_id = ip_them ^ port_them ^ seqno;
@@ -615,7 +665,7 @@ template_set_target(
      * the checksum.
      */
     {
-        unsigned total_length = tmpl->length - tmpl->offset_ip;
+        unsigned total_length = length - tmpl->offset_ip;
         px[offset_ip+2] = (unsigned char)(total_length>>8);
         px[offset_ip+3] = (unsigned char)(total_length>>0);
     }
@@ -643,7 +693,7 @@ template_set_target(
     px[offset_ip+10] = (unsigned char)(0);
     px[offset_ip+11] = (unsigned char)(0);
 
-    xsum2 = (unsigned)~ip_header_checksum(px, offset_ip, tmpl->length);
+    xsum2 = (unsigned)~ip_header_checksum(px, offset_ip, length);
 
 
     /*xsum3 = *(unsigned*)&px[offset_ip+0];
@@ -695,22 +745,21 @@ template_set_target(
         px[offset_tcp+ 1] = (unsigned char)(port_me & 0xFF);
         px[offset_tcp+ 2] = (unsigned char)(port_them >> 8);
         px[offset_tcp+ 3] = (unsigned char)(port_them & 0xFF);
-        px[offset_tcp+ 4] = (unsigned char)((tmpl->length - tmpl->offset_app + 8)>>8);
-        px[offset_tcp+ 5] = (unsigned char)((tmpl->length - tmpl->offset_app + 8)&0xFF);
+        px[offset_tcp+ 4] = (unsigned char)((length - tmpl->offset_app + 8)>>8);
+        px[offset_tcp+ 5] = (unsigned char)((length - tmpl->offset_app + 8)&0xFF);
 
-        px[offset_tcp+6] = (unsigned char)(0);
-        px[offset_tcp+7] = (unsigned char)(0);
-        xsum = udp_checksum2(px, offset_ip, offset_tcp, tmpl->length - offset_tcp);
-        /*xsum += (uint64_t)tmpl->checksum_tcp
+        /* Pseudo-header, UDP header, then the payload's checksum that we
+         * already have, rather than summing the whole packet again */
+        xsum = 17
                 + (uint64_t)ip_me
                 + (uint64_t)ip_them
                 + (uint64_t)port_me
                 + (uint64_t)port_them
-                + (uint64_t)2*(tmpl->length - tmpl->offset_app);
+                + (uint64_t)2*(length - tmpl->offset_app + 8)
+                + payload_xsum;
         xsum = (xsum >> 16) + (xsum & 0xFFFF);
         xsum = (xsum >> 16) + (xsum & 0xFFFF);
         xsum = (xsum >> 16) + (xsum & 0xFFFF);
-        printf("%04x\n", xsum);*/
         xsum = ~xsum;
         px[offset_tcp+6] = (unsigned char)(xsum >>  8);
         px[offset_tcp+7] = (unsigned char)(xsum >>  0);
@@ -726,7 +775,7 @@ template_set_target(
         px[offset_tcp+18] = (unsigned char)(seqno >>  8);
         px[offset_tcp+19] = (unsigned char)(seqno >>  0);
 
-        xsum = sctp_checksum(px + offset_tcp, tmpl->length - offset_tcp);
+        xsum = sctp_checksum(px + offset_tcp, length - offset_tcp);
         px[offset_tcp+ 8] = (unsigned char)(xsum >>  24);
         px[offset_tcp+ 9] = (unsigned char)(xsum >>  16);
         px[offset_tcp+10] = (unsigned char)(xsum >>   8);
@@ -1031,6 +1080,72 @@ template_set_source_port(struct TemplateSet *tmplset, unsigned port)
 
 }
 
+/***************************************************************************
+ * There's no IPv6 template of its own: the IPv4 TCP template already has
+ * the link layer and the TCP header with its options, so we copy those
+ * and put an IPv6 header between them.
+ ***************************************************************************/
+void
+template_set_target_ipv6(
+    struct TemplateSet *tmplset,
+    ipv6address ip_them, unsigned port_them,
+    ipv6address ip_me, unsigned port_me,
+    unsigned seqno,
+    unsigned char *px, size_t sizeof_px, size_t *r_length)
+{
+    const struct TemplatePacket *tmpl = &tmplset->pkts[Proto_TCP];
+    unsigned offset_ip = tmpl->offset_ip;
+    unsigned offset_tcp = offset_ip + 40;
+    unsigned tcp_length = tmpl->length - tmpl->offset_tcp;
+    unsigned xsum;
+    unsigned i;
+
+    *r_length = 0;
+    if (port_them >= Templ_TCP + 65536 || offset_tcp + tcp_length > sizeof_px)
+        return;
+
+    /* link layer, now with the IPv6 EtherType */
+    memcpy(px, tmpl->packet, offset_ip);
+    if (offset_ip >= 14) {
+        px[offset_ip-2] = 0x86;
+        px[offset_ip-1] = 0xdd;
+    }
+
+    /* IPv6 header, with the hop limit from --ttl */
+    px[offset_ip+0] = 0x60;
+    px[offset_ip+1] = 0;
+    px[offset_ip+2] = 0;
+    px[offset_ip+3] = 0;
+    px[offset_ip+4] = (unsigned char)(tcp_length >> 8);
+    px[offset_ip+5] = (unsigned char)(tcp_length & 0xFF);
+    px[offset_ip+6] = 6; /* next header = TCP */
+    px[offset_ip+7] = tmpl->packet[tmpl->offset_ip + 8];
+    for (i=0; i<8; i++) {
+        px[offset_ip+ 8+i] = (unsigned char)(ip_me.hi >> (56 - 8*i));
+        px[offset_ip+16+i] = (unsigned char)(ip_me.lo >> (56 - 8*i));
+        px[offset_ip+24+i] = (unsigned char)(ip_them.hi >> (56 - 8*i));
+        px[offset_ip+32+i] = (unsigned char)(ip_them.lo >> (56 - 8*i));
+    }
+
+    /* TCP header */
+    memcpy(px + offset_tcp, tmpl->packet + tmpl->offset_tcp, tcp_length);
+    px[offset_tcp+ 0] = (unsigned char)(port_me >> 8);
+    px[offset_tcp+ 1] = (unsigned char)(port_me & 0xFF);
+    px[offset_tcp+ 2] = (unsigned char)(port_them >> 8);
+    px[offset_tcp+ 3] = (unsigned char)(port_them & 0xFF);
+    px[offset_tcp+ 4] = (unsigned char)(seqno >> 24);
+    px[offset_tcp+ 5] = (unsigned char)(seqno >> 16);
+    px[offset_tcp+ 6] = (unsigned char)(seqno >>  8);
+    px[offset_tcp+ 7] = (unsigned char)(seqno >>  0);
+    px[offset_tcp+16] = 0;
+    px[offset_tcp+17] = 0;
+    xsum = ~tcp_checksum_ipv6(px, offset_ip, offset_tcp, tcp_length);
+    px[offset_tcp+16] = (unsigned char)(xsum >>  8);
+    px[offset_tcp+17] = (unsigned char)(xsum >>  0);
+
+    *r_length = offset_tcp + tcp_length;
+}
+
 /***************************************************************************
  * Overwrites the TTL of the packet
  ***************************************************************************/
@@ -1107,6 +1222,66 @@ template_selftest(void)
     //failures += tmplset->pkts[Proto_ICMP_timestamp].proto != Proto_ICMP_timestamp;
     //failures += tmplset->pkts[Proto_ARP].proto  != Proto_ARP;
 
+    /*
+     * UDP checksums are built from the payload's checksum rather than
+     * summing the packet, so check them against the slow way, with and
+     * without cookies, on odd and even lengths
+     */
+    {
+        static const unsigned ports[] = {53, 123, 161, 1900, 11211, 7, 0};
+        struct NmapPayloads *payloads = payloads_create();
+        unsigned i;
+        unsigned retry;
+
+        tmplset->pkts[Proto_UDP].payloads = payloads;
+        for (i=0; ports[i]; i++)
+        for (retry=0; retry<2; retry++) {
+            const struct TemplatePacket *tmpl = &tmplset->pkts[Proto_UDP];
+            unsigned char px[2048];
+            size_t length;
+
+            template_set_target(tmplset, 0x0A010203, Templ_UDP + ports[i],
+                                0xC0A80001, 40000 + i,
+                                0x12345678 + i, retry,
+                                px, sizeof(px), &length);
+            if (length < tmpl->offset_app) {
+                failures++;
+                continue;
+            }
+            if (udp_checksum2(px, tmpl->offset_ip, tmpl->offset_tcp,
+                              length - tmpl->offset_tcp) != 0xFFFF)
+                failures++;
+        }
+        tmplset->pkts[Proto_UDP].payloads = 0;
+        payloads_destroy(payloads);
+    }
+
+    /*
+     * IPv6 SYNs are built from the IPv4 template
+     */
+    {
+        unsigned char px[2048];
+        size_t length;
+        ipv6address them;
+        ipv6address me;
+
+        them.hi = 0x20010db800000000ULL;
+        them.lo = 0x1;
+        me.hi = 0x20010db8FFFF0000ULL;
+        me.lo = 0xFFFFFFFF00000002ULL;
+        template_set_target_ipv6(tmplset, them, 443, me, 40000, 0x12345678,
+                                 px, sizeof(px), &length);
+        if (length != 14 + 40 + tmplset->pkts[Proto_TCP].length - 34 || px[12] != 0x86 || px[13] != 0xdd
+                || px[14] != 0x60 || px[20] != 6 || px[14+40+3] != (443&0xFF))
+            failures++;
+        else if (tcp_checksum_ipv6(px, 14, 14+40, length - 14 - 40) != 0xFFFF)
+            failures++;
+        template_set_target_ipv6(tmplset, them, Templ_UDP + 53, me, 40000, 0,
+                                 px, sizeof(px), &length);
+        if (length != 0)
+            failures++;
+    }
+
     if (failures)
         fprintf(stderr, "template: failed\n");
     return failures;
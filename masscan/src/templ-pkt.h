@@ -2,6 +2,7 @@
 #define TCP_PACKET_H
 #include <stdio.h>
 #include <stdint.h>
+#include "ranges6.h"
 struct NmapPayloads;
 struct MassScript;
 
@@ -129,12 +130,28 @@ template_packet_init(
  *      will create from SYN-cookies. Other protocols may use this in a
  *      different manner. For example, if the UDP port is 161, then
  *      this will be the transaction ID of the SNMP request template.
+ * @param retry
+ *      Which attempt this is at the target (--retries), 0 for the first.
+ *      UDP ports with several payloads send a different one each time.
  */
 void
 template_set_target(
     struct TemplateSet *templset,
     unsigned ip_them, unsigned port_them,
     unsigned ip_me, unsigned port_me,
+    unsigned seqno, unsigned retry,
+    unsigned char *px, size_t sizeof_px, size_t *r_length);
+
+
+/**
+ * Create a TCP SYN to an IPv6 target. Only TCP is supported for IPv6, so
+ * for any other kind of port, this sets '*r_length' to zero.
+ */
+void
+template_set_target_ipv6(
+    struct TemplateSet *templset,
+    ipv6address ip_them, unsigned port_them,
+    ipv6address ip_me, unsigned port_me,
     unsigned seqno,
     unsigned char *px, size_t sizeof_px, size_t *r_length);
 
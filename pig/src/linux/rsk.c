@@ -5,6 +5,7 @@
  * the terms of the GNU General Public License version 2.
  *
  */
+#define _GNU_SOURCE
 #include "rsk.h"
 #include <unistd.h>
 #include <sys/types.h>
@@ -16,6 +17,8 @@
 #include <net/if.h>
 #include <sys/ioctl.h>
 
+#define LIN_RSK_MMSG_NR 64
+
 static int get_iface_index(const char *iface);
 
 static int get_iface_index(const char *iface) {
@@ -74,6 +77,36 @@ int lin_rsk_sendto(const unsigned char *buffer, size_t buffer_size, const int so
     return sendto(sockfd, buffer, buffer_size, 0, NULL, 0);
 }
 
+int lin_rsk_sendmmsg(const unsigned char **buffers, const size_t *buffers_size, const size_t buffers_nr, const int sockfd) {
+    struct mmsghdr msgs[LIN_RSK_MMSG_NR];
+    struct iovec iovs[LIN_RSK_MMSG_NR];
+    size_t b = 0, m = 0, m_nr = 0;
+    int sent_nr = 0, retval = 0;
+    //  INFO(Santiago): the frames are pushed to the kernel in chunks, one syscall per chunk instead of one per frame.
+    while (b < buffers_nr) {
+        m_nr = buffers_nr - b;
+        if (m_nr > LIN_RSK_MMSG_NR) {
+            m_nr = LIN_RSK_MMSG_NR;
+        }
+        memset(msgs, 0, sizeof(msgs[0]) * m_nr);
+        for (m = 0; m < m_nr; m++) {
+            iovs[m].iov_base = (void *)buffers[b + m];
+            iovs[m].iov_len = buffers_size[b + m];
+            msgs[m].msg_hdr.msg_iov = &iovs[m];
+            msgs[m].msg_hdr.msg_iovlen = 1;
+        }
+        sent_nr = sendmmsg(sockfd, msgs, m_nr, 0);
+        if (sent_nr <= 0) {
+            //  WARN(Santiago): the frame at the head of the chunk was refused, let us skip it and keep going.
+            b++;
+            continue;
+        }
+        retval += sent_nr;
+        b += sent_nr;
+    }
+    return retval;
+}
+
 int lin_rsk_lo_sendto(const unsigned char *buffer, size_t buffer_size, const int sockfd) {
     struct sockaddr_in sk_in = { 0 };
     unsigned int ipv4_addr = 0;
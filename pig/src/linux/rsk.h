@@ -18,6 +18,8 @@ void lin_rsk_close(const int sockfd);
 
 int lin_rsk_sendto(const unsigned char *buffer, size_t buffer_size, const int sockfd);
 
+int lin_rsk_sendmmsg(const unsigned char **buffers, const size_t *buffers_size, const size_t buffers_nr, const int sockfd);
+
 int lin_rsk_lo_sendto(const unsigned char *buffer, size_t buffer_size, const int sockfd);
 
 #endif
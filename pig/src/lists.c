@@ -11,6 +11,7 @@
 #include "to_ipv4.h"
 #include "mkrnd.h"
 #include "strglob.h"
+#include "pkttmpl.h"
 #include <string.h>
 
 static pigsty_conf_set_ctx *get_pigsty_conf_set_tail(pigsty_conf_set_ctx *conf);
@@ -46,6 +47,7 @@ void del_pigsty_entry(pigsty_entry_ctx *entries) {
     for (t = p = entries; t; p = t) {
         t = p->next;
         del_pigsty_conf_set(p->conf);
+        del_pkt_template(p->tmpl);
         free(p);
     }
 }
@@ -144,6 +146,23 @@ const pigsty_entry_ctx *get_pigsty_entry_by_index(const size_t index, const pigs
     return NULL;
 }
 
+const pigsty_entry_ctx **mk_pigsty_entry_array(const pigsty_entry_ctx *entries, size_t *entries_nr) {
+    const pigsty_entry_ctx **array = NULL;
+    const pigsty_entry_ctx *ep = NULL;
+    size_t e = 0, count = get_pigsty_entry_count(entries);
+    if (entries_nr != NULL) {
+        *entries_nr = count;
+    }
+    if (count == 0) {
+        return NULL;
+    }
+    array = (const pigsty_entry_ctx **) pig_newseg(sizeof(pigsty_entry_ctx *) * count);
+    for (ep = entries; ep != NULL; ep = ep->next) {
+        array[e++] = ep;
+    }
+    return array;
+}
+
 void del_pig_target_addr(pig_target_addr_ctx *addrs) {
     pig_target_addr_ctx *t, *p;
     for (t = p = addrs; t; p = t) {
@@ -11,7 +11,7 @@
 #include "types.h"
 
 #define new_pigsty_entry(p) ( (p) = (pigsty_entry_ctx *) pig_newseg(sizeof(pigsty_entry_ctx)),\
-                             (p)->next = NULL, (p)->conf = NULL, (p)->signature_name = NULL )
+                             (p)->next = NULL, (p)->conf = NULL, (p)->signature_name = NULL, (p)->tmpl = NULL )
 
 #define new_pigsty_conf_set(c) ( (c) = (pigsty_conf_set_ctx *) pig_newseg(sizeof(pigsty_conf_set_ctx)),\
                                     (c)->next = NULL, (c)->field = (pigsty_field_ctx *) pig_newseg(sizeof(pigsty_field_ctx)), (c)->field->data = NULL, (c)->field->index = kUnk )
@@ -46,6 +46,8 @@ size_t get_pigsty_entry_count(const pigsty_entry_ctx *entries);
 
 const pigsty_entry_ctx *get_pigsty_entry_by_index(const size_t index, const pigsty_entry_ctx *entries);
 
+const pigsty_entry_ctx **mk_pigsty_entry_array(const pigsty_entry_ctx *entries, size_t *entries_nr);
+
 void del_pig_target_addr(pig_target_addr_ctx *addrs);
 
 pig_target_addr_ctx *add_target_addr_to_pig_target_addr(pig_target_addr_ctx *addrs, const char *range);
@@ -0,0 +1,105 @@
+/*
+ *                                Copyright (C) 2017 by Rafael Santiago
+ *
+ * This is a free software. You can redistribute it and/or modify under
+ * the terms of the GNU General Public License version 2.
+ *
+ */
+#include "netif.h"
+#include "if.h"
+#include "sock.h"
+#include "lists.h"
+#include "memory.h"
+#include <arpa/inet.h>
+#include <string.h>
+
+//  INFO(Santiago): Everything that used to be looked up again and again for each sent packet and that only depends
+//                  on the local interface lives here: its ip address, the loopback raw socket and the resolved
+//                  MAC addresses (a hash table of small pig_hwaddr_ctx chains instead of one long list).
+
+static size_t get_hwaddr_bucket(const unsigned int nt_addr[4]);
+
+static size_t get_hwaddr_bucket(const unsigned int nt_addr[4]) {
+    unsigned int h = nt_addr[0] ^ nt_addr[1] ^ nt_addr[2] ^ nt_addr[3];
+    h *= 0x9e3779b1;
+    return (h >> 22) % PIG_NETIF_HWADDR_BUCKETS_NR;
+}
+
+pig_netif_ctx *mk_pig_netif(const char *iface) {
+    pig_netif_ctx *netif = NULL;
+    char *temp = NULL;
+
+    netif = (pig_netif_ctx *) pig_newseg(sizeof(pig_netif_ctx));
+    memset(netif, 0, sizeof(pig_netif_ctx));
+    netif->sockfd_lo = -1;
+
+    if (iface == NULL) {
+        return netif;
+    }
+
+    netif->iface = (char *) pig_newseg(strlen(iface) + 1);
+    strcpy(netif->iface, iface);
+
+    temp = get_iface_ip(iface);
+    if (temp != NULL) {
+        if (*temp != 0) {
+            //  WARN(Santiago): until now IPv4 only.
+            netif->lo_addr[0] = htonl(inet_addr(temp));
+        }
+        free(temp);
+    }
+
+    return netif;
+}
+
+void del_pig_netif(pig_netif_ctx *netif) {
+    size_t b = 0;
+
+    if (netif == NULL) {
+        return;
+    }
+
+    for (b = 0; b < PIG_NETIF_HWADDR_BUCKETS_NR; b++) {
+        del_pig_hwaddr(netif->hwaddr[b]);
+    }
+
+    if (netif->sockfd_lo != -1) {
+        deinit_raw_socket(netif->sockfd_lo);
+    }
+
+    free(netif->iface);
+    free(netif);
+}
+
+int get_pig_netif_lo_socket(pig_netif_ctx *netif) {
+    if (netif == NULL) {
+        return -1;
+    }
+    if (netif->sockfd_lo == -1) {
+        netif->sockfd_lo = init_loopback_raw_socket();
+    }
+    return netif->sockfd_lo;
+}
+
+unsigned char *get_pig_netif_hwaddr(const pig_netif_ctx *netif, const unsigned int nt_addr[4]) {
+    if (netif == NULL) {
+        return NULL;
+    }
+    return get_ph_addr_from_pig_hwaddr(nt_addr, netif->hwaddr[get_hwaddr_bucket(nt_addr)]);
+}
+
+unsigned char *add_pig_netif_hwaddr(pig_netif_ctx *netif, const unsigned char ph_addr[6], const unsigned int nt_addr[4], const int version) {
+    pig_hwaddr_ctx *hwaddr = NULL;
+    size_t b = 0;
+
+    if (netif == NULL || ph_addr == NULL) {
+        return NULL;
+    }
+
+    b = get_hwaddr_bucket(nt_addr);
+    hwaddr = add_hwaddr_to_pig_hwaddr(NULL, ph_addr, nt_addr, version);
+    hwaddr->next = netif->hwaddr[b];
+    netif->hwaddr[b] = hwaddr;
+
+    return &hwaddr->ph_addr[0];
+}
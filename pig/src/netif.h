@@ -0,0 +1,23 @@
+/*
+ *                                Copyright (C) 2017 by Rafael Santiago
+ *
+ * This is a free software. You can redistribute it and/or modify under
+ * the terms of the GNU General Public License version 2.
+ *
+ */
+#ifndef PIG_NETIF_H
+#define PIG_NETIF_H 1
+
+#include "types.h"
+
+pig_netif_ctx *mk_pig_netif(const char *iface);
+
+void del_pig_netif(pig_netif_ctx *netif);
+
+int get_pig_netif_lo_socket(pig_netif_ctx *netif);
+
+unsigned char *get_pig_netif_hwaddr(const pig_netif_ctx *netif, const unsigned int nt_addr[4]);
+
+unsigned char *add_pig_netif_hwaddr(pig_netif_ctx *netif, const unsigned char ph_addr[6], const unsigned int nt_addr[4], const int version);
+
+#endif
@@ -11,10 +11,11 @@
 #include "eth.h"
 #include "arp.h"
 #include "ip.h"
-#include "if.h"
 #include "lists.h"
 #include "pigsty.h"
 #include "options.h"
+#include "pkttmpl.h"
+#include "netif.h"
 #include "linux/native_arp.h"
 #include <string.h>
 #include <arpa/inet.h>
@@ -23,14 +24,16 @@
 
 #define pig_get_net_mask_from_addr(a, m) ( ( (a) & (m) ) )
 
-static void fill_up_mac_addresses_by_ipinfo(struct ethernet_frame *eth, const struct ip4 iph, pig_hwaddr_ctx **hwaddr, const unsigned char *gw_hwaddr, const unsigned int nt_mask[4], const char *loiface, pigsty_conf_set_ctx *conf);
+static void fill_up_mac_addresses_by_ipinfo(struct ethernet_frame *eth, const struct ip4 iph, pig_netif_ctx *netif, const unsigned char *gw_hwaddr, const unsigned int nt_mask[4], pigsty_conf_set_ctx *conf);
 
 static void fill_up_mac_addresses_by_arpinfo(struct ethernet_frame *eth, const struct arp *arph, pigsty_conf_set_ctx *conf);
 
-static int should_route(const unsigned int addr[4], const unsigned int nt_mask[4], const char *loiface);
+static int should_route(const unsigned int addr[4], const unsigned int nt_mask[4], const unsigned int lo_addr[4]);
 
 static int is_lopkt(const unsigned char *datagram, const size_t datagram_sz);
 
+static int oink_tmpl(const pigsty_entry_ctx *signature, pig_netif_ctx *netif, const pig_target_addr_ctx *addrs, const int sockfd, const unsigned char *gw_hwaddr, const unsigned int nt_mask[4]);
+
 static int is_lopkt(const unsigned char *datagram, const size_t datagram_sz) {
     int retval = 0;
     unsigned int ip4_addr = 0;
@@ -58,29 +61,16 @@ static int is_lopkt(const unsigned char *datagram, const size_t datagram_sz) {
     return retval;
 }
 
-static int should_route(const unsigned int addr[4], const unsigned int nt_mask[4], const char *loiface) {
-    static unsigned int lo_addr[4] = { 0, 0, 0, 0 };
-    char *temp = NULL;
-    if (lo_addr[0] == 0 && lo_addr[1] == 0 && lo_addr[2] == 0 && lo_addr[3] == 0) {
-        temp = get_iface_ip(loiface);
-        if (temp != NULL) {
-            if (*temp != 0) {
-                //  WARN(Santiago): until now IPv4 only.
-                lo_addr[0] = htonl(inet_addr(temp));
-            }
-            free(temp);
-        }
-    }
+static int should_route(const unsigned int addr[4], const unsigned int nt_mask[4], const unsigned int lo_addr[4]) {
     return !((pig_get_net_mask_from_addr(addr[0], nt_mask[0]) == pig_get_net_mask_from_addr(lo_addr[0], nt_mask[0])) &&
              (pig_get_net_mask_from_addr(addr[1], nt_mask[1]) == pig_get_net_mask_from_addr(lo_addr[1], nt_mask[1])) &&
              (pig_get_net_mask_from_addr(addr[2], nt_mask[2]) == pig_get_net_mask_from_addr(lo_addr[2], nt_mask[2])) &&
              (pig_get_net_mask_from_addr(addr[3], nt_mask[3]) == pig_get_net_mask_from_addr(lo_addr[3], nt_mask[3])));
 }
 
-static void fill_up_mac_addresses_by_ipinfo(struct ethernet_frame *eth, const struct ip4 iph, pig_hwaddr_ctx **hwaddr, const unsigned char *gw_hwaddr, const unsigned int nt_mask[4], const char *loiface, pigsty_conf_set_ctx *conf) {
+static void fill_up_mac_addresses_by_ipinfo(struct ethernet_frame *eth, const struct ip4 iph, pig_netif_ctx *netif, const unsigned char *gw_hwaddr, const unsigned int nt_mask[4], pigsty_conf_set_ctx *conf) {
     unsigned int nt_addr[4] = { 0, 0, 0, 0 };
-    pig_hwaddr_ctx *hwa_p = (*hwaddr);
-    unsigned char *mac = NULL;
+    unsigned char *mac = NULL, *resolved = NULL;
     char *temp = NULL;
     in_addr_t addr;
     pigsty_field_ctx *fp = NULL;
@@ -92,20 +82,16 @@ static void fill_up_mac_addresses_by_ipinfo(struct ethernet_frame *eth, const st
 
     if (fp == NULL) {
         nt_addr[0] = iph.src;
-        if (!should_route(nt_addr, nt_mask, loiface)) {
-            mac = get_ph_addr_from_pig_hwaddr(nt_addr, hwa_p);
+        if (!should_route(nt_addr, nt_mask, netif->lo_addr)) {
+            mac = get_pig_netif_hwaddr(netif, nt_addr);
             if (mac == NULL) {
                 addr = htonl(iph.src);
-                temp = get_mac_by_addr(addr, loiface, PIG_ARP_TRIES_NR);
+                temp = get_mac_by_addr(addr, netif->iface, PIG_ARP_TRIES_NR);
                 if (temp != NULL) {
-                    mac = mac2byte(temp, strlen(temp));
+                    resolved = mac2byte(temp, strlen(temp));
                     free(temp);
-                    hwa_p = add_hwaddr_to_pig_hwaddr(hwa_p, mac, nt_addr, 4);
-                    free(mac);
-                    hwa_p = get_pig_hwaddr_tail(hwa_p);
-                    if (hwa_p != NULL) {
-                        mac = &hwa_p->ph_addr[0];
-                    }
+                    mac = add_pig_netif_hwaddr(netif, resolved, nt_addr, 4);
+                    free(resolved);
                 }
             }
         }
@@ -128,20 +114,16 @@ static void fill_up_mac_addresses_by_ipinfo(struct ethernet_frame *eth, const st
 
     if (fp == NULL) {
         nt_addr[0] = iph.dst;
-        if (!should_route(nt_addr, nt_mask, loiface)) {
-            mac = get_ph_addr_from_pig_hwaddr(nt_addr, hwa_p);
+        if (!should_route(nt_addr, nt_mask, netif->lo_addr)) {
+            mac = get_pig_netif_hwaddr(netif, nt_addr);
             if (mac == NULL) {
                 addr = htonl(iph.dst);
-                temp = get_mac_by_addr(addr, loiface, PIG_ARP_TRIES_NR);
+                temp = get_mac_by_addr(addr, netif->iface, PIG_ARP_TRIES_NR);
                 if (temp != NULL) {
-                    mac = mac2byte(temp, strlen((char *)temp));
+                    resolved = mac2byte(temp, strlen((char *)temp));
                     free(temp);
-                    hwa_p = add_hwaddr_to_pig_hwaddr(hwa_p, mac, nt_addr, 4);
-                    free(mac);
-                    hwa_p = get_pig_hwaddr_tail(hwa_p);
-                    if (hwa_p != NULL) {
-                        mac = &hwa_p->ph_addr[0];
-                    }
+                    mac = add_pig_netif_hwaddr(netif, resolved, nt_addr, 4);
+                    free(resolved);
                 }
             }
         }
@@ -189,7 +171,7 @@ static void fill_up_mac_addresses_by_arpinfo(struct ethernet_frame *eth, const s
     memcpy(eth->dest_hw_addr, (dst != NULL) ? dst : arph->dest_hw_addr, 6);
 }
 
-int oink(const pigsty_entry_ctx *signature, pig_hwaddr_ctx **hwaddr, const pig_target_addr_ctx *addrs, const int sockfd, const unsigned char *gw_hwaddr, const unsigned int nt_mask[4], const char *loiface) {
+int oink(const pigsty_entry_ctx *signature, pig_netif_ctx *netif, const pig_target_addr_ctx *addrs, const int sockfd, const unsigned char *gw_hwaddr, const unsigned int nt_mask[4]) {
     unsigned char *packet = NULL;
     struct ethernet_frame eth;
     struct ip4 iph, *iph_p = &iph;
@@ -200,6 +182,10 @@ int oink(const pigsty_entry_ctx *signature, pig_hwaddr_ctx **hwaddr, const pig_t
     int sockfd_lo = -1;
     pigsty_field_ctx *fp = NULL;
 
+    if (signature->tmpl != NULL) {
+        return oink_tmpl(signature, netif, addrs, sockfd, gw_hwaddr, nt_mask);
+    }
+
     eth.payload = mk_pkt(signature->conf, (pig_target_addr_ctx *)addrs, &eth.payload_size);
     is_lo = (gw_hwaddr == NULL && is_lopkt(eth.payload, eth.payload_size));
     if (is_arp_packet(signature->conf)) {
@@ -240,7 +226,7 @@ int oink(const pigsty_entry_ctx *signature, pig_hwaddr_ctx **hwaddr, const pig_t
                 eth.ether_type = *(unsigned short *)fp->data;
             }
 
-            fill_up_mac_addresses_by_ipinfo(&eth, iph, hwaddr, gw_hwaddr, nt_mask, loiface, signature->conf);
+            fill_up_mac_addresses_by_ipinfo(&eth, iph, netif, gw_hwaddr, nt_mask, signature->conf);
 
             if (iph.payload != NULL) {
                 free(iph.payload);
@@ -254,13 +240,81 @@ int oink(const pigsty_entry_ctx *signature, pig_hwaddr_ctx **hwaddr, const pig_t
                 free(packet);
             }
         } else {
-            sockfd_lo = init_loopback_raw_socket();
+            sockfd_lo = get_pig_netif_lo_socket(netif);
             if (sockfd_lo != -1) {
                 retval = inject_lo(eth.payload, eth.payload_size, sockfd_lo);
-                deinit_raw_socket(sockfd_lo);
             }
             free(eth.payload);
         }
     }
     return retval;
 }
+
+static int oink_tmpl(const pigsty_entry_ctx *signature, pig_netif_ctx *netif, const pig_target_addr_ctx *addrs, const int sockfd, const unsigned char *gw_hwaddr, const unsigned int nt_mask[4]) {
+    pig_pkt_template_ctx *tmpl = signature->tmpl;
+    int retval = -1;
+    int sockfd_lo = -1;
+
+    switch (mk_oink_frame(tmpl, signature->conf, netif, addrs, gw_hwaddr, nt_mask)) {
+        case PIG_OINK_FRAME_ETH:
+            retval = inject(tmpl->frame, tmpl->frame_size, sockfd);
+            break;
+
+        case PIG_OINK_FRAME_LO:
+            sockfd_lo = get_pig_netif_lo_socket(netif);
+            if (sockfd_lo != -1) {
+                retval = inject_lo(tmpl->dgram, tmpl->dgram_size, sockfd_lo);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return retval;
+}
+
+int mk_oink_frame(pig_pkt_template_ctx *tmpl, pigsty_conf_set_ctx *conf, pig_netif_ctx *netif, const pig_target_addr_ctx *addrs, const unsigned char *gw_hwaddr, const unsigned int nt_mask[4]) {
+    struct ethernet_frame eth;
+    struct ip4 iph;
+    struct arp *arph = NULL;
+
+    if (tmpl == NULL) {
+        return -1;
+    }
+
+    render_pkt_template(tmpl, (pig_target_addr_ctx *)addrs);
+
+    if (gw_hwaddr == NULL && is_lopkt(tmpl->dgram, tmpl->dgram_size)) {
+        return (tmpl->is_arp) ? -1 : PIG_OINK_FRAME_LO;
+    }
+
+    //  INFO(Santiago): the MAC addresses only need to be resolved again when the ip addresses are random.
+    if (!tmpl->mac_ready) {
+        memset(&eth, 0, sizeof(eth));
+        if (tmpl->is_arp) {
+            arph = parse_arp_dgram(tmpl->dgram, tmpl->dgram_size);
+            fill_up_mac_addresses_by_arpinfo(&eth, arph, conf);
+            if (arph != NULL) {
+                arp_header_free(arph);
+                free(arph);
+            }
+        } else {
+            memset(&iph, 0, sizeof(iph));
+            iph.src = (((unsigned int)tmpl->dgram[12]) << 24) |
+                      (((unsigned int)tmpl->dgram[13]) << 16) |
+                      (((unsigned int)tmpl->dgram[14]) <<  8) |
+                      ((unsigned int)tmpl->dgram[15]);
+            iph.dst = (((unsigned int)tmpl->dgram[16]) << 24) |
+                      (((unsigned int)tmpl->dgram[17]) << 16) |
+                      (((unsigned int)tmpl->dgram[18]) <<  8) |
+                      ((unsigned int)tmpl->dgram[19]);
+            fill_up_mac_addresses_by_ipinfo(&eth, iph, netif, gw_hwaddr, nt_mask, conf);
+        }
+        memcpy(&tmpl->frame[0], eth.dest_hw_addr, sizeof(eth.dest_hw_addr));
+        memcpy(&tmpl->frame[6], eth.src_hw_addr, sizeof(eth.src_hw_addr));
+        tmpl->mac_ready = !tmpl->has_rnd_addr;
+    }
+
+    return PIG_OINK_FRAME_ETH;
+}
@@ -10,6 +10,12 @@
 
 #include "types.h"
 
-int oink(const pigsty_entry_ctx *signature, pig_hwaddr_ctx **hwaddr, const pig_target_addr_ctx *addrs, const int sockfd, const unsigned char *gw_hwaddr, const unsigned int nt_mask[4], const char *loiface);
+#define PIG_OINK_FRAME_LO  0
+
+#define PIG_OINK_FRAME_ETH 1
+
+int oink(const pigsty_entry_ctx *signature, pig_netif_ctx *netif, const pig_target_addr_ctx *addrs, const int sockfd, const unsigned char *gw_hwaddr, const unsigned int nt_mask[4]);
+
+int mk_oink_frame(pig_pkt_template_ctx *tmpl, pigsty_conf_set_ctx *conf, pig_netif_ctx *netif, const pig_target_addr_ctx *addrs, const unsigned char *gw_hwaddr, const unsigned int nt_mask[4]);
 
 #endif
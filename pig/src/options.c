@@ -19,7 +19,7 @@ void register_options(const int argc, char **argv) {
 }
 
 char *get_option(const char *option, char *default_value) {
-    static char retval[8192] = "";
+    static __thread char retval[8192] = "";
     int a;
     char temp[8192] = "";
 
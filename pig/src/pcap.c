@@ -9,6 +9,32 @@
 #include "memory.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define PCAP_MAGIC_USEC         0xa1b2c3d4
+
+#define PCAP_MAGIC_NSEC         0xa1b23c4d
+
+#define PCAPNG_BLOCK_SHB        0x0a0d0d0a
+
+#define PCAPNG_BLOCK_IDB        0x00000001
+
+#define PCAPNG_BLOCK_OPB        0x00000002
+
+#define PCAPNG_BLOCK_SPB        0x00000003
+
+#define PCAPNG_BLOCK_EPB        0x00000006
+
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+
+#define PCAPNG_OPT_IF_TSRESOL   9
+
+#define PCAP_DEFAULT_TSRESOL    1000000ULL
 
 #define new_pcap_record_ctx(p) ( (p) = (pcap_record_ctx *) pig_newseg(sizeof(pcap_record_ctx)),\
                                  (p)->next = NULL, (p)->data = NULL, memset(&(p)->hdr, 0, sizeof(pcap_record_header_t)) )
@@ -17,13 +43,24 @@
 #define new_pcap_file_ctx(p) ( (p) = (pcap_file_ctx *) pig_newseg(sizeof(pcap_file_ctx)),\
                                (p)->path = NULL, (p)->rec = NULL, memset(&(p)->hdr, 0, sizeof(pcap_file_ctx)) )
 
-static pcap_record_ctx *get_pcap_record_ctx_tail(pcap_record_ctx *recs);
+static pcap_record_ctx *add_record_to_pcap_record_ctx(pcap_record_ctx *tail, const pcap_record_ctx *record);
 
-static pcap_file_ctx *ld_records_from_pcap_file(pcap_file_ctx *file);
+static unsigned int pcap_stream_u32(const pcap_stream_ctx *stream, const unsigned char *p);
 
-static pcap_file_ctx *get_pcap_file_global_info(const char *filepath);
+static unsigned short pcap_stream_u16(const pcap_stream_ctx *stream, const unsigned char *p);
 
-static pcap_record_ctx *add_record_to_pcap_record_ctx(pcap_record_ctx *recs, pcap_record_header_t hdr, unsigned char *pkt_data);
+static int ld_pcap_stream_global_info(pcap_stream_ctx *stream);
+
+static int next_pcap_record(pcap_stream_ctx *stream, pcap_record_ctx *record);
+
+static int next_pcapng_record(pcap_stream_ctx *stream, pcap_record_ctx *record);
+
+static int ld_pcapng_section_header(pcap_stream_ctx *stream, const unsigned char *block, const size_t block_size);
+
+static void ld_pcapng_interface(pcap_stream_ctx *stream, const unsigned char *block, const size_t block_size);
+
+static void set_pcap_stream_record_ts(const pcap_stream_ctx *stream, pcap_record_ctx *record,
+                                      const unsigned int if_id, const unsigned long long ts);
 
 static void del_pcap_file_ctx(pcap_file_ctx *file);
 
@@ -35,89 +72,400 @@ static void del_pcap_file_ctx(pcap_file_ctx *file) {
     }
     free(file->path);
     del_pcap_record_ctx(file->rec);
+    free(file);
 }
 
 pcap_file_ctx *ld_pcap_file(const char *filepath) {
-    return ld_records_from_pcap_file(get_pcap_file_global_info(filepath));
+    pcap_stream_ctx *stream = NULL;
+    pcap_file_ctx *file = NULL;
+    pcap_record_ctx record, *tail = NULL;
+    size_t pathsize = 0;
+
+    if ((stream = open_pcap_stream(filepath)) == NULL) {
+        return NULL;
+    }
+
+    new_pcap_file_ctx(file);
+    pathsize = strlen(filepath);
+    file->path = (char *) pig_newseg(pathsize + 1);
+    memset(file->path, 0, pathsize + 1);
+    strncpy(file->path, filepath, pathsize);
+
+    //  INFO(Santiago): The tail is tracked here, walking the list on each append made the loading O(n^2).
+    while (next_pcap_stream_record(stream, &record)) {
+        tail = add_record_to_pcap_record_ctx(tail, &record);
+        if (file->rec == NULL) {
+            file->rec = tail;
+        }
+    }
+
+    file->hdr = stream->hdr;
+
+    close_pcap_stream(stream);
+
+    return file;
 }
 
 void close_pcap_file(pcap_file_ctx *file) {
     del_pcap_file_ctx(file);
 }
 
-static pcap_file_ctx *get_pcap_file_global_info(const char *filepath) {
-    FILE *fp = NULL;
-    pcap_file_ctx *file = NULL;
-    size_t pathsize = 0;
+static pcap_record_ctx *add_record_to_pcap_record_ctx(pcap_record_ctx *tail, const pcap_record_ctx *record) {
+    pcap_record_ctx *p = NULL;
+    if (record == NULL || record->data == NULL) {
+        return tail;
+    }
+    new_pcap_record_ctx(p);
+    if (tail != NULL) {
+        tail->next = p;
+    }
+    p->hdr = record->hdr;
+    p->data = (unsigned char *) pig_newseg(p->hdr.incl_len + 1);
+    memset(p->data, 0, p->hdr.incl_len + 1);
+    memcpy(p->data, record->data, p->hdr.incl_len);
+    return p;
+}
+
+pcap_stream_ctx *open_pcap_stream(const char *filepath) {
+    pcap_stream_ctx *stream = NULL;
+    struct stat st;
+    int fd = -1;
+    void *data = NULL;
+
     if (filepath == NULL) {
         return NULL;
     }
-    fp = fopen(filepath, "rb");
-    if (fp == NULL) {
+
+    if ((fd = open(filepath, O_RDONLY)) == -1) {
         return NULL;
     }
-    new_pcap_file_ctx(file);
-    pathsize = strlen(filepath);
-    file->path = (char *) pig_newseg(pathsize + 1);
-    memset(file->path, 0, pathsize + 1);
-    strncpy(file->path, filepath, pathsize);
-    fread(&file->hdr, 1, sizeof(file->hdr), fp);
-    fclose(fp);
-    return file;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(pcap_global_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    //  INFO(Santiago): The records are visited only once and from the beginning to the end, let the kernel know it
+    //                  in order to get a more aggressive read-ahead and pages being dropped as soon as possible.
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    stream = (pcap_stream_ctx *) pig_newseg(sizeof(pcap_stream_ctx));
+    memset(stream, 0, sizeof(pcap_stream_ctx));
+    stream->data = (unsigned char *) data;
+    stream->data_size = st.st_size;
+
+    if (!ld_pcap_stream_global_info(stream)) {
+        close_pcap_stream(stream);
+        return NULL;
+    }
+
+    return stream;
 }
 
-static pcap_file_ctx *ld_records_from_pcap_file(pcap_file_ctx *file) {
-    FILE *fp = NULL;
-    pcap_record_header_t nrec;
-    unsigned char ndata[65535];
-    if (file == NULL || file->path == NULL) {
-        return file;
+void close_pcap_stream(pcap_stream_ctx *stream) {
+    if (stream == NULL) {
+        return;
     }
-    fp = fopen(file->path, "rb");
-    if (fp == NULL) {
-        return file;
+    if (stream->data != NULL) {
+        munmap(stream->data, stream->data_size);
     }
-    fseek(fp, sizeof(file->hdr), SEEK_SET);
-    fread(&nrec, 1, sizeof(nrec), fp);
-    fread(ndata, 1, nrec.incl_len, fp);
-    while (!feof(fp)) {
-        file->rec = add_record_to_pcap_record_ctx(file->rec, nrec, ndata);
-        fread(&nrec, 1, sizeof(nrec), fp);
-        fread(ndata, 1, nrec.incl_len, fp);
+    free(stream->if_tsresol);
+    free(stream);
+}
+
+int next_pcap_stream_record(pcap_stream_ctx *stream, pcap_record_ctx *record) {
+    if (stream == NULL || record == NULL) {
+        return 0;
     }
-    fclose(fp);
-    return file;
+
+    memset(record, 0, sizeof(pcap_record_ctx));
+
+    if (stream->is_pcapng) {
+        return next_pcapng_record(stream, record);
+    }
+
+    return next_pcap_record(stream, record);
+}
+
+static unsigned int pcap_stream_u32(const pcap_stream_ctx *stream, const unsigned char *p) {
+    unsigned int value = 0;
+    memcpy(&value, p, sizeof(value));
+    if (stream->swapped) {
+        value = (value >> 24) | ((value >> 8) & 0x0000ff00) | ((value << 8) & 0x00ff0000) | (value << 24);
+    }
+    return value;
+}
+
+static unsigned short pcap_stream_u16(const pcap_stream_ctx *stream, const unsigned char *p) {
+    unsigned short value = 0;
+    memcpy(&value, p, sizeof(value));
+    if (stream->swapped) {
+        value = (value >> 8) | (value << 8);
+    }
+    return value;
+}
+
+static int ld_pcap_stream_global_info(pcap_stream_ctx *stream) {
+    unsigned int magic = 0;
+
+    memcpy(&magic, stream->data, sizeof(magic));
+
+    stream->if_tsresol = (unsigned long long *) pig_newseg(sizeof(unsigned long long));
+    stream->if_tsresol[0] = PCAP_DEFAULT_TSRESOL;
+    stream->if_nr = 1;
+
+    if (magic == PCAPNG_BLOCK_SHB) {
+        //  INFO(Santiago): The records will be handed out as classic pcap ones, so a classic global header is
+        //                  synthesized. The link type and snaplen come from the first interface description block.
+        stream->is_pcapng = 1;
+        stream->hdr.magic_number = PCAP_MAGIC_USEC;
+        stream->hdr.version_major = 2;
+        stream->hdr.version_minor = 4;
+        stream->hdr.network = 1;
+        stream->if_nr = 0;
+        return 1;
+    }
+
+    if (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC) {
+        stream->swapped = 1;
+        magic = pcap_stream_u32(stream, stream->data);
+        if (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC) {
+            return 0;
+        }
+    }
+
+    if (magic == PCAP_MAGIC_NSEC) {
+        stream->if_tsresol[0] = 1000000000ULL;
+    }
+
+    stream->hdr.magic_number = PCAP_MAGIC_USEC;
+    stream->hdr.version_major = pcap_stream_u16(stream, stream->data + 4);
+    stream->hdr.version_minor = pcap_stream_u16(stream, stream->data + 6);
+    stream->hdr.thiszone = (int) pcap_stream_u32(stream, stream->data + 8);
+    stream->hdr.sigfigs = pcap_stream_u32(stream, stream->data + 12);
+    stream->hdr.snaplen = pcap_stream_u32(stream, stream->data + 16);
+    stream->hdr.network = pcap_stream_u32(stream, stream->data + 20);
+    stream->offset = sizeof(pcap_global_header_t);
+
+    return 1;
+}
+
+static int next_pcap_record(pcap_stream_ctx *stream, pcap_record_ctx *record) {
+    const unsigned char *rp = NULL;
+    unsigned int ts_frac = 0;
+
+    if (stream->data_size - stream->offset < sizeof(pcap_record_header_t)) {
+        return 0;
+    }
+
+    rp = stream->data + stream->offset;
+
+    record->hdr.ts_sec = pcap_stream_u32(stream, rp);
+    ts_frac = pcap_stream_u32(stream, rp + 4);
+    record->hdr.incl_len = pcap_stream_u32(stream, rp + 8);
+    record->hdr.orig_len = pcap_stream_u32(stream, rp + 12);
+
+    if (stream->data_size - stream->offset - sizeof(pcap_record_header_t) < record->hdr.incl_len) {
+        //  WARN(Santiago): Truncated capture, the last record is incomplete.
+        return 0;
+    }
+
+    record->hdr.ts_usec = ts_frac / (stream->if_tsresol[0] / PCAP_DEFAULT_TSRESOL);
+    record->data = stream->data + stream->offset + sizeof(pcap_record_header_t);
+
+    stream->offset += sizeof(pcap_record_header_t) + record->hdr.incl_len;
+
+    return 1;
+}
+
+static int next_pcapng_record(pcap_stream_ctx *stream, pcap_record_ctx *record) {
+    const unsigned char *bp = NULL;
+    unsigned int block_type = 0;
+    size_t block_size = 0;
+    unsigned int caplen = 0;
+    unsigned int if_id = 0;
+
+    while (stream->data_size - stream->offset >= 12) {
+        bp = stream->data + stream->offset;
+
+        memcpy(&block_type, bp, sizeof(block_type));
+
+        if (block_type == PCAPNG_BLOCK_SHB) {
+            if (!ld_pcapng_section_header(stream, bp, stream->data_size - stream->offset)) {
+                return 0;
+            }
+        } else {
+            block_type = pcap_stream_u32(stream, bp);
+        }
+
+        block_size = pcap_stream_u32(stream, bp + 4);
+
+        if (block_size < 12 || (block_size % 4) != 0 || block_size > stream->data_size - stream->offset) {
+            return 0;
+        }
+
+        stream->offset += block_size;
+
+        switch (block_type) {
+            case PCAPNG_BLOCK_IDB:
+                ld_pcapng_interface(stream, bp, block_size);
+                break;
+
+            case PCAPNG_BLOCK_EPB:
+                if (block_size < 32) {
+                    break;
+                }
+                if_id = pcap_stream_u32(stream, bp + 8);
+                caplen = pcap_stream_u32(stream, bp + 20);
+                if (caplen > block_size - 32) {
+                    break;
+                }
+                record->hdr.incl_len = caplen;
+                record->hdr.orig_len = pcap_stream_u32(stream, bp + 24);
+                set_pcap_stream_record_ts(stream, record, if_id,
+                                          ((unsigned long long)pcap_stream_u32(stream, bp + 12) << 32) |
+                                           pcap_stream_u32(stream, bp + 16));
+                record->data = (unsigned char *)bp + 28;
+                return 1;
+
+            case PCAPNG_BLOCK_OPB:
+                if (block_size < 32) {
+                    break;
+                }
+                if_id = pcap_stream_u16(stream, bp + 8);
+                caplen = pcap_stream_u32(stream, bp + 20);
+                if (caplen > block_size - 32) {
+                    break;
+                }
+                record->hdr.incl_len = caplen;
+                record->hdr.orig_len = pcap_stream_u32(stream, bp + 24);
+                set_pcap_stream_record_ts(stream, record, if_id,
+                                          ((unsigned long long)pcap_stream_u32(stream, bp + 12) << 32) |
+                                           pcap_stream_u32(stream, bp + 16));
+                record->data = (unsigned char *)bp + 28;
+                return 1;
+
+            case PCAPNG_BLOCK_SPB:
+                if (block_size < 16) {
+                    break;
+                }
+                //  INFO(Santiago): Simple packet blocks carry neither timestamp nor captured length, this last one
+                //                  is the original length bounded by the block size.
+                record->hdr.orig_len = pcap_stream_u32(stream, bp + 8);
+                record->hdr.incl_len = record->hdr.orig_len;
+                if (record->hdr.incl_len > block_size - 16) {
+                    record->hdr.incl_len = block_size - 16;
+                }
+                record->data = (unsigned char *)bp + 12;
+                return 1;
+
+            default:
+                //  INFO(Santiago): Name resolution, statistics, custom blocks, etc. Nothing useful for us.
+                break;
+        }
+    }
+
+    return 0;
 }
 
-static pcap_record_ctx *add_record_to_pcap_record_ctx(pcap_record_ctx *recs, pcap_record_header_t hdr, unsigned char *pkt_data) {
-    pcap_record_ctx *head = recs, *p;
-    if (pkt_data == NULL) {
-        return head;
+static int ld_pcapng_section_header(pcap_stream_ctx *stream, const unsigned char *block, const size_t block_size) {
+    unsigned int bom = 0;
+
+    if (block_size < 28) {
+        return 0;
     }
-    if (head == NULL) {
-        new_pcap_record_ctx(head);
-        p = head;
+
+    memcpy(&bom, block + 8, sizeof(bom));
+
+    if (bom == PCAPNG_BYTE_ORDER_MAGIC) {
+        stream->swapped = 0;
     } else {
-        p = get_pcap_record_ctx_tail(head);
-        new_pcap_record_ctx(p->next);
-        p = p->next;
+        stream->swapped = 1;
+        if (pcap_stream_u32(stream, block + 8) != PCAPNG_BYTE_ORDER_MAGIC) {
+            return 0;
+        }
     }
-    p->hdr = hdr;
-    p->data = (unsigned char *) pig_newseg(p->hdr.incl_len + 1);
-    memset(p->data, 0, p->hdr.incl_len + 1);
-    memcpy(p->data, pkt_data, p->hdr.incl_len);
-    return head;
+
+    //  INFO(Santiago): Interface ids are local to the section.
+    stream->if_nr = 0;
+
+    return 1;
+}
+
+static void ld_pcapng_interface(pcap_stream_ctx *stream, const unsigned char *block, const size_t block_size) {
+    unsigned long long *if_tsresol = NULL;
+    unsigned long long tsresol = PCAP_DEFAULT_TSRESOL;
+    const unsigned char *op = NULL, *op_end = NULL;
+    unsigned short opt_code = 0, opt_len = 0;
+    unsigned char r = 0;
+
+    if (block_size < 20) {
+        return;
+    }
+
+    if (stream->hdr.snaplen == 0) {
+        stream->hdr.network = pcap_stream_u16(stream, block + 8);
+        stream->hdr.snaplen = pcap_stream_u32(stream, block + 12);
+        if (stream->hdr.snaplen == 0) {
+            stream->hdr.snaplen = 65535;
+        }
+    }
+
+    op = block + 16;
+    op_end = block + block_size - 4;
+
+    while (op + 4 <= op_end) {
+        opt_code = pcap_stream_u16(stream, op);
+        opt_len = pcap_stream_u16(stream, op + 2);
+        if (opt_code == 0 || op + 4 + opt_len > op_end) {
+            break;
+        }
+        if (opt_code == PCAPNG_OPT_IF_TSRESOL && opt_len >= 1) {
+            r = *(op + 4);
+            if (r & 0x80) {
+                tsresol = (r & 0x7f) < 64 ? (1ULL << (r & 0x7f)) : PCAP_DEFAULT_TSRESOL;
+            } else {
+                for (tsresol = 1; r > 0 && r < 20; r--) {
+                    tsresol *= 10;
+                }
+            }
+        }
+        op += 4 + ((opt_len + 3) & ~3);
+    }
+
+    if_tsresol = (unsigned long long *) pig_newseg(sizeof(unsigned long long) * (stream->if_nr + 1));
+    if (stream->if_nr > 0) {
+        memcpy(if_tsresol, stream->if_tsresol, sizeof(unsigned long long) * stream->if_nr);
+    }
+    if_tsresol[stream->if_nr++] = tsresol;
+    free(stream->if_tsresol);
+    stream->if_tsresol = if_tsresol;
 }
 
-static pcap_record_ctx *get_pcap_record_ctx_tail(pcap_record_ctx *recs) {
-    pcap_record_ctx *r;
-    for (r = recs; r->next != NULL; r = r->next);
-    return r;
+static void set_pcap_stream_record_ts(const pcap_stream_ctx *stream, pcap_record_ctx *record,
+                                      const unsigned int if_id, const unsigned long long ts) {
+    unsigned long long tsresol = PCAP_DEFAULT_TSRESOL;
+
+    if (if_id < stream->if_nr && stream->if_tsresol[if_id] > 0) {
+        tsresol = stream->if_tsresol[if_id];
+    }
+
+    record->hdr.ts_sec = ts / tsresol;
+    record->hdr.ts_usec = ((ts % tsresol) * PCAP_DEFAULT_TSRESOL) / tsresol;
 }
 
 static void del_pcap_record_ctx(pcap_record_ctx *recs) {
     pcap_record_ctx *t, *p;
-    for (t = p = recs; t; t = p->next, p = t) {
+    for (t = p = recs; t; p = t) {
+        t = p->next;
         free(p->data);
         free(p);
     }
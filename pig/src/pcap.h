@@ -16,4 +16,10 @@ void close_pcap_file(pcap_file_ctx *file);
 
 int save_pcap_file(const pcap_file_ctx *file);
 
+pcap_stream_ctx *open_pcap_stream(const char *filepath);
+
+int next_pcap_stream_record(pcap_stream_ctx *stream, pcap_record_ctx *record);
+
+void close_pcap_stream(pcap_stream_ctx *stream);
+
 #endif
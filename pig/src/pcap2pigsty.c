@@ -10,9 +10,12 @@
 #include "pktslicer.h"
 #include "endianess.h"
 #include "options.h"
+#include "memory.h"
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 
 typedef int (*pcap_rec_dumper)(FILE *pigsty, const pcap_record_ctx *record);
@@ -28,12 +31,33 @@ struct pkt_field_dumper_ctx {
     dump_writer write;
 };
 
+#define PCAP2PIGSTY_BATCH_SIZE 4096
+
+struct pcap2pigsty_batch_ctx {
+    pcap_record_ctx record[PCAP2PIGSTY_BATCH_SIZE];
+    size_t record_nr;
+    int first_index;
+    int incl_ethframe;
+    const char *signature_fmt;
+    char *out;
+    size_t out_size;
+    int exit_code;
+    pthread_t thread;
+};
+
 //static pcap_rec_dumper g_pcap_rec_dumper_ip6tlayer_lt[0xffff] = { 0 };
 
 static void init_pcap_rec_dumper_lookup_tables(void);
 
 static int pigsty_data(FILE *pigsty, const pcap_record_ctx *record, const int incl_ethframe);
 
+static int pcap2pigsty_serial(FILE *pigsty, pcap_stream_ctx *pcap, const char *signature_fmt, const int incl_ethframe);
+
+static int pcap2pigsty_parallel(FILE *pigsty, pcap_stream_ctx *pcap, const char *signature_fmt, const int incl_ethframe,
+                                const size_t threads_nr);
+
+static void *pcap2pigsty_batch_routine(void *args);
+
 static int ethframe_dumper(FILE *pigsty, const pcap_record_ctx *record);
 
 static int ip4_dumper(FILE *pigsty, const pcap_record_ctx *record);
@@ -84,12 +108,11 @@ void get_option_label_from_field(char *option, const char *field);
 
 #define NEXT_PIGSTY "\n]\n"
 
-int pcap2pigsty(const char *pigsty_filepath, const char *pcap_filepath, const char *signature_fmt, const int incl_ethframe) {
+int pcap2pigsty(const char *pigsty_filepath, const char *pcap_filepath, const char *signature_fmt, const int incl_ethframe,
+                const size_t threads_nr) {
     int exit_code = 1;
-    pcap_file_ctx *pcap = NULL;
-    pcap_record_ctx *rp = NULL;
+    pcap_stream_ctx *pcap = NULL;
     FILE *pigsty = NULL;
-    int signature_index = 0;
 
     if (pigsty_filepath == NULL) {
         goto ___pcap2pigsty_cleanup;
@@ -99,7 +122,7 @@ int pcap2pigsty(const char *pigsty_filepath, const char *pcap_filepath, const ch
         goto ___pcap2pigsty_cleanup;
     }
 
-    if ((pcap = ld_pcap_file(pcap_filepath)) == NULL) {
+    if ((pcap = open_pcap_stream(pcap_filepath)) == NULL) {
         goto ___pcap2pigsty_cleanup;
     }
 
@@ -109,18 +132,17 @@ int pcap2pigsty(const char *pigsty_filepath, const char *pcap_filepath, const ch
 
     init_pcap_rec_dumper_lookup_tables();
 
-    exit_code = 0;
-
-    for (rp = pcap->rec; rp != NULL && exit_code == 0; rp = rp->next) {
-        pigsty_ini(pigsty);
-        exit_code = pigsty_data(pigsty, rp, incl_ethframe);
-        pigsty_finis(pigsty, signature_fmt, signature_index++);
+    if (threads_nr > 1) {
+        exit_code = pcap2pigsty_parallel(pigsty, pcap, signature_fmt, incl_ethframe,
+                                         (threads_nr > PCAP2PIGSTY_MAX_THREADS) ? PCAP2PIGSTY_MAX_THREADS : threads_nr);
+    } else {
+        exit_code = pcap2pigsty_serial(pigsty, pcap, signature_fmt, incl_ethframe);
     }
 
 ___pcap2pigsty_cleanup:
 
     if (pcap != NULL) {
-        close_pcap_file(pcap);
+        close_pcap_stream(pcap);
     }
 
     if (pigsty != NULL) {
@@ -134,6 +156,102 @@ ___pcap2pigsty_cleanup:
     return exit_code;
 }
 
+static int pcap2pigsty_serial(FILE *pigsty, pcap_stream_ctx *pcap, const char *signature_fmt, const int incl_ethframe) {
+    pcap_record_ctx record;
+    int signature_index = 0;
+    int exit_code = 0;
+
+    while (exit_code == 0 && next_pcap_stream_record(pcap, &record)) {
+        pigsty_ini(pigsty);
+        exit_code = pigsty_data(pigsty, &record, incl_ethframe);
+        pigsty_finis(pigsty, signature_fmt, signature_index++);
+    }
+
+    return exit_code;
+}
+
+static int pcap2pigsty_parallel(FILE *pigsty, pcap_stream_ctx *pcap, const char *signature_fmt, const int incl_ethframe,
+                                const size_t threads_nr) {
+    struct pcap2pigsty_batch_ctx *batch = NULL;
+    size_t b = 0, batch_nr = 0;
+    int signature_index = 0;
+    int exit_code = 0;
+    int eof = 0;
+
+    //  INFO(Santiago): Each round hands one batch of records to each thread. The records are only views over the
+    //                  mapped capture, so the memory in use is bounded by the batches and not by the capture size.
+    //                  The signatures are rendered in memory and written following the original record order.
+    batch = (struct pcap2pigsty_batch_ctx *) pig_newseg(sizeof(struct pcap2pigsty_batch_ctx) * threads_nr);
+
+    while (exit_code == 0 && !eof) {
+        for (batch_nr = 0; batch_nr < threads_nr && !eof; batch_nr++) {
+            batch[batch_nr].record_nr = 0;
+            batch[batch_nr].first_index = signature_index;
+            batch[batch_nr].incl_ethframe = incl_ethframe;
+            batch[batch_nr].signature_fmt = signature_fmt;
+            batch[batch_nr].out = NULL;
+            batch[batch_nr].out_size = 0;
+            batch[batch_nr].exit_code = 0;
+            while (batch[batch_nr].record_nr < PCAP2PIGSTY_BATCH_SIZE &&
+                   next_pcap_stream_record(pcap, &batch[batch_nr].record[batch[batch_nr].record_nr])) {
+                batch[batch_nr].record_nr++;
+            }
+            eof = (batch[batch_nr].record_nr < PCAP2PIGSTY_BATCH_SIZE);
+            signature_index += batch[batch_nr].record_nr;
+        }
+
+        for (b = 0; b < batch_nr; b++) {
+            if (pthread_create(&batch[b].thread, NULL, pcap2pigsty_batch_routine, &batch[b]) != 0) {
+                //  WARN(Santiago): No more threads? Fine, do it by ourselves.
+                pcap2pigsty_batch_routine(&batch[b]);
+                batch[b].thread = pthread_self();
+            }
+        }
+
+        for (b = 0; b < batch_nr; b++) {
+            if (!pthread_equal(batch[b].thread, pthread_self())) {
+                pthread_join(batch[b].thread, NULL);
+            }
+            if (exit_code == 0) {
+                exit_code = batch[b].exit_code;
+                if (batch[b].out != NULL) {
+                    fwrite(batch[b].out, 1, batch[b].out_size, pigsty);
+                }
+            }
+            free(batch[b].out);
+        }
+    }
+
+    free(batch);
+
+    return exit_code;
+}
+
+static void *pcap2pigsty_batch_routine(void *args) {
+    struct pcap2pigsty_batch_ctx *batch = (struct pcap2pigsty_batch_ctx *)args;
+    FILE *pigsty = NULL;
+    size_t r = 0;
+
+    if (batch->record_nr == 0) {
+        return NULL;
+    }
+
+    if ((pigsty = open_memstream(&batch->out, &batch->out_size)) == NULL) {
+        batch->exit_code = 1;
+        return NULL;
+    }
+
+    for (r = 0; r < batch->record_nr && batch->exit_code == 0; r++) {
+        pigsty_ini(pigsty);
+        batch->exit_code = pigsty_data(pigsty, &batch->record[r], batch->incl_ethframe);
+        pigsty_finis(pigsty, batch->signature_fmt, batch->first_index + r);
+    }
+
+    fclose(pigsty);
+
+    return NULL;
+}
+
 static void pigsty_ini(FILE *pigsty) {
     fprintf(pigsty, NEW_PIGSTY);
 }
@@ -8,6 +8,11 @@
 #ifndef PIG_PCAP2PIGSTY_H
 #define PIG_PCAP2PIGSTY_H 1
 
-int pcap2pigsty(const char *pigsty_filepath, const char *pcap_filepath, const char *signature_fmt, const int incl_ethframe);
+#include <stdlib.h>
+
+#define PCAP2PIGSTY_MAX_THREADS 64
+
+int pcap2pigsty(const char *pigsty_filepath, const char *pcap_filepath, const char *signature_fmt, const int incl_ethframe,
+                const size_t threads_nr);
 
 #endif
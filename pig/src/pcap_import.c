@@ -9,9 +9,12 @@
 #include "pcap2pigsty.h"
 #include "options.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
 
 static int pcap_import_help(void) {
-    printf("usage: pig --sub-task=pcap-import --pcap=<pcap-file-path> --pigsty=<pigsty-file-path> --include-ethernet-frames\n");
+    printf("usage: pig --sub-task=pcap-import --pcap=<pcap-file-path> --pigsty=<pigsty-file-path> --include-ethernet-frames "
+           "--threads=<n>\n");
     return 0;
 }
 
@@ -20,6 +23,9 @@ int pcap_import(void) {
     char *pigsty = NULL;
     char *incl_ethframe = NULL;
     char *signature_fmt = NULL;
+    char *threads = NULL;
+    char *tp = NULL;
+    size_t threads_nr = 1;
 
     if (get_option("help", NULL) != NULL) {
         return pcap_import_help();
@@ -29,6 +35,7 @@ int pcap_import(void) {
     pigsty = get_option("pigsty", NULL);
     incl_ethframe = get_option("include-ethernet-frames", NULL);
     signature_fmt = get_option("signature-fmt", NULL);
+    threads = get_option("threads", NULL);
 
     if (pcap == NULL) {
         printf("pig ERROR: --pcap option is missing.\n");
@@ -40,5 +47,15 @@ int pcap_import(void) {
         return 1;
     }
 
-    return pcap2pigsty(pigsty, pcap, signature_fmt, incl_ethframe != NULL);
+    if (threads != NULL) {
+        for (tp = threads; *tp != 0 && isdigit(*tp); tp++)
+            ;
+        if (*threads == 0 || *tp != 0 || (threads_nr = strtoul(threads, NULL, 10)) == 0 ||
+            threads_nr > PCAP2PIGSTY_MAX_THREADS) {
+            printf("pig ERROR: --threads must be a number between 1 and %d.\n", PCAP2PIGSTY_MAX_THREADS);
+            return 1;
+        }
+    }
+
+    return pcap2pigsty(pigsty, pcap, signature_fmt, incl_ethframe != NULL, threads_nr);
 }
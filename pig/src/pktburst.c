@@ -0,0 +1,464 @@
+/*
+ *                                Copyright (C) 2017 by Rafael Santiago
+ *
+ * This is a free software. You can redistribute it and/or modify under
+ * the terms of the GNU General Public License version 2.
+ *
+ */
+#include "pktburst.h"
+#include "pkttmpl.h"
+#include "oink.h"
+#include "sock.h"
+#include "lists.h"
+#include "memory.h"
+#include "options.h"
+#include "netif.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+//  INFO(Santiago): The burst engine replaces the "one inject() plus one usleep()" loop when the user asks for a rate
+//                  (--pps), a burst size (--burst) or more than one sender (--senders). Every sender thread owns its
+//                  socket and its own copies of the packet templates, renders a whole burst and pushes it to the
+//                  kernel with a single inject_batch() call. The pace is given by a token bucket shared among
+//                  the senders, so the total rate stays the requested one no matter how many threads are running.
+
+#define PIG_BURST_STAT_INTERVAL_NS 1000000000LL
+
+#define PIG_BURST_STAT_POLL_NS      100000000LL
+
+struct pig_token_bucket_ctx {
+    pthread_mutex_t lock;
+    double pps;
+    double depth;
+    double tokens;
+    long long last;
+};
+
+struct pig_burst_ctx {
+    const pigsty_entry_ctx **signatures;
+    size_t signatures_count;
+    const pig_target_addr_ctx *addr;
+    const unsigned char *gw_hwaddr;
+    const unsigned int *nt_mask_addr;
+    const char *loiface;
+    int loop_mode;
+    size_t burst_size;
+    size_t frame_size;
+    unsigned long long budget;
+    unsigned long long issued;
+    unsigned long long seq;
+    unsigned long long sent;
+    unsigned long long failed;
+    size_t senders_done;
+    struct pig_token_bucket_ctx bucket;
+};
+
+struct pig_burst_sender_ctx {
+    pthread_t thread;
+    struct pig_burst_ctx *burst;
+    pig_pkt_template_ctx **tmpl;
+    pig_netif_ctx *netif;
+    unsigned char *frames;
+    const unsigned char **frames_p;
+    size_t *frames_size;
+    unsigned int seed;
+    int sockfd;
+};
+
+static int read_uint_option(const char *option, const unsigned int default_value, unsigned int *value);
+
+static long long get_monotonic_ns(void);
+
+static void sleep_ns(const long long ns);
+
+static void init_token_bucket(struct pig_token_bucket_ctx *bucket, const unsigned int pps, const size_t burst_size);
+
+static size_t take_burst_tokens(struct pig_burst_ctx *burst, const size_t wanted);
+
+static void count_burst(struct pig_burst_ctx *burst, const unsigned long long sent, const unsigned long long failed);
+
+static void *pktburst_sender(void *arg);
+
+static int init_burst_sender(struct pig_burst_sender_ctx *sender, struct pig_burst_ctx *burst, const unsigned int sender_id);
+
+static void deinit_burst_sender(struct pig_burst_sender_ctx *sender);
+
+static void print_burst_stat(const struct pig_burst_ctx *burst, const unsigned long long last_sent, const long long elapsed_ns, const int final);
+
+static int read_uint_option(const char *option, const unsigned int default_value, unsigned int *value) {
+    char *data = get_option(option, NULL);
+    char *dp = NULL;
+    unsigned long ul_value = 0;
+    if (data == NULL) {
+        *value = default_value;
+        return 1;
+    }
+    if (*data == 0) {
+        return 0;
+    }
+    for (dp = data; *dp != 0; dp++) {
+        if (!isdigit((unsigned char)*dp)) {
+            return 0;
+        }
+    }
+    errno = 0;
+    ul_value = strtoul(data, NULL, 10);
+    if ((ul_value == ULONG_MAX && errno == ERANGE) || ul_value > UINT_MAX) {
+        return 0;
+    }
+    *value = (unsigned int)ul_value;
+    return 1;
+}
+
+int should_pktburst(const struct pktcraft_options_ctx *user_options) {
+    return (user_options != NULL &&
+            (user_options->pps > 0 || user_options->burst_size > 0 || user_options->senders_nr > 1));
+}
+
+int parse_pktburst_options(struct pktcraft_options_ctx *options) {
+    if (!read_uint_option("pps", 0, &options->pps)) {
+        printf("pig ERROR: an invalid --pps value was supplied.\n");
+        return 1;
+    }
+
+    if (!read_uint_option("burst", 0, &options->burst_size) || options->burst_size > PIG_BURST_MAX_SIZE ||
+        (options->burst_size == 0 && get_option("burst", NULL) != NULL)) {
+        printf("pig ERROR: --burst must be a number between 1 and %d.\n", PIG_BURST_MAX_SIZE);
+        return 1;
+    }
+
+    if (!read_uint_option("senders", 1, &options->senders_nr) ||
+        options->senders_nr == 0 || options->senders_nr > PIG_BURST_MAX_SENDERS) {
+        printf("pig ERROR: --senders must be a number between 1 and %d.\n", PIG_BURST_MAX_SENDERS);
+        return 1;
+    }
+
+    return 0;
+}
+
+static long long get_monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long)ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_ns(const long long ns) {
+    struct timespec ts;
+    if (ns <= 0) {
+        return;
+    }
+    ts.tv_sec = ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    nanosleep(&ts, NULL);
+}
+
+static void init_token_bucket(struct pig_token_bucket_ctx *bucket, const unsigned int pps, const size_t burst_size) {
+    pthread_mutex_init(&bucket->lock, NULL);
+    bucket->pps = pps;
+    //  INFO(Santiago): the bucket depth is the burst size, so the senders never get more than one burst ahead.
+    bucket->depth = burst_size;
+    bucket->tokens = burst_size;
+    bucket->last = get_monotonic_ns();
+}
+
+static size_t take_burst_tokens(struct pig_burst_ctx *burst, const size_t wanted) {
+    struct pig_token_bucket_ctx *bucket = &burst->bucket;
+    size_t granted = 0;
+    long long now = 0, wait_ns = 0;
+
+    while (granted == 0 && !pktcraft_aborted()) {
+        pthread_mutex_lock(&bucket->lock);
+
+        granted = wanted;
+
+        if (burst->budget > 0) {
+            if (burst->issued >= burst->budget) {
+                pthread_mutex_unlock(&bucket->lock);
+                return 0;
+            }
+            if (burst->budget - burst->issued < granted) {
+                granted = burst->budget - burst->issued;
+            }
+        }
+
+        if (bucket->pps > 0) {
+            now = get_monotonic_ns();
+            bucket->tokens += bucket->pps * (double)(now - bucket->last) / 1000000000.0;
+            bucket->last = now;
+            if (bucket->tokens > bucket->depth) {
+                bucket->tokens = bucket->depth;
+            }
+            if (bucket->tokens < 1.0) {
+                wait_ns = (long long)((1.0 - bucket->tokens) * 1000000000.0 / bucket->pps) + 1;
+                granted = 0;
+            } else if ((double)granted > bucket->tokens) {
+                granted = (size_t)bucket->tokens;
+            }
+            bucket->tokens -= granted;
+        }
+
+        burst->issued += granted;
+
+        pthread_mutex_unlock(&bucket->lock);
+
+        if (granted == 0) {
+            //  WARN(Santiago): sleeping in small steps, otherwise a very low --pps would hide a CTRL+C for too long.
+            sleep_ns((wait_ns < PIG_BURST_STAT_POLL_NS) ? wait_ns : PIG_BURST_STAT_POLL_NS);
+        }
+    }
+
+    return granted;
+}
+
+static void count_burst(struct pig_burst_ctx *burst, const unsigned long long sent, const unsigned long long failed) {
+    if (sent > 0) {
+        __sync_fetch_and_add(&burst->sent, sent);
+    }
+    if (failed > 0) {
+        __sync_fetch_and_add(&burst->failed, failed);
+    }
+}
+
+static int init_burst_sender(struct pig_burst_sender_ctx *sender, struct pig_burst_ctx *burst, const unsigned int sender_id) {
+    size_t s = 0, f = 0;
+
+    memset(sender, 0, sizeof(struct pig_burst_sender_ctx));
+
+    sender->burst = burst;
+    sender->seed = (unsigned int)time(0) ^ (sender_id * 0x9e3779b9);
+    sender->sockfd = init_raw_socket(burst->loiface);
+
+    if (sender->sockfd == -1) {
+        return 0;
+    }
+
+    sender->netif = mk_pig_netif(burst->loiface);
+
+    //  INFO(Santiago): the templates are patched in place at every send, so each sender needs its own copies.
+    sender->tmpl = (pig_pkt_template_ctx **) pig_newseg(sizeof(pig_pkt_template_ctx *) * burst->signatures_count);
+    for (s = 0; s < burst->signatures_count; s++) {
+        sender->tmpl[s] = dup_pkt_template(burst->signatures[s]->tmpl);
+    }
+
+    sender->frames = (unsigned char *) pig_newseg(burst->frame_size * burst->burst_size);
+    sender->frames_p = (const unsigned char **) pig_newseg(sizeof(unsigned char *) * burst->burst_size);
+    sender->frames_size = (size_t *) pig_newseg(sizeof(size_t) * burst->burst_size);
+
+    for (f = 0; f < burst->burst_size; f++) {
+        sender->frames_p[f] = sender->frames + f * burst->frame_size;
+    }
+
+    return 1;
+}
+
+static void deinit_burst_sender(struct pig_burst_sender_ctx *sender) {
+    size_t s = 0;
+
+    if (sender->tmpl != NULL) {
+        for (s = 0; s < sender->burst->signatures_count; s++) {
+            del_pkt_template(sender->tmpl[s]);
+        }
+        free(sender->tmpl);
+    }
+
+    free(sender->frames);
+    free(sender->frames_p);
+    free(sender->frames_size);
+    del_pig_netif(sender->netif);
+
+    if (sender->sockfd != -1) {
+        deinit_raw_socket(sender->sockfd);
+    }
+}
+
+static void *pktburst_sender(void *arg) {
+    struct pig_burst_sender_ctx *sender = (struct pig_burst_sender_ctx *)arg;
+    struct pig_burst_ctx *burst = sender->burst;
+    const pigsty_entry_ctx *signature = NULL;
+    pig_pkt_template_ctx *tmpl = NULL;
+    size_t tokens_nr = 0, t = 0, frames_nr = 0, index = 0;
+    unsigned long long sent = 0, failed = 0;
+    int sent_nr = 0;
+
+    while ((tokens_nr = take_burst_tokens(burst, burst->burst_size)) > 0) {
+        frames_nr = 0;
+        sent = failed = 0;
+
+        for (t = 0; t < tokens_nr; t++) {
+            if (burst->loop_mode == PIG_BURST_LOOP_SEQUENTIAL) {
+                index = __sync_fetch_and_add(&burst->seq, 1) % burst->signatures_count;
+            } else {
+                index = rand_r(&sender->seed) % burst->signatures_count;
+            }
+
+            signature = burst->signatures[index];
+            tmpl = sender->tmpl[index];
+
+            if (tmpl == NULL) {
+                //  INFO(Santiago): signatures without template (explicit Ethernet frames) go through the old path.
+                if (oink(signature, sender->netif, burst->addr, sender->sockfd,
+                         burst->gw_hwaddr, burst->nt_mask_addr) != -1) {
+                    sent++;
+                } else {
+                    failed++;
+                }
+                continue;
+            }
+
+            switch (mk_oink_frame(tmpl, signature->conf, sender->netif, burst->addr,
+                                  burst->gw_hwaddr, burst->nt_mask_addr)) {
+                case PIG_OINK_FRAME_ETH:
+                    //  WARN(Santiago): the same template can be picked twice in one burst, so the frame is copied out.
+                    memcpy((unsigned char *)sender->frames_p[frames_nr], tmpl->frame, tmpl->frame_size);
+                    sender->frames_size[frames_nr] = tmpl->frame_size;
+                    frames_nr++;
+                    break;
+
+                case PIG_OINK_FRAME_LO:
+                    if (inject_lo(tmpl->dgram, tmpl->dgram_size, get_pig_netif_lo_socket(sender->netif)) != -1) {
+                        sent++;
+                    } else {
+                        failed++;
+                    }
+                    break;
+
+                default:
+                    failed++;
+                    break;
+            }
+        }
+
+        if (frames_nr > 0) {
+            sent_nr = inject_batch(sender->frames_p, sender->frames_size, frames_nr, sender->sockfd);
+            if (sent_nr < 0) {
+                sent_nr = 0;
+            }
+            sent += sent_nr;
+            failed += frames_nr - sent_nr;
+        }
+
+        count_burst(burst, sent, failed);
+    }
+
+    __sync_fetch_and_add(&burst->senders_done, 1);
+
+    return NULL;
+}
+
+static void print_burst_stat(const struct pig_burst_ctx *burst, const unsigned long long last_sent, const long long elapsed_ns, const int final) {
+    double pps = 0.0;
+    if (elapsed_ns > 0) {
+        pps = (double)(burst->sent - last_sent) * 1000000000.0 / (double)elapsed_ns;
+    }
+    printf("pig INFO: %s %llu packet(s) sent, %llu failure(s), %.0f pps achieved.\n",
+           (final) ? "done," : "    ", burst->sent, burst->failed, pps);
+    fflush(stdout);
+}
+
+int pktburst(const pigsty_entry_ctx **signatures,
+             const size_t signatures_count,
+             const pig_target_addr_ctx *addr,
+             const unsigned char *gw_hwaddr,
+             const unsigned int nt_mask_addr[4],
+             const int loop_mode,
+             const struct pktcraft_options_ctx *user_options) {
+    struct pig_burst_ctx burst;
+    struct pig_burst_sender_ctx *senders = NULL;
+    size_t s = 0, senders_nr = 0, running_nr = 0;
+    long long start = 0, now = 0, last_stat = 0;
+    unsigned long long last_sent = 0;
+
+    if (signatures == NULL || signatures_count == 0 || user_options == NULL) {
+        return 1;
+    }
+
+    memset(&burst, 0, sizeof(burst));
+
+    burst.signatures = signatures;
+    burst.signatures_count = signatures_count;
+    for (s = 0; s < signatures_count; s++) {
+        if (signatures[s]->tmpl != NULL && signatures[s]->tmpl->frame_size > burst.frame_size) {
+            burst.frame_size = signatures[s]->tmpl->frame_size;
+        }
+    }
+
+    burst.addr = addr;
+    burst.gw_hwaddr = gw_hwaddr;
+    burst.nt_mask_addr = nt_mask_addr;
+    burst.loiface = user_options->loiface;
+    burst.loop_mode = loop_mode;
+    burst.budget = user_options->times_nr;
+    burst.burst_size = (user_options->burst_size > 0) ? user_options->burst_size : PIG_BURST_DEFAULT_SIZE;
+    if (burst.frame_size == 0) {
+        burst.frame_size = 1;
+    }
+
+    init_token_bucket(&burst.bucket, user_options->pps, burst.burst_size);
+
+    senders_nr = user_options->senders_nr;
+    if (senders_nr == 0) {
+        senders_nr = 1;
+    }
+
+    senders = (struct pig_burst_sender_ctx *) pig_newseg(sizeof(struct pig_burst_sender_ctx) * senders_nr);
+
+    if (!user_options->should_be_quiet) {
+        if (user_options->pps > 0) {
+            printf("pig INFO: injecting at %u pps, %zu packet(s) per burst, %zu sender(s)...\n\n",
+                   user_options->pps, burst.burst_size, senders_nr);
+        } else {
+            printf("pig INFO: injecting at full rate, %zu packet(s) per burst, %zu sender(s)...\n\n",
+                   burst.burst_size, senders_nr);
+        }
+    }
+
+    start = last_stat = get_monotonic_ns();
+
+    for (s = 0; s < senders_nr; s++) {
+        if (!init_burst_sender(&senders[s], &burst, s)) {
+            printf("pig PANIC: unable to create the socket for the sender #%zu.\n", s);
+            deinit_burst_sender(&senders[s]);
+            break;
+        }
+        if (pthread_create(&senders[s].thread, NULL, pktburst_sender, &senders[s]) != 0) {
+            printf("pig PANIC: unable to start the sender #%zu.\n", s);
+            deinit_burst_sender(&senders[s]);
+            break;
+        }
+        running_nr++;
+    }
+
+    while (running_nr > 0 && burst.senders_done < running_nr) {
+        sleep_ns(PIG_BURST_STAT_POLL_NS);
+        now = get_monotonic_ns();
+        if (!user_options->should_be_quiet && now - last_stat >= PIG_BURST_STAT_INTERVAL_NS) {
+            print_burst_stat(&burst, last_sent, now - last_stat, 0);
+            last_sent = burst.sent;
+            last_stat = now;
+        }
+    }
+
+    for (s = 0; s < running_nr; s++) {
+        pthread_join(senders[s].thread, NULL);
+        deinit_burst_sender(&senders[s]);
+    }
+
+    if (!user_options->should_be_quiet) {
+        print_burst_stat(&burst, 0, get_monotonic_ns() - start, 1);
+        if (pktcraft_aborted()) {
+            printf("\npig INFO: exiting... please wait...\npig INFO: pig has gone.\n");
+        }
+    }
+
+    pthread_mutex_destroy(&burst.bucket.lock);
+    free(senders);
+
+    return (running_nr == 0 || burst.failed > 0);
+}
@@ -0,0 +1,36 @@
+/*
+ *                                Copyright (C) 2017 by Rafael Santiago
+ *
+ * This is a free software. You can redistribute it and/or modify under
+ * the terms of the GNU General Public License version 2.
+ *
+ */
+#ifndef PIG_PKTBURST_H
+#define PIG_PKTBURST_H 1
+
+#include "types.h"
+#include "pktcraft.h"
+
+#define PIG_BURST_LOOP_RANDOM     0
+
+#define PIG_BURST_LOOP_SEQUENTIAL 1
+
+#define PIG_BURST_DEFAULT_SIZE   32
+
+#define PIG_BURST_MAX_SIZE     1024
+
+#define PIG_BURST_MAX_SENDERS    64
+
+int parse_pktburst_options(struct pktcraft_options_ctx *options);
+
+int should_pktburst(const struct pktcraft_options_ctx *user_options);
+
+int pktburst(const pigsty_entry_ctx **signatures,
+             const size_t signatures_count,
+             const pig_target_addr_ctx *addr,
+             const unsigned char *gw_hwaddr,
+             const unsigned int nt_mask_addr[4],
+             const int loop_mode,
+             const struct pktcraft_options_ctx *user_options);
+
+#endif
@@ -16,6 +16,9 @@
 #include "netmask.h"
 #include "options.h"
 #include "strglob.h"
+#include "pkttmpl.h"
+#include "pktburst.h"
+#include "netif.h"
 #include <unistd.h>
 #include <stdio.h>
 #include <ctype.h>
@@ -25,9 +28,9 @@
 
 static int g_pig_out = 0; //  :)
 
-typedef int (*pig_pktcrafter)(const pigsty_entry_ctx *pigsty,
+typedef int (*pig_pktcrafter)(const pigsty_entry_ctx **signatures,
                               const size_t signatures_count,
-                              pig_hwaddr_ctx *hwaddr,
+                              pig_netif_ctx *netif,
                               const pig_target_addr_ctx *addr,
                               const int sockfd,
                               const unsigned char *gw_hwaddr,
@@ -40,36 +43,36 @@ static pig_target_addr_ctx *parse_targets(const char *targets);
 
 static int is_targets_option_required(const pigsty_entry_ctx *entries);
 
-static int singletest_pktcrafter(const pigsty_entry_ctx *pigsty,
+static int singletest_pktcrafter(const pigsty_entry_ctx **signatures,
                                  const size_t signatures_count,
-                                 pig_hwaddr_ctx *hwaddr,
+                                 pig_netif_ctx *netif,
                                  const pig_target_addr_ctx *addr,
                                  const int sockfd,
                                  const unsigned char *gw_hwaddr,
                                  const unsigned int nt_mask_addr[4],
                                  const struct pktcraft_options_ctx user_options);
 
-static int endless_pktcrafter(const pigsty_entry_ctx *pigsty,
+static int endless_pktcrafter(const pigsty_entry_ctx **signatures,
                               const size_t signatures_count,
-                              pig_hwaddr_ctx *hwaddr,
+                              pig_netif_ctx *netif,
                               const pig_target_addr_ctx *addr,
                               const int sockfd,
                               const unsigned char *gw_hwaddr,
                               const unsigned int nt_mask_addr[4],
                               const struct pktcraft_options_ctx user_options);
 
-static int sequential_pktcrafter(const pigsty_entry_ctx *pigsty,
+static int sequential_pktcrafter(const pigsty_entry_ctx **signatures,
                                  const size_t signatures_count,
-                                 pig_hwaddr_ctx *hwaddr,
+                                 pig_netif_ctx *netif,
                                  const pig_target_addr_ctx *addr,
                                  const int sockfd,
                                  const unsigned char *gw_hwaddr,
                                  const unsigned int nt_mask_addr[4],
                                  const struct pktcraft_options_ctx user_options);
 
-static int random_pktcrafter(const pigsty_entry_ctx *pigsty,
+static int random_pktcrafter(const pigsty_entry_ctx **signatures,
                              const size_t signatures_count,
-                             pig_hwaddr_ctx *hwaddr,
+                             pig_netif_ctx *netif,
                              const pig_target_addr_ctx *addr,
                              const int sockfd,
                              const unsigned char *gw_hwaddr,
@@ -77,25 +80,25 @@ static int random_pktcrafter(const pigsty_entry_ctx *pigsty,
                              const struct pktcraft_options_ctx user_options);
 
 static int single_pktcraft(const pigsty_entry_ctx *signature,
-                           pig_hwaddr_ctx *hwaddr,
+                           pig_netif_ctx *netif,
                            const pig_target_addr_ctx *addr,
                            const int sockfd,
                            const unsigned char *gw_hwaddr,
                            const unsigned int nt_mask_addr[4],
                            const struct pktcraft_options_ctx user_options);
 
-static int loop_pktcrafter(const pigsty_entry_ctx *pigsty,
+static int loop_pktcrafter(const pigsty_entry_ctx **signatures,
                            const size_t signatures_count,
-                           pig_hwaddr_ctx *hwaddr,
+                           pig_netif_ctx *netif,
                            const pig_target_addr_ctx *addr,
                            const int sockfd,
                            const unsigned char *gw_hwaddr,
                            const unsigned int nt_mask_addr[4],
                            const struct pktcraft_options_ctx user_options);
 
-static int glob_pktcrafter(const pigsty_entry_ctx *pigsty,
+static int glob_pktcrafter(const pigsty_entry_ctx **signatures,
                            const size_t signatures_count,
-                           pig_hwaddr_ctx *hwaddr,
+                           pig_netif_ctx *netif,
                            const pig_target_addr_ctx *addr,
                            const int sockfd,
                            const unsigned char *gw_hwaddr,
@@ -130,7 +133,8 @@ int pktcraft_help(void) {
     printf("usage: pig --signatures=file.0,file.1,(...),file.n "
            "--gateway=<gateway address> --net-mask=<network mask> "
            "--lo-iface=<network interface> [--timeout=<in msecs> "
-           "--no-echo --targets=n.n.n.n,n.*.*.*,n.n.n.n/n --no-gateway --loop=<random|sequential>]\n\n"
+           "--no-echo --targets=n.n.n.n,n.*.*.*,n.n.n.n/n --no-gateway --loop=<random|sequential> "
+           "--pps=<packets per second> --burst=<packets> --senders=<threads>]\n\n"
            "*** If you want to know more about some sub-task you should try: \"pig --sub-task=<name> --help\".\n"
            "    Do not you know any sub-task name? Welcome newbie! It is time to read some documentation: \"man pig\".\n___\n"
            "pig is Copyright (C) 2015-2017 by Rafael Santiago.\n\n"
@@ -194,7 +198,7 @@ int parse_pktcraft_options(struct pktcraft_options_ctx *options) {
     options->targets = get_option("targets", NULL);
     options->single_test = get_option("single-test", NULL);
 
-    return 0;
+    return parse_pktburst_options(options);
 }
 
 int exec_pktcraft(const struct pktcraft_options_ctx user_options) {
@@ -202,7 +206,8 @@ int exec_pktcraft(const struct pktcraft_options_ctx user_options) {
     size_t signatures_count = 0, addr_count = 0;
     pigsty_entry_ctx *signature = NULL, *sp = NULL;
     pig_target_addr_ctx *addr = NULL, *addr_p = NULL;
-    pig_hwaddr_ctx *hwaddr = NULL;
+    pig_netif_ctx *netif = NULL;
+    const pigsty_entry_ctx **signatures = NULL;
     int sockfd = -1;
     int exit_code = 1;
     int should_be_quiet = 0;
@@ -312,36 +317,48 @@ int exec_pktcraft(const struct pktcraft_options_ctx user_options) {
         return 1;
     }
 
-    exit_code = pktcrafter(pigsty, signatures_count, hwaddr, addr, sockfd, gw_hwaddr, nt_mask_addr, user_options);
+    //  INFO(Santiago): each signature is serialized only once, the crafters just patch the random fields.
+    mk_pigsty_entry_templates(pigsty, addr);
+
+    //  INFO(Santiago): the crafters pick signatures by index, walking the list for each packet is too expensive.
+    signatures = mk_pigsty_entry_array(pigsty, &signatures_count);
+
+    netif = mk_pig_netif(user_options.loiface);
+
+    exit_code = pktcrafter(signatures, signatures_count, netif, addr, sockfd, gw_hwaddr, nt_mask_addr, user_options);
 
     free(gw_hwaddr);
 
     if (pigsty != user_options.pigsty) {
         del_pigsty_entry(pigsty);
+    } else {
+        //  WARN(Santiago): the shell can change its signatures between runs, so its templates do not survive.
+        del_pigsty_entry_templates(pigsty);
     }
     del_pig_target_addr(addr);
-    del_pig_hwaddr(hwaddr);
+    del_pig_netif(netif);
+    free(signatures);
     deinit_raw_socket(sockfd);
 
     return exit_code;
 }
 
-static int singletest_pktcrafter(const pigsty_entry_ctx *pigsty,
+static int singletest_pktcrafter(const pigsty_entry_ctx **signatures,
                                  const size_t signatures_count,
-                                 pig_hwaddr_ctx *hwaddr,
+                                 pig_netif_ctx *netif,
                                  const pig_target_addr_ctx *addr,
                                  const int sockfd,
                                  const unsigned char *gw_hwaddr,
                                  const unsigned int nt_mask_addr[4],
                                  const struct pktcraft_options_ctx user_options) {
 
-    return single_pktcraft(get_pigsty_entry_by_index(rand() % signatures_count, pigsty),
-                           hwaddr, addr, sockfd, gw_hwaddr, nt_mask_addr, user_options);
+    return single_pktcraft(signatures[rand() % signatures_count],
+                           netif, addr, sockfd, gw_hwaddr, nt_mask_addr, user_options);
 }
 
-static int endless_pktcrafter(const pigsty_entry_ctx *pigsty,
+static int endless_pktcrafter(const pigsty_entry_ctx **signatures,
                               const size_t signatures_count,
-                              pig_hwaddr_ctx *hwaddr,
+                              pig_netif_ctx *netif,
                               const pig_target_addr_ctx *addr,
                               const int sockfd,
                               const unsigned char *gw_hwaddr,
@@ -361,26 +378,30 @@ static int endless_pktcrafter(const pigsty_entry_ctx *pigsty,
         return 1;
     }
 
-    return pktcrafter(pigsty, signatures_count, hwaddr, addr, sockfd, gw_hwaddr, nt_mask_addr, user_options);
+    return pktcrafter(signatures, signatures_count, netif, addr, sockfd, gw_hwaddr, nt_mask_addr, user_options);
 }
 
-static int sequential_pktcrafter(const pigsty_entry_ctx *pigsty,
+static int sequential_pktcrafter(const pigsty_entry_ctx **signatures,
                                  const size_t signatures_count,
-                                 pig_hwaddr_ctx *hwaddr,
+                                 pig_netif_ctx *netif,
                                  const pig_target_addr_ctx *addr,
                                  const int sockfd,
                                  const unsigned char *gw_hwaddr,
                                  const unsigned int nt_mask_addr[4],
                                  const struct pktcraft_options_ctx user_options) {
 
-    const pigsty_entry_ctx *p = pigsty;
+    size_t s = 0;
     int retval = 0;
 
+    if (should_pktburst(&user_options)) {
+        return pktburst(signatures, signatures_count, addr, gw_hwaddr, nt_mask_addr, PIG_BURST_LOOP_SEQUENTIAL, &user_options);
+    }
+
     while (!g_pig_out) {
 
-        retval = single_pktcraft(p, hwaddr, addr, sockfd, gw_hwaddr, nt_mask_addr, user_options);
+        retval = single_pktcraft(signatures[s], netif, addr, sockfd, gw_hwaddr, nt_mask_addr, user_options);
 
-        p = (p->next != NULL) ? p->next : pigsty;
+        s = (s + 1) % signatures_count;
 
         usleep(user_options.timeo);
     }
@@ -392,9 +413,9 @@ static int sequential_pktcrafter(const pigsty_entry_ctx *pigsty,
     return retval;
 }
 
-static int random_pktcrafter(const pigsty_entry_ctx *pigsty,
+static int random_pktcrafter(const pigsty_entry_ctx **signatures,
                              const size_t signatures_count,
-                             pig_hwaddr_ctx *hwaddr,
+                             pig_netif_ctx *netif,
                              const pig_target_addr_ctx *addr,
                              const int sockfd,
                              const unsigned char *gw_hwaddr,
@@ -406,14 +427,18 @@ static int random_pktcrafter(const pigsty_entry_ctx *pigsty,
 
     srand(time(0));
 
+    if (should_pktburst(&user_options)) {
+        return pktburst(signatures, signatures_count, addr, gw_hwaddr, nt_mask_addr, PIG_BURST_LOOP_RANDOM, &user_options);
+    }
+
     while (!g_pig_out) {
-        signature = get_pigsty_entry_by_index(rand() % signatures_count, pigsty);
+        signature = signatures[rand() % signatures_count];
 
         if (signature == NULL) {
             continue; //  WARN(Santiago): It should never happen.
         }
 
-        retval = single_pktcraft(signature, hwaddr, addr, sockfd, gw_hwaddr, nt_mask_addr, user_options);
+        retval = single_pktcraft(signature, netif, addr, sockfd, gw_hwaddr, nt_mask_addr, user_options);
 
         usleep(user_options.timeo);
     }
@@ -426,14 +451,14 @@ static int random_pktcrafter(const pigsty_entry_ctx *pigsty,
 }
 
 static int single_pktcraft(const pigsty_entry_ctx *signature,
-                           pig_hwaddr_ctx *hwaddr,
+                           pig_netif_ctx *netif,
                            const pig_target_addr_ctx *addr,
                            const int sockfd,
                            const unsigned char *gw_hwaddr,
                            const unsigned int nt_mask_addr[4],
                            const struct pktcraft_options_ctx user_options) {
 
-    int retval = (oink(signature, &hwaddr, addr, sockfd, gw_hwaddr, nt_mask_addr, user_options.loiface) != -1 ? 0 : 1);
+    int retval = (oink(signature, netif, addr, sockfd, gw_hwaddr, nt_mask_addr) != -1 ? 0 : 1);
     if (retval == 0) {
         if (!user_options.should_be_quiet) {
             printf("pig INFO: a packet based on signature \"%s\" was sent.\n", signature->signature_name);
@@ -528,9 +553,9 @@ static int is_targets_option_required(const pigsty_entry_ctx *entries) {
     return 0;
 }
 
-static int loop_pktcrafter(const pigsty_entry_ctx *pigsty,
+static int loop_pktcrafter(const pigsty_entry_ctx **signatures,
                            const size_t signatures_count,
-                           pig_hwaddr_ctx *hwaddr,
+                           pig_netif_ctx *netif,
                            const pig_target_addr_ctx *addr,
                            const int sockfd,
                            const unsigned char *gw_hwaddr,
@@ -539,9 +564,13 @@ static int loop_pktcrafter(const pigsty_entry_ctx *pigsty,
     unsigned int t;
     int exit_code = 1;
 
+    if (should_pktburst(&user_options)) {
+        return pktburst(signatures, signatures_count, addr, gw_hwaddr, nt_mask_addr, PIG_BURST_LOOP_RANDOM, &user_options);
+    }
+
     for (t = 0; t < user_options.times_nr && !g_pig_out; t++) {
-        exit_code = single_pktcraft(get_pigsty_entry_by_index(rand() % signatures_count, pigsty),
-                                       hwaddr, addr, sockfd, gw_hwaddr, nt_mask_addr, user_options);
+        exit_code = single_pktcraft(signatures[rand() % signatures_count],
+                                       netif, addr, sockfd, gw_hwaddr, nt_mask_addr, user_options);
         usleep(user_options.timeo);
     }
 
@@ -552,29 +581,30 @@ int pktcraft_aborted(void) {
     return g_pig_out;
 }
 
-static int glob_pktcrafter(const pigsty_entry_ctx *pigsty,
+static int glob_pktcrafter(const pigsty_entry_ctx **signatures,
                            const size_t signatures_count,
-                           pig_hwaddr_ctx *hwaddr,
+                           pig_netif_ctx *netif,
                            const pig_target_addr_ctx *addr,
                            const int sockfd,
                            const unsigned char *gw_hwaddr,
                            const unsigned int nt_mask_addr[4],
                            const struct pktcraft_options_ctx user_options) {
-    const pigsty_entry_ctx *sp = pigsty;
+    const pigsty_entry_ctx *sp = NULL;
+    size_t s = 0;
     int exit_code = 0;
     int t = 0;
 
-    while (sp != NULL && !g_pig_out) {
+    for (s = 0; s < signatures_count && !g_pig_out; s++) {
+        sp = signatures[s];
         if (strglob(sp->signature_name, user_options.globmask)) {
-            exit_code = single_pktcraft(sp, hwaddr, addr, sockfd, gw_hwaddr, nt_mask_addr, user_options);
+            exit_code = single_pktcraft(sp, netif, addr, sockfd, gw_hwaddr, nt_mask_addr, user_options);
             usleep(user_options.timeo);
 
             for (t = 1; t < user_options.times_nr && !g_pig_out; t++) {
-                exit_code = single_pktcraft(sp, hwaddr, addr, sockfd, gw_hwaddr, nt_mask_addr, user_options);
+                exit_code = single_pktcraft(sp, netif, addr, sockfd, gw_hwaddr, nt_mask_addr, user_options);
                 usleep(user_options.timeo);
             }
         }
-        sp = sp->next;
     }
 
     return exit_code;
@@ -23,6 +23,9 @@ struct pktcraft_options_ctx {
     unsigned int times_nr;
     pigsty_entry_ctx *pigsty;
     char *globmask;
+    unsigned int pps;
+    unsigned int burst_size;
+    unsigned int senders_nr;
 };
 
 void stop_pktcraft(void);
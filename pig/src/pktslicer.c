@@ -115,9 +115,10 @@ void set_pkt_field(const char *field, unsigned char *buf, size_t buf_size, const
 void *get_pkt_field(const char *field, const unsigned char *buf, const size_t buf_size, size_t *field_size) {
     size_t p = 0;
     const unsigned char *mbuf_end = NULL;
-    static unsigned int slice = 0;
-    static unsigned char mbuf[0xffff] = "";
-    static size_t mbuf_size = 0;
+    //  INFO(Santiago): Thread local, pcap2pigsty() may slice packets from several threads at once.
+    static __thread unsigned int slice = 0;
+    static __thread unsigned char mbuf[0xffff] = "";
+    static __thread size_t mbuf_size = 0;
     get_pkt_data_func get_data = NULL;
     void *data = NULL;
 
@@ -125,8 +126,8 @@ void *get_pkt_field(const char *field, const unsigned char *buf, const size_t bu
         return NULL;
     }
 
-    memcpy(mbuf, buf, buf_size);
-    mbuf_size = buf_size;
+    mbuf_size = (buf_size < sizeof(mbuf)) ? buf_size : sizeof(mbuf);
+    memcpy(mbuf, buf, mbuf_size);
     mbuf_end = mbuf + mbuf_size;
     for (p = 0; p < g_pkt_fields_size; p++) {
         if (strcmp(g_pkt_fields[p].name, field) == 0) {
@@ -0,0 +1,481 @@
+/*
+ *                                Copyright (C) 2017 by Rafael Santiago
+ *
+ * This is a free software. You can redistribute it and/or modify under
+ * the terms of the GNU General Public License version 2.
+ *
+ */
+#include "pkttmpl.h"
+#include "memory.h"
+#include "mkpkt.h"
+#include "mkrnd.h"
+#include "lists.h"
+#include "pigsty.h"
+#include "eth.h"
+#include <string.h>
+
+//  INFO(Santiago): A template is the packet produced by mk_pkt() for a signature, already wrapped into
+//                  an Ethernet frame. Every field that mk_pkt() would randomize is recorded as a slot and
+//                  only those slots are rewritten at send time. The checksums are fixed up incrementally
+//                  (RFC-1624) instead of being evaluated again over the whole datagram.
+
+#define PIG_PKT_TMPL_IP4_HDR_SIZE 20
+
+#define PIG_PKT_TMPL_TCP_OFFSET PIG_PKT_TMPL_IP4_HDR_SIZE
+
+static void add_pkt_slot(pig_pkt_template_ctx *tmpl, const pig_pkt_slot_t kind, const pig_rnd_addr_t rnd_addr);
+
+static pig_rnd_addr_t get_rnd_addr_type(const pigsty_field_ctx *fp);
+
+static unsigned int mk_rnd_addr(const pig_rnd_addr_t rnd_addr, pig_target_addr_ctx *addrs);
+
+static unsigned short mk_rnd_port(void);
+
+static unsigned short get_dgram_u16(const pig_pkt_template_ctx *tmpl, const size_t offset);
+
+static void put_dgram_u16(pig_pkt_template_ctx *tmpl, const size_t offset, const unsigned short value, unsigned int *ip_sum, unsigned int *l4_sum);
+
+static void put_dgram_u32(pig_pkt_template_ctx *tmpl, const size_t offset, const unsigned int value, unsigned int *ip_sum, unsigned int *l4_sum);
+
+static void add_to_chsum_delta(unsigned int *sum, const unsigned short old_value, const unsigned short new_value);
+
+static unsigned short fixup_chsum(const unsigned short chsum, unsigned int sum);
+
+static void render_tcp_flags(pig_pkt_template_ctx *tmpl, const pig_pkt_slot_ctx *slot, unsigned int *ip_sum, unsigned int *l4_sum);
+
+static int mk_ipv4_slots(pig_pkt_template_ctx *tmpl, pigsty_conf_set_ctx *conf);
+
+static void add_pkt_slot(pig_pkt_template_ctx *tmpl, const pig_pkt_slot_t kind, const pig_rnd_addr_t rnd_addr) {
+    pig_pkt_slot_ctx *slot = NULL;
+    if (tmpl->slot_nr >= kMaxPigPktSlots) {
+        return;
+    }
+    slot = &tmpl->slot[tmpl->slot_nr++];
+    slot->kind = kind;
+    slot->rnd_addr = rnd_addr;
+    slot->rnd_reserv = 0;
+    slot->flags_mask = 0;
+}
+
+static pig_rnd_addr_t get_rnd_addr_type(const pigsty_field_ctx *fp) {
+    if (fp == NULL || fp->data == NULL || fp->dsize <= 4) {
+        return kRndAddrNone;
+    }
+    if (strcmp(fp->data, "european-ip") == 0) {
+        return kRndAddrEuropean;
+    } else if (strcmp(fp->data, "asian-ip") == 0) {
+        return kRndAddrAsian;
+    } else if (strcmp(fp->data, "south-american-ip") == 0) {
+        return kRndAddrSouthAmerican;
+    } else if (strcmp(fp->data, "north-american-ip") == 0) {
+        return kRndAddrNorthAmerican;
+    } else if (strcmp(fp->data, "user-defined-ip") == 0) {
+        return kRndAddrUserDefined;
+    }
+    return kRndAddrNone;
+}
+
+static unsigned int mk_rnd_addr(const pig_rnd_addr_t rnd_addr, pig_target_addr_ctx *addrs) {
+    size_t addrs_count = 0;
+
+    switch (rnd_addr) {
+        case kRndAddrEuropean:
+            return mk_rnd_european_ipv4();
+
+        case kRndAddrAsian:
+            return mk_rnd_asian_ipv4();
+
+        case kRndAddrSouthAmerican:
+            return mk_rnd_south_american_ipv4();
+
+        case kRndAddrNorthAmerican:
+            return mk_rnd_north_american_ipv4();
+
+        case kRndAddrUserDefined:
+            addrs_count = get_pig_target_addr_count(addrs);
+            if (addrs_count > 0) {
+                return get_ipv4_pig_target_by_index(rand() % addrs_count, addrs);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+static unsigned short mk_rnd_port(void) {
+    unsigned short port = 0;
+    do {
+        port = mk_rnd_u16();
+    } while (port == 0);
+    return port;
+}
+
+static unsigned short get_dgram_u16(const pig_pkt_template_ctx *tmpl, const size_t offset) {
+    return (((unsigned short)tmpl->dgram[offset]) << 8) | tmpl->dgram[offset + 1];
+}
+
+static void add_to_chsum_delta(unsigned int *sum, const unsigned short old_value, const unsigned short new_value) {
+    if (sum != NULL) {
+        *sum += ((~old_value) & 0xffff) + new_value;
+    }
+}
+
+static unsigned short fixup_chsum(const unsigned short chsum, unsigned int sum) {
+    //  INFO(Santiago): HC' = ~(~HC + ~m + m') where sum already holds all (~m + m') pairs.
+    sum += ((~chsum) & 0xffff);
+    while (sum >> 16) {
+        sum = (sum >> 16) + (sum & 0x0000ffff);
+    }
+    return (unsigned short)(~sum);
+}
+
+static void put_dgram_u16(pig_pkt_template_ctx *tmpl, const size_t offset, const unsigned short value, unsigned int *ip_sum, unsigned int *l4_sum) {
+    unsigned short old_value = get_dgram_u16(tmpl, offset);
+    tmpl->dgram[offset] = value >> 8;
+    tmpl->dgram[offset + 1] = value & 0x00ff;
+    //  WARN(Santiago): pig's ip checksum also covers the ip payload, so every patched word goes to ip_sum.
+    add_to_chsum_delta(ip_sum, old_value, value);
+    add_to_chsum_delta(l4_sum, old_value, value);
+}
+
+static void put_dgram_u32(pig_pkt_template_ctx *tmpl, const size_t offset, const unsigned int value, unsigned int *ip_sum, unsigned int *l4_sum) {
+    put_dgram_u16(tmpl, offset, value >> 16, ip_sum, l4_sum);
+    put_dgram_u16(tmpl, offset + 2, value & 0x0000ffff, ip_sum, l4_sum);
+}
+
+static void render_tcp_flags(pig_pkt_template_ctx *tmpl, const pig_pkt_slot_ctx *slot, unsigned int *ip_sum, unsigned int *l4_sum) {
+    size_t offset = PIG_PKT_TMPL_TCP_OFFSET + 12;
+    unsigned char len = tmpl->dgram[offset] >> 4;
+    unsigned char reserv = ((tmpl->dgram[offset] & 0x0f) << 2) | (tmpl->dgram[offset + 1] >> 6);
+    unsigned char flags = tmpl->dgram[offset + 1] & 0x3f;
+    unsigned short old_value = 0, new_value = 0;
+
+    //  WARN(Santiago): eval_tcp_ip4_chsum() sums (len << 12 | reserv << 6 | flags), which is not the
+    //                  word that mk_tcp_buffer() puts on the wire, so both checksums get their own delta.
+    old_value = ((unsigned short)len << 12) | ((unsigned short)reserv << 6) | flags;
+
+    if (slot->rnd_reserv) {
+        reserv = mk_rnd_u6();
+    }
+    flags = mk_rnd_u6() | slot->flags_mask;
+
+    new_value = ((unsigned short)len << 12) | ((unsigned short)reserv << 6) | flags;
+    add_to_chsum_delta(l4_sum, old_value, new_value);
+
+    new_value = ((unsigned short)(len & 0x0f) << 12) |
+                ((unsigned short)((reserv & 0x3e) >> 2) << 8) |
+                ((unsigned short)(reserv & 0x03) << 6) | flags;
+    put_dgram_u16(tmpl, offset, new_value, ip_sum, NULL);
+}
+
+static int mk_ipv4_slots(pig_pkt_template_ctx *tmpl, pigsty_conf_set_ctx *conf) {
+    pigsty_field_ctx *fp = NULL;
+    pigsty_conf_set_ctx *cp = NULL;
+    pig_rnd_addr_t rnd_addr = kRndAddrNone;
+    unsigned char flags_mask = 0;
+
+    if (get_pigsty_conf_set_field(kIpv4_tos, conf) == NULL) {
+        add_pkt_slot(tmpl, kSlotIpv4Tos, kRndAddrNone);
+    }
+
+    if (get_pigsty_conf_set_field(kIpv4_id, conf) == NULL) {
+        add_pkt_slot(tmpl, kSlotIpv4Id, kRndAddrNone);
+    }
+
+    if ((rnd_addr = get_rnd_addr_type(get_pigsty_conf_set_field(kIpv4_src, conf))) != kRndAddrNone) {
+        add_pkt_slot(tmpl, kSlotIpv4Src, rnd_addr);
+        tmpl->has_rnd_addr = 1;
+    }
+
+    if ((rnd_addr = get_rnd_addr_type(get_pigsty_conf_set_field(kIpv4_dst, conf))) != kRndAddrNone) {
+        add_pkt_slot(tmpl, kSlotIpv4Dst, rnd_addr);
+        tmpl->has_rnd_addr = 1;
+    }
+
+    tmpl->l4_proto = tmpl->dgram[9];
+
+    switch (tmpl->l4_proto) {
+        case 6:
+            if (tmpl->dgram_size < PIG_PKT_TMPL_TCP_OFFSET + 20) {
+                return 0;
+            }
+
+            fp = get_pigsty_conf_set_field(kTcp_checksum, conf);
+            tmpl->l4_chsum_auto = (fp == NULL || *(unsigned short *)fp->data == 0);
+
+            for (cp = conf; cp != NULL; cp = cp->next) {
+                switch (cp->field->index) {
+                    case kTcp_urg:
+                        flags_mask |= (*(unsigned char *)cp->field->data) << 5;
+                        break;
+
+                    case kTcp_ack:
+                        flags_mask |= (*(unsigned char *)cp->field->data) << 4;
+                        break;
+
+                    case kTcp_psh:
+                        flags_mask |= (*(unsigned char *)cp->field->data) << 3;
+                        break;
+
+                    case kTcp_rst:
+                        flags_mask |= (*(unsigned char *)cp->field->data) << 2;
+                        break;
+
+                    case kTcp_syn:
+                        flags_mask |= (*(unsigned char *)cp->field->data) << 1;
+                        break;
+
+                    case kTcp_fin:
+                        flags_mask |= *(unsigned char *)cp->field->data;
+                        break;
+
+                    default:
+                        break;
+                }
+            }
+
+            if (flags_mask > 0x3f) {
+                //  WARN(Santiago): those flag bits would overflow into the reserved bits, let mk_pkt() handle it.
+                return 0;
+            }
+
+            if (get_pigsty_conf_set_field(kTcp_src, conf) == NULL) {
+                add_pkt_slot(tmpl, kSlotTcpSrc, kRndAddrNone);
+            }
+
+            if (get_pigsty_conf_set_field(kTcp_dst, conf) == NULL) {
+                add_pkt_slot(tmpl, kSlotTcpDst, kRndAddrNone);
+            }
+
+            if (get_pigsty_conf_set_field(kTcp_seq, conf) == NULL) {
+                add_pkt_slot(tmpl, kSlotTcpSeq, kRndAddrNone);
+            }
+
+            if (get_pigsty_conf_set_field(kTcp_ackno, conf) == NULL) {
+                add_pkt_slot(tmpl, kSlotTcpAckno, kRndAddrNone);
+            }
+
+            add_pkt_slot(tmpl, kSlotTcpFlags, kRndAddrNone);
+            tmpl->slot[tmpl->slot_nr - 1].rnd_reserv = (get_pigsty_conf_set_field(kTcp_reserv, conf) == NULL);
+            tmpl->slot[tmpl->slot_nr - 1].flags_mask = flags_mask;
+
+            if (get_pigsty_conf_set_field(kTcp_wsize, conf) == NULL) {
+                add_pkt_slot(tmpl, kSlotTcpWsize, kRndAddrNone);
+            }
+
+            if (get_pigsty_conf_set_field(kTcp_urgp, conf) == NULL) {
+                add_pkt_slot(tmpl, kSlotTcpUrgp, kRndAddrNone);
+            }
+            break;
+
+        case 17:
+            if (tmpl->dgram_size < PIG_PKT_TMPL_TCP_OFFSET + 8) {
+                return 0;
+            }
+
+            fp = get_pigsty_conf_set_field(kUdp_checksum, conf);
+            tmpl->l4_chsum_auto = (fp == NULL || *(unsigned short *)fp->data == 0);
+
+            if (get_pigsty_conf_set_field(kUdp_src, conf) == NULL) {
+                add_pkt_slot(tmpl, kSlotUdpSrc, kRndAddrNone);
+            }
+
+            if (get_pigsty_conf_set_field(kUdp_dst, conf) == NULL) {
+                add_pkt_slot(tmpl, kSlotUdpDst, kRndAddrNone);
+            }
+            break;
+
+        default:
+            //  INFO(Santiago): icmp and unknown protocols do not depend on any randomized field.
+            tmpl->l4_chsum_auto = 0;
+            break;
+    }
+
+    return 1;
+}
+
+pig_pkt_template_ctx *mk_pkt_template(pigsty_conf_set_ctx *conf, pig_target_addr_ctx *addrs) {
+    pig_pkt_template_ctx *tmpl = NULL;
+    pigsty_field_ctx *fp = NULL;
+    unsigned char *dgram = NULL;
+    size_t dgram_size = 0;
+    unsigned short ether_type = 0;
+    int is_ipv4 = 0;
+
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    is_ipv4 = (get_pigsty_conf_set_field(kIpv4_version, conf) != NULL);
+
+    if (!is_ipv4 && !is_arp_packet(conf)) {
+        //  INFO(Santiago): user defined Ethernet frames keep going through mk_pkt() on every send.
+        return NULL;
+    }
+
+    if (is_ipv4) {
+        fp = get_pigsty_conf_set_field(kIpv4_ihl, conf);
+        if (fp != NULL && *(unsigned char *)fp->data < 5) {
+            return NULL;
+        }
+    }
+
+    dgram = mk_pkt(conf, addrs, &dgram_size);
+
+    if (dgram == NULL || (is_ipv4 && dgram_size < PIG_PKT_TMPL_IP4_HDR_SIZE)) {
+        free(dgram);
+        return NULL;
+    }
+
+    tmpl = (pig_pkt_template_ctx *) pig_newseg(sizeof(pig_pkt_template_ctx));
+    memset(tmpl, 0, sizeof(pig_pkt_template_ctx));
+
+    tmpl->frame_size = PIG_PKT_TMPL_ETH_HDR_SIZE + dgram_size;
+    tmpl->frame = (unsigned char *) pig_newseg(tmpl->frame_size);
+    memset(tmpl->frame, 0, PIG_PKT_TMPL_ETH_HDR_SIZE);
+    tmpl->dgram = tmpl->frame + PIG_PKT_TMPL_ETH_HDR_SIZE;
+    tmpl->dgram_size = dgram_size;
+    memcpy(tmpl->dgram, dgram, dgram_size);
+    free(dgram);
+
+    tmpl->is_arp = !is_ipv4;
+
+    fp = get_pigsty_conf_set_field(kEth_type, conf);
+
+    if (fp == NULL) {
+        ether_type = (tmpl->is_arp) ? ETHER_TYPE_ARP : ETHER_TYPE_IP;
+    } else {
+        ether_type = *(unsigned short *)fp->data;
+    }
+
+    tmpl->frame[12] = ether_type >> 8;
+    tmpl->frame[13] = ether_type & 0xff;
+
+    if (is_ipv4 && !mk_ipv4_slots(tmpl, conf)) {
+        del_pkt_template(tmpl);
+        return NULL;
+    }
+
+    return tmpl;
+}
+
+void render_pkt_template(pig_pkt_template_ctx *tmpl, pig_target_addr_ctx *addrs) {
+    unsigned int ip_sum = 0, l4_sum = 0;
+    unsigned int *l4_sum_p = NULL, *l4_pseudo_p = NULL;
+    const pig_pkt_slot_ctx *slot = NULL;
+    size_t s = 0, offset = 0;
+
+    if (tmpl == NULL || tmpl->slot_nr == 0) {
+        return;
+    }
+
+    if (tmpl->l4_chsum_auto) {
+        l4_sum_p = &l4_sum;
+        //  INFO(Santiago): tcp and udp checksums also cover the ip addresses through the pseudo header.
+        l4_pseudo_p = &l4_sum;
+    }
+
+    for (s = 0; s < tmpl->slot_nr; s++) {
+        slot = &tmpl->slot[s];
+        switch (slot->kind) {
+            case kSlotIpv4Tos:
+                put_dgram_u16(tmpl, 0, ((unsigned short)tmpl->dgram[0] << 8) | mk_rnd_u8(), &ip_sum, NULL);
+                break;
+
+            case kSlotIpv4Id:
+                put_dgram_u16(tmpl, 4, mk_rnd_u16(), &ip_sum, NULL);
+                break;
+
+            case kSlotIpv4Src:
+                put_dgram_u32(tmpl, 12, mk_rnd_addr(slot->rnd_addr, addrs), &ip_sum, l4_pseudo_p);
+                break;
+
+            case kSlotIpv4Dst:
+                put_dgram_u32(tmpl, 16, mk_rnd_addr(slot->rnd_addr, addrs), &ip_sum, l4_pseudo_p);
+                break;
+
+            case kSlotTcpSrc:
+            case kSlotUdpSrc:
+                put_dgram_u16(tmpl, PIG_PKT_TMPL_TCP_OFFSET, mk_rnd_port(), &ip_sum, l4_sum_p);
+                break;
+
+            case kSlotTcpDst:
+            case kSlotUdpDst:
+                put_dgram_u16(tmpl, PIG_PKT_TMPL_TCP_OFFSET + 2, mk_rnd_port(), &ip_sum, l4_sum_p);
+                break;
+
+            case kSlotTcpSeq:
+                put_dgram_u32(tmpl, PIG_PKT_TMPL_TCP_OFFSET + 4, mk_rnd_u16(), &ip_sum, l4_sum_p);
+                break;
+
+            case kSlotTcpAckno:
+                put_dgram_u32(tmpl, PIG_PKT_TMPL_TCP_OFFSET + 8, mk_rnd_u16(), &ip_sum, l4_sum_p);
+                break;
+
+            case kSlotTcpFlags:
+                render_tcp_flags(tmpl, slot, &ip_sum, l4_sum_p);
+                break;
+
+            case kSlotTcpWsize:
+                put_dgram_u16(tmpl, PIG_PKT_TMPL_TCP_OFFSET + 14, mk_rnd_u16(), &ip_sum, l4_sum_p);
+                break;
+
+            case kSlotTcpUrgp:
+                put_dgram_u16(tmpl, PIG_PKT_TMPL_TCP_OFFSET + 18, mk_rnd_u16(), &ip_sum, l4_sum_p);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    if (tmpl->l4_chsum_auto) {
+        offset = PIG_PKT_TMPL_TCP_OFFSET + ((tmpl->l4_proto == 6) ? 16 : 6);
+        put_dgram_u16(tmpl, offset, fixup_chsum(get_dgram_u16(tmpl, offset), l4_sum), &ip_sum, NULL);
+    }
+
+    if (!tmpl->is_arp) {
+        put_dgram_u16(tmpl, 10, fixup_chsum(get_dgram_u16(tmpl, 10), ip_sum), NULL, NULL);
+    }
+}
+
+pig_pkt_template_ctx *dup_pkt_template(const pig_pkt_template_ctx *tmpl) {
+    pig_pkt_template_ctx *dup = NULL;
+    if (tmpl == NULL) {
+        return NULL;
+    }
+    dup = (pig_pkt_template_ctx *) pig_newseg(sizeof(pig_pkt_template_ctx));
+    memcpy(dup, tmpl, sizeof(pig_pkt_template_ctx));
+    dup->frame = (unsigned char *) pig_newseg(tmpl->frame_size);
+    memcpy(dup->frame, tmpl->frame, tmpl->frame_size);
+    dup->dgram = dup->frame + PIG_PKT_TMPL_ETH_HDR_SIZE;
+    return dup;
+}
+
+void del_pkt_template(pig_pkt_template_ctx *tmpl) {
+    if (tmpl == NULL) {
+        return;
+    }
+    free(tmpl->frame);
+    free(tmpl);
+}
+
+void mk_pigsty_entry_templates(pigsty_entry_ctx *entries, pig_target_addr_ctx *addrs) {
+    pigsty_entry_ctx *ep = NULL;
+    for (ep = entries; ep != NULL; ep = ep->next) {
+        if (ep->tmpl == NULL) {
+            ep->tmpl = mk_pkt_template(ep->conf, addrs);
+        }
+    }
+}
+
+void del_pigsty_entry_templates(pigsty_entry_ctx *entries) {
+    pigsty_entry_ctx *ep = NULL;
+    for (ep = entries; ep != NULL; ep = ep->next) {
+        del_pkt_template(ep->tmpl);
+        ep->tmpl = NULL;
+    }
+}
@@ -0,0 +1,27 @@
+/*
+ *                                Copyright (C) 2017 by Rafael Santiago
+ *
+ * This is a free software. You can redistribute it and/or modify under
+ * the terms of the GNU General Public License version 2.
+ *
+ */
+#ifndef PIG_PKTTMPL_H
+#define PIG_PKTTMPL_H 1
+
+#include "types.h"
+
+#define PIG_PKT_TMPL_ETH_HDR_SIZE 14
+
+pig_pkt_template_ctx *mk_pkt_template(pigsty_conf_set_ctx *conf, pig_target_addr_ctx *addrs);
+
+void render_pkt_template(pig_pkt_template_ctx *tmpl, pig_target_addr_ctx *addrs);
+
+pig_pkt_template_ctx *dup_pkt_template(const pig_pkt_template_ctx *tmpl);
+
+void del_pkt_template(pig_pkt_template_ctx *tmpl);
+
+void mk_pigsty_entry_templates(pigsty_entry_ctx *entries, pig_target_addr_ctx *addrs);
+
+void del_pigsty_entry_templates(pigsty_entry_ctx *entries);
+
+#endif
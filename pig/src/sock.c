@@ -40,6 +40,21 @@ int inject(const unsigned char *packet, const size_t packet_size, const int sock
 #endif
 }
 
+int inject_batch(const unsigned char **packets, const size_t *packets_size, const size_t packets_nr, const int sockfd) {
+#ifdef __linux
+    return lin_rsk_sendmmsg(packets, packets_size, packets_nr, sockfd);
+#else
+    size_t p;
+    int retval = 0;
+    for (p = 0; p < packets_nr; p++) {
+        if (inject(packets[p], packets_size[p], sockfd) != -1) {
+            retval++;
+        }
+    }
+    return retval;
+#endif
+}
+
 int inject_lo(const unsigned char *packet, const size_t packet_size, const int sockfd) {
 #ifdef __linux
     return lin_rsk_lo_sendto(packet, packet_size, sockfd);
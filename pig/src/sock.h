@@ -16,6 +16,8 @@ int init_loopback_raw_socket(void);
 
 int inject(const unsigned char *packet, const size_t packet_size, const int sockfd);
 
+int inject_batch(const unsigned char **packets, const size_t *packets_size, const size_t packets_nr, const int sockfd);
+
 int inject_lo(const unsigned char *packet, const size_t packet_size, const int sockfd);
 
 void deinit_raw_socket(const int sockfd);
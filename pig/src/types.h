@@ -34,9 +34,46 @@ typedef struct _pigsty_conf_set {
     struct _pigsty_conf_set *next;
 }pigsty_conf_set_ctx;
 
+typedef enum _pig_pkt_slot_t {
+    kSlotIpv4Tos = 0, kSlotIpv4Id, kSlotIpv4Src, kSlotIpv4Dst,
+    kSlotTcpSrc, kSlotTcpDst, kSlotTcpSeq, kSlotTcpAckno, kSlotTcpFlags, kSlotTcpWsize, kSlotTcpUrgp,
+    kSlotUdpSrc, kSlotUdpDst, kMaxPigPktSlots
+}pig_pkt_slot_t;
+
+typedef enum _pig_rnd_addr_t {
+    kRndAddrNone = 0,
+    kRndAddrEuropean,
+    kRndAddrAsian,
+    kRndAddrSouthAmerican,
+    kRndAddrNorthAmerican,
+    kRndAddrUserDefined
+}pig_rnd_addr_t;
+
+typedef struct _pig_pkt_slot {
+    pig_pkt_slot_t kind;
+    pig_rnd_addr_t rnd_addr;
+    unsigned char rnd_reserv;
+    unsigned char flags_mask;
+}pig_pkt_slot_ctx;
+
+typedef struct _pig_pkt_template {
+    unsigned char *frame;
+    size_t frame_size;
+    unsigned char *dgram;
+    size_t dgram_size;
+    int is_arp;
+    int has_rnd_addr;
+    int mac_ready;
+    int l4_proto;
+    int l4_chsum_auto;
+    pig_pkt_slot_ctx slot[kMaxPigPktSlots];
+    size_t slot_nr;
+}pig_pkt_template_ctx;
+
 typedef struct _pigsty_entry {
     char *signature_name;
     pigsty_conf_set_ctx *conf;
+    pig_pkt_template_ctx *tmpl;
     struct _pigsty_entry *next;
 }pigsty_entry_ctx;
 
@@ -63,6 +100,15 @@ typedef struct _pig_hwaddr {
     struct _pig_hwaddr *next;
 }pig_hwaddr_ctx;
 
+#define PIG_NETIF_HWADDR_BUCKETS_NR 1024
+
+typedef struct _pig_netif {
+    char *iface;
+    unsigned int lo_addr[4];
+    int sockfd_lo;
+    pig_hwaddr_ctx *hwaddr[PIG_NETIF_HWADDR_BUCKETS_NR];
+}pig_netif_ctx;
+
 typedef struct _pcap_global_header_t {
     unsigned int magic_number;
     unsigned short version_major;
@@ -92,4 +138,15 @@ typedef struct _pcap_file_ctx {
     char *path;
 }pcap_file_ctx;
 
+typedef struct _pcap_stream_ctx {
+    pcap_global_header_t hdr;
+    int is_pcapng;
+    int swapped;
+    unsigned char *data;
+    size_t data_size;
+    size_t offset;
+    unsigned long long *if_tsresol;
+    size_t if_nr;
+}pcap_stream_ctx;
+
 #endif
@@ -23,6 +23,8 @@
 #include "../pktslicer.h"
 #include "../pcap2pigsty.h"
 #include "../strglob.h"
+#include "../pkttmpl.h"
+#include "../netif.h"
 #include "pcap_data.h"
 #include <cutest.h>
 #include <stdlib.h>
@@ -362,6 +364,27 @@ CUTE_TEST_CASE(pigsty_entry_ctx_tests)
     CUTE_ASSERT(pigsty == NULL);
 CUTE_TEST_CASE_END
 
+CUTE_TEST_CASE(pigsty_entry_array_tests)
+    pigsty_entry_ctx *pigsty = NULL;
+    const pigsty_entry_ctx **signatures = NULL;
+    size_t signatures_nr = 0, s = 0;
+    char signature_name[20];
+    CUTE_CHECK("signatures != NULL", mk_pigsty_entry_array(NULL, &signatures_nr) == NULL);
+    CUTE_CHECK("signatures_nr != 0", signatures_nr == 0);
+    for (s = 0; s < 100; s++) {
+        sprintf(signature_name, "oink-%d", s);
+        pigsty = add_signature_to_pigsty_entry(pigsty, signature_name);
+    }
+    signatures = mk_pigsty_entry_array(pigsty, &signatures_nr);
+    CUTE_ASSERT(signatures != NULL);
+    CUTE_CHECK("signatures_nr != 100", signatures_nr == 100);
+    for (s = 0; s < signatures_nr; s++) {
+        CUTE_CHECK("signatures[s] != get_pigsty_entry_by_index(s)", signatures[s] == get_pigsty_entry_by_index(s, pigsty));
+    }
+    free(signatures);
+    del_pigsty_entry(pigsty);
+CUTE_TEST_CASE_END
+
 CUTE_TEST_CASE(pigsty_conf_set_ctx_tests)
     pigsty_entry_ctx *pigsty = NULL;
     pigsty_conf_set_ctx *cp = NULL;
@@ -750,6 +773,34 @@ CUTE_TEST_CASE(pig_hwaddr_ctx_tests)
     del_pig_hwaddr(hwaddr);
 CUTE_TEST_CASE_END
 
+CUTE_TEST_CASE(pig_netif_ctx_tests)
+    pig_netif_ctx *netif = NULL;
+    unsigned char *p = NULL;
+    unsigned char mac[6];
+    unsigned int nt_addr[4] = { 0, 0, 0, 0 };
+    unsigned int a = 0;
+    netif = mk_pig_netif(NULL);
+    CUTE_ASSERT(netif != NULL);
+    CUTE_CHECK("netif->sockfd_lo != -1", netif->sockfd_lo == -1);
+    for (a = 0; a < 5000; a++) {
+        nt_addr[0] = 0x0a000000 | a;
+        memcpy(mac, &nt_addr[0], sizeof(nt_addr[0]));
+        mac[4] = 0xbe;
+        mac[5] = 0xef;
+        p = add_pig_netif_hwaddr(netif, mac, nt_addr, 4);
+        CUTE_ASSERT(p != NULL);
+    }
+    for (a = 0; a < 5000; a++) {
+        nt_addr[0] = 0x0a000000 | a;
+        p = get_pig_netif_hwaddr(netif, nt_addr);
+        CUTE_ASSERT(p != NULL);
+        CUTE_CHECK("unexpected MAC", memcmp(p, &nt_addr[0], sizeof(nt_addr[0])) == 0 && p[4] == 0xbe && p[5] == 0xef);
+    }
+    nt_addr[0] = 0x7f000001;
+    CUTE_CHECK("p != NULL", get_pig_netif_hwaddr(netif, nt_addr) == NULL);
+    del_pig_netif(netif);
+CUTE_TEST_CASE_END
+
 CUTE_TEST_CASE(eth_frame_making_tests)
     unsigned char *expected_frame = (unsigned char *)"\xba\xba\xca\xde\xad\xbe\xde\xad\xbe\xef\xde\xad\x08\x00";
     unsigned char *working_buffer = NULL;
@@ -899,6 +950,208 @@ CUTE_TEST_CASE(pcap_loading_tests)
     remove("pcap-test.pcap");
 CUTE_TEST_CASE_END
 
+unsigned int swap_u32(const unsigned int value) {
+    return (value >> 24) | ((value >> 8) & 0x0000ff00) | ((value << 8) & 0x00ff0000) | (value << 24);
+}
+
+void fwrite_swapped_u32(FILE *fp, const unsigned int value) {
+    unsigned int swapped = swap_u32(value);
+    fwrite(&swapped, 1, sizeof(swapped), fp);
+}
+
+void fwrite_u32(FILE *fp, const unsigned int value) {
+    fwrite(&value, 1, sizeof(value), fp);
+}
+
+CUTE_TEST_CASE(pcap_stream_tests)
+    FILE *pcap = NULL, *swapped_pcap = NULL, *pcapng = NULL;
+    pcap_stream_ctx *stream = NULL, *swapped_stream = NULL, *pcapng_stream = NULL;
+    pcap_file_ctx *pcap_file = NULL;
+    pcap_record_ctx record, swapped_record, pcapng_record, *rp = NULL;
+    size_t records_nr = 0, loaded_nr = 0, pad = 0;
+    unsigned long long ts = 0;
+    unsigned short u16 = 0;
+    const unsigned char zeros[4] = { 0, 0, 0, 0 };
+
+    pcap = fopen("pcap-test.pcap", "wb");
+    CUTE_ASSERT(pcap != NULL);
+    fwrite(pcap_data, 1, pcap_data_size, pcap);
+    fclose(pcap);
+
+    CUTE_ASSERT(open_pcap_stream("marklar.pcap") == NULL);
+
+    stream = open_pcap_stream("pcap-test.pcap");
+    CUTE_ASSERT(stream != NULL);
+
+    // INFO(Santiago): The same records written as a big-endian capture and as a pcapng with nanosecond timestamps.
+
+    swapped_pcap = fopen("pcap-test-swapped.pcap", "wb");
+    CUTE_ASSERT(swapped_pcap != NULL);
+    fwrite_swapped_u32(swapped_pcap, stream->hdr.magic_number);
+    u16 = (stream->hdr.version_major >> 8) | (stream->hdr.version_major << 8);
+    fwrite(&u16, 1, sizeof(u16), swapped_pcap);
+    u16 = (stream->hdr.version_minor >> 8) | (stream->hdr.version_minor << 8);
+    fwrite(&u16, 1, sizeof(u16), swapped_pcap);
+    fwrite_swapped_u32(swapped_pcap, stream->hdr.thiszone);
+    fwrite_swapped_u32(swapped_pcap, stream->hdr.sigfigs);
+    fwrite_swapped_u32(swapped_pcap, stream->hdr.snaplen);
+    fwrite_swapped_u32(swapped_pcap, stream->hdr.network);
+
+    pcapng = fopen("pcap-test.pcapng", "wb");
+    CUTE_ASSERT(pcapng != NULL);
+    fwrite_u32(pcapng, 0x0a0d0d0a);
+    fwrite_u32(pcapng, 28);
+    fwrite_u32(pcapng, 0x1a2b3c4d);
+    fwrite_u32(pcapng, 0x00000001);
+    fwrite_u32(pcapng, 0xffffffff);
+    fwrite_u32(pcapng, 0xffffffff);
+    fwrite_u32(pcapng, 28);
+    fwrite_u32(pcapng, 0x00000004);
+    fwrite_u32(pcapng, 16);
+    fwrite_u32(pcapng, 0x00000000);
+    fwrite_u32(pcapng, 16);
+    fwrite_u32(pcapng, 0x00000001);
+    fwrite_u32(pcapng, 32);
+    fwrite_u32(pcapng, stream->hdr.network);
+    fwrite_u32(pcapng, stream->hdr.snaplen);
+    fwrite_u32(pcapng, 0x00010009);
+    fwrite_u32(pcapng, 0x00000009);
+    fwrite_u32(pcapng, 0x00000000);
+    fwrite_u32(pcapng, 32);
+
+    while (next_pcap_stream_record(stream, &record)) {
+        fwrite_swapped_u32(swapped_pcap, record.hdr.ts_sec);
+        fwrite_swapped_u32(swapped_pcap, record.hdr.ts_usec);
+        fwrite_swapped_u32(swapped_pcap, record.hdr.incl_len);
+        fwrite_swapped_u32(swapped_pcap, record.hdr.orig_len);
+        fwrite(record.data, 1, record.hdr.incl_len, swapped_pcap);
+
+        pad = (4 - (record.hdr.incl_len % 4)) % 4;
+        ts = (unsigned long long)record.hdr.ts_sec * 1000000000ULL + (unsigned long long)record.hdr.ts_usec * 1000ULL;
+        fwrite_u32(pcapng, 0x00000006);
+        fwrite_u32(pcapng, 32 + record.hdr.incl_len + pad);
+        fwrite_u32(pcapng, 0);
+        fwrite_u32(pcapng, ts >> 32);
+        fwrite_u32(pcapng, ts & 0xffffffff);
+        fwrite_u32(pcapng, record.hdr.incl_len);
+        fwrite_u32(pcapng, record.hdr.orig_len);
+        fwrite(record.data, 1, record.hdr.incl_len, pcapng);
+        fwrite(zeros, 1, pad, pcapng);
+        fwrite_u32(pcapng, 32 + record.hdr.incl_len + pad);
+
+        records_nr++;
+    }
+
+    // INFO(Santiago): Blocks without packets must be skipped (here an interface statistics block).
+    fwrite_u32(pcapng, 0x00000005);
+    fwrite_u32(pcapng, 24);
+    fwrite_u32(pcapng, 0);
+    fwrite_u32(pcapng, 0);
+    fwrite_u32(pcapng, 0);
+    fwrite_u32(pcapng, 24);
+
+    fclose(swapped_pcap);
+    fclose(pcapng);
+    close_pcap_stream(stream);
+
+    CUTE_ASSERT(records_nr > 0);
+
+    stream = open_pcap_stream("pcap-test.pcap");
+    CUTE_ASSERT(stream != NULL);
+    swapped_stream = open_pcap_stream("pcap-test-swapped.pcap");
+    CUTE_ASSERT(swapped_stream != NULL);
+    pcapng_stream = open_pcap_stream("pcap-test.pcapng");
+    CUTE_ASSERT(pcapng_stream != NULL);
+
+    while (next_pcap_stream_record(stream, &record)) {
+        CUTE_ASSERT(next_pcap_stream_record(swapped_stream, &swapped_record) == 1);
+        CUTE_ASSERT(next_pcap_stream_record(pcapng_stream, &pcapng_record) == 1);
+        CUTE_ASSERT(memcmp(&record.hdr, &swapped_record.hdr, sizeof(record.hdr)) == 0);
+        CUTE_ASSERT(memcmp(&record.hdr, &pcapng_record.hdr, sizeof(record.hdr)) == 0);
+        CUTE_ASSERT(memcmp(record.data, swapped_record.data, record.hdr.incl_len) == 0);
+        CUTE_ASSERT(memcmp(record.data, pcapng_record.data, record.hdr.incl_len) == 0);
+    }
+
+    CUTE_ASSERT(next_pcap_stream_record(swapped_stream, &swapped_record) == 0);
+    CUTE_ASSERT(next_pcap_stream_record(pcapng_stream, &pcapng_record) == 0);
+    CUTE_ASSERT(pcapng_stream->hdr.network == stream->hdr.network);
+    CUTE_ASSERT(pcapng_stream->hdr.snaplen == stream->hdr.snaplen);
+
+    close_pcap_stream(stream);
+    close_pcap_stream(swapped_stream);
+    close_pcap_stream(pcapng_stream);
+
+    pcap_file = ld_pcap_file("pcap-test.pcapng");
+    CUTE_ASSERT(pcap_file != NULL);
+    for (rp = pcap_file->rec; rp != NULL; rp = rp->next) {
+        loaded_nr++;
+    }
+    CUTE_ASSERT(loaded_nr == records_nr);
+    close_pcap_file(pcap_file);
+
+    remove("pcap-test.pcap");
+    remove("pcap-test-swapped.pcap");
+    remove("pcap-test.pcapng");
+CUTE_TEST_CASE_END
+
+CUTE_TEST_CASE(pcap2pigsty_parallel_tests)
+    FILE *fp = NULL;
+    size_t c = 0;
+    char *serial = NULL, *parallel = NULL;
+    long serial_size = 0, parallel_size = 0;
+    const char *pcap_filepath = "test-pcap.pcap";
+    const char *serial_filepath = "test-serial.pigsty";
+    const char *parallel_filepath = "test-parallel.pigsty";
+
+    // INFO(Santiago): Enough copies of the single tcp record to spread it over several batches per thread.
+    fp = fopen(pcap_filepath, "wb");
+    CUTE_ASSERT(fp != NULL);
+    fwrite(single_tcp_pcap, 1, 24, fp);
+    for (c = 0; c < 20000; c++) {
+        fwrite(single_tcp_pcap + 24, 1, single_tcp_pcap_len - 24, fp);
+    }
+    fclose(fp);
+
+    register_options(0, NULL);
+
+    remove(serial_filepath);
+    remove(parallel_filepath);
+
+    CUTE_ASSERT(pcap2pigsty(serial_filepath, pcap_filepath, "Test_%d", 1, 1) == 0);
+    CUTE_ASSERT(pcap2pigsty(parallel_filepath, pcap_filepath, "Test_%d", 1, 3) == 0);
+
+    fp = fopen(serial_filepath, "rb");
+    CUTE_ASSERT(fp != NULL);
+    fseek(fp, 0L, SEEK_END);
+    serial_size = ftell(fp);
+    fseek(fp, 0L, SEEK_SET);
+    serial = (char *) malloc(serial_size);
+    CUTE_ASSERT(serial != NULL);
+    fread(serial, 1, serial_size, fp);
+    fclose(fp);
+
+    fp = fopen(parallel_filepath, "rb");
+    CUTE_ASSERT(fp != NULL);
+    fseek(fp, 0L, SEEK_END);
+    parallel_size = ftell(fp);
+    fseek(fp, 0L, SEEK_SET);
+    parallel = (char *) malloc(parallel_size);
+    CUTE_ASSERT(parallel != NULL);
+    fread(parallel, 1, parallel_size, fp);
+    fclose(fp);
+
+    CUTE_ASSERT(serial_size > 0 && serial_size == parallel_size);
+    CUTE_ASSERT(memcmp(serial, parallel, serial_size) == 0);
+    CUTE_ASSERT(strstr(serial, "signature = \"Test_19999\"") != NULL);
+
+    free(serial);
+    free(parallel);
+
+    remove(pcap_filepath);
+    remove(serial_filepath);
+    remove(parallel_filepath);
+CUTE_TEST_CASE_END
+
 CUTE_TEST_CASE(pktslicer_get_pkt_field_tests)
     unsigned char *ipv4_packet = (unsigned char *)"\x5c\xac\x4c\xaa\xf5\xb5\x08\x95\x2a\xad\xd6\x4f\x08\x00\x45\x00"
                                                   "\x00\x34\xc8\xc5\x40\x00\x3a\x06\xc2\x7f\x17\x2d\xdc\x5e\xc0\xa8"
@@ -1474,7 +1727,7 @@ CUTE_TEST_CASE(pcap2pigsty_tests)
 
         register_options(rounds[r].argc, rounds[r].argv);
 
-        CUTE_ASSERT(pcap2pigsty(pigsty_filepath, pcap_filepath, "Test_%d", rounds[r].incl_ethframe) == 0);
+        CUTE_ASSERT(pcap2pigsty(pigsty_filepath, pcap_filepath, "Test_%d", rounds[r].incl_ethframe, 1) == 0);
 
         fp = fopen(pigsty_filepath, "r");
         CUTE_ASSERT(fp != NULL);
@@ -1537,6 +1790,85 @@ CUTE_TEST_CASE(strglob_tests)
     }
 CUTE_TEST_CASE_END
 
+CUTE_TEST_CASE(pkt_template_tests)
+    pigsty_entry_ctx *pigsty = NULL, *ep = NULL;
+    pig_target_addr_ctx *addrs = NULL;
+    struct ip4 iph, *iph_p = &iph;
+    struct tcp tcph;
+    struct udp udph, *udph_p = &udph;
+    unsigned short chsum = 0;
+    size_t r = 0;
+    char *test_pigsty = "[ signature = \"tcp\", ip.version = 4, ip.ihl = 5, ip.src = european-ip, ip.dst = user-defined-ip, "
+                        "ip.protocol = 6, tcp.src = 1024, tcp.dst = 80, tcp.syn = 1, tcp.payload = \"\\x6f\\x69\\x6e\\x6b\\x21\" ]\n"
+                        "[ signature = \"udp\", ip.version = 4, ip.ihl = 5, ip.tos = 0, ip.src = 10.0.0.1, ip.dst = north-american-ip, "
+                        "ip.protocol = 17, udp.src = 5353, udp.dst = 53, udp.payload = \"\\x72\\x6f\\x63\\x21\" ]\n"
+                        "[ signature = \"icmp\", ip.version = 4, ip.ihl = 5, ip.src = asian-ip, ip.dst = 10.0.0.2, "
+                        "ip.protocol = 1, icmp.type = 8, icmp.code = 0, icmp.payload = \"\\x62\\x6f\\x6f\" ]\n"
+                        "[ signature = \"static\", ip.version = 4, ip.ihl = 5, ip.tos = 0, ip.id = 1, ip.src = 10.0.0.1, ip.dst = 10.0.0.2, "
+                        "ip.protocol = 17, udp.src = 53, udp.dst = 53, udp.payload = \"\\x73\\x74\\x61\\x74\\x69\\x63\" ]";
+    unsigned char static_frame[64];
+    write_to_file("test.pigsty", test_pigsty);
+    pigsty = load_pigsty_data_from_file(pigsty, "test.pigsty");
+    remove("test.pigsty");
+    CUTE_ASSERT(pigsty != NULL);
+    addrs = add_target_addr_to_pig_target_addr(addrs, "192.168.0.1");
+    addrs = add_target_addr_to_pig_target_addr(addrs, "192.168.0.2");
+    mk_pigsty_entry_templates(pigsty, addrs);
+    for (ep = pigsty; ep != NULL; ep = ep->next) {
+        CUTE_ASSERT(ep->tmpl != NULL);
+        CUTE_ASSERT(ep->tmpl->frame_size == ep->tmpl->dgram_size + PIG_PKT_TMPL_ETH_HDR_SIZE);
+        CUTE_ASSERT(ep->tmpl->frame[12] == 0x08 && ep->tmpl->frame[13] == 0x00);
+        if (strcmp(ep->signature_name, "static") == 0) {
+            CUTE_ASSERT(ep->tmpl->slot_nr == 0);
+            CUTE_ASSERT(ep->tmpl->frame_size <= sizeof(static_frame));
+            memcpy(static_frame, ep->tmpl->frame, ep->tmpl->frame_size);
+        }
+        for (r = 0; r < 1000; r++) {
+            render_pkt_template(ep->tmpl, addrs);
+            iph.payload = NULL;
+            parse_ip4_dgram(&iph_p, ep->tmpl->dgram, ep->tmpl->dgram_size);
+            chsum = iph.chsum;
+            iph.chsum = 0;
+            CUTE_ASSERT(eval_ip4_chsum(iph) == chsum);
+            if (strcmp(ep->signature_name, "tcp") == 0) {
+                CUTE_ASSERT(iph.src >= 0xc2000000 && iph.src < 0xc4000000);
+                CUTE_ASSERT(iph.dst == 0xc0a80001 || iph.dst == 0xc0a80002);
+                tcph.src = (iph.payload[0] << 8) | iph.payload[1];
+                tcph.dst = (iph.payload[2] << 8) | iph.payload[3];
+                tcph.seqno = (iph.payload[4] << 24) | (iph.payload[5] << 16) | (iph.payload[6] << 8) | iph.payload[7];
+                tcph.ackno = (iph.payload[8] << 24) | (iph.payload[9] << 16) | (iph.payload[10] << 8) | iph.payload[11];
+                tcph.len = iph.payload[12] >> 4;
+                tcph.reserv = ((iph.payload[12] & 0x0f) << 2) | (iph.payload[13] >> 6);
+                tcph.flags = iph.payload[13] & 0x3f;
+                tcph.window = (iph.payload[14] << 8) | iph.payload[15];
+                tcph.chsum = 0;
+                tcph.urgp = (iph.payload[18] << 8) | iph.payload[19];
+                tcph.payload = &iph.payload[20];
+                tcph.payload_size = iph.payload_size - 20;
+                CUTE_ASSERT(tcph.src == 1024 && tcph.dst == 80);
+                CUTE_ASSERT((tcph.flags & 0x02) == 0x02);
+                CUTE_ASSERT(eval_tcp_ip4_chsum(tcph, iph.src, iph.dst) == ((iph.payload[16] << 8) | iph.payload[17]));
+            } else if (strcmp(ep->signature_name, "udp") == 0 || strcmp(ep->signature_name, "static") == 0) {
+                parse_udp_dgram(&udph_p, iph.payload, iph.payload_size);
+                chsum = udph.chsum;
+                udph.chsum = 0;
+                CUTE_ASSERT(eval_udp_chsum(udph, iph.src, iph.dst, udph.len) == chsum);
+                free(udph.payload);
+            }
+            free(iph.payload);
+        }
+        if (strcmp(ep->signature_name, "static") == 0) {
+            CUTE_ASSERT(memcmp(static_frame, ep->tmpl->frame, ep->tmpl->frame_size) == 0);
+        }
+    }
+    del_pigsty_entry_templates(pigsty);
+    for (ep = pigsty; ep != NULL; ep = ep->next) {
+        CUTE_ASSERT(ep->tmpl == NULL);
+    }
+    del_pigsty_entry(pigsty);
+    del_pig_target_addr(addrs);
+CUTE_TEST_CASE_END
+
 CUTE_TEST_CASE(run_tests)
     printf("running unit tests...\n\n");
     CUTE_RUN_TEST(pigsty_file_parsing_tests);
@@ -1546,9 +1878,11 @@ CUTE_TEST_CASE(run_tests)
     CUTE_RUN_TEST(to_ipv4_mask_tests);
     CUTE_RUN_TEST(to_ipv4_cidr_tests);
     CUTE_RUN_TEST(pigsty_entry_ctx_tests);
+    CUTE_RUN_TEST(pigsty_entry_array_tests);
     CUTE_RUN_TEST(pigsty_conf_set_ctx_tests);
     CUTE_RUN_TEST(pig_target_addr_ctx_tests);
     CUTE_RUN_TEST(pig_hwaddr_ctx_tests);
+    CUTE_RUN_TEST(pig_netif_ctx_tests);
     CUTE_RUN_TEST(eth_frame_making_tests);
     CUTE_RUN_TEST(arp_packet_making_tests);
     CUTE_RUN_TEST(ip_packet_making_tests);
@@ -1563,8 +1897,11 @@ CUTE_TEST_CASE(run_tests)
     CUTE_RUN_TEST(get_options_tests);
     CUTE_RUN_TEST(pcap_loading_tests);
     CUTE_RUN_TEST(pktslicer_get_pkt_field_tests);
+    CUTE_RUN_TEST(pcap_stream_tests);
     CUTE_RUN_TEST(pcap2pigsty_tests);
+    CUTE_RUN_TEST(pcap2pigsty_parallel_tests);
     CUTE_RUN_TEST(strglob_tests);
+    CUTE_RUN_TEST(pkt_template_tests);
 CUTE_TEST_CASE_END
 
 CUTE_MAIN(run_tests)
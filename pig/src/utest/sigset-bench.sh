@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+#                                Copyright (C) 2017 by Rafael Santiago
+#
+# This is a free software. You can redistribute it and/or modify under
+# the terms of the GNU General Public License version 2.
+#
+#
+# Measures the injection rate against the size of the loaded signature set.
+# It must run as root, the packets are injected on the given interface (the loopback by default).
+#
+# usage: sigset-bench.sh [pig binary] [interface] [seconds per run]
+#
+
+PIG=${1:-../bin/pig}
+IFACE=${2:-lo}
+SECS=${3:-5}
+PIGSTY=/tmp/pig-sigset-bench.$$.pigsty
+
+if [ ! -x "$PIG" ]; then
+    echo "ERROR: unable to find the pig binary \"$PIG\"."
+    exit 1
+fi
+
+trap 'rm -f $PIGSTY' EXIT
+
+echo "signatures        pps"
+
+for N in 1 10 100 1000 10000; do
+    rm -f $PIGSTY
+    i=0
+    while [ $i -lt $N ]; do
+        echo "[ signature = \"bench-$i\", ip.version = 4, ip.ihl = 5, ip.src = 10.0.0.1, ip.dst = user-defined-ip,"\
+             "ip.protocol = 17, udp.src = $((1024 + i % 60000)), udp.dst = 53 ]"
+        i=$((i + 1))
+    done > $PIGSTY
+    PPS=$(timeout -s INT $SECS $PIG --signatures=$PIGSTY --targets=10.0.0.0/24 --no-gateway --lo-iface=$IFACE\
+                                    --senders=1 --burst=32 2>&1 | grep "done," | sed 's/.*failure(s), \([0-9]*\) pps.*/\1/')
+    printf "%10d %10s\n" $N "${PPS:-?}"
+done
@@ -34,6 +34,14 @@ typedef struct bl_linked_list {
 
 static constraint_t *constraint = NULL;
 
+// prefixes read from files and lists, which are set on the constraint
+// together once they're all read, since that's much faster than setting
+// them one at a time
+static constraint_prefix_t *pending = NULL;
+static size_t pending_len = 0;
+static size_t pending_cap = 0;
+static int pending_value = ADDR_DISALLOWED;
+
 // keep track of the prefixes we've tried to BL/WL
 // for logging purposes
 static bl_ll_t *blacklisted_cidrs = NULL;
@@ -72,9 +80,54 @@ int blacklist_is_allowed(uint32_t s_addr)
 	return constraint_lookup_ip(constraint, ntohl(s_addr)) == ADDR_ALLOWED;
 }
 
+// check many IP addresses at once: out[i] = blacklist_is_allowed(s_addrs[i])
+void blacklist_is_allowed_batch(const uint32_t *s_addrs, size_t count,
+				uint8_t *out)
+{
+	uint32_t addrs[256];
+	value_t values[256];
+	while (count) {
+		size_t n = count < 256 ? count : 256;
+		for (size_t i = 0; i < n; i++) {
+			addrs[i] = ntohl(s_addrs[i]);
+		}
+		constraint_lookup_ips(constraint, addrs, values, n);
+		for (size_t i = 0; i < n; i++) {
+			out[i] = values[i] == ADDR_ALLOWED;
+		}
+		s_addrs += n;
+		out += n;
+		count -= n;
+	}
+}
+
+// set the pending prefixes on the constraint
+static void _flush_constraints(void)
+{
+	if (pending_len) {
+		constraint_set_bulk(constraint, pending, pending_len,
+				    pending_value);
+	}
+	pending_len = 0;
+}
+
+// queue a prefix to be set on the constraint by _flush_constraints().
+// prefixes with the same value can be set in any order, but a different
+// value has to wait until those before it are set.
 static void _add_constraint(struct in_addr addr, int prefix_len, int value)
 {
-	constraint_set(constraint, ntohl(addr.s_addr), prefix_len, value);
+	if (value != pending_value) {
+		_flush_constraints();
+		pending_value = value;
+	}
+	if (pending_len == pending_cap) {
+		pending_cap = pending_cap ? 2 * pending_cap : 1024;
+		pending = xrealloc(pending,
+				   pending_cap * sizeof(constraint_prefix_t));
+	}
+	pending[pending_len].prefix = ntohl(addr.s_addr);
+	pending[pending_len].len = prefix_len;
+	pending_len++;
 	if (value == ADDR_ALLOWED) {
 		bl_ll_add(whitelisted_cidrs, addr, prefix_len);
 	} else if (value == ADDR_DISALLOWED) {
@@ -92,6 +145,7 @@ void blacklist_prefix(char *ip, int prefix_len)
 	struct in_addr addr;
 	addr.s_addr = inet_addr(ip);
 	_add_constraint(addr, prefix_len, ADDR_DISALLOWED);
+	_flush_constraints();
 }
 
 // whitelist a CIDR network allocation
@@ -100,6 +154,7 @@ void whitelist_prefix(char *ip, int prefix_len)
 	struct in_addr addr;
 	addr.s_addr = inet_addr(ip);
 	_add_constraint(addr, prefix_len, ADDR_ALLOWED);
+	_flush_constraints();
 }
 
 static int init_from_string(char *ip, int value)
@@ -265,6 +320,10 @@ int blacklist_init(char *whitelist_filename, char *blacklist_filename,
 				ADDR_DISALLOWED, ignore_invalid_hosts);
 	}
 	init_from_string(strdup("0.0.0.0"), ADDR_DISALLOWED);
+	_flush_constraints();
+	free(pending);
+	pending = NULL;
+	pending_cap = 0;
 	constraint_paint_value(constraint, ADDR_ALLOWED);
 	uint64_t allowed = blacklist_count_allowed();
 	log_debug("constraint",
@@ -14,6 +14,9 @@ uint32_t blacklist_lookup_index(uint64_t index);
 
 int blacklist_is_allowed(uint32_t s_addr);
 
+void blacklist_is_allowed_batch(const uint32_t *s_addrs, size_t count,
+				uint8_t *out);
+
 void blacklist_prefix(char *ip, int prefix_len);
 
 void whitelist_prefix(char *ip, int prefix_len);
@@ -34,9 +34,13 @@
 // 128.0.0.0/1.)  Each leaf of the tree stores the value that applies
 // to every address within the leaf's portion of the prefix space.
 //
-// As an optimization, after all values are set, we look up the
-// value or subtree for every /16 prefix and cache them as an array.
-// This lets subsequent lookups bypass the bottom half of the tree.
+// As an optimization, after all values are set, we flatten the tree
+// into a multi-bit trie with strides of 16, 8 and 8 bits, kept in one
+// contiguous array.  A lookup is then at most three array reads instead
+// of up to 32 pointer chases.  Painting a value lists the /20s that have
+// that value throughout, which come first in index order, and adds a
+// running count of the rest of the addresses with that value to every
+// trie entry, which lets us find those by searching the counts.
 //
 
 /*
@@ -51,19 +55,33 @@ typedef struct node {
 	struct node *l;
 	struct node *r;
 	value_t value;
-	uint64_t count;
 } node_t;
 
+// The first level of the trie has an entry for every /16.  Each entry is
+// either the value for the whole prefix or, with TRIE_CHILD set, the
+// offset of a block of 256 entries for the next 8 bits.
+#define TRIE_ROOT_LEN (1 << 16)
+#define TRIE_BLOCK_LEN (1 << 8)
+#define TRIE_CHILD 0x80000000
+
 // As an optimization, we precompute lookups for every prefix of this
 // length:
 #define RADIX_LENGTH 20
 
 struct _constraint {
-	node_t *root;     // root node of the tree
-	uint32_t *radix;  // array of prefixes (/RADIX_LENGTH) that are painted
-			  // paint_value
-	size_t radix_len; // number of prefixes in radix array
-	int painted;      // have we precomputed counts for each node?
+	node_t *root;	   // root node of the tree
+	uint32_t *trie;	   // flattened trie, or NULL until optimized
+	size_t trie_len;   // number of entries in trie
+	size_t trie_cap;   // number of entries allocated for trie
+	uint32_t *rank;	   // for each block entry, count of painted addresses
+			   // in the entries before it in the same block
+	uint32_t *radix;   // array of prefixes (/RADIX_LENGTH) that are painted
+			   // paint_value
+	size_t radix_len;  // number of prefixes in radix array
+	uint64_t *index16; // count of painted addresses outside the radix
+			   // before each /16
+	uint32_t *jump;	   // the /16 holding every (1 << 16)th of those
+	int painted;	   // have we precomputed counts for each entry?
 	value_t paint_value; // value for which we precomputed counts
 };
 
@@ -102,6 +120,18 @@ static void _convert_to_leaf(node_t *node)
 	node->r = NULL;
 }
 
+// Free the trie and the counts painted on it, after the tree changes.
+static void _free_trie(constraint_t *con)
+{
+	free(con->trie);
+	free(con->rank);
+	con->trie = NULL;
+	con->rank = NULL;
+	con->trie_len = 0;
+	con->trie_cap = 0;
+	con->painted = 0;
+}
+
 // Recursive function to set value for a given network prefix within
 // the tree.  (Note: prefix must be in host byte order.)
 static void _set_recurse(node_t *node, uint32_t prefix, int len, value_t value)
@@ -156,8 +186,77 @@ static void _set_recurse(node_t *node, uint32_t prefix, int len, value_t value)
 void constraint_set(constraint_t *con, uint32_t prefix, int len, value_t value)
 {
 	assert(con);
+	assert(!(value & TRIE_CHILD));
 	_set_recurse(con->root, prefix, len, value);
-	con->painted = 0;
+	_free_trie(con);
+}
+
+static int _compare_prefix(const void *a, const void *b)
+{
+	const constraint_prefix_t *x = a;
+	const constraint_prefix_t *y = b;
+	if (x->prefix != y->prefix) {
+		return x->prefix < y->prefix ? -1 : 1;
+	}
+	return x->len - y->len;
+}
+
+static uint32_t _prefix_mask(int len)
+{
+	return len ? 0xFFFFFFFF << (32 - len) : 0;
+}
+
+// Set the same value for many prefixes at once.  Since they all get the
+// same value, their order doesn't matter, so we sort them, drop the ones
+// inside another, and join pairs of halves into the prefix they make up
+// before touching the tree.  Large lists, such as ones derived from BGP
+// tables, shrink a good deal this way, and what is left is inserted in
+// address order.  The array is reordered and overwritten.
+// (Note: prefixes must be in host byte order.)
+void constraint_set_bulk(constraint_t *con, constraint_prefix_t *prefixes,
+			 size_t count, value_t value)
+{
+	assert(con);
+	assert(!(value & TRIE_CHILD));
+	for (size_t i = 0; i < count; i++) {
+		assert(0 <= prefixes[i].len && prefixes[i].len <= 32);
+		prefixes[i].prefix &= _prefix_mask(prefixes[i].len);
+	}
+	qsort(prefixes, count, sizeof(constraint_prefix_t), _compare_prefix);
+
+	// The kept prefixes form a stack at the front of the array, which
+	// stays sorted and never overlaps.
+	size_t kept = 0;
+	for (size_t i = 0; i < count; i++) {
+		constraint_prefix_t p = prefixes[i];
+		if (kept) {
+			constraint_prefix_t *top = &prefixes[kept - 1];
+			if ((p.prefix & _prefix_mask(top->len)) ==
+			    top->prefix) {
+				continue;
+			}
+		}
+		while (kept && p.len > 0) {
+			constraint_prefix_t *top = &prefixes[kept - 1];
+			uint32_t half = 1U << (32 - p.len);
+			if (top->len != p.len ||
+			    (top->prefix ^ p.prefix) != half ||
+			    (top->prefix & half)) {
+				break;
+			}
+			p.prefix = top->prefix;
+			p.len--;
+			kept--;
+		}
+		prefixes[kept++] = p;
+	}
+	log_debug("constraint", "setting %zu prefixes, merged from %zu", kept,
+		  count);
+	for (size_t i = 0; i < kept; i++) {
+		_set_recurse(con->root, prefixes[i].prefix, prefixes[i].len,
+			     value);
+	}
+	_free_trie(con);
 }
 
 // Return the value pertaining to an address, according to the tree
@@ -180,34 +279,101 @@ static int _lookup_ip(node_t *root, uint32_t address)
 	}
 }
 
+static inline value_t _trie_lookup(const uint32_t *trie, uint32_t address)
+{
+	uint32_t e = trie[address >> 16];
+	if (e & TRIE_CHILD) {
+		e = trie[(e & ~TRIE_CHILD) + ((address >> 8) & 0xFF)];
+		if (e & TRIE_CHILD) {
+			e = trie[(e & ~TRIE_CHILD) + (address & 0xFF)];
+		}
+	}
+	return e;
+}
+
 // Return the value pertaining to an address.
 // (Note: address must be in host byte order.)
 value_t constraint_lookup_ip(constraint_t *con, uint32_t address)
 {
 	assert(con);
+	if (con->trie) {
+		return _trie_lookup(con->trie, address);
+	}
 	return _lookup_ip(con->root, address);
 }
 
-// Return the nth painted IP address.
-static int _lookup_index(node_t *root, uint64_t n)
+// Look up many addresses at once: out[i] = constraint_lookup_ip(addresses[i]).
+// Each trie level is read for the whole batch before moving on to the
+// next, so the cache misses of different addresses overlap rather than
+// waiting on each other.  (Note: addresses must be in host byte order.)
+void constraint_lookup_ips(constraint_t *con, const uint32_t *addresses,
+			   value_t *out, size_t count)
 {
-	assert(root);
-	node_t *node = root;
-	uint32_t ip = 0;
-	uint32_t mask = 0x80000000;
-	for (;;) {
-		if (IS_LEAF(node)) {
-			return ip | n;
+	assert(con);
+	if (!con->trie) {
+		for (size_t i = 0; i < count; i++) {
+			out[i] = _lookup_ip(con->root, addresses[i]);
 		}
-		if (n < node->l->count) {
-			node = node->l;
+		return;
+	}
+	const uint32_t *trie = con->trie;
+	int deeper = 0;
+	for (size_t i = 0; i < count; i++) {
+		out[i] = trie[addresses[i] >> 16];
+		deeper |= out[i] & TRIE_CHILD;
+	}
+	if (!deeper) {
+		return;
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (out[i] & TRIE_CHILD) {
+			__builtin_prefetch(&trie[(out[i] & ~TRIE_CHILD) +
+						 ((addresses[i] >> 8) & 0xFF)]);
+		}
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (out[i] & TRIE_CHILD) {
+			out[i] = trie[(out[i] & ~TRIE_CHILD) +
+				      ((addresses[i] >> 8) & 0xFF)];
+			if (out[i] & TRIE_CHILD) {
+				out[i] = trie[(out[i] & ~TRIE_CHILD) +
+					      (addresses[i] & 0xFF)];
+			}
+		}
+	}
+}
+
+// Return the last of the first len entries of counts that is at most n.
+// The counts are running totals over entries of size addresses each, so
+// this is the entry whose addresses include the nth one.  No entry holds
+// more than size, so the answer is at least n / size, and when most of
+// the entries are painted it is close to that, so we search forward from
+// there with steps that double before narrowing down.
+static size_t _search_counts(const uint32_t *counts, size_t len, uint32_t n,
+			     uint32_t size)
+{
+	size_t lo = n / size;
+	if (lo >= len) {
+		lo = len - 1;
+	}
+	size_t hi = lo + 1, step = 1;
+	while (hi < len && counts[hi] <= n) {
+		lo = hi;
+		step *= 2;
+		hi = lo + step;
+	}
+	if (hi > len) {
+		hi = len;
+	}
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (counts[mid] <= n) {
+			lo = mid;
 		} else {
-			n -= node->l->count;
-			node = node->r;
-			ip |= mask;
+			hi = mid;
 		}
-		mask >>= 1;
 	}
+	return lo;
 }
 
 // For a given value, return the IP address with zero-based index n.
@@ -222,54 +388,61 @@ uint32_t constraint_lookup_index(constraint_t *con, uint64_t index,
 		constraint_paint_value(con, value);
 	}
 
-	uint64_t radix_idx = index / (1 << (32 - RADIX_LENGTH));
+	uint64_t radix_idx = index >> (32 - RADIX_LENGTH);
 	if (radix_idx < con->radix_len) {
 		// Radix lookup
 		uint32_t radix_offset =
-		    index % (1 << (32 - RADIX_LENGTH)); // TODO: bitwise maths
+		    index & ((1 << (32 - RADIX_LENGTH)) - 1);
 		return con->radix[radix_idx] | radix_offset;
 	}
-
-	// Otherwise, do the "slow" lookup in tree.
-	// Note that tree counts do NOT include things in the radix,
-	// so we subtract these off here.
-	index -= con->radix_len * (1 << (32 - RADIX_LENGTH));
-	assert(index < con->root->count);
-	return _lookup_index(con->root, index);
+	// Otherwise, search the counts in the trie, which do NOT include
+	// things in the radix, so we subtract these off here.
+	index -= (uint64_t)con->radix_len << (32 - RADIX_LENGTH);
+	assert(index < con->index16[TRIE_ROOT_LEN]);
+
+	// Find the /16 with a binary search over the running counts, between
+	// the /16s holding the nearest multiples of 1 << 16 around index.
+	uint64_t j = index >> 16;
+	size_t lo = con->jump[j];
+	size_t hi = TRIE_ROOT_LEN;
+	if (((j + 1) << 16) < con->index16[TRIE_ROOT_LEN]) {
+		hi = con->jump[j + 1] + 1;
+	}
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (con->index16[mid] <= index) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	uint32_t ip = (uint32_t)lo << 16;
+	uint32_t n = index - con->index16[lo];
+	uint32_t e = con->trie[lo];
+	int shift = 16;
+	while (e & TRIE_CHILD) {
+		// Then the /24 and the address within blocks the same way.
+		uint32_t block = e & ~TRIE_CHILD;
+		shift -= 8;
+		size_t i = _search_counts(&con->rank[block], TRIE_BLOCK_LEN, n,
+					  1U << shift);
+		ip |= (uint32_t)i << shift;
+		n -= con->rank[block + i];
+		e = con->trie[block + i];
+	}
+	return ip | n;
 }
 
 // Implement count_ips by recursing on halves of the tree.  Size represents
 // the number of addresses in a prefix at the current level of the tree.
-// If paint is specified, each node will have its count set to the number of
-// leaves under it set to value.
-// If exclude_radix is specified, the number of addresses will exlcude prefixes
-// that are a /RADIX_LENGTH or larger
-static uint64_t _count_ips_recurse(node_t *node, value_t value, uint64_t size,
-				   int paint, int exclude_radix)
+static uint64_t _count_ips_recurse(node_t *node, value_t value, uint64_t size)
 {
 	assert(node);
-	uint64_t n;
 	if (IS_LEAF(node)) {
-		if (node->value == value) {
-			n = size;
-			// Exclude prefixes already included in the radix
-			if (exclude_radix &&
-			    size >= (1 << (32 - RADIX_LENGTH))) {
-				n = 0;
-			}
-		} else {
-			n = 0;
-		}
-	} else {
-		n = _count_ips_recurse(node->l, value, size >> 1, paint,
-				       exclude_radix) +
-		    _count_ips_recurse(node->r, value, size >> 1, paint,
-				       exclude_radix);
+		return node->value == value ? size : 0;
 	}
-	if (paint) {
-		node->count = n;
-	}
-	return n;
+	return _count_ips_recurse(node->l, value, size >> 1) +
+	       _count_ips_recurse(node->r, value, size >> 1);
 }
 
 // Return a node that determines the values for the addresses with
@@ -299,30 +472,135 @@ static node_t *_lookup_node(node_t *root, uint32_t prefix, int len)
 	return node;
 }
 
-// For each node, precompute the count of leaves beneath it set to value.
-// Note that the tree can be painted for only one value at a time.
-void constraint_paint_value(constraint_t *con, value_t value)
+// Add a block of the trie for the 8 bits of addresses below node, and
+// return its offset.  Depth is the length of the prefix node covers.
+static uint32_t _compile_block(constraint_t *con, node_t *node, int depth)
+{
+	if (con->trie_len + TRIE_BLOCK_LEN > con->trie_cap) {
+		con->trie_cap *= 2;
+		con->trie =
+		    xrealloc(con->trie, con->trie_cap * sizeof(uint32_t));
+	}
+	assert(con->trie_len + TRIE_BLOCK_LEN <= TRIE_CHILD);
+	uint32_t block = con->trie_len;
+	con->trie_len += TRIE_BLOCK_LEN;
+	for (uint32_t i = 0; i < TRIE_BLOCK_LEN; i++) {
+		node_t *n = _lookup_node(node, i << 24, 8);
+		if (IS_LEAF(n)) {
+			con->trie[block + i] = n->value;
+		} else {
+			// Compile the child first, since it may move the trie.
+			assert(depth + 8 < 32);
+			uint32_t child = _compile_block(con, n, depth + 8);
+			con->trie[block + i] = TRIE_CHILD | child;
+		}
+	}
+	return block;
+}
+
+// Flatten the tree into the trie used by lookups.  This must be called
+// again after any values are set, and before lookups from more than one
+// thread, since nothing here is locked.
+void constraint_optimize(constraint_t *con)
 {
 	assert(con);
-	log_debug("constraint", "Painting value %lu", value);
+	_free_trie(con);
+	con->trie_cap = 2 * TRIE_ROOT_LEN;
+	con->trie = xmalloc(con->trie_cap * sizeof(uint32_t));
+	con->trie_len = TRIE_ROOT_LEN;
+	for (uint32_t i = 0; i < TRIE_ROOT_LEN; i++) {
+		node_t *n = _lookup_node(con->root, i << 16, 16);
+		if (IS_LEAF(n)) {
+			con->trie[i] = n->value;
+		} else {
+			uint32_t child = _compile_block(con, n, 16);
+			con->trie[i] = TRIE_CHILD | child;
+		}
+	}
+	log_debug("constraint", "flattened tree into %zu trie blocks",
+		  (con->trie_len - TRIE_ROOT_LEN) / TRIE_BLOCK_LEN);
+}
 
-	// Paint everything except what we will put in radix
-	_count_ips_recurse(con->root, value, (uint64_t)1 << 32, 1, 1);
+// Fill in the running counts of a trie block, where each entry covers
+// size addresses, and return the count for the whole block.  Entries in
+// the groups of 16 flagged in radix are in the radix and aren't counted.
+static uint32_t _paint_block(constraint_t *con, uint32_t block, uint32_t size,
+			     value_t value, uint16_t radix)
+{
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < TRIE_BLOCK_LEN; i++) {
+		uint32_t e = con->trie[block + i];
+		con->rank[block + i] = n;
+		if (e & TRIE_CHILD) {
+			n += _paint_block(con, e & ~TRIE_CHILD,
+					  size / TRIE_BLOCK_LEN, value, 0);
+		} else if (e == value && !(radix & (1 << (i >> 4)))) {
+			n += size;
+		}
+	}
+	return n;
+}
 
-	// Fill in the radix array with a list of addresses
-	uint32_t i;
+// Return a flag for each /20 in a block of /24s painted value throughout.
+static uint16_t _radix_block(constraint_t *con, uint32_t block,
+			     value_t value)
+{
+	uint16_t radix = 0;
+	for (uint32_t i = 0; i < TRIE_BLOCK_LEN; i += 16) {
+		uint32_t j = i;
+		while (j < i + 16 && con->trie[block + j] == value) {
+			j++;
+		}
+		if (j == i + 16) {
+			radix |= 1 << (i >> 4);
+		}
+	}
+	return radix;
+}
+
+// For each trie entry, precompute the count of addresses before it set to
+// value, after filling in the radix array.  Note that the trie can be
+// painted for only one value at a time.
+void constraint_paint_value(constraint_t *con, value_t value)
+{
+	assert(con);
+	log_debug("constraint", "Painting value %lu", value);
+	if (!con->trie) {
+		constraint_optimize(con);
+	}
+	free(con->rank);
+	con->rank = xmalloc(con->trie_len * sizeof(uint32_t));
+	uint64_t n = 0;
 	con->radix_len = 0;
-	for (i = 0; i < (1 << RADIX_LENGTH); i++) {
-		uint32_t prefix = i << (32 - RADIX_LENGTH);
-		node_t *node = _lookup_node(con->root, prefix, RADIX_LENGTH);
-		if (IS_LEAF(node) && node->value == value) {
-			// Add this prefix to the radix
-			con->radix[con->radix_len++] = prefix;
+	for (uint32_t i = 0; i < TRIE_ROOT_LEN; i++) {
+		uint32_t e = con->trie[i];
+		con->index16[i] = n;
+		uint16_t radix = 0;
+		if (e & TRIE_CHILD) {
+			radix = _radix_block(con, e & ~TRIE_CHILD, value);
+			n += _paint_block(con, e & ~TRIE_CHILD,
+					  TRIE_ROOT_LEN / TRIE_BLOCK_LEN, value,
+					  radix);
+		} else if (e == value) {
+			radix = 0xFFFF;
+		}
+		for (uint32_t k = 0; k < 16; k++) {
+			if (radix & (1 << k)) {
+				con->radix[con->radix_len++] =
+				    (i << 16) | (k << (32 - RADIX_LENGTH));
+			}
 		}
 	}
-	log_debug("constraint", "%lu IPs in radix array, %lu IPs in tree",
-		  con->radix_len * (1 << (32 - RADIX_LENGTH)),
-		  con->root->count);
+	con->index16[TRIE_ROOT_LEN] = n;
+	uint64_t next = 0;
+	for (uint32_t i = 0; i < TRIE_ROOT_LEN; i++) {
+		while (next < con->index16[i + 1]) {
+			con->jump[next >> 16] = i;
+			next += 1 << 16;
+		}
+	}
+	log_debug("constraint", "%lu IPs in radix array, %lu IPs in trie",
+		  con->radix_len * (1 << (32 - RADIX_LENGTH)), n);
 	con->painted = 1;
 	con->paint_value = value;
 }
@@ -332,11 +610,10 @@ uint64_t constraint_count_ips(constraint_t *con, value_t value)
 {
 	assert(con);
 	if (con->painted && con->paint_value == value) {
-		return con->root->count +
+		return con->index16[TRIE_ROOT_LEN] +
 		       con->radix_len * (1 << (32 - RADIX_LENGTH));
 	} else {
-		return _count_ips_recurse(con->root, value, (uint64_t)1 << 32,
-					  0, 0);
+		return _count_ips_recurse(con->root, value, (uint64_t)1 << 32);
 	}
 }
 
@@ -345,8 +622,16 @@ uint64_t constraint_count_ips(constraint_t *con, value_t value)
 constraint_t *constraint_init(value_t value)
 {
 	constraint_t *con = xmalloc(sizeof(constraint_t));
+	assert(!(value & TRIE_CHILD));
 	con->root = _create_leaf(value);
+	con->trie = NULL;
+	con->rank = NULL;
+	con->trie_len = 0;
+	con->trie_cap = 0;
 	con->radix = xcalloc(sizeof(uint32_t), 1 << RADIX_LENGTH);
+	con->radix_len = 0;
+	con->index16 = xcalloc(TRIE_ROOT_LEN + 1, sizeof(uint64_t));
+	con->jump = xcalloc(TRIE_ROOT_LEN + 1, sizeof(uint32_t));
 	con->painted = 0;
 	return con;
 }
@@ -357,7 +642,10 @@ void constraint_free(constraint_t *con)
 	assert(con);
 	log_debug("constraint", "Cleaning up");
 	_destroy_subtree(con->root);
+	_free_trie(con);
 	free(con->radix);
+	free(con->index16);
+	free(con->jump);
 	free(con);
 }
 
@@ -2,14 +2,27 @@
 #define CONSTRAINT_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 typedef struct _constraint constraint_t;
 typedef uint32_t value_t;
 
+typedef struct constraint_prefix {
+	uint32_t prefix;
+	int len;
+} constraint_prefix_t;
+
+// Values must fit in 31 bits.
+
 constraint_t *constraint_init(value_t value);
 void constraint_free(constraint_t *con);
 void constraint_set(constraint_t *con, uint32_t prefix, int len, value_t value);
+void constraint_set_bulk(constraint_t *con, constraint_prefix_t *prefixes,
+			 size_t count, value_t value);
+void constraint_optimize(constraint_t *con);
 value_t constraint_lookup_ip(constraint_t *con, uint32_t address);
+void constraint_lookup_ips(constraint_t *con, const uint32_t *addresses,
+			   value_t *out, size_t count);
 uint64_t constraint_count_ips(constraint_t *con, value_t value);
 uint32_t constraint_lookup_index(constraint_t *con, uint64_t index,
 				 value_t value);
@@ -4,13 +4,18 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include "logger.h"
 #include "xalloc.h"
+#include "pbm.h"
 
 #define NUM_VALUES 0xFFFFFFFF
 #define PAGE_SIZE_IN_BITS 0x10000
@@ -18,6 +23,11 @@
 #define NUM_PAGES 0x10000
 #define PAGE_MASK 0xFFFF
 
+#define APBM_SIZE_IN_BYTES (1ULL << 29)
+// files smaller than this aren't worth splitting across threads
+#define APBM_MIN_CHUNK (1 << 20)
+#define APBM_MAX_THREADS 16
+
 uint8_t **pbm_init(void)
 {
 	uint8_t **retv = xcalloc(NUM_PAGES, sizeof(void *));
@@ -57,6 +67,20 @@ void pbm_set(uint8_t **b, uint32_t v)
 	bm_set(b[top], bottom);
 }
 
+// One IP address per line, with optional # comments.
+static uint32_t parse_ip_line(char *line)
+{
+	char *comment = strchr(line, '#');
+	if (comment) {
+		*comment = '\0';
+	}
+	struct in_addr addr;
+	if (inet_aton(line, &addr) != 1) {
+		log_fatal("pbm", "unable to parse IP address: %s", line);
+	}
+	return addr.s_addr;
+}
+
 uint32_t pbm_load_from_file(uint8_t **b, char *file)
 {
 	if (!b) {
@@ -73,18 +97,187 @@ uint32_t pbm_load_from_file(uint8_t **b, char *file)
 	char line[1000];
 	uint32_t count = 0;
 	while (fgets(line, sizeof(line), fp)) {
-		char *comment = strchr(line, '#');
-		if (comment) {
-			*comment = '\0';
+		pbm_set(b, parse_ip_line(line));
+		++count;
+	}
+	fclose(fp);
+	return count;
+}
+
+apbm_t *apbm_init(int hugetlb)
+{
+	apbm_t *b = xmalloc(sizeof(apbm_t));
+	void *words = MAP_FAILED;
+	if (hugetlb) {
+#ifdef MAP_HUGETLB
+		// Only works if enough huge pages have been reserved, and then
+		// takes them whether or not the bits are ever set, so it's
+		// opt-in. This mustn't be MAP_NORESERVE, or it would map
+		// without the pages and fault later.
+		words = mmap(NULL, APBM_SIZE_IN_BYTES, PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANON | MAP_HUGETLB, -1, 0);
+		if (words == MAP_FAILED) {
+			log_warn("pbm",
+				 "unable to map %llu byte bitmap from reserved "
+				 "huge pages: %s, falling back to normal pages",
+				 APBM_SIZE_IN_BYTES, strerror(errno));
+		} else {
+			log_debug("pbm",
+				  "mapped %llu byte bitmap from reserved huge pages",
+				  APBM_SIZE_IN_BYTES);
 		}
-		struct in_addr addr;
-		if (inet_aton(line, &addr) != 1) {
-			log_fatal("pbm", "unable to parse IP address: %s",
-				  line);
+#else
+		log_warn("pbm", "huge page mappings are not supported on "
+				"this platform, using normal pages");
+#endif
+	}
+	if (words == MAP_FAILED) {
+		int flags = MAP_PRIVATE | MAP_ANON;
+#ifdef MAP_NORESERVE
+		flags |= MAP_NORESERVE;
+#endif
+		words = mmap(NULL, APBM_SIZE_IN_BYTES, PROT_READ | PROT_WRITE,
+			     flags, -1, 0);
+		if (words == MAP_FAILED) {
+			log_fatal("pbm", "unable to map %llu byte bitmap: %s",
+				  APBM_SIZE_IN_BYTES, strerror(errno));
 		}
-		pbm_set(b, addr.s_addr);
-		++count;
+#ifdef MADV_HUGEPAGE
+		madvise(words, APBM_SIZE_IN_BYTES, MADV_HUGEPAGE);
+#endif
+		log_debug("pbm", "mapped %llu byte bitmap on demand",
+			  APBM_SIZE_IN_BYTES);
+	}
+	b->words = words;
+	return b;
+}
+
+void apbm_free(apbm_t *b)
+{
+	if (!b) {
+		return;
+	}
+	munmap(b->words, APBM_SIZE_IN_BYTES);
+	free(b);
+}
+
+int apbm_check(const apbm_t *b, uint32_t v)
+{
+	uint64_t word = __atomic_load_n(&b->words[v >> 6], __ATOMIC_RELAXED);
+	return (word >> (v & 63)) & 1;
+}
+
+int apbm_set(apbm_t *b, uint32_t v)
+{
+	uint64_t *word = &b->words[v >> 6];
+	uint64_t mask = 1ULL << (v & 63);
+	// Skip the locked instruction when the bit is already set, which for
+	// duplicate responses is most of the time.
+	if (__atomic_load_n(word, __ATOMIC_RELAXED) & mask) {
+		return 1;
+	}
+	return (__atomic_fetch_or(word, mask, __ATOMIC_RELAXED) & mask) != 0;
+}
+
+void apbm_check_batch(const apbm_t *b, const uint32_t *v, size_t n,
+		      uint8_t *out)
+{
+	// Nearly every lookup misses the cache, so start them all before
+	// waiting on any of them.
+	for (size_t i = 0; i < n; i++) {
+		__builtin_prefetch(&b->words[v[i] >> 6]);
+	}
+	for (size_t i = 0; i < n; i++) {
+		out[i] = apbm_check(b, v[i]);
+	}
+}
+
+typedef struct apbm_load_arg {
+	apbm_t *b;
+	const char *file;
+	off_t start;
+	off_t end;
+	uint32_t count;
+} apbm_load_arg_t;
+
+// Load the lines that start in [start, end). The line running over start
+// belongs to the previous chunk.
+static void *apbm_load_chunk(void *arg)
+{
+	apbm_load_arg_t *a = arg;
+	FILE *fp = fopen(a->file, "r");
+	if (fp == NULL) {
+		log_fatal("pbm", "unable to open file: %s: %s", a->file,
+			  strerror(errno));
+	}
+	char line[1000];
+	off_t pos = a->start;
+	if (pos > 0) {
+		fseeko(fp, pos - 1, SEEK_SET);
+		int c;
+		while ((c = fgetc(fp)) != EOF && c != '\n') {
+		}
+		pos = ftello(fp);
+	}
+	while (pos < a->end && fgets(line, sizeof(line), fp)) {
+		pos += strlen(line);
+		apbm_set(a->b, parse_ip_line(line));
+		a->count++;
 	}
 	fclose(fp);
+	return NULL;
+}
+
+uint32_t apbm_load_from_file(apbm_t *b, char *file)
+{
+	if (!b) {
+		log_fatal("pbm", "load_from_file called with NULL PBM");
+	}
+	if (!file) {
+		log_fatal("pbm", "load_from_file called with NULL filename");
+	}
+	struct stat st;
+	if (stat(file, &st)) {
+		log_fatal("pbm", "unable to open file: %s: %s", file,
+			  strerror(errno));
+	}
+	long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_threads > st.st_size / APBM_MIN_CHUNK) {
+		num_threads = st.st_size / APBM_MIN_CHUNK;
+	}
+	if (num_threads > APBM_MAX_THREADS) {
+		num_threads = APBM_MAX_THREADS;
+	}
+	if (num_threads < 1 || !S_ISREG(st.st_mode)) {
+		num_threads = 1;
+	}
+	apbm_load_arg_t args[APBM_MAX_THREADS];
+	pthread_t threads[APBM_MAX_THREADS];
+	for (long i = 0; i < num_threads; i++) {
+		args[i].b = b;
+		args[i].file = file;
+		args[i].start = st.st_size * i / num_threads;
+		args[i].end = S_ISREG(st.st_mode)
+				  ? st.st_size * (i + 1) / num_threads
+				  : (off_t)INT64_MAX;
+		args[i].count = 0;
+	}
+	if (num_threads == 1) {
+		apbm_load_chunk(&args[0]);
+		return args[0].count;
+	}
+	for (long i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, apbm_load_chunk,
+				   &args[i])) {
+			log_fatal("pbm", "unable to create load thread");
+		}
+	}
+	uint32_t count = 0;
+	for (long i = 0; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+		count += args[i].count;
+	}
+	log_debug("pbm", "loaded %u addresses from %s with %ld threads", count,
+		  file, num_threads);
 	return count;
 }
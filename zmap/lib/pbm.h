@@ -2,10 +2,31 @@
 #define ZMAP_PBM_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 uint8_t **pbm_init(void);
 int pbm_check(uint8_t **b, uint32_t v);
 void pbm_set(uint8_t **b, uint32_t v);
 uint32_t pbm_load_from_file(uint8_t **b, char *file);
 
+// A bitmap over all of IPv4 that many threads can check and set at once. It
+// is a single 512 MB mapping, which the kernel only backs with memory where
+// bits get set, on transparent huge pages where it can.
+typedef struct apbm {
+	uint64_t *words;
+} apbm_t;
+
+// With hugetlb set, tries first to map the bitmap from the huge pages
+// reserved with vm.nr_hugepages, which takes 256 of them.
+apbm_t *apbm_init(int hugetlb);
+void apbm_free(apbm_t *b);
+int apbm_check(const apbm_t *b, uint32_t v);
+// returns whether the bit was already set
+int apbm_set(apbm_t *b, uint32_t v);
+// out[i] = apbm_check(b, v[i]), with the memory accesses overlapped
+void apbm_check_batch(const apbm_t *b, const uint32_t *v, size_t n,
+		      uint8_t *out);
+// like pbm_load_from_file(), but reads large files with several threads
+uint32_t apbm_load_from_file(apbm_t *b, char *file);
+
 #endif /* ZMAP_PBM_H */
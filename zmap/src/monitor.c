@@ -16,10 +16,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <json.h>
+
 #include "iterator.h"
 #include "recv.h"
 #include "state.h"
@@ -33,6 +37,7 @@
 #define NUMBER_STR_LEN 20
 #define WARMUP_PERIOD 5
 #define MIN_HITRATE_TIME_WINDOW 5 // seconds
+#define STRTIME_LEN 64
 
 // internal monitor status that is used to track deltas
 typedef struct internal_scan_status {
@@ -103,6 +108,22 @@ typedef struct export_scan_status {
 
 static FILE *status_fd = NULL;
 
+// metrics are written to a file or, with unix:path, to a unix socket.
+// the values kept here are from the last update, for the per-second
+// numbers.
+typedef struct metrics_state {
+	FILE *file;
+	int sock;
+	double last_now;
+	uint32_t *last_sent;
+	uint32_t *last_send_errors;
+	uint64_t last_recv_ns;
+	uint32_t last_pcap_drop;
+	uint32_t last_pcap_ifdrop;
+} metrics_state_t;
+
+static metrics_state_t metrics = {.file = NULL, .sock = -1};
+
 // find minimum of an array of doubles
 static double min_d(double array[], int n)
 {
@@ -408,6 +429,217 @@ static void update_status_updates_file(export_status_t *exp, FILE *f)
 	fflush(f);
 }
 
+static void init_metrics_file(char *path)
+{
+	if (!strncmp(path, "unix:", 5)) {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (strlen(path + 5) >= sizeof(addr.sun_path)) {
+			log_fatal("monitor", "metrics socket path too long (%s)",
+				  path + 5);
+		}
+		strcpy(addr.sun_path, path + 5);
+		metrics.sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (metrics.sock < 0 ||
+		    connect(metrics.sock, (struct sockaddr *)&addr,
+			    sizeof(addr))) {
+			log_fatal("monitor",
+				  "could not connect to metrics socket (%s): %s",
+				  path + 5, strerror(errno));
+		}
+	} else {
+		metrics.file = fopen(path, "w");
+		if (!metrics.file) {
+			log_fatal("monitor",
+				  "could not open metrics file (%s): %s", path,
+				  strerror(errno));
+		}
+	}
+	log_debug("monitor", "metrics will be written to %s", path);
+	// counters start from zero when the scan does
+	metrics.last_now = zsend.start;
+	metrics.last_sent = xcalloc(zconf.senders, sizeof(uint32_t));
+	metrics.last_send_errors = xcalloc(zconf.senders, sizeof(uint32_t));
+}
+
+static void write_metrics_line(const char *line)
+{
+	if (metrics.file) {
+		fprintf(metrics.file, "%s\n", line);
+		fflush(metrics.file);
+		return;
+	}
+	if (metrics.sock < 0) {
+		return;
+	}
+	// a reader going away shouldn't take the scan with it, so don't
+	// raise SIGPIPE, and stop sending instead
+	size_t len = strlen(line);
+	char *buf = xmalloc(len + 1);
+	memcpy(buf, line, len);
+	buf[len++] = '\n';
+	char *p = buf;
+	while (len) {
+		ssize_t n = send(metrics.sock, p, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			log_warn("monitor",
+				 "unable to write to metrics socket: %s. "
+				 "no more metrics will be sent",
+				 strerror(errno));
+			close(metrics.sock);
+			metrics.sock = -1;
+			break;
+		}
+		p += n;
+		len -= n;
+	}
+	free(buf);
+}
+
+// an array of a histogram's buckets, up to the last one that isn't empty
+static json_object *json_hist(uint32_t *hist)
+{
+	int len = RECV_HIST_BUCKETS;
+	while (len > 0 && !hist[len - 1]) {
+		len--;
+	}
+	json_object *arr = json_object_new_array();
+	for (int i = 0; i < len; i++) {
+		json_object_array_add(arr, json_object_new_int64(hist[i]));
+	}
+	return arr;
+}
+
+static void update_metrics_file(export_status_t *exp, iterator_t *it)
+{
+	double cur_time = now();
+	double delta = cur_time - metrics.last_now;
+	if (delta <= 0) {
+		delta = UPDATE_INTERVAL;
+	}
+	json_object *obj = json_object_new_object();
+	char timestamp[STRTIME_LEN];
+	dstrftime(timestamp, STRTIME_LEN, "%Y-%m-%dT%H:%M:%S%z", cur_time);
+	json_object_object_add(obj, "time", json_object_new_string(timestamp));
+	json_object_object_add(obj, "time_elapsed",
+			       json_object_new_int64(exp->time_past));
+	json_object_object_add(obj, "rate", json_object_new_int64(zconf.rate));
+	json_object_object_add(obj, "send_complete",
+			       json_object_new_boolean(zsend.complete));
+
+	// sender threads
+	json_object *senders = json_object_new_array();
+	for (uint8_t i = 0; i < zconf.senders; i++) {
+		struct shard_state *st = &get_shard(it, i)->state;
+		uint32_t sent = st->sent;
+		uint32_t send_errors = st->send_errors;
+		json_object *t = json_object_new_object();
+		json_object_object_add(t, "thread", json_object_new_int(i));
+		json_object_object_add(t, "sent", json_object_new_int64(sent));
+		json_object_object_add(
+		    t, "send_rate",
+		    json_object_new_double((sent - metrics.last_sent[i]) /
+					   delta));
+		json_object_object_add(t, "tried_sent",
+				       json_object_new_int64(st->tried_sent));
+		json_object_object_add(t, "sendto_failures",
+				       json_object_new_int64(st->failures));
+		json_object_object_add(t, "send_errors",
+				       json_object_new_int64(send_errors));
+		json_object_object_add(
+		    t, "send_errors_rate",
+		    json_object_new_double(
+			(send_errors - metrics.last_send_errors[i]) / delta));
+		json_object_object_add(t, "pacing_sleeps",
+				       json_object_new_int64(st->pacing_sleeps));
+		json_object_object_add(
+		    t, "pacing_sleep_secs",
+		    json_object_new_double(st->pacing_sleep_ns / 1e9));
+		json_object_object_add(t, "pacing_delay",
+				       json_object_new_int64(st->pacing_delay));
+		json_object_array_add(senders, t);
+		metrics.last_sent[i] = sent;
+		metrics.last_send_errors[i] = send_errors;
+	}
+	json_object_object_add(obj, "senders", senders);
+
+	// receive thread. drops by pcap mean the receive thread didn't read
+	// packets fast enough, so they're shown next to how busy it was.
+	json_object *recv = json_object_new_object();
+	uint64_t validate_ns = zrecv.validate_ns;
+	uint64_t process_ns = zrecv.process_ns;
+	uint64_t output_ns = zrecv.output_ns;
+	uint64_t recv_ns = validate_ns + process_ns + output_ns;
+	uint32_t handled = zrecv.validation_passed + zrecv.validation_failed;
+	json_object_object_add(recv, "pcap_recv",
+			       json_object_new_int64(zrecv.pcap_recv));
+	json_object_object_add(recv, "validation_passed",
+			       json_object_new_int64(zrecv.validation_passed));
+	json_object_object_add(recv, "validation_failed",
+			       json_object_new_int64(zrecv.validation_failed));
+	json_object_object_add(recv, "success_unique",
+			       json_object_new_int64(zrecv.success_unique));
+	json_object_object_add(
+	    recv, "busy",
+	    json_object_new_double((recv_ns - metrics.last_recv_ns) / 1e9 /
+				   delta));
+	json_object_object_add(recv, "validate_secs",
+			       json_object_new_double(validate_ns / 1e9));
+	json_object_object_add(recv, "process_secs",
+			       json_object_new_double(process_ns / 1e9));
+	json_object_object_add(recv, "output_secs",
+			       json_object_new_double(output_ns / 1e9));
+	json_object_object_add(
+	    recv, "ns_per_packet",
+	    json_object_new_double(handled ? (double)recv_ns / handled : 0));
+	json_object_object_add(recv, "pcap_drop",
+			       json_object_new_int64(zrecv.pcap_drop));
+	json_object_object_add(
+	    recv, "pcap_drop_rate",
+	    json_object_new_double((zrecv.pcap_drop - metrics.last_pcap_drop) /
+				   delta));
+	json_object_object_add(recv, "pcap_ifdrop",
+			       json_object_new_int64(zrecv.pcap_ifdrop));
+	json_object_object_add(
+	    recv, "pcap_ifdrop_rate",
+	    json_object_new_double(
+		(zrecv.pcap_ifdrop - metrics.last_pcap_ifdrop) / delta));
+	// bucket i holds values from 2^i up to 2^(i+1)
+	json_object_object_add(recv, "packets_per_read",
+			       json_hist(zrecv.batch_hist));
+	json_object_object_add(obj, "recv", recv);
+	if (zconf.fsconf.sent_ts_index >= 0) {
+		json_object_object_add(obj, "rtt_us",
+				       json_hist(zrecv.rtt_hist));
+	}
+	metrics.last_recv_ns = recv_ns;
+	metrics.last_pcap_drop = zrecv.pcap_drop;
+	metrics.last_pcap_ifdrop = zrecv.pcap_ifdrop;
+	metrics.last_now = cur_time;
+
+	write_metrics_line(
+	    json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN));
+	json_object_put(obj);
+}
+
+static void close_metrics_file(void)
+{
+	if (metrics.file) {
+		fclose(metrics.file);
+		metrics.file = NULL;
+	}
+	if (metrics.sock >= 0) {
+		close(metrics.sock);
+		metrics.sock = -1;
+	}
+	free(metrics.last_sent);
+	free(metrics.last_send_errors);
+}
+
 static inline void check_min_hitrate(export_status_t *exp)
 {
 	if (exp->seconds_under_min_hitrate >= MIN_HITRATE_TIME_WINDOW) {
@@ -433,6 +665,9 @@ void monitor_init(void)
 		status_fd = init_status_update_file(zconf.status_updates_file);
 		assert(status_fd);
 	}
+	if (zconf.metrics_file) {
+		init_metrics_file(zconf.metrics_file);
+	}
 }
 
 void monitor_run(iterator_t *it, pthread_mutex_t *lock)
@@ -458,6 +693,9 @@ void monitor_run(iterator_t *it, pthread_mutex_t *lock)
 		if (status_fd) {
 			update_status_updates_file(export_status, status_fd);
 		}
+		if (zconf.metrics_file) {
+			update_metrics_file(export_status, it);
+		}
 		sleep(UPDATE_INTERVAL);
 	}
 	if (!zconf.quiet) {
@@ -469,4 +707,11 @@ void monitor_run(iterator_t *it, pthread_mutex_t *lock)
 		fflush(status_fd);
 		fclose(status_fd);
 	}
+	if (zconf.metrics_file) {
+		// the final totals
+		update_pcap_stats(lock);
+		export_stats(internal_status, export_status, it);
+		update_metrics_file(export_status, it);
+		close_metrics_file();
+	}
 }
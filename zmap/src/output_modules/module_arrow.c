@@ -0,0 +1,957 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+// Writes results as an Apache Arrow IPC file, which pandas, pyarrow, DuckDB,
+// and friends load without parsing. Each output field becomes a column, typed
+// from the probe module's field definitions: int fields are uint64, bool are
+// bool, string are utf8, and binary are binary.
+//
+// The receive thread only copies values into column chunks. When a chunk is
+// full (--output-args sets how many rows, 65536 by default), or has been
+// filling for a few seconds, it's handed to a writer thread that encodes it
+// as a record batch. String columns that mostly repeat in the first chunk
+// (classification, for instance) are dictionary encoded from then on, with
+// new values written as delta dictionary batches.
+//
+// The Arrow metadata is FlatBuffers, which we build by hand below. See
+// Schema.fbs, Message.fbs, and File.fbs in the Arrow format specification.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "../../lib/logger.h"
+#include "../../lib/xalloc.h"
+#include "../fieldset.h"
+
+#include "output_modules.h"
+#include "module_arrow.h"
+
+#define UNUSED __attribute__((unused))
+
+#define ARROW_DEFAULT_ROWS 65536
+#define ARROW_MAX_ROWS (1 << 20)
+#define ARROW_FLUSH_SECONDS 5
+// chunks waiting on the writer before the receive thread has to wait too
+#define ARROW_MAX_QUEUED 4
+
+// from the Arrow format flatbuffers schemas
+#define ARROW_METADATA_V5 4
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_BINARY 4
+#define ARROW_TYPE_UTF8 5
+#define ARROW_TYPE_BOOL 6
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_DICTIONARY_BATCH 2
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_ENDIAN_LITTLE 0
+#define ARROW_ENDIAN_BIG 1
+
+enum arrow_kind { ARROW_UINT64, ARROW_BOOL, ARROW_STRING, ARROW_BINARY };
+
+typedef struct arrow_column {
+	uint8_t *validity;
+	uint64_t *nums;	  // ARROW_UINT64
+	uint8_t *bits;	  // ARROW_BOOL
+	int32_t *offsets; // ARROW_STRING and ARROW_BINARY
+	uint8_t *data;
+	size_t data_len;
+	size_t data_cap;
+	size_t null_count;
+} arrow_column_t;
+
+typedef struct arrow_chunk {
+	size_t rows;
+	time_t started;
+	arrow_column_t *columns;
+	struct arrow_chunk *next;
+} arrow_chunk_t;
+
+// The dictionary of a string column is kept in Arrow's own layout, so that
+// the values added by each chunk can be written out as they are.
+typedef struct arrow_dict {
+	int32_t *offsets;
+	uint8_t *data;
+	size_t count;
+	size_t cap;
+	size_t data_cap;
+	size_t written;
+	int sent;
+	// open addressed, holding index + 1
+	uint32_t *table;
+	size_t table_size;
+	int32_t *indices;
+} arrow_dict_t;
+
+typedef struct arrow_field {
+	const char *name;
+	int kind;
+	int is_dictionary;
+	arrow_dict_t dict;
+} arrow_field_t;
+
+typedef struct arrow_block {
+	int64_t offset;
+	int32_t meta_len;
+	int64_t body_len;
+} arrow_block_t;
+
+// Builds a flatbuffer from the back, children before their parents, the way
+// the flatbuffers library does. Positions are distances from the end.
+typedef struct fb {
+	uint8_t *buf;
+	size_t cap;
+	size_t len;
+	size_t minalign;
+	size_t table_start;
+	size_t slots[8];
+	int num_slots;
+} fb_t;
+
+typedef struct arrow_buf {
+	const void *ptr;
+	size_t len;
+} arrow_buf_t;
+
+static FILE *file = NULL;
+static arrow_field_t *fields = NULL;
+static int num_fields = 0;
+static size_t chunk_rows = ARROW_DEFAULT_ROWS;
+
+static arrow_chunk_t *filling = NULL;
+static arrow_chunk_t *queue_head = NULL;
+static arrow_chunk_t *queue_tail = NULL;
+static arrow_chunk_t *free_chunks = NULL;
+static int num_queued = 0;
+static int closing = 0;
+static pthread_t writer;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+// everything below is only touched by the writer thread, or after it exits
+static fb_t fb;
+static int64_t file_pos = 0;
+static int schema_written = 0;
+static arrow_block_t *dict_blocks = NULL;
+static size_t num_dict_blocks = 0;
+static arrow_block_t *batch_blocks = NULL;
+static size_t num_batch_blocks = 0;
+static arrow_buf_t *bufs = NULL;
+static int64_t *buf_meta = NULL;
+static int64_t *nodes = NULL;
+
+static void fb_reset(fb_t *b)
+{
+	b->len = 0;
+	b->minalign = 1;
+}
+
+static void fb_grow(fb_t *b, size_t n)
+{
+	if (b->len + n <= b->cap) {
+		return;
+	}
+	size_t cap = b->cap ? b->cap : 1024;
+	while (cap < b->len + n) {
+		cap *= 2;
+	}
+	uint8_t *buf = xmalloc(cap);
+	if (b->len) {
+		memcpy(buf + cap - b->len, b->buf + b->cap - b->len, b->len);
+	}
+	free(b->buf);
+	b->buf = buf;
+	b->cap = cap;
+}
+
+static void fb_push(fb_t *b, const void *p, size_t n)
+{
+	fb_grow(b, n);
+	b->len += n;
+	memcpy(b->buf + b->cap - b->len, p, n);
+}
+
+static void fb_pad(fb_t *b, size_t n)
+{
+	fb_grow(b, n);
+	b->len += n;
+	memset(b->buf + b->cap - b->len, 0, n);
+}
+
+// Pad so that once 'extra' more bytes are pushed, we're aligned to 'align'.
+static void fb_prep(fb_t *b, size_t align, size_t extra)
+{
+	if (align > b->minalign) {
+		b->minalign = align;
+	}
+	fb_pad(b, (0 - (b->len + extra)) & (align - 1));
+}
+
+// Flatbuffers are little-endian whatever the host is.
+static void fb_scalar(fb_t *b, uint64_t val, size_t size)
+{
+	uint8_t tmp[8];
+	for (size_t i = 0; i < size; i++) {
+		tmp[i] = (val >> (8 * i)) & 0xFF;
+	}
+	fb_prep(b, size, 0);
+	fb_push(b, tmp, size);
+}
+
+static void fb_uoffset(fb_t *b, size_t target)
+{
+	fb_prep(b, 4, 0);
+	fb_scalar(b, b->len + 4 - target, 4);
+}
+
+static size_t fb_string(fb_t *b, const char *s)
+{
+	size_t n = strlen(s);
+	fb_prep(b, 4, n + 1);
+	fb_pad(b, 1);
+	fb_push(b, s, n);
+	fb_scalar(b, n, 4);
+	return b->len;
+}
+
+static size_t fb_offset_vector(fb_t *b, const size_t *targets, size_t n)
+{
+	fb_prep(b, 4, 4 * n);
+	for (size_t i = n; i-- > 0;) {
+		fb_uoffset(b, targets[i]);
+	}
+	fb_scalar(b, n, 4);
+	return b->len;
+}
+
+// A vector of structs of two longs, which is what FieldNode and Buffer are.
+static size_t fb_pair_vector(fb_t *b, const int64_t *vals, size_t n)
+{
+	fb_prep(b, 4, 16 * n);
+	fb_prep(b, 8, 16 * n);
+	for (size_t i = 2 * n; i-- > 0;) {
+		fb_scalar(b, vals[i], 8);
+	}
+	fb_scalar(b, n, 4);
+	return b->len;
+}
+
+static size_t fb_block_vector(fb_t *b, const arrow_block_t *blocks, size_t n)
+{
+	fb_prep(b, 4, 24 * n);
+	fb_prep(b, 8, 24 * n);
+	for (size_t i = n; i-- > 0;) {
+		fb_scalar(b, blocks[i].body_len, 8);
+		fb_pad(b, 4);
+		fb_scalar(b, blocks[i].meta_len, 4);
+		fb_scalar(b, blocks[i].offset, 8);
+	}
+	fb_scalar(b, n, 4);
+	return b->len;
+}
+
+static void fb_start(fb_t *b, int num_slots)
+{
+	assert(num_slots <= (int)(sizeof(b->slots) / sizeof(b->slots[0])));
+	b->table_start = b->len;
+	b->num_slots = num_slots;
+	memset(b->slots, 0, sizeof(b->slots));
+}
+
+static void fb_field(fb_t *b, int slot, uint64_t val, size_t size)
+{
+	fb_scalar(b, val, size);
+	b->slots[slot] = b->len;
+}
+
+static void fb_field_offset(fb_t *b, int slot, size_t target)
+{
+	fb_uoffset(b, target);
+	b->slots[slot] = b->len;
+}
+
+static size_t fb_end(fb_t *b)
+{
+	fb_scalar(b, 0, 4);
+	size_t table = b->len;
+	int n = b->num_slots;
+	while (n > 0 && !b->slots[n - 1]) {
+		n--;
+	}
+	for (int i = n; i-- > 0;) {
+		fb_scalar(b, b->slots[i] ? table - b->slots[i] : 0, 2);
+	}
+	fb_scalar(b, table - b->table_start, 2);
+	fb_scalar(b, 4 + 2 * n, 2);
+	// the table starts with the signed distance back to its vtable
+	uint32_t to_vtable = b->len - table;
+	uint8_t *p = b->buf + b->cap - table;
+	for (int i = 0; i < 4; i++) {
+		p[i] = (to_vtable >> (8 * i)) & 0xFF;
+	}
+	return table;
+}
+
+static void fb_finish(fb_t *b, size_t root)
+{
+	fb_prep(b, b->minalign, 4);
+	fb_uoffset(b, root);
+}
+
+static void arrow_write(const void *p, size_t len)
+{
+	static const uint8_t zeros[8];
+	if (len && fwrite(p, len, 1, file) != 1) {
+		log_fatal("arrow", "could not write output file: %s",
+			  strerror(errno));
+	}
+	size_t pad = (0 - len) & 7;
+	if (pad && fwrite(zeros, pad, 1, file) != 1) {
+		log_fatal("arrow", "could not write output file: %s",
+			  strerror(errno));
+	}
+	file_pos += len + pad;
+}
+
+static size_t arrow_schema(fb_t *b)
+{
+	size_t *children = xcalloc(num_fields, sizeof(size_t));
+	for (int i = 0; i < num_fields; i++) {
+		arrow_field_t *f = &fields[i];
+		size_t name = fb_string(b, f->name);
+		size_t none = fb_offset_vector(b, NULL, 0);
+		int type_tag;
+		fb_start(b, 2);
+		switch (f->kind) {
+		case ARROW_UINT64:
+			type_tag = ARROW_TYPE_INT;
+			fb_field(b, 0, 64, 4);
+			fb_field(b, 1, 0, 1);
+			break;
+		case ARROW_BOOL:
+			type_tag = ARROW_TYPE_BOOL;
+			break;
+		case ARROW_STRING:
+			type_tag = ARROW_TYPE_UTF8;
+			break;
+		default:
+			type_tag = ARROW_TYPE_BINARY;
+			break;
+		}
+		size_t type = fb_end(b);
+		size_t dictionary = 0;
+		if (f->is_dictionary) {
+			fb_start(b, 2);
+			fb_field(b, 0, 32, 4);
+			fb_field(b, 1, 1, 1);
+			size_t index_type = fb_end(b);
+			fb_start(b, 2);
+			fb_field(b, 0, i, 8);
+			fb_field_offset(b, 1, index_type);
+			dictionary = fb_end(b);
+		}
+		fb_start(b, 6);
+		fb_field_offset(b, 0, name);
+		fb_field(b, 1, 1, 1);
+		fb_field(b, 2, type_tag, 1);
+		fb_field_offset(b, 3, type);
+		if (dictionary) {
+			fb_field_offset(b, 4, dictionary);
+		}
+		fb_field_offset(b, 5, none);
+		children[i] = fb_end(b);
+	}
+	size_t vector = fb_offset_vector(b, children, num_fields);
+	free(children);
+	uint16_t probe = 1;
+	fb_start(b, 2);
+	fb_field(b, 0,
+		 *(uint8_t *)&probe ? ARROW_ENDIAN_LITTLE : ARROW_ENDIAN_BIG,
+		 2);
+	fb_field_offset(b, 1, vector);
+	return fb_end(b);
+}
+
+// Where each buffer goes in the message body, each padded to 8 bytes.
+static int64_t arrow_body_layout(size_t num_bufs)
+{
+	int64_t body_len = 0;
+	for (size_t i = 0; i < num_bufs; i++) {
+		buf_meta[2 * i] = body_len;
+		buf_meta[2 * i + 1] = bufs[i].len;
+		body_len += (bufs[i].len + 7) & ~(size_t)7;
+	}
+	return body_len;
+}
+
+static size_t arrow_record_batch(fb_t *b, size_t rows, size_t num_nodes,
+				 size_t num_bufs)
+{
+	arrow_body_layout(num_bufs);
+	size_t node_vector = fb_pair_vector(b, nodes, num_nodes);
+	size_t buf_vector = fb_pair_vector(b, buf_meta, num_bufs);
+	fb_start(b, 3);
+	fb_field(b, 0, rows, 8);
+	fb_field_offset(b, 1, node_vector);
+	fb_field_offset(b, 2, buf_vector);
+	return fb_end(b);
+}
+
+// Write an encapsulated message: a continuation marker, the metadata length,
+// the Message flatbuffer, and then the body.
+static arrow_block_t arrow_message(int header_type, size_t header,
+				   size_t num_bufs)
+{
+	int64_t body_len = arrow_body_layout(num_bufs);
+	fb_start(&fb, 4);
+	fb_field(&fb, 0, ARROW_METADATA_V5, 2);
+	fb_field(&fb, 1, header_type, 1);
+	fb_field_offset(&fb, 2, header);
+	fb_field(&fb, 3, body_len, 8);
+	fb_finish(&fb, fb_end(&fb));
+
+	arrow_block_t block;
+	block.offset = file_pos;
+	block.meta_len = 8 + ((fb.len + 7) & ~(size_t)7);
+	block.body_len = body_len;
+	uint32_t prefix[2] = {0xFFFFFFFF, 0};
+	uint8_t *p = (uint8_t *)&prefix[1];
+	for (int i = 0; i < 4; i++) {
+		p[i] = ((block.meta_len - 8) >> (8 * i)) & 0xFF;
+	}
+	arrow_write(prefix, sizeof(prefix));
+	arrow_write(fb.buf + fb.cap - fb.len, fb.len);
+	for (size_t i = 0; i < num_bufs; i++) {
+		arrow_write(bufs[i].ptr, bufs[i].len);
+	}
+	return block;
+}
+
+// Message headers are built first, since the Message table refers to them
+// and children come before parents.
+static void arrow_write_schema(void)
+{
+	fb_reset(&fb);
+	arrow_message(ARROW_HEADER_SCHEMA, arrow_schema(&fb), 0);
+	schema_written = 1;
+}
+
+static uint32_t arrow_hash(const uint8_t *p, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		hash = (hash ^ p[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static void dict_rehash(arrow_dict_t *d)
+{
+	free(d->table);
+	d->table_size = d->table_size ? 2 * d->table_size : 256;
+	d->table = xcalloc(d->table_size, sizeof(uint32_t));
+	for (size_t i = 0; i < d->count; i++) {
+		const uint8_t *p = d->data + d->offsets[i];
+		size_t len = d->offsets[i + 1] - d->offsets[i];
+		size_t slot = arrow_hash(p, len) & (d->table_size - 1);
+		while (d->table[slot]) {
+			slot = (slot + 1) & (d->table_size - 1);
+		}
+		d->table[slot] = i + 1;
+	}
+}
+
+static int32_t dict_index(arrow_dict_t *d, const uint8_t *p, size_t len)
+{
+	if (2 * (d->count + 1) > d->table_size) {
+		dict_rehash(d);
+	}
+	size_t slot = arrow_hash(p, len) & (d->table_size - 1);
+	for (; d->table[slot]; slot = (slot + 1) & (d->table_size - 1)) {
+		uint32_t i = d->table[slot] - 1;
+		if ((size_t)(d->offsets[i + 1] - d->offsets[i]) == len &&
+		    !memcmp(d->data + d->offsets[i], p, len)) {
+			return i;
+		}
+	}
+	if (d->count + 1 >= d->cap) {
+		d->cap = d->cap ? 2 * d->cap : 256;
+		d->offsets = xrealloc(d->offsets, (d->cap + 1) * sizeof(int32_t));
+		if (!d->count) {
+			d->offsets[0] = 0;
+		}
+	}
+	size_t used = d->offsets[d->count];
+	if (used + len > d->data_cap) {
+		while (used + len > d->data_cap) {
+			d->data_cap = d->data_cap ? 2 * d->data_cap : 4096;
+		}
+		d->data = xrealloc(d->data, d->data_cap);
+	}
+	memcpy(d->data + used, p, len);
+	d->offsets[d->count + 1] = used + len;
+	d->table[slot] = d->count + 1;
+	return d->count++;
+}
+
+static void dict_encode(arrow_dict_t *d, const arrow_column_t *c,
+			size_t rows)
+{
+	for (size_t r = 0; r < rows; r++) {
+		if (!(c->validity[r / 8] & (1 << (r % 8)))) {
+			d->indices[r] = 0;
+			continue;
+		}
+		d->indices[r] = dict_index(d, c->data + c->offsets[r],
+					   c->offsets[r + 1] - c->offsets[r]);
+	}
+}
+
+// The values this chunk added, or all of them the first time.
+static void arrow_write_dictionary(int i)
+{
+	arrow_dict_t *d = &fields[i].dict;
+	size_t n = d->count - d->written;
+	int32_t *offsets = xmalloc((n + 1) * sizeof(int32_t));
+	for (size_t k = 0; k <= n; k++) {
+		offsets[k] = (d->count ? d->offsets[d->written + k] : 0) -
+			     (d->count ? d->offsets[d->written] : 0);
+	}
+	nodes[0] = n;
+	nodes[1] = 0;
+	bufs[0].ptr = NULL;
+	bufs[0].len = 0;
+	bufs[1].ptr = offsets;
+	bufs[1].len = (n + 1) * sizeof(int32_t);
+	bufs[2].ptr = n ? d->data + d->offsets[d->written] : NULL;
+	bufs[2].len = offsets[n];
+
+	fb_reset(&fb);
+	size_t batch = arrow_record_batch(&fb, n, 1, 3);
+	fb_start(&fb, 3);
+	fb_field(&fb, 0, i, 8);
+	fb_field_offset(&fb, 1, batch);
+	fb_field(&fb, 2, d->sent, 1);
+	size_t header = fb_end(&fb);
+	dict_blocks = xrealloc(dict_blocks,
+			       (num_dict_blocks + 1) * sizeof(arrow_block_t));
+	dict_blocks[num_dict_blocks++] =
+	    arrow_message(ARROW_HEADER_DICTIONARY_BATCH, header, 3);
+	free(offsets);
+	d->written = d->count;
+	d->sent = 1;
+}
+
+static void arrow_write_chunk(arrow_chunk_t *chunk)
+{
+	size_t rows = chunk->rows;
+	if (!schema_written) {
+		// Keep dictionary encoding for the columns where each value
+		// shows up at least eight times.
+		for (int i = 0; i < num_fields; i++) {
+			arrow_dict_t *d = &fields[i].dict;
+			if (fields[i].kind != ARROW_STRING) {
+				continue;
+			}
+			dict_encode(d, &chunk->columns[i], rows);
+			fields[i].is_dictionary = d->count * 8 <= rows;
+			if (!fields[i].is_dictionary) {
+				free(d->offsets);
+				free(d->data);
+				free(d->table);
+				free(d->indices);
+				memset(d, 0, sizeof(arrow_dict_t));
+			}
+		}
+		arrow_write_schema();
+	} else {
+		for (int i = 0; i < num_fields; i++) {
+			if (fields[i].is_dictionary) {
+				dict_encode(&fields[i].dict, &chunk->columns[i],
+					    rows);
+			}
+		}
+	}
+	for (int i = 0; i < num_fields; i++) {
+		arrow_dict_t *d = &fields[i].dict;
+		if (fields[i].is_dictionary &&
+		    (d->count > d->written || !d->sent)) {
+			arrow_write_dictionary(i);
+		}
+	}
+
+	size_t num_bufs = 0;
+	for (int i = 0; i < num_fields; i++) {
+		arrow_field_t *f = &fields[i];
+		arrow_column_t *c = &chunk->columns[i];
+		nodes[2 * i] = rows;
+		nodes[2 * i + 1] = c->null_count;
+		bufs[num_bufs].ptr = c->validity;
+		bufs[num_bufs++].len = c->null_count ? (rows + 7) / 8 : 0;
+		if (f->is_dictionary) {
+			bufs[num_bufs].ptr = f->dict.indices;
+			bufs[num_bufs++].len = rows * sizeof(int32_t);
+		} else if (f->kind == ARROW_UINT64) {
+			bufs[num_bufs].ptr = c->nums;
+			bufs[num_bufs++].len = rows * sizeof(uint64_t);
+		} else if (f->kind == ARROW_BOOL) {
+			bufs[num_bufs].ptr = c->bits;
+			bufs[num_bufs++].len = (rows + 7) / 8;
+		} else {
+			bufs[num_bufs].ptr = c->offsets;
+			bufs[num_bufs++].len = (rows + 1) * sizeof(int32_t);
+			bufs[num_bufs].ptr = c->data;
+			bufs[num_bufs++].len = c->data_len;
+		}
+	}
+	fb_reset(&fb);
+	size_t header = arrow_record_batch(&fb, rows, num_fields, num_bufs);
+	batch_blocks = xrealloc(batch_blocks,
+				(num_batch_blocks + 1) * sizeof(arrow_block_t));
+	batch_blocks[num_batch_blocks++] =
+	    arrow_message(ARROW_HEADER_RECORD_BATCH, header, num_bufs);
+	fflush(file);
+	check_and_log_file_error(file, "arrow");
+}
+
+static void arrow_write_footer(void)
+{
+	// end of stream marker, then the footer, which repeats the schema and
+	// says where every message is
+	uint32_t eos[2] = {0xFFFFFFFF, 0};
+	arrow_write(eos, sizeof(eos));
+	fb_reset(&fb);
+	size_t schema = arrow_schema(&fb);
+	size_t dicts = fb_block_vector(&fb, dict_blocks, num_dict_blocks);
+	size_t batches = fb_block_vector(&fb, batch_blocks, num_batch_blocks);
+	fb_start(&fb, 4);
+	fb_field(&fb, 0, ARROW_METADATA_V5, 2);
+	fb_field_offset(&fb, 1, schema);
+	fb_field_offset(&fb, 2, dicts);
+	fb_field_offset(&fb, 3, batches);
+	fb_finish(&fb, fb_end(&fb));
+	uint8_t len[4];
+	for (int i = 0; i < 4; i++) {
+		len[i] = (fb.len >> (8 * i)) & 0xFF;
+	}
+	if (fwrite(fb.buf + fb.cap - fb.len, fb.len, 1, file) != 1 ||
+	    fwrite(len, sizeof(len), 1, file) != 1 ||
+	    fwrite("ARROW1", 6, 1, file) != 1) {
+		log_fatal("arrow", "could not write output file: %s",
+			  strerror(errno));
+	}
+}
+
+static arrow_chunk_t *chunk_new(void)
+{
+	arrow_chunk_t *chunk = xcalloc(1, sizeof(arrow_chunk_t));
+	chunk->columns = xcalloc(num_fields, sizeof(arrow_column_t));
+	for (int i = 0; i < num_fields; i++) {
+		arrow_column_t *c = &chunk->columns[i];
+		c->validity = xcalloc((chunk_rows + 7) / 8, 1);
+		switch (fields[i].kind) {
+		case ARROW_UINT64:
+			c->nums = xcalloc(chunk_rows, sizeof(uint64_t));
+			break;
+		case ARROW_BOOL:
+			c->bits = xcalloc((chunk_rows + 7) / 8, 1);
+			break;
+		default:
+			c->offsets = xcalloc(chunk_rows + 1, sizeof(int32_t));
+			c->data_cap = 4096;
+			c->data = xmalloc(c->data_cap);
+			break;
+		}
+	}
+	return chunk;
+}
+
+static void chunk_free(arrow_chunk_t *chunk)
+{
+	for (int i = 0; i < num_fields; i++) {
+		arrow_column_t *c = &chunk->columns[i];
+		free(c->validity);
+		free(c->nums);
+		free(c->bits);
+		free(c->offsets);
+		free(c->data);
+	}
+	free(chunk->columns);
+	free(chunk);
+}
+
+static void chunk_reset(arrow_chunk_t *chunk)
+{
+	for (int i = 0; i < num_fields; i++) {
+		arrow_column_t *c = &chunk->columns[i];
+		memset(c->validity, 0, (chunk->rows + 7) / 8);
+		if (c->bits) {
+			memset(c->bits, 0, (chunk->rows + 7) / 8);
+		}
+		c->data_len = 0;
+		c->null_count = 0;
+	}
+	chunk->rows = 0;
+	chunk->next = NULL;
+}
+
+static void *arrow_writer_thread(UNUSED void *arg)
+{
+	for (;;) {
+		pthread_mutex_lock(&queue_mutex);
+		while (!queue_head && !closing) {
+			pthread_cond_wait(&queue_cond, &queue_mutex);
+		}
+		arrow_chunk_t *chunk = queue_head;
+		if (!chunk) {
+			pthread_mutex_unlock(&queue_mutex);
+			return NULL;
+		}
+		queue_head = chunk->next;
+		if (!queue_head) {
+			queue_tail = NULL;
+		}
+		pthread_mutex_unlock(&queue_mutex);
+
+		arrow_write_chunk(chunk);
+		chunk_reset(chunk);
+
+		pthread_mutex_lock(&queue_mutex);
+		chunk->next = free_chunks;
+		free_chunks = chunk;
+		num_queued--;
+		pthread_cond_broadcast(&queue_cond);
+		pthread_mutex_unlock(&queue_mutex);
+	}
+}
+
+// Hand the filling chunk to the writer and take an empty one, waiting if the
+// writer has fallen too far behind.
+static void arrow_flush(void)
+{
+	pthread_mutex_lock(&queue_mutex);
+	if (queue_tail) {
+		queue_tail->next = filling;
+	} else {
+		queue_head = filling;
+	}
+	queue_tail = filling;
+	num_queued++;
+	pthread_cond_broadcast(&queue_cond);
+	while (num_queued >= ARROW_MAX_QUEUED) {
+		pthread_cond_wait(&queue_cond, &queue_mutex);
+	}
+	filling = free_chunks;
+	if (filling) {
+		free_chunks = filling->next;
+		filling->next = NULL;
+	}
+	pthread_mutex_unlock(&queue_mutex);
+	if (!filling) {
+		filling = chunk_new();
+	}
+}
+
+static void column_append(arrow_column_t *c, size_t row, const void *p,
+			  size_t len)
+{
+	if (c->data_len + len > c->data_cap) {
+		while (c->data_len + len > c->data_cap) {
+			c->data_cap *= 2;
+		}
+		c->data = xrealloc(c->data, c->data_cap);
+	}
+	memcpy(c->data + c->data_len, p, len);
+	c->data_len += len;
+	c->offsets[row + 1] = c->data_len;
+}
+
+int arrow_init(struct state_conf *conf, char **fieldnames, int fieldlens)
+{
+	assert(conf);
+	if (conf->output_args) {
+		char *end = NULL;
+		long rows = strtol(conf->output_args, &end, 10);
+		if (*end || rows < 1 || rows > ARROW_MAX_ROWS) {
+			log_fatal("arrow",
+				  "--output-args should be the number of rows "
+				  "per record batch, from 1 to %d",
+				  ARROW_MAX_ROWS);
+		}
+		chunk_rows = rows;
+	}
+	if (!conf->output_filename || !strcmp(conf->output_filename, "-")) {
+		file = stdout;
+	} else if (!(file = fopen(conf->output_filename, "w"))) {
+		log_fatal("arrow", "could not open Arrow output file (%s): %s",
+			  conf->output_filename, strerror(errno));
+	}
+
+	// Column types come from the definitions the probe module declares.
+	num_fields = fieldlens;
+	fields = xcalloc(num_fields, sizeof(arrow_field_t));
+	for (int i = 0; i < num_fields; i++) {
+		int j = fds_get_index_by_name(&conf->fsconf.defs, fieldnames[i]);
+		if (j < 0) {
+			log_fatal("arrow", "unknown output field: %s",
+				  fieldnames[i]);
+		}
+		const char *type = conf->fsconf.defs.fielddefs[j].type;
+		fields[i].name = fieldnames[i];
+		if (!strcmp(type, "int")) {
+			fields[i].kind = ARROW_UINT64;
+		} else if (!strcmp(type, "bool")) {
+			fields[i].kind = ARROW_BOOL;
+		} else if (!strcmp(type, "string")) {
+			fields[i].kind = ARROW_STRING;
+			fields[i].dict.indices =
+			    xcalloc(chunk_rows, sizeof(int32_t));
+		} else if (!strcmp(type, "binary")) {
+			fields[i].kind = ARROW_BINARY;
+		} else {
+			log_fatal("arrow",
+				  "field %s is of type %s, which Arrow output "
+				  "does not support",
+				  fieldnames[i], type);
+		}
+	}
+	// at most three buffers per column
+	bufs = xcalloc(3 * num_fields, sizeof(arrow_buf_t));
+	buf_meta = xcalloc(6 * num_fields, sizeof(int64_t));
+	nodes = xcalloc(2 * num_fields, sizeof(int64_t));
+
+	arrow_write("ARROW1", 6);
+	filling = chunk_new();
+	filling->started = time(NULL);
+	if (pthread_create(&writer, NULL, arrow_writer_thread, NULL)) {
+		log_fatal("arrow", "unable to create writer thread");
+	}
+	return EXIT_SUCCESS;
+}
+
+int arrow_process(fieldset_t *fs)
+{
+	arrow_chunk_t *chunk = filling;
+	size_t row = chunk->rows;
+	if (!row) {
+		chunk->started = time(NULL);
+	}
+	assert(fs->len == num_fields);
+	for (int i = 0; i < num_fields; i++) {
+		field_t *f = &fs->fields[i];
+		arrow_column_t *c = &chunk->columns[i];
+		int valid = 1;
+		switch (fields[i].kind) {
+		case ARROW_UINT64:
+			valid = f->type == FS_UINT64 || f->type == FS_BOOL;
+			c->nums[row] = valid ? f->value.num : 0;
+			break;
+		case ARROW_BOOL:
+			valid = f->type == FS_BOOL || f->type == FS_UINT64;
+			if (valid && f->value.num) {
+				c->bits[row / 8] |= 1 << (row % 8);
+			}
+			break;
+		default:
+			if (f->type == FS_STRING) {
+				column_append(c, row, f->value.ptr,
+					      strlen(f->value.ptr));
+			} else if (f->type == FS_BINARY &&
+				   fields[i].kind == ARROW_BINARY) {
+				column_append(c, row, f->value.ptr, f->len);
+			} else {
+				valid = 0;
+				c->offsets[row + 1] = c->data_len;
+			}
+			break;
+		}
+		if (valid) {
+			c->validity[row / 8] |= 1 << (row % 8);
+		} else {
+			c->null_count++;
+		}
+	}
+	chunk->rows++;
+	if (chunk->rows == chunk_rows ||
+	    time(NULL) - chunk->started >= ARROW_FLUSH_SECONDS) {
+		arrow_flush();
+	}
+	return EXIT_SUCCESS;
+}
+
+int arrow_close(UNUSED struct state_conf *c, UNUSED struct state_send *s,
+		UNUSED struct state_recv *r)
+{
+	if (!file) {
+		return EXIT_SUCCESS;
+	}
+	if (filling->rows) {
+		arrow_flush();
+	}
+	pthread_mutex_lock(&queue_mutex);
+	closing = 1;
+	pthread_cond_broadcast(&queue_cond);
+	pthread_mutex_unlock(&queue_mutex);
+	pthread_join(writer, NULL);
+
+	if (!schema_written) {
+		arrow_write_schema();
+	}
+	arrow_write_footer();
+	fflush(file);
+	check_and_log_file_error(file, "arrow");
+	if (file != stdout) {
+		fclose(file);
+	}
+	file = NULL;
+
+	chunk_free(filling);
+	while (free_chunks) {
+		arrow_chunk_t *next = free_chunks->next;
+		chunk_free(free_chunks);
+		free_chunks = next;
+	}
+	for (int i = 0; i < num_fields; i++) {
+		arrow_dict_t *d = &fields[i].dict;
+		free(d->offsets);
+		free(d->data);
+		free(d->table);
+		free(d->indices);
+	}
+	free(fields);
+	free(bufs);
+	free(buf_meta);
+	free(nodes);
+	free(dict_blocks);
+	free(batch_blocks);
+	free(fb.buf);
+	return EXIT_SUCCESS;
+}
+
+output_module_t module_arrow_file = {
+    .name = "arrow",
+    .filter_duplicates = 0,   // framework should not filter out duplicates
+    .filter_unsuccessful = 0, // framework should not filter out unsuccessful
+    .init = &arrow_init,
+    .start = NULL,
+    .update = NULL,
+    .update_interval = 0,
+    .close = &arrow_close,
+    .process_ip = &arrow_process,
+    .supports_dynamic_output = DYNAMIC_SUPPORT,
+    .helptext =
+	"Outputs the output fields as columns of an Apache Arrow IPC file, "
+	"which pandas, pyarrow, and DuckDB can load directly. int fields are "
+	"written as uint64, bool as bool, string as utf8 (dictionary encoded "
+	"if the values repeat), and binary as binary. Repeated fields are not "
+	"supported. Results are written in record batches of --output-args "
+	"rows (default 65536), or every few seconds, by a separate thread."};
@@ -13,6 +13,7 @@
 
 extern output_module_t module_csv_file;
 extern output_module_t module_json_file;
+extern output_module_t module_arrow_file;
 
 #ifdef REDIS
 extern output_module_t module_redis;
@@ -25,7 +26,7 @@ extern output_module_t module_mongodb;
 #endif
 
 output_module_t *output_modules[] = {
-    &module_csv_file, &module_json_file,
+    &module_csv_file, &module_json_file, &module_arrow_file,
 #ifdef REDIS
     &module_redis,    &module_redis_csv,
 #endif
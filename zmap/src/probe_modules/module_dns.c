@@ -34,6 +34,19 @@
  *the number of questions in --probe-args, and --output-filter="" to remove the
  *implicit "filter_duplicates" configuration flag.
  *
+ * Responses to open-resolver scans can be large, and decoding every name into
+ * its own string is most of the receive thread's time. Prefixing the args with
+ * "compact:" (e.g. "compact:A,example.com") instead matches the question with
+ * a hash lookup and walks the records in place, emitting them in dns_records
+ * as a stream of fixed-size entries that point into raw_data:
+ *   section (1 byte: 0 question, 1 answer, 2 authority, 3 additional)
+ *   length (1 byte: number of bytes that follow)
+ *   name offset, type, class (2 bytes each)
+ *   and for all but questions: ttl (4), rdlength (2), rdata offset (2)
+ * All fields are big-endian, and offsets are from the start of raw_data, so
+ * names can be decompressed from there offline. dns_questions, dns_answers,
+ * dns_authorities, and dns_additionals are null in this mode.
+ *
  * Based on a deprecated udp_dns module.
  */
 
@@ -64,6 +77,12 @@
 #define BAD_QTYPE_VAL -1
 #define MAX_LABEL_RECURSION 10
 #define DNS_QR_ANSWER 1
+#define DNS_COMPACT_PREFIX "compact"
+#define DNS_COMPACT_QUESTION_LEN 6
+#define DNS_COMPACT_RR_LEN 14
+// The smallest question is 5 bytes on the wire, and nothing is smaller, so a
+// captured packet can't hold more records than this.
+#define DNS_COMPACT_MAX_LEN ((PCAP_SNAPLEN / 5 + 1) * (2 + DNS_COMPACT_RR_LEN))
 
 // Note: each label has a max length of 63 bytes. So someone has to be doing
 // something really annoying. Will raise a warning.
@@ -90,6 +109,22 @@ static char **qnames;
 static uint16_t *qtypes;
 static int num_questions = 0;
 
+// Compact mode. The question table is open addressed, holding the index of
+// each question plus one, so that 0 is empty.
+static int compact_records = 0;
+static uint32_t *question_table;
+static uint32_t question_table_mask;
+// Receive is single threaded and output happens before the next packet is
+// processed, so one buffer serves every response.
+static uint8_t compact_buf[DNS_COMPACT_MAX_LEN];
+
+enum dns_section {
+	DNS_SECTION_QUESTION = 0,
+	DNS_SECTION_ANSWER = 1,
+	DNS_SECTION_AUTHORITY = 2,
+	DNS_SECTION_ADDITIONAL = 3
+};
+
 /* Array of qtypes we support. Jumping through some hoops (1 level of
  * indirection) so the per-packet processing time is fast. Keep this in sync
  * with: dns_qtype (.h) qtype_strid_to_qtype (below) qtype_qtype_to_strid
@@ -564,6 +599,186 @@ static bool process_response_answer(char **data, uint16_t *data_len,
 	return 0;
 }
 
+// FNV-1a over the wire-format qname and the qtype.
+static uint32_t question_hash(const uint8_t *qname, uint16_t qname_len,
+			      uint16_t qtype)
+{
+	uint32_t hash = 2166136261u;
+	for (uint16_t i = 0; i < qname_len; i++) {
+		hash = (hash ^ qname[i]) * 16777619u;
+	}
+	hash = (hash ^ (qtype >> 8)) * 16777619u;
+	hash = (hash ^ (qtype & 0xFF)) * 16777619u;
+	return hash;
+}
+
+static void build_question_table(void)
+{
+	uint32_t size = 4;
+	while (size < 2 * (uint32_t)num_questions) {
+		size <<= 1;
+	}
+	question_table = xcalloc(size, sizeof(uint32_t));
+	question_table_mask = size - 1;
+	for (int i = 0; i < num_questions; i++) {
+		uint32_t slot =
+		    question_hash((uint8_t *)qnames[i], qname_lens[i], qtypes[i]);
+		while (question_table[slot & question_table_mask]) {
+			slot++;
+		}
+		question_table[slot & question_table_mask] = i + 1;
+	}
+}
+
+// Find which of our questions the response echoes, without copying the name
+// out. Like the strcmp() it replaces, the name must not be compressed.
+// Returns the question index, or -1 if it isn't one of ours.
+static int lookup_question(const uint8_t *payload, uint16_t payload_len)
+{
+	uint16_t off = sizeof(dns_header);
+	while (off < payload_len && payload[off] != '\0') {
+		if (payload[off] >= 0x40) {
+			return -1;
+		}
+		off += payload[off] + 1;
+	}
+	if (off + 1 + sizeof(dns_question_tail) > payload_len) {
+		return -1;
+	}
+	const uint8_t *qname = payload + sizeof(dns_header);
+	uint16_t qname_len = off + 1 - sizeof(dns_header);
+	const dns_question_tail *tail =
+	    (const dns_question_tail *)(payload + off + 1);
+	uint16_t qtype = ntohs(tail->qtype);
+	if (tail->qclass != htons(0x01)) {
+		return -1;
+	}
+	uint32_t slot = question_hash(qname, qname_len, qtype);
+	for (;; slot++) {
+		uint32_t entry = question_table[slot & question_table_mask];
+		if (!entry) {
+			return -1;
+		}
+		int i = entry - 1;
+		if (qtypes[i] == qtype && qname_lens[i] == qname_len &&
+		    memcmp(qnames[i], qname, qname_len) == 0) {
+			return i;
+		}
+	}
+}
+
+// Check the name at payload[off] in place. Compression pointers have to
+// point before the last place we jumped to, so they can't loop. Returns the
+// offset just past the name where it sits (past the first pointer, if any),
+// or 0 if the name is malformed.
+static uint16_t skip_name(const uint8_t *payload, uint16_t payload_len,
+			  uint16_t off)
+{
+	uint16_t end = 0;
+	uint16_t limit = off;
+	uint16_t name_len = 0;
+	while (off < payload_len) {
+		uint8_t byte = payload[off];
+		if (byte >= 0xc0) {
+			if (off + 1 >= payload_len) {
+				return 0;
+			}
+			uint16_t ptr = ((byte & 0x3F) << 8) | payload[off + 1];
+			if (ptr >= limit) {
+				return 0;
+			}
+			if (!end) {
+				end = off + 2;
+			}
+			limit = ptr;
+			off = ptr;
+		} else if (byte >= 0x40) {
+			// Extended label types. Nobody uses these.
+			return 0;
+		} else if (byte == '\0') {
+			return end ? end : off + 1;
+		} else {
+			name_len += byte + 1;
+			if (name_len > 255) {
+				return 0;
+			}
+			off += byte + 1;
+		}
+	}
+	return 0;
+}
+
+static inline uint8_t *put_uint16(uint8_t *out, uint16_t val)
+{
+	out[0] = val >> 8;
+	out[1] = val & 0xFF;
+	return out + 2;
+}
+
+// Walk every section and describe each record in compact_buf. The type,
+// class, ttl, and rdlength are already big-endian on the wire, so they are
+// copied over as they are.
+static void add_compact_records(fieldset_t *fs, const dns_header *dns_hdr,
+				uint16_t payload_len)
+{
+	const uint8_t *payload = (const uint8_t *)dns_hdr;
+	uint16_t counts[] = {ntohs(dns_hdr->qdcount), ntohs(dns_hdr->ancount),
+			     ntohs(dns_hdr->nscount), ntohs(dns_hdr->arcount)};
+	uint16_t off = sizeof(dns_header);
+	uint8_t *out = compact_buf;
+	bool err = 0;
+	for (int section = DNS_SECTION_QUESTION;
+	     section <= DNS_SECTION_ADDITIONAL && !err; section++) {
+		for (int i = 0; i < counts[section]; i++) {
+			uint16_t end = skip_name(payload, payload_len, off);
+			if (!end || out + 2 + DNS_COMPACT_RR_LEN >
+					compact_buf + sizeof(compact_buf)) {
+				err = 1;
+				break;
+			}
+			out[0] = section;
+			if (section == DNS_SECTION_QUESTION) {
+				if (end + sizeof(dns_question_tail) >
+				    payload_len) {
+					err = 1;
+					break;
+				}
+				out[1] = DNS_COMPACT_QUESTION_LEN;
+				out = put_uint16(out + 2, off);
+				memcpy(out, payload + end,
+				       sizeof(dns_question_tail));
+				out += sizeof(dns_question_tail);
+				off = end + sizeof(dns_question_tail);
+				continue;
+			}
+			if (end + sizeof(dns_answer_tail) > payload_len) {
+				err = 1;
+				break;
+			}
+			const dns_answer_tail *tail =
+			    (const dns_answer_tail *)(payload + end);
+			uint16_t rdata = end + sizeof(dns_answer_tail);
+			if (rdata + ntohs(tail->rdlength) > payload_len) {
+				err = 1;
+				break;
+			}
+			out[1] = DNS_COMPACT_RR_LEN;
+			out = put_uint16(out + 2, off);
+			memcpy(out, tail, sizeof(dns_answer_tail));
+			out += sizeof(dns_answer_tail);
+			out = put_uint16(out, rdata);
+			off = rdata + ntohs(tail->rdlength);
+		}
+	}
+	fs_add_null(fs, "dns_questions");
+	fs_add_null(fs, "dns_answers");
+	fs_add_null(fs, "dns_authorities");
+	fs_add_null(fs, "dns_additionals");
+	fs_add_binary(fs, "dns_records", out - compact_buf, compact_buf, 0);
+	fs_add_uint64(fs, "dns_unconsumed_bytes", payload_len - off);
+	fs_add_uint64(fs, "dns_parse_err", err || off != payload_len);
+}
+
 /*
  * Start of required zmap exports.
  */
@@ -596,12 +811,22 @@ static int dns_global_initialize(struct state_conf *conf)
 	udp_set_num_ports(num_ports);
 	setup_qtype_str_map();
 
-	if (conf->probe_args) { // no parameters passed in. Use defaults
-		int arg_strlen = strlen(conf->probe_args);
-		char *arg_pos = conf->probe_args;
+	char *probe_args = conf->probe_args;
+	if (probe_args && !strncmp(probe_args, DNS_COMPACT_PREFIX,
+				   strlen(DNS_COMPACT_PREFIX))) {
+		char *rest = probe_args + strlen(DNS_COMPACT_PREFIX);
+		if (*rest == ':' || *rest == '\0') {
+			compact_records = 1;
+			probe_args = *rest ? rest + 1 : NULL;
+		}
+	}
+
+	if (probe_args) { // no parameters passed in. Use defaults
+		int arg_strlen = strlen(probe_args);
+		char *arg_pos = probe_args;
 
 		for (int i = 0; i < num_questions; i++) {
-			if (arg_pos >= (conf->probe_args + arg_strlen)) {
+			if (arg_pos >= (probe_args + arg_strlen)) {
 				log_fatal(
 				    "dns",
 				    "More probes than questions configured. Add additional questions.");
@@ -652,13 +877,19 @@ static int dns_global_initialize(struct state_conf *conf)
 			arg_pos = probe_q_delimiter_p + domain_len + 2;
 		}
 
-		if (arg_pos != conf->probe_args + arg_strlen + 2) {
+		if (arg_pos != probe_args + arg_strlen + 2) {
 			log_fatal(
 			    "dns",
 			    "More args than probes passed. Add additional probes.");
 		}
 	}
-	return build_global_dns_packets(domains, num_questions);
+	if (build_global_dns_packets(domains, num_questions) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+	if (compact_records) {
+		build_question_table();
+	}
+	return EXIT_SUCCESS;
 }
 
 static int dns_global_cleanup(UNUSED struct state_conf *zconf,
@@ -697,6 +928,11 @@ static int dns_global_cleanup(UNUSED struct state_conf *zconf,
 		free(qtypes);
 	}
 
+	if (question_table) {
+		free(question_table);
+	}
+	question_table = NULL;
+
 	return EXIT_SUCCESS;
 }
 
@@ -870,7 +1106,7 @@ void dns_process_packet(const u_char *packet, uint32_t len, fieldset_t *fs,
 
 		int match = 0;
 		bool is_valid = 0;
-		for (int i = 0; i < num_questions; i++) {
+		for (int i = 0; i < num_questions && !compact_records; i++) {
 			if (udp_len < dns_packet_lens[i]) {
 				continue;
 			}
@@ -899,9 +1135,15 @@ void dns_process_packet(const u_char *packet, uint32_t len, fieldset_t *fs,
 				}
 			}
 		}
-		assert(match > 0);
+		assert(match > 0 || compact_records);
 
 		dns_header *dns_hdr = (dns_header *)&udp_hdr[1];
+		uint16_t dns_len = udp_len - sizeof(struct udphdr);
+		if (compact_records) {
+			is_valid =
+			    dns_hdr->id == (validation[2] & 0xFFFF) &&
+			    lookup_question((uint8_t *)dns_hdr, dns_len) >= 0;
+		}
 		uint16_t qr = dns_hdr->qr;
 		uint16_t rcode = dns_hdr->rcode;
 		// Success: Has the right validation bits and the right Q
@@ -950,6 +1192,7 @@ void dns_process_packet(const u_char *packet, uint32_t len, fieldset_t *fs,
 					fs_new_repeated_fieldset());
 			fs_add_repeated(fs, "dns_additionals",
 					fs_new_repeated_fieldset());
+			fs_add_null(fs, "dns_records");
 
 			fs_add_uint64(fs, "dns_unconsumed_bytes", 0);
 			fs_add_uint64(fs, "dns_parse_err", 1);
@@ -974,6 +1217,10 @@ void dns_process_packet(const u_char *packet, uint32_t len, fieldset_t *fs,
 				      ntohs(dns_hdr->nscount));
 			fs_add_uint64(fs, "dns_arcount",
 				      ntohs(dns_hdr->arcount));
+		}
+		if (is_valid && compact_records) {
+			add_compact_records(fs, dns_hdr, dns_len);
+		} else if (is_valid) {
 			// And now for the complicated part. Hierarchical data.
 			char *data = ((char *)dns_hdr) + sizeof(dns_header);
 			uint16_t data_len =
@@ -1015,6 +1262,7 @@ void dns_process_packet(const u_char *packet, uint32_t len, fieldset_t *fs,
 							      udp_len, list);
 			}
 			fs_add_repeated(fs, "dns_additionals", list);
+			fs_add_null(fs, "dns_records");
 			// Do we have unconsumed data?
 			fs_add_uint64(fs, "dns_unconsumed_bytes", data_len);
 			if (data_len != 0) {
@@ -1083,6 +1331,7 @@ void dns_process_packet(const u_char *packet, uint32_t len, fieldset_t *fs,
 				fs_new_repeated_fieldset());
 		fs_add_repeated(fs, "dns_additionals",
 				fs_new_repeated_fieldset());
+		fs_add_null(fs, "dns_records");
 
 		fs_add_uint64(fs, "dns_unconsumed_bytes", 0);
 		fs_add_uint64(fs, "dns_parse_err", 1);
@@ -1147,6 +1396,9 @@ static fielddef_t fields[] = {
     {.name = "dns_additionals",
      .type = "repeated",
      .desc = "DNS additional list"},
+    {.name = "dns_records",
+     .type = "binary",
+     .desc = "With compact: probe args, the records as offsets into raw_data"},
     {.name = "dns_parse_err",
      .type = "int",
      .desc = "Problem parsing the DNS response"},
@@ -1182,6 +1434,9 @@ probe_module_t module_dns = {
 	"PTR, MX, TXT, AAAA, RRSIG, and ALL. The module will accept and attempt "
 	"to parse all DNS responses. There is currently support for parsing out "
 	"full data from A, NS, CNAME, MX, TXT, and AAAA. Any other types will be "
-	"output in raw form."
+	"output in raw form. Prefixing the arguments with 'compact:' skips "
+	"decoding, and instead outputs dns_records, a list of each record's "
+	"section, type, class, ttl, and the offsets of its name and rdata in "
+	"raw_data."
 
 };
@@ -208,9 +208,8 @@ int ntp_init_perthread(void *buf, macaddr_t *src, macaddr_t *gw,
 	assert(module_ntp.packet_length <= MAX_PACKET_SIZE);
 	memcpy(payload, ntp_header, module_ntp.packet_length);
 
-	uint32_t seed = aesrand_getword(zconf.aes);
-	aesrand_t *aes = aesrand_init_from_seed(seed);
-	*arg = aes;
+	// udp_make_packet() builds the probes, so it gets the state it needs
+	*arg = udp_probe_state_init();
 
 	return EXIT_SUCCESS;
 }
@@ -34,6 +34,7 @@ static char *udp_send_msg = NULL;
 static int udp_send_msg_len = 0;
 static int udp_send_substitutions = 0;
 static udp_payload_template_t *udp_template = NULL;
+static udp_payload_compiled_t *udp_compiled = NULL;
 
 static const char *udp_send_msg_default = "GET / HTTP/1.1\r\nHost: www\r\n\r\n";
 
@@ -195,6 +196,7 @@ int udp_global_initialize(struct state_conf *conf)
 			udp_send_substitutions = 1;
 			udp_template =
 			    udp_template_load(udp_send_msg, udp_send_msg_len);
+			udp_compiled = udp_template_compile(udp_template);
 		}
 
 	} else if (strcmp(args, "hex") == 0) {
@@ -226,6 +228,12 @@ int udp_global_initialize(struct state_conf *conf)
 			 MAX_UDP_PAYLOAD_LEN, udp_send_msg_len);
 		udp_send_msg_len = MAX_UDP_PAYLOAD_LEN;
 	}
+	// Templated payloads vary in length, so this is the longest one,
+	// for working out the rate from --bandwidth
+	module_udp.packet_length =
+	    sizeof(struct ether_header) + sizeof(struct ip) +
+	    sizeof(struct udphdr) +
+	    (udp_compiled ? udp_compiled->max_len : (unsigned)udp_send_msg_len);
 	free(args);
 	return EXIT_SUCCESS;
 }
@@ -239,6 +247,11 @@ int udp_global_cleanup(__attribute__((unused)) struct state_conf *zconf,
 		udp_send_msg = NULL;
 	}
 
+	if (udp_compiled) {
+		udp_template_compiled_free(udp_compiled);
+		udp_compiled = NULL;
+	}
+
 	if (udp_template) {
 		udp_template_free(udp_template);
 		udp_template = NULL;
@@ -264,21 +277,32 @@ int udp_init_perthread(void *buf, macaddr_t *src, macaddr_t *gw,
 
 	char *payload = (char *)(&udp_header[1]);
 
-	module_udp.packet_length = sizeof(struct ether_header) +
-				   sizeof(struct ip) + sizeof(struct udphdr) +
-				   udp_send_msg_len;
 	assert(module_udp.packet_length <= MAX_PACKET_SIZE);
 	memcpy(payload, udp_send_msg, udp_send_msg_len);
 
-	// Seed our random number generator with the global generator
-	uint32_t seed = aesrand_getword(zconf.aes);
-	aesrand_t *aes = aesrand_init_from_seed(seed);
-	*arg_ptr = aes;
+	*arg_ptr = udp_probe_state_init();
 
 	return EXIT_SUCCESS;
 }
 
-int udp_make_packet(void *buf, UNUSED size_t *buf_len, ipaddr_n_t src_ip,
+udp_probe_state_t *udp_probe_state_init(void)
+{
+	udp_probe_state_t *st = xcalloc(1, sizeof(udp_probe_state_t));
+
+	// Seed our random number generator with the global generator
+	uint32_t seed = aesrand_getword(zconf.aes);
+	st->aes = aesrand_init_from_seed(seed);
+
+	// The RAND_* fields come from xorshift128+, seeded from AES, which
+	// gives 8 bytes a step instead of one AES block per byte. The state
+	// must not be all zeroes.
+	st->rand[0] = aesrand_getword(st->aes);
+	st->rand[1] = aesrand_getword(st->aes) | 1;
+	st->primed_buf = NULL;
+	return st;
+}
+
+int udp_make_packet(void *buf, size_t *buf_len, ipaddr_n_t src_ip,
 		    ipaddr_n_t dst_ip, uint32_t *validation, int probe_num,
 		    void *arg)
 {
@@ -294,30 +318,18 @@ int udp_make_packet(void *buf, UNUSED size_t *buf_len, ipaddr_n_t src_ip,
 
 	if (udp_send_substitutions) {
 		char *payload = (char *)&udp_header[1];
-		int payload_len = 0;
-
-		memset(payload, 0, MAX_UDP_PAYLOAD_LEN);
-
-		// Grab our random number generator
-		aesrand_t *aes = (aesrand_t *)arg;
-
-		// The buf is a stack var of our caller of size MAX_PACKET_SIZE
-		// Recalculate the payload using the loaded template
-		payload_len = udp_template_build(udp_template, payload,
-						 MAX_UDP_PAYLOAD_LEN, ip_header,
-						 udp_header, aes);
-		// Recalculate the total length of the packet
-		module_udp.packet_length = sizeof(struct ether_header) +
-					   sizeof(struct ip) +
-					   sizeof(struct udphdr) + payload_len;
-
-		// If success is zero, the template output was truncated
-		if (payload_len <= 0) {
-			log_fatal(
-			    "udp",
-			    "UDP payload template generated an empty payload");
-			exit(1);
-		}
+		int payload_len;
+
+		// The buf belongs to our sender thread and is MAX_PACKET_SIZE.
+		// Fill in the compiled template's fields for this probe
+		payload_len = udp_template_fill(udp_compiled, payload,
+						ip_header, udp_header,
+						(udp_probe_state_t *)arg);
+
+		// The length is this probe's own, since other threads are
+		// building probes of other lengths at the same time
+		*buf_len = sizeof(struct ether_header) + sizeof(struct ip) +
+			   sizeof(struct udphdr) + payload_len;
 
 		// Update the IP and UDP headers to match the new payload length
 		ip_header->ip_len = htons(sizeof(struct ip) +
@@ -545,170 +557,241 @@ void udp_template_free(udp_payload_template_t *t)
 	free(t);
 }
 
-int udp_random_bytes(char *dst, int len, const unsigned char *charset,
-		     int charset_len, aesrand_t *aes)
+// The widest a field can be in the payload
+static unsigned int udp_field_width(const udp_payload_field_t *f)
 {
-	int i;
-	for (i = 0; i < len; i++) {
-		*dst++ =
-		    charset[(aesrand_getword(aes) & 0xFFFFFFFF) % charset_len];
+	switch (f->ftype) {
+	case UDP_SADDR_N:
+	case UDP_DADDR_N:
+		return 4;
+	case UDP_SPORT_N:
+	case UDP_DPORT_N:
+		return 2;
+	case UDP_SADDR_A:
+	case UDP_DADDR_A:
+		return 15;
+	case UDP_SPORT_A:
+	case UDP_DPORT_A:
+		return 5;
+	default:
+		return f->length;
 	}
-	return i;
 }
 
-int udp_template_build(udp_payload_template_t *t, char *out, unsigned int len,
-		       struct ip *ip_hdr, struct udphdr *udp_hdr,
-		       aesrand_t *aes)
+// Fields whose width depends on the probe, after which nothing in the
+// payload stays in the same place
+static int udp_field_is_variable(udp_payload_field_type_t ftype)
 {
-	udp_payload_field_t *c;
-	char *p;
-	char *max;
-	char tmp[256];
-	int full = 0;
-	unsigned int x, y;
-	uint32_t *u32;
-	uint16_t *u16;
-
-	max = out + len;
-	p = out;
-
-	for (x = 0; x < t->fcount; x++) {
-		c = t->fields[x];
-
-		// Exit the processing loop if our packet buffer would overflow
-		if (p + c->length >= max) {
-			full = 1;
-			return 0;
-		}
+	return ftype == UDP_SADDR_A || ftype == UDP_DADDR_A ||
+	       ftype == UDP_SPORT_A || ftype == UDP_DPORT_A;
+}
 
-		switch (c->ftype) {
+udp_payload_compiled_t *udp_template_compile(udp_payload_template_t *t)
+{
+	udp_payload_compiled_t *c = xcalloc(1, sizeof(udp_payload_compiled_t));
+	unsigned int data_len = 0;
+	int in_tail = 0;
 
-		// These fields have a specified output length value
+	c->data = xcalloc(1, MAX_UDP_PAYLOAD_LEN);
+	c->patches = xcalloc(t->fcount + 1, sizeof(udp_payload_slot_t));
+	c->tail = xcalloc(t->fcount + 1, sizeof(udp_payload_slot_t));
 
-		case UDP_DATA:
-			if (!(c->data && c->length))
-				break;
-			memcpy(p, c->data, c->length);
-			p += c->length;
-			break;
-
-		case UDP_RAND_DIGIT:
-			p += udp_random_bytes(p, c->length, charset_digit, 10,
-					      aes);
-			break;
+	for (unsigned int x = 0; x < t->fcount; x++) {
+		udp_payload_field_t *f = t->fields[x];
+		unsigned int width = udp_field_width(f);
+		udp_payload_slot_t *s;
 
-		case UDP_RAND_ALPHA:
-			p += udp_random_bytes(p, c->length, charset_alpha, 52,
-					      aes);
-			break;
+		if (width == 0) {
+			continue;
+		}
+		if (c->max_len + width > MAX_UDP_PAYLOAD_LEN) {
+			log_fatal("udp",
+				  "UDP payload template can be longer than "
+				  "%d bytes",
+				  MAX_UDP_PAYLOAD_LEN);
+		}
+		c->max_len += width;
+		if (udp_field_is_variable(f->ftype)) {
+			in_tail = 1;
+		}
 
-		case UDP_RAND_ALPHANUM:
-			p += udp_random_bytes(p, c->length, charset_alphanum,
-					      62, aes);
-			break;
+		if (!in_tail) {
+			// Static bytes go in place once and for all, and
+			// fields get a hole to be patched per probe
+			if (f->ftype == UDP_DATA) {
+				memcpy(c->data + data_len, f->data, f->length);
+			} else {
+				s = &c->patches[c->patch_count++];
+				s->ftype = f->ftype;
+				s->offset = data_len;
+				s->length = width;
+			}
+			data_len += width;
+			c->prefix_len = data_len;
+			continue;
+		}
 
-		case UDP_RAND_BYTE:
-			p += udp_random_bytes(p, c->length, charset_all, 256,
-					      aes);
-			break;
+		s = &c->tail[c->tail_count++];
+		s->ftype = f->ftype;
+		s->length = f->length;
+		if (f->ftype == UDP_DATA) {
+			memcpy(c->data + data_len, f->data, f->length);
+			s->offset = data_len;
+			data_len += f->length;
+		}
+	}
 
-		// These fields need to calculate size on their own
+	if (c->max_len == 0) {
+		log_fatal("udp",
+			  "UDP payload template generated an empty payload");
+	}
+	return c;
+}
 
-		// TODO: Condense these case statements to remove redundant code
-		case UDP_SADDR_A:
-			if (p + 15 >= max) {
-				full = 1;
-				break;
-			}
-			// Write to stack and then memcpy in order to properly
-			// track length
-			inet_ntop(AF_INET, (char *)&ip_hdr->ip_src, tmp,
-				  sizeof(tmp) - 1);
-			memcpy(p, tmp, strlen(tmp));
-			p += strlen(tmp);
-			break;
+void udp_template_compiled_free(udp_payload_compiled_t *c)
+{
+	free(c->data);
+	free(c->patches);
+	free(c->tail);
+	free(c);
+}
 
-		case UDP_DADDR_A:
-			if (p + 15 >= max) {
-				full = 1;
-				break;
-			}
-			// Write to stack and then memcpy in order to properly
-			// track length
-			inet_ntop(AF_INET, (char *)&ip_hdr->ip_dst, tmp,
-				  sizeof(tmp) - 1);
-			memcpy(p, tmp, strlen(tmp));
-			p += strlen(tmp);
-			break;
+static inline uint64_t udp_random_next(udp_probe_state_t *st)
+{
+	uint64_t s1 = st->rand[0];
+	const uint64_t s0 = st->rand[1];
 
-		case UDP_SADDR_N:
-			if (p + 4 >= max) {
-				full = 1;
-				break;
-			}
+	st->rand[0] = s0;
+	s1 ^= s1 << 23;
+	st->rand[1] = s1 ^ s0 ^ (s1 >> 18) ^ (s0 >> 5);
+	return st->rand[1] + s0;
+}
 
-			u32 = (uint32_t *)p;
-			*u32 = ip_hdr->ip_src.s_addr;
-			p += 4;
-			break;
+// Fill 'len' bytes from the charset, a word of the random stream at a time:
+// 8 bytes of it for RAND_BYTE, or 4 characters for the others, each scaled
+// from 16 bits into the charset rather than taking a remainder
+static void udp_random_fill(udp_probe_state_t *st, char *dst, unsigned int len,
+			    const unsigned char *charset,
+			    unsigned int charset_len)
+{
+	uint64_t r;
 
-		case UDP_DADDR_N:
-			if (p + 4 >= max) {
-				full = 1;
-				break;
-			}
-			u32 = (uint32_t *)p;
-			*u32 = ip_hdr->ip_dst.s_addr;
-			p += 4;
-			break;
+	if (charset_len == 256) {
+		for (; len >= 8; len -= 8, dst += 8) {
+			r = udp_random_next(st);
+			memcpy(dst, &r, 8);
+		}
+		if (len) {
+			r = udp_random_next(st);
+			memcpy(dst, &r, len);
+		}
+		return;
+	}
+	while (len) {
+		r = udp_random_next(st);
+		for (int i = 0; i < 4 && len; i++, len--) {
+			*dst++ = charset[((r & 0xFFFF) * charset_len) >> 16];
+			r >>= 16;
+		}
+	}
+}
 
-		case UDP_SPORT_N:
-			if (p + 2 >= max) {
-				full = 1;
-				break;
-			}
-			u16 = (uint16_t *)p;
-			*u16 = udp_hdr->uh_sport;
-			p += 2;
-			break;
+static unsigned int udp_format_uint(char *p, unsigned int n)
+{
+	char tmp[10];
+	unsigned int len = 0;
+
+	do {
+		tmp[len++] = '0' + n % 10;
+		n /= 10;
+	} while (n);
+	for (unsigned int i = 0; i < len; i++) {
+		p[i] = tmp[len - 1 - i];
+	}
+	return len;
+}
 
-		case UDP_DPORT_N:
-			if (p + 2 >= max) {
-				full = 1;
-				break;
-			}
-			u16 = (uint16_t *)p;
-			*u16 = udp_hdr->uh_sport;
-			p += 2;
-			break;
+static unsigned int udp_format_ip(char *p, struct in_addr addr)
+{
+	const uint8_t *b = (const uint8_t *)&addr.s_addr;
+	unsigned int len;
+
+	len = udp_format_uint(p, b[0]);
+	p[len++] = '.';
+	len += udp_format_uint(p + len, b[1]);
+	p[len++] = '.';
+	len += udp_format_uint(p + len, b[2]);
+	p[len++] = '.';
+	len += udp_format_uint(p + len, b[3]);
+	return len;
+}
 
-		case UDP_SPORT_A:
-			if (p + 5 >= max) {
-				full = 1;
-				break;
-			}
-			y = snprintf(tmp, 6, "%d", ntohs(udp_hdr->uh_sport));
-			memcpy(p, tmp, y);
-			p += y;
-			break;
+// Write one field of the compiled template, returning its length
+static unsigned int udp_slot_write(const udp_payload_compiled_t *c,
+				   const udp_payload_slot_t *s, char *p,
+				   struct ip *ip_hdr, struct udphdr *udp_hdr,
+				   udp_probe_state_t *st)
+{
+	switch (s->ftype) {
+	case UDP_DATA:
+		memcpy(p, c->data + s->offset, s->length);
+		return s->length;
+	case UDP_RAND_DIGIT:
+		udp_random_fill(st, p, s->length, charset_digit, 10);
+		return s->length;
+	case UDP_RAND_ALPHA:
+		udp_random_fill(st, p, s->length, charset_alpha, 52);
+		return s->length;
+	case UDP_RAND_ALPHANUM:
+		udp_random_fill(st, p, s->length, charset_alphanum, 62);
+		return s->length;
+	case UDP_RAND_BYTE:
+		udp_random_fill(st, p, s->length, charset_all, 256);
+		return s->length;
+	case UDP_SADDR_N:
+		memcpy(p, &ip_hdr->ip_src.s_addr, 4);
+		return 4;
+	case UDP_DADDR_N:
+		memcpy(p, &ip_hdr->ip_dst.s_addr, 4);
+		return 4;
+	case UDP_SPORT_N:
+		memcpy(p, &udp_hdr->uh_sport, 2);
+		return 2;
+	case UDP_DPORT_N:
+		memcpy(p, &udp_hdr->uh_dport, 2);
+		return 2;
+	case UDP_SADDR_A:
+		return udp_format_ip(p, ip_hdr->ip_src);
+	case UDP_DADDR_A:
+		return udp_format_ip(p, ip_hdr->ip_dst);
+	case UDP_SPORT_A:
+		return udp_format_uint(p, ntohs(udp_hdr->uh_sport));
+	case UDP_DPORT_A:
+		return udp_format_uint(p, ntohs(udp_hdr->uh_dport));
+	}
+	return 0;
+}
 
-		case UDP_DPORT_A:
-			if (p + 5 >= max) {
-				full = 1;
-				break;
-			}
-			y = snprintf(tmp, 6, "%d", ntohs(udp_hdr->uh_sport));
-			memcpy(p, tmp, y);
-			p += y;
-			break;
-		}
+// Build this probe's payload in 'out', returning its length. The prefix is
+// only copied when 'out' isn't the buffer it was last copied to, since
+// nothing but its fields changes between probes.
+int udp_template_fill(udp_payload_compiled_t *c, char *out, struct ip *ip_hdr,
+		      struct udphdr *udp_hdr, udp_probe_state_t *st)
+{
+	char *p;
 
-		// Bail out if our packet buffer would overflow
-		if (full == 1) {
-			return 0;
-		}
+	if (st->primed_buf != out) {
+		memcpy(out, c->data, c->prefix_len);
+		st->primed_buf = out;
+	}
+	for (unsigned int i = 0; i < c->patch_count; i++) {
+		const udp_payload_slot_t *s = &c->patches[i];
+		udp_slot_write(c, s, out + s->offset, ip_hdr, udp_hdr, st);
+	}
+	p = out + c->prefix_len;
+	for (unsigned int i = 0; i < c->tail_count; i++) {
+		p += udp_slot_write(c, &c->tail[i], p, ip_hdr, udp_hdr, st);
 	}
-
 	return p - out;
 }
 
@@ -51,6 +51,35 @@ typedef struct udp_payload_template {
 	struct udp_payload_field **fields;
 } udp_payload_template_t;
 
+// A template compiled for sending. The payload up to the first field whose
+// width varies (the ASCII addresses and ports) is laid out once per thread in
+// the prefix, and each probe only patches the fields inside it. Whatever comes
+// after is written in order from 'tail'.
+typedef struct udp_payload_slot {
+	enum udp_payload_field_type ftype;
+	unsigned int offset; // into the payload, or into 'data' for UDP_DATA
+	unsigned int length;
+} udp_payload_slot_t;
+
+typedef struct udp_payload_compiled {
+	char *data; // the prefix, followed by the static bytes of the tail
+	unsigned int prefix_len;
+	udp_payload_slot_t *patches;
+	unsigned int patch_count;
+	udp_payload_slot_t *tail;
+	unsigned int tail_count;
+	unsigned int max_len; // with every ASCII field at its widest
+} udp_payload_compiled_t;
+
+// What each sender thread needs to build probes: a random stream for the
+// RAND_* fields, seeded from the scan's aesrand, and which packet buffer
+// already holds the compiled template's prefix.
+typedef struct udp_probe_state {
+	aesrand_t *aes;
+	uint64_t rand[2];
+	void *primed_buf;
+} udp_probe_state_t;
+
 typedef struct udp_payload_output {
 	int length;
 	char *data;
@@ -84,10 +113,15 @@ void udp_template_add_field(udp_payload_template_t *t,
 
 void udp_template_free(udp_payload_template_t *t);
 
-int udp_template_build(udp_payload_template_t *t, char *out, unsigned int len,
-		       struct ip *ip_hdr, struct udphdr *udp_hdr,
-		       aesrand_t *aes);
-
 int udp_template_field_lookup(char *vname, udp_payload_field_t *c);
 
 udp_payload_template_t *udp_template_load(char *buf, unsigned int len);
+
+udp_payload_compiled_t *udp_template_compile(udp_payload_template_t *t);
+
+void udp_template_compiled_free(udp_payload_compiled_t *c);
+
+int udp_template_fill(udp_payload_compiled_t *c, char *out, struct ip *ip_hdr,
+		      struct udphdr *udp_hdr, udp_probe_state_t *st);
+
+udp_probe_state_t *udp_probe_state_init(void);
@@ -12,6 +12,7 @@
 #include <stdint.h>
 
 void handle_packet(uint32_t buflen, const uint8_t *bytes);
+void recv_hist_add(uint32_t *hist, uint64_t value);
 void recv_init();
 void recv_packets();
 void recv_cleanup();
@@ -94,6 +94,8 @@ void recv_packets()
 		log_fatal("recv", "pcap_dispatch error");
 	} else if (ret == 0) {
 		usleep(1000);
+	} else if (zconf.metrics_file) {
+		recv_hist_add(zrecv.batch_hist, ret);
 	}
 }
 
@@ -15,6 +15,7 @@
 #include "../lib/pbm.h"
 
 #include <pthread.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "recv-internal.h"
@@ -26,10 +27,57 @@
 #include "output_modules/output_modules.h"
 
 // bitmap of observed IP addresses
-static uint8_t **seen = NULL;
+static apbm_t *seen = NULL;
+
+// a send time further back than this can't be one of ours, and is most
+// likely a response that doesn't echo our probe back
+#define MAX_RTT_US (3600ULL * 1000 * 1000)
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// count value in the bucket for its power of two
+void recv_hist_add(uint32_t *hist, uint64_t value)
+{
+	int i = value ? 63 - __builtin_clzll(value) : 0;
+	if (i >= RECV_HIST_BUCKETS) {
+		i = RECV_HIST_BUCKETS - 1;
+	}
+	hist[i]++;
+}
+
+// add the round trip time of a response to the histogram, if the probe
+// module tells us when the probe was sent
+static void add_rtt(fieldset_t *fs)
+{
+	struct fieldset_conf *c = &zconf.fsconf;
+	if (c->sent_ts_index < 0 || c->recv_ts_index < 0 ||
+	    fs->fields[c->sent_ts_index].type != FS_UINT64 ||
+	    fs->fields[c->sent_us_index].type != FS_UINT64) {
+		return;
+	}
+	uint64_t sent =
+	    fs_get_uint64_by_index(fs, c->sent_ts_index) * 1000000 +
+	    fs_get_uint64_by_index(fs, c->sent_us_index);
+	uint64_t recvd =
+	    fs_get_uint64_by_index(fs, c->recv_ts_index) * 1000000 +
+	    fs_get_uint64_by_index(fs, c->recv_us_index);
+	if (recvd < sent || recvd - sent > MAX_RTT_US) {
+		return;
+	}
+	recv_hist_add(zrecv.rtt_hist, recvd - sent);
+}
 
 void handle_packet(uint32_t buflen, const u_char *bytes)
 {
+	// time each stage only when someone is going to look at it
+	int timed = zconf.metrics_file != NULL;
+	uint64_t t = timed ? now_ns() : 0;
+	uint64_t t_next;
 	if (sizeof(struct ip) + sizeof(struct ether_header) > buflen) {
 		// buffer not large enough to contain ethernet
 		// and ip headers. further action would overrun buf
@@ -49,12 +97,20 @@ void handle_packet(uint32_t buflen, const u_char *bytes)
 		ip_hdr, buflen - sizeof(struct ether_header), &src_ip,
 		validation)) {
 		zrecv.validation_failed++;
+		if (timed) {
+			zrecv.validate_ns += now_ns() - t;
+		}
 		return;
 	} else {
 		zrecv.validation_passed++;
 	}
+	if (timed) {
+		t_next = now_ns();
+		zrecv.validate_ns += t_next - t;
+		t = t_next;
+	}
 	// woo! We've validated that the packet is a response to our scan
-	int is_repeat = pbm_check(seen, ntohl(src_ip));
+	int is_repeat = apbm_check(seen, ntohl(src_ip));
 	// track whether this is the first packet in an IP fragment.
 	if (ip_hdr->ip_off & IP_MF) {
 		zrecv.ip_fragments++;
@@ -73,7 +129,7 @@ void handle_packet(uint32_t buflen, const u_char *bytes)
 		zrecv.success_total++;
 		if (!is_repeat) {
 			zrecv.success_unique++;
-			pbm_set(seen, ntohl(src_ip));
+			apbm_set(seen, ntohl(src_ip));
 		}
 		if (zsend.complete) {
 			zrecv.cooldown_total++;
@@ -81,6 +137,9 @@ void handle_packet(uint32_t buflen, const u_char *bytes)
 				zrecv.cooldown_unique++;
 			}
 		}
+		if (timed) {
+			add_rtt(fs);
+		}
 	} else {
 		zrecv.failure_total++;
 	}
@@ -96,6 +155,12 @@ void handle_packet(uint32_t buflen, const u_char *bytes)
 		}
 	}
 
+	if (timed) {
+		t_next = now_ns();
+		zrecv.process_ns += t_next - t;
+		t = t_next;
+	}
+
 	fieldset_t *o = NULL;
 	// we need to translate the data provided by the probe module
 	// into a fieldset that can be used by the output module
@@ -120,6 +185,9 @@ cleanup:
 	    !(zrecv.success_unique % zconf.output_module->update_interval)) {
 		zconf.output_module->update(&zconf, &zsend, &zrecv);
 	}
+	if (timed) {
+		zrecv.output_ns += now_ns() - t;
+	}
 }
 
 int recv_run(pthread_mutex_t *recv_ready_mutex)
@@ -131,7 +199,7 @@ int recv_run(pthread_mutex_t *recv_ready_mutex)
 	}
 
 	// initialize paged bitmap
-	seen = pbm_init();
+	seen = apbm_init(zconf.hugetlb);
 	if (zconf.filter_duplicates) {
 		log_debug("recv",
 			  "duplicate responses will be excluded from output");
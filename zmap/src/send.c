@@ -211,6 +211,47 @@ iterator_t *send_init(void)
 	return it;
 }
 
+// With a list of IPs, most addresses the shard generates aren't on the list,
+// and each check is a cache miss somewhere in a 512 MB bitmap. Take them from
+// the shard in batches, so that the misses overlap.
+#define LIST_BATCH_SIZE 64
+
+typedef struct list_batch {
+	uint32_t ips[LIST_BATCH_SIZE];
+	uint8_t listed[LIST_BATCH_SIZE];
+	int len;
+	int pos;
+	int done;
+} list_batch_t;
+
+static uint32_t get_next_listed_ip(shard_t *s, list_batch_t *batch)
+{
+	for (;;) {
+		while (batch->pos < batch->len) {
+			int i = batch->pos++;
+			if (batch->listed[i]) {
+				return batch->ips[i];
+			}
+			s->state.tried_sent++;
+		}
+		if (batch->done) {
+			return ZMAP_SHARD_DONE;
+		}
+		batch->len = 0;
+		batch->pos = 0;
+		while (batch->len < LIST_BATCH_SIZE) {
+			uint32_t ip = shard_get_next_ip(s);
+			if (ip == ZMAP_SHARD_DONE) {
+				batch->done = 1;
+				break;
+			}
+			batch->ips[batch->len++] = ip;
+		}
+		apbm_check_batch(zsend.list_of_ips_pbm, batch->ips, batch->len,
+				 batch->listed);
+	}
+}
+
 static inline ipaddr_n_t get_src_ip(ipaddr_n_t dst, int local_offset)
 {
 	if (srcip_first == srcip_last) {
@@ -282,6 +323,7 @@ int send_run(sock_t st, shard_t *s)
 				 (zconf.rate / zconf.senders);
 			interval = (zconf.rate / zconf.senders) / 20;
 			last_time = now();
+			s->state.pacing_delay = delay;
 		}
 	}
 	// Get the initial IP to scan.
@@ -290,17 +332,17 @@ int send_run(sock_t st, shard_t *s)
 	// If provided a list of IPs to scan, then the first generated address
 	// might not be on that list. Iterate until the current IP is one the
 	// list, then start the true scanning process.
-	if (zconf.list_of_ips_filename) {
-		while (!pbm_check(zsend.list_of_ips_pbm, current_ip)) {
-			current_ip = shard_get_next_ip(s);
-			s->state.tried_sent++;
-			if (current_ip == ZMAP_SHARD_DONE) {
-				log_debug(
-				    "send",
-				    "never made it to send loop in send thread %i",
-				    s->thread_id);
-				goto cleanup;
-			}
+	list_batch_t list_batch;
+	memset(&list_batch, 0, sizeof(list_batch));
+	if (zconf.list_of_ips_filename &&
+	    !apbm_check(zsend.list_of_ips_pbm, current_ip)) {
+		s->state.tried_sent++;
+		current_ip = get_next_listed_ip(s, &list_batch);
+		if (current_ip == ZMAP_SHARD_DONE) {
+			log_debug("send",
+				  "never made it to send loop in send thread %i",
+				  s->thread_id);
+			goto cleanup;
 		}
 	}
 	int attempts = zconf.num_retries + 1;
@@ -321,6 +363,8 @@ int send_run(sock_t st, shard_t *s)
 					  ts.tv_sec, ts.tv_nsec);
 				while (nanosleep(&ts, &rem) == -1) {
 				}
+				s->state.pacing_sleeps++;
+				s->state.pacing_sleep_ns += sleep_time;
 				last_time = t;
 			} else {
 				for (vi = delay; vi--;)
@@ -334,6 +378,7 @@ int send_run(sock_t st, shard_t *s)
 						 (zconf.rate / zconf.senders);
 					if (delay < 1)
 						log_fatal("send", "send rate exceeds system capabilities");
+					s->state.pacing_delay = delay;
 					last_count = count;
 					last_time = t;
 				}
@@ -392,6 +437,7 @@ int send_run(sock_t st, shard_t *s)
 					int rc = send_packet(st, contents,
 							     length, idx);
 					if (rc < 0) {
+						s->state.send_errors++;
 						struct in_addr addr;
 						addr.s_addr = current_ip;
 						char addr_str_buf
@@ -423,23 +469,12 @@ int send_run(sock_t st, shard_t *s)
 		s->state.sent++;
 		s->state.tried_sent++;
 
-		// Get the next IP to scan
-		current_ip = shard_get_next_ip(s);
-		if (zconf.list_of_ips_filename &&
-		    current_ip != ZMAP_SHARD_DONE) {
-			// If we have a list of IPs bitmap, ensure the next IP
-			// to scan is on the list.
-			while (!pbm_check(zsend.list_of_ips_pbm, current_ip)) {
-				current_ip = shard_get_next_ip(s);
-				s->state.tried_sent++;
-				if (current_ip == ZMAP_SHARD_DONE) {
-					log_debug(
-					    "send",
-					    "send thread %hhu shard finished in get_next_ip_loop depleted",
-					    s->thread_id);
-					goto cleanup;
-				}
-			}
+		// Get the next IP to scan. If we have a list of IPs bitmap,
+		// ensure the next IP to scan is on the list.
+		if (zconf.list_of_ips_filename) {
+			current_ip = get_next_listed_ip(s, &list_batch);
+		} else {
+			current_ip = shard_get_next_ip(s);
 		}
 	}
 cleanup:
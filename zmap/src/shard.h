@@ -26,6 +26,13 @@ typedef struct shard {
 		uint32_t failures;
 		uint32_t first_scanned;
 		uint32_t max_targets;
+		// sendto calls that failed, including ones a retry made up for
+		uint32_t send_errors;
+		// times the thread slept to keep to its rate, and for how long
+		uint32_t pacing_sleeps;
+		uint64_t pacing_sleep_ns;
+		// spin loop iterations between packets, when not sleeping
+		uint32_t pacing_delay;
 	} state;
 	struct shard_params {
 		uint64_t first;
@@ -49,6 +49,7 @@ struct state_conf zconf = {.log_level = LOG_INFO,
 			   .log_file = NULL,
 			   .log_directory = NULL,
 			   .status_updates_file = NULL,
+			   .metrics_file = NULL,
 			   .dryrun = 0,
 			   .quiet = 0,
 			   .syslog = 1,
@@ -13,6 +13,7 @@
 #include <stdint.h>
 
 #include "../lib/includes.h"
+#include "../lib/pbm.h"
 
 #ifdef PFRING
 #include <pfring_zc.h>
@@ -24,6 +25,7 @@
 #include "types.h"
 
 #define MAX_PACKET_SIZE 4096
+#define RECV_HIST_BUCKETS 32
 #define MAC_ADDR_LEN_BYTES 6
 
 struct probe_module;
@@ -36,6 +38,12 @@ struct fieldset_conf {
 	int success_index;
 	int app_success_index;
 	int classification_index;
+	// send time carried in the probe, for probe modules that have it,
+	// and the time the response arrived. -1 if there is no send time.
+	int sent_ts_index;
+	int sent_us_index;
+	int recv_ts_index;
+	int recv_us_index;
 };
 
 // global configuration
@@ -110,6 +118,7 @@ struct state_conf {
 	char *log_file;
 	char *log_directory;
 	char *status_updates_file;
+	char *metrics_file;
 	int dryrun;
 	int quiet;
 	int ignore_invalid_hosts;
@@ -122,6 +131,7 @@ struct state_conf {
 	uint64_t total_disallowed;
 	int max_sendto_failures;
 	float min_hitrate;
+	int hugetlb;
 #ifdef PFRING
 	struct {
 		pfring_zc_cluster *cluster;
@@ -149,7 +159,7 @@ struct state_send {
 	uint32_t max_targets;
 	uint32_t sendto_failures;
 	uint32_t max_index;
-	uint8_t **list_of_ips_pbm;
+	apbm_t *list_of_ips_pbm;
 };
 extern struct state_send zsend;
 
@@ -190,6 +200,17 @@ struct state_recv {
 	uint32_t pcap_drop;
 	// number of packets dropped by the network interface or its driver.
 	uint32_t pcap_ifdrop;
+
+	// the rest is only kept when writing a metrics file.
+	// round trip times of responses to probes that carry their send
+	// time, where bucket i counts times of 2^i up to 2^(i+1) microseconds
+	uint32_t rtt_hist[RECV_HIST_BUCKETS];
+	// packets handled per pcap_dispatch() call, bucketed the same way
+	uint32_t batch_hist[RECV_HIST_BUCKETS];
+	// time spent validating, classifying and outputting packets
+	uint64_t validate_ns;
+	uint64_t process_ns;
+	uint64_t output_ns;
 };
 extern struct state_recv zrecv;
 
@@ -45,21 +45,20 @@
 //	uint32_t duplicates;
 //};
 
-#undef MIN
-#define MIN(X, Y) ((X) < (Y) ? (X) : (Y))
-
 // allow 1mb lines + newline + \0
 #define MAX_LINE_LENGTH 1024 * 1024 + 2
 
-static inline char *zmin(char *a, char *b)
-{
-	if (a && !b)
-		return a;
-	else if (b && !a)
-		return b;
-	else
-		return MIN(a, b);
-}
+// input is read in blocks of this size, and the lines in it checked
+// against the blacklist in batches of LINE_BATCH_SIZE, so that their
+// lookups overlap rather than wait on each other
+#define READ_BUFFER_SIZE (16 * 1024 * 1024)
+#define LINE_BATCH_SIZE 256
+
+typedef struct zbl_line {
+	char *start;
+	size_t len;
+	int valid;
+} zbl_line_t;
 
 struct zbl_conf {
 	char *blacklist_filename;
@@ -73,6 +72,30 @@ struct zbl_conf {
 	// struct zbl_stats stats;
 };
 
+// Write out the lines of a batch that are allowed and not duplicates, in
+// the order they were read.
+static void process_batch(struct zbl_conf *conf, apbm_t *seen,
+			  zbl_line_t *lines, uint32_t *addrs, size_t count)
+{
+	uint8_t allowed[LINE_BATCH_SIZE];
+	blacklist_is_allowed_batch(addrs, count, allowed);
+	for (size_t i = 0; i < count; i++) {
+		if (!lines[i].valid) {
+			if (!conf->ignore_input_errors) {
+				fwrite(lines[i].start, 1, lines[i].len, stdout);
+			}
+			continue;
+		}
+		if (!allowed[i]) {
+			continue;
+		}
+		if (conf->check_duplicates && apbm_set(seen, ntohl(addrs[i]))) {
+			continue;
+		}
+		fwrite(lines[i].start, 1, lines[i].len, stdout);
+	}
+}
+
 #define SET_IF_GIVEN(DST, ARG)                                                 \
 	{                                                                      \
 		if (args.ARG##_given) {                                        \
@@ -194,70 +217,92 @@ int main(int argc, char **argv)
 		log_fatal("zmap", "unable to initialize blacklist / whitelist");
 	}
 	// initialize paged bitmap
-	uint8_t **seen = NULL;
+	apbm_t *seen = NULL;
 	if (conf.check_duplicates) {
-		seen = pbm_init();
+		seen = apbm_init(0);
 		if (!seen) {
 			log_fatal("zblacklist",
 				  "unable to initialize paged bitmap");
 		}
 	}
-	// process addresses
-	char *line = malloc(MAX_LINE_LENGTH);
-	assert(line);
-	char *original = malloc(MAX_LINE_LENGTH);
-	assert(original);
-	while (fgets(line, MAX_LINE_LENGTH, stdin) != NULL) {
-		size_t len = strlen(line);
-		if (len >= (MAX_LINE_LENGTH - 1)) {
-			log_fatal("zblacklist",
-				  "received line longer than max length: %i",
-				  MAX_LINE_LENGTH);
-		}
-		// remove new line
-		memcpy(original, line, len + 1);
-		char *n =
-		    zmin(zmin(zmin(zmin(strchr(line, '\n'), strchr(line, ',')),
-				   strchr(line, '\t')),
-			      strchr(line, ' ')),
-			 strchr(line, '#'));
-		assert(n);
-		n[0] = 0;
-		log_debug("zblacklist", "input value %s", line);
-		// parse into int
-		struct in_addr addr;
-		if (!inet_aton(line, &addr)) {
-			log_warn("zblacklist", "invalid input address: %s",
-				 line);
-			if (!conf.ignore_input_errors) {
-				printf("%s", original);
+	// process addresses. one byte past the buffer is left for the \0
+	// that ends the last line when it has no newline.
+	char *buf = malloc(READ_BUFFER_SIZE + 1);
+	assert(buf);
+	zbl_line_t lines[LINE_BATCH_SIZE];
+	uint32_t addrs[LINE_BATCH_SIZE];
+	size_t have = 0;
+	int eof = 0;
+	while (!eof || have) {
+		if (!eof) {
+			size_t r = fread(buf + have, 1, READ_BUFFER_SIZE - have,
+					 stdin);
+			if (r == 0) {
+				if (ferror(stdin)) {
+					log_fatal("zblacklist",
+						  "unable to read input: %s",
+						  strerror(errno));
+				}
+				eof = 1;
 			}
-			continue;
+			have += r;
 		}
-		if (conf.check_duplicates) {
-			if (pbm_check(seen, ntohl(addr.s_addr))) {
-				log_debug("zblacklist",
-					  "%s is a duplicate: skipped", line);
-				continue;
+		char *p = buf;
+		char *end = buf + have;
+		size_t count = 0;
+		while (p < end) {
+			char *next = memchr(p, '\n', end - p);
+			if (next) {
+				next++;
+			} else if (eof) {
+				next = end;
 			} else {
-				log_debug("zblacklist",
-					  "%s not a duplicate: skipped", line);
+				// the rest of this line hasn't been read yet
+				break;
 			}
-		} else {
-			log_debug("zblacklist", "no duplicate checking for %s",
-				  line);
-		}
-		// check if in blacklist
-		if (blacklist_is_allowed(addr.s_addr)) {
-			if (conf.check_duplicates) {
-				if (!pbm_check(seen, ntohl(addr.s_addr))) {
-					pbm_set(seen, ntohl(addr.s_addr));
-					printf("%s", original);
-				}
-			} else {
-				printf("%s", original);
+			size_t len = next - p;
+			if (len >= (MAX_LINE_LENGTH - 1)) {
+				log_fatal("zblacklist",
+					  "received line longer than max length: %i",
+					  MAX_LINE_LENGTH);
 			}
+			// the address ends at the first separator
+			char *t = p;
+			while (t < next && *t != '\n' && *t != ',' &&
+			       *t != '\t' && *t != ' ' && *t != '#') {
+				t++;
+			}
+			char c = *t;
+			*t = 0;
+			struct in_addr addr;
+			lines[count].start = p;
+			lines[count].len = len;
+			lines[count].valid = inet_aton(p, &addr);
+			if (!lines[count].valid) {
+				log_warn("zblacklist",
+					 "invalid input address: %s", p);
+				addr.s_addr = 0;
+			}
+			*t = c;
+			addrs[count] = addr.s_addr;
+			if (++count == LINE_BATCH_SIZE) {
+				process_batch(&conf, seen, lines, addrs, count);
+				count = 0;
+			}
+			p = next;
+		}
+		process_batch(&conf, seen, lines, addrs, count);
+		if (!eof && end - p >= (MAX_LINE_LENGTH - 1)) {
+			log_fatal("zblacklist",
+				  "received line longer than max length: %i",
+				  MAX_LINE_LENGTH);
 		}
+		have = end - p;
+		memmove(buf, p, have);
+	}
+	free(buf);
+	if (seen) {
+		apbm_free(seen);
 	}
 	return EXIT_SUCCESS;
 }
@@ -272,7 +272,8 @@ static void start_zmap(void)
 			log_fatal("zmap", "unable to join recv thread");
 			exit(EXIT_FAILURE);
 		}
-		if (!zconf.quiet || zconf.status_updates_file) {
+		if (!zconf.quiet || zconf.status_updates_file ||
+		    zconf.metrics_file) {
 			pthread_join(tmon, NULL);
 			if (r != 0) {
 				log_fatal("zmap",
@@ -500,6 +501,19 @@ int main(int argc, char *argv[])
 		log_fatal("fieldset", "probe module does not supply "
 				      "required packet classification field.");
 	}
+	// probe modules that put the send time in their probes let us
+	// measure round trip times for the metrics file
+	zconf.fsconf.sent_ts_index =
+	    fds_get_index_by_name(fds, (char *)"sent_timestamp_ts");
+	zconf.fsconf.sent_us_index =
+	    fds_get_index_by_name(fds, (char *)"sent_timestamp_us");
+	if (zconf.fsconf.sent_us_index < 0) {
+		zconf.fsconf.sent_ts_index = -1;
+	}
+	zconf.fsconf.recv_ts_index =
+	    fds_get_index_by_name(fds, (char *)"timestamp_ts");
+	zconf.fsconf.recv_us_index =
+	    fds_get_index_by_name(fds, (char *)"timestamp_us");
 	// default output module does not support multiple fields throw an error
 	// if the user asks for this because otherwise we'll generate a
 	// malformed CSV file when this gets redirected to the CSV output module
@@ -580,6 +594,7 @@ int main(int argc, char *argv[])
 
 	SET_BOOL(zconf.dryrun, dryrun);
 	SET_BOOL(zconf.quiet, quiet);
+	SET_BOOL(zconf.hugetlb, hugetlb);
 	zconf.cooldown_secs = args.cooldown_time_arg;
 	SET_IF_GIVEN(zconf.output_filename, output_file);
 	SET_IF_GIVEN(zconf.blacklist_filename, blacklist_file);
@@ -592,6 +607,7 @@ int main(int argc, char *argv[])
 	SET_IF_GIVEN(zconf.rate, rate);
 	SET_IF_GIVEN(zconf.packet_streams, probes);
 	SET_IF_GIVEN(zconf.status_updates_file, status_updates_file);
+	SET_IF_GIVEN(zconf.metrics_file, metrics_file);
 	SET_IF_GIVEN(zconf.num_retries, retries);
 	SET_IF_GIVEN(zconf.max_sendto_failures, max_sendto_failures);
 	SET_IF_GIVEN(zconf.min_hitrate, min_hitrate);
@@ -813,8 +829,8 @@ int main(int argc, char *argv[])
 	// if there's a list of ips to scan, then initialize PBM and populate
 	// it based on the provided file
 	if (zconf.list_of_ips_filename) {
-		zsend.list_of_ips_pbm = pbm_init();
-		zconf.list_of_ips_count = pbm_load_from_file(
+		zsend.list_of_ips_pbm = apbm_init(zconf.hugetlb);
+		zconf.list_of_ips_count = apbm_load_from_file(
 		    zsend.list_of_ips_pbm, zconf.list_of_ips_filename);
 	}
 